@@ -9,16 +9,16 @@ class aabb
 {
   public:
     aabb() {}
-    aabb(const vec3d &a, const vec3d &b) : minimum(a), maximum(b) {}
+    aabb(const vec3r &a, const vec3r &b) : minimum(a), maximum(b) {}
 
-    vec3d Min() const { return minimum; }
-    vec3d Max() const { return maximum; }
+    vec3r Min() const { return minimum; }
+    vec3r Max() const { return maximum; }
 
     // NOTE: Ray-AABB Intersection
     // TMin, TMax are the tValues for which the ray is inside the 3D aabb
     // region.
     b32
-    Hit(const ray &Ray, f64 TMin, f64 TMax) const
+    Hit(const ray &Ray, real TMin, real TMax) const
     {
         b32 Result = true;
 
@@ -26,10 +26,10 @@ class aabb
             Index < 3;
             ++Index)
         {
-            f64 InvDir = 1.0 / Ray.Direction()[Index];
+            real InvDir = 1.0 / Ray.Direction()[Index];
 
-            f64 t0 = (Min()[Index] - Ray.Origin()[Index])*InvDir;
-            f64 t1 = (Max()[Index] - Ray.Origin()[Index])*InvDir;
+            real t0 = (Min()[Index] - Ray.Origin()[Index])*InvDir;
+            real t1 = (Max()[Index] - Ray.Origin()[Index])*InvDir;
             if(InvDir < 0.0)
             {
                 Swap(t0, t1);
@@ -48,24 +48,97 @@ class aabb
         return Result;
     }
 
+    // NOTE: Same test, but narrowing TMin and TMax down to the part of the
+    // ray inside of the box. False if there is none.
+    b32
+    Clip(const ray &Ray, real &TMin, real &TMax) const
+    {
+        for(i32 Index = 0; Index < 3; ++Index)
+        {
+            real InvDir = 1.0 / Ray.Direction()[Index];
+            real t0 = (Min()[Index] - Ray.Origin()[Index])*InvDir;
+            real t1 = (Max()[Index] - Ray.Origin()[Index])*InvDir;
+            if(InvDir < 0.0)
+            {
+                Swap(t0, t1);
+            }
+
+            TMin = (t0 > TMin) ? t0 : TMin;
+            TMax = (t1 < TMax) ? t1 : TMax;
+        }
+
+        b32 Result = (TMin < TMax);
+        return Result;
+    }
+
     // NOTE: The Bounding Box of two boxes.
     static aabb
     SurroundingBox(const aabb &Box0, const aabb &Box1)
     {
-        vec3d Min = Vec3d(MIN(Box0.Min().x, Box1.Min().x),
-                          MIN(Box0.Min().y, Box1.Min().y),
-                          MIN(Box0.Min().z, Box1.Min().z));
-        vec3d Max = Vec3d(MAX(Box0.Max().x, Box1.Max().x),
-                          MAX(Box0.Max().y, Box1.Max().y),
-                          MAX(Box0.Max().z, Box1.Max().z));
-
-        aabb Result = aabb(Min, Max);
+        aabb Result = aabb(ComponentMin(Box0.minimum, Box1.minimum),
+                           ComponentMax(Box0.maximum, Box1.maximum));
+        return Result;
+    }
+
+    // NOTE: An inverted box, which any Grow() call replaces with the grown
+    // point/box. Used as the starting value while accumulating bounds.
+    static aabb
+    Empty()
+    {
+        aabb Result = aabb(Vec3r( Infinity,  Infinity,  Infinity),
+                           Vec3r(-Infinity, -Infinity, -Infinity));
+        return Result;
+    }
+
+    void
+    Grow(const vec3r &P)
+    {
+        minimum = ComponentMin(minimum, P);
+        maximum = ComponentMax(maximum, P);
+    }
+
+    void
+    Grow(const aabb &Box)
+    {
+        Grow(Box.minimum);
+        Grow(Box.maximum);
+    }
+
+    vec3r
+    Centroid() const
+    {
+        vec3r Result = 0.5*(minimum + maximum);
+        return Result;
+    }
+
+    // NOTE: Half of the surface area of the box. The SAH only compares areas
+    // against each other so the factor of 2 is dropped.
+    real
+    HalfArea() const
+    {
+        vec3r Extent = maximum - minimum;
+        real Result = (Extent.x*Extent.y + Extent.y*Extent.z + Extent.z*Extent.x);
+        if(!(Result > 0.))
+        {
+            Result = 0.;
+        }
+        return Result;
+    }
+
+    // The axis along which the box is the longest.
+    i32
+    LongestAxis() const
+    {
+        vec3r Extent = maximum - minimum;
+        i32 Result = 0;
+        if(Extent.y > Extent.x) { Result = 1; }
+        if(Extent.z > Extent[Result]) { Result = 2; }
         return Result;
     }
 
   private:
-    vec3d minimum;
-    vec3d maximum;
+    vec3r minimum;
+    vec3r maximum;
 };
 
 #define AABB_H
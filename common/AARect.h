@@ -2,38 +2,82 @@
 
 #include "defines.h"
 #include "Hittable.h"
+#include "Stats.h"
+
+// NOTE: Rects as lights are sampled uniformly by area, turned into a density
+// over solid angle by distance^2/cos. They emit on both sides, hence the fabs.
+inline real
+RectPdfValue(const hittable &Rect, real Area, const vec3r &Origin, const vec3r &Direction)
+{
+    real Result = 0;
+    hit_record Record;
+    if(Rect.Hit(ray(Origin, Direction, 0), interval(0, Infinity), Record))
+    {
+        f64 Length = Direction.Magnitude();
+        f64 Distance2 = (f64)Record.t*Record.t*Length*Length;
+        f64 Cosine = fabs(Dot(Direction, Record.Normal)) / Length;
+        Result = (Cosine > 0) ? (real)(Distance2 / (Cosine*Area)) : 0;
+    }
+
+    return Result;
+}
 
 // NOTE: The XY Plane
 class xy_rect : public hittable
 {
   public:
     xy_rect() {}
-    xy_rect(f64 X0, f64 X1, f64 Y0, f64 Y1, f64 _k, std::shared_ptr<material> Mat)
+    xy_rect(real X0, real X1, real Y0, real Y1, real _k, material *Mat)
         : x0(X0), y0(Y0), x1(X1), y1(Y1), k(_k), mp(Mat) {}
 
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const override;
 
     virtual b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         // NOTE: The bounding box must have non-zero width in each dimension, so
         // pad the Z with a small amount. This is needed for our BVH code to
         // work correctly.
-        vec3d MinRange = Vec3d(x0, y0, k-0.0001);
-        vec3d MaxRange = Vec3d(x1, y1, k+0.0001);
+        vec3r MinRange = Vec3r(x0, y0, k-0.0001);
+        vec3r MaxRange = Vec3r(x1, y1, k+0.0001);
 
         OutputBox = aabb(MinRange, MaxRange);
 
         return true;
     }
 
+    virtual real
+    PdfValue(const vec3r &Origin, const vec3r &Direction) const override
+    {
+        real Result = RectPdfValue(*this, (x1 - x0)*(y1 - y0), Origin, Direction);
+        return Result;
+    }
+
+    virtual vec3r
+    Random(const vec3r &Origin, const vec2d &Sample) const override
+    {
+        vec3r Result = Vec3r(x0 + Sample.u*(x1 - x0), y0 + Sample.v*(y1 - y0), k) - Origin;
+        return Result;
+    }
+
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        if(mp)
+        {
+            Emitters.push_back({this, mp, Vec3r(0.5*(x0 + x1), 0.5*(y0 + y1), k), (x1 - x0)*(y1 - y0)});
+        }
+    }
+
   private:
-    std::shared_ptr<material> mp;
-    f64 x0, y0;
-    f64 x1, y1;
+    friend class scene_cache;
+
+    material *mp = nullptr;
+    real x0, y0;
+    real x1, y1;
     // This is the Z pos for this rectangle.
-    f64 k;
+    real k;
 };
 
 // NOTE: The XZ Plane
@@ -41,8 +85,8 @@ class xz_rect : public hittable
 {
   public:
     xz_rect() {}
-    xz_rect(f64 X0, f64 X1, f64 Z0, f64 Z1, f64 _k,
-            std::shared_ptr<material> Mat)
+    xz_rect(real X0, real X1, real Z0, real Z1, real _k,
+            material *Mat)
         : x0(X0), x1(X1), z0(Z0), z1(Z1), k(_k), mp(Mat)
     {
     }
@@ -51,22 +95,47 @@ class xz_rect : public hittable
                     hit_record &Record) const override;
 
     virtual b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         // NOTE: The bounding box must have non-zero width in each dimension, so
         // pad the Z with a small amount. This is needed for our BVH code to
         // work correctly.
-        vec3d MinRange = Vec3d(x0, k-0.0001, z0);
-        vec3d MaxRange = Vec3d(x1, k+0.0001, z1);
+        vec3r MinRange = Vec3r(x0, k-0.0001, z0);
+        vec3r MaxRange = Vec3r(x1, k+0.0001, z1);
 
         OutputBox = aabb(MinRange, MaxRange);
 
         return true;
     }
 
+    virtual real
+    PdfValue(const vec3r &Origin, const vec3r &Direction) const override
+    {
+        real Result = RectPdfValue(*this, (x1 - x0)*(z1 - z0), Origin, Direction);
+        return Result;
+    }
+
+    virtual vec3r
+    Random(const vec3r &Origin, const vec2d &Sample) const override
+    {
+        vec3r Result = Vec3r(x0 + Sample.u*(x1 - x0), k, z0 + Sample.v*(z1 - z0)) - Origin;
+        return Result;
+    }
+
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        if(mp)
+        {
+            Emitters.push_back({this, mp, Vec3r(0.5*(x0 + x1), k, 0.5*(z0 + z1)), (x1 - x0)*(z1 - z0)});
+        }
+    }
+
   private:
-    std::shared_ptr<material> mp;
-    f64 x0, z0, x1, z1, k;
+    friend class scene_cache;
+
+    material *mp = nullptr;
+    real x0, z0, x1, z1, k;
 };
 
 // NOTE: The YZ Plane
@@ -74,8 +143,8 @@ class yz_rect : public hittable
 {
   public:
     yz_rect() {}
-    yz_rect(f64 Y0, f64 Y1, f64 Z0, f64 Z1, f64 _k,
-            std::shared_ptr<material> Mat)
+    yz_rect(real Y0, real Y1, real Z0, real Z1, real _k,
+            material *Mat)
         : y0(Y0), y1(Y1), z0(Z0), z1(Z1), k(_k), mp(Mat)
     {
     }
@@ -84,35 +153,61 @@ class yz_rect : public hittable
                     hit_record &Record) const override;
 
     virtual b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         // NOTE: The bounding box must have non-zero width in each dimension, so
         // pad the Z with a small amount. This is needed for our BVH code to
         // work correctly.
-        vec3d MinRange = Vec3d(k-0.0001, y0, z0);
-        vec3d MaxRange = Vec3d(k+0.0001, y1, z1);
+        vec3r MinRange = Vec3r(k-0.0001, y0, z0);
+        vec3r MaxRange = Vec3r(k+0.0001, y1, z1);
 
         OutputBox = aabb(MinRange, MaxRange);
 
         return true;
     }
 
+    virtual real
+    PdfValue(const vec3r &Origin, const vec3r &Direction) const override
+    {
+        real Result = RectPdfValue(*this, (y1 - y0)*(z1 - z0), Origin, Direction);
+        return Result;
+    }
+
+    virtual vec3r
+    Random(const vec3r &Origin, const vec2d &Sample) const override
+    {
+        vec3r Result = Vec3r(k, y0 + Sample.u*(y1 - y0), z0 + Sample.v*(z1 - z0)) - Origin;
+        return Result;
+    }
+
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        if(mp)
+        {
+            Emitters.push_back({this, mp, Vec3r(k, 0.5*(y0 + y1), 0.5*(z0 + z1)), (y1 - y0)*(z1 - z0)});
+        }
+    }
+
   private:
-    std::shared_ptr<material> mp;
-    f64 y0, z0, y1, z1, k;
+    friend class scene_cache;
+
+    material *mp = nullptr;
+    real y0, z0, y1, z1, k;
 };
 
 b32 xy_rect::Hit(const ray &Ray, const interval &Interval,
                 hit_record &Record) const
 {
+    RT_STAT(Stat_PrimitiveTests);
     b32 Result = false;
 
     // NOTE: k here is the rectangle's Z Position.
-    f64 t = (k - Ray.Origin().z) / Ray.Direction().z;
+    real t = (k - Ray.Origin().z) / Ray.Direction().z;
     if ((t > Interval.Min) && (t < Interval.Max))
     {
-        f64 x = Ray.Origin().x + t * Ray.Direction().x;
-        f64 y = Ray.Origin().y + t * Ray.Direction().y;
+        real x = Ray.Origin().x + t * Ray.Direction().x;
+        real y = Ray.Origin().y + t * Ray.Direction().y;
 
         // NOTE: If the ray actually hits the insides of the rectangle.
         if ((x > x0) && (x < x1) && (y > y0) && (y < y1))
@@ -121,10 +216,17 @@ b32 xy_rect::Hit(const ray &Ray, const interval &Interval,
             Record.V = (y - y0) / (y1 - y0);
             Record.t = t;
 
-            vec3d OutwardNormal = Vec3d(0, 0, 1);
+            vec3r OutwardNormal = Vec3r(0, 0, 1);
             Record.SetFaceNormal(Ray, OutwardNormal);
             Record.Material = mp;
+            Record.Object = this;
             Record.P = Ray.At(t);
+            // NOTE: Snapped onto the plane, so the only error left is in x, y.
+            Record.P.z = k;
+            Record.UVPerUnit = MAX(1 / (x1 - x0), 1 / (y1 - y0));
+            Record.Error = 0;
+            Record.Curvature = 0;
+            Record.Medium = nullptr;
             Result = true;
         }
     }
@@ -135,14 +237,15 @@ b32 xy_rect::Hit(const ray &Ray, const interval &Interval,
 b32 xz_rect::Hit(const ray &Ray, const interval &Interval,
                 hit_record &Record) const
 {
+    RT_STAT(Stat_PrimitiveTests);
     b32 Result = false;
 
     // NOTE: k here is the rectangle's Z Position.
-    f64 t = (k - Ray.Origin().y) / Ray.Direction().y;
+    real t = (k - Ray.Origin().y) / Ray.Direction().y;
     if ((t > Interval.Min) && (t < Interval.Max))
     {
-        f64 x = Ray.Origin().x + t*Ray.Direction().x;
-        f64 z = Ray.Origin().z + t*Ray.Direction().z;
+        real x = Ray.Origin().x + t*Ray.Direction().x;
+        real z = Ray.Origin().z + t*Ray.Direction().z;
 
         // NOTE: If the ray actually hits the insides of the rectangle.
         if ((x > x0) && (x < x1) && (z > z0) && (z < z1))
@@ -151,10 +254,16 @@ b32 xz_rect::Hit(const ray &Ray, const interval &Interval,
             Record.V = (z-z0) / (z1-z0);
             Record.t = t;
 
-            vec3d OutwardNormal = Vec3d(0, 1, 0);
+            vec3r OutwardNormal = Vec3r(0, 1, 0);
             Record.SetFaceNormal(Ray, OutwardNormal);
             Record.Material = mp;
+            Record.Object = this;
             Record.P = Ray.At(t);
+            Record.P.y = k;
+            Record.UVPerUnit = MAX(1 / (x1 - x0), 1 / (z1 - z0));
+            Record.Error = 0;
+            Record.Curvature = 0;
+            Record.Medium = nullptr;
             Result = true;
         }
     }
@@ -165,14 +274,15 @@ b32 xz_rect::Hit(const ray &Ray, const interval &Interval,
 b32 yz_rect::Hit(const ray &Ray, const interval &Interval,
                 hit_record &Record) const
 {
+    RT_STAT(Stat_PrimitiveTests);
     b32 Result = false;
 
     // NOTE: k here is the rectangle's Z Position.
-    f64 t = (k - Ray.Origin().x) / Ray.Direction().x;
+    real t = (k - Ray.Origin().x) / Ray.Direction().x;
     if ((t > Interval.Min) && (t < Interval.Max))
     {
-        f64 y = Ray.Origin().y + t*Ray.Direction().y;
-        f64 z = Ray.Origin().z + t*Ray.Direction().z;
+        real y = Ray.Origin().y + t*Ray.Direction().y;
+        real z = Ray.Origin().z + t*Ray.Direction().z;
 
         // NOTE: If the ray actually hits the insides of the rectangle.
         if ((y > y0) && (y < y1) && (z > z0) && (z < z1))
@@ -181,10 +291,16 @@ b32 yz_rect::Hit(const ray &Ray, const interval &Interval,
             Record.V = (z-z0) / (z1-z0);
             Record.t = t;
 
-            vec3d OutwardNormal = Vec3d(1, 0, 0);
+            vec3r OutwardNormal = Vec3r(1, 0, 0);
             Record.SetFaceNormal(Ray, OutwardNormal);
             Record.Material = mp;
+            Record.Object = this;
             Record.P = Ray.At(t);
+            Record.P.x = k;
+            Record.UVPerUnit = MAX(1 / (y1 - y0), 1 / (z1 - z0));
+            Record.Error = 0;
+            Record.Curvature = 0;
+            Record.Medium = nullptr;
             Result = true;
         }
     }
@@ -0,0 +1,277 @@
+#if !defined(AOV_H)
+
+#include "defines.h"
+#include "Color.h"
+#include "File.h"
+#include "Hittable.h"
+#include "Vec.h"
+
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// NOTE: Arbitrary output variables, images of something other than the final
+// color that get rendered along with it, for compositing and debugging. Each
+// one is written to its own float image next to the color one,
+// <output>.<name>.pfm, as the mean over the samples of every pixel. They are
+// all opt-in: with none of them asked for the camera hands RayColor no
+// first_hit to fill in, and the render loop is the same as without them.
+//
+//   albedo    what the first hit reflects (Attenuation), or emits for lights
+//             and what the background is for rays that miss
+//   normal    the first hit's normal, facing the camera, -1 to 1
+//   depth     the distance to the first hit, 0 for rays that miss
+//   material  the first hit's material as an ID, 0 for none
+//   object    the first hit's primitive, box or instance as an ID, 0 for none
+//   emission  the light the first hit gives off itself
+//   direct    the light that gets to the camera off one bounce
+//   indirect  the light that gets to the camera off more than one
+//   samples   the number of samples that went into the pixel
+//
+// Emission, direct and indirect add up to the color. IDs are numbered in the
+// order they first show up in the image, left to right and top to bottom,
+// from the first sample of every pixel, so they stay the same from one run to
+// the next and IDs of neighbouring frames line up as long as the same things
+// show up in the same order. They go in all three channels.
+enum aov_type
+{
+    AOV_Albedo = (1u << 0),
+    AOV_Normal = (1u << 1),
+    AOV_Depth = (1u << 2),
+    AOV_MaterialID = (1u << 3),
+    AOV_ObjectID = (1u << 4),
+    AOV_Emission = (1u << 5),
+    AOV_Direct = (1u << 6),
+    AOV_Indirect = (1u << 7),
+    AOV_SampleCount = (1u << 8),
+
+    // NOTE: Not written out. The sum of the squared luminance of the
+    // samples, for the variance the denoiser needs.
+    AOV_LuminanceSquares = (1u << 9),
+
+    AOV_Count = 10,
+    AOV_All = (1u << 9) - 1,
+};
+
+// NOTE: What the camera ray of a sample saw first. Rays that scatter in a
+// medium or miss everything get the direction they came from as their
+// normal, so neighbouring pixels of fog or sky still line up for the
+// denoiser.
+struct first_hit
+{
+    color Albedo;
+    vec3r Normal;
+    real Depth;
+    const material *Material;
+    const hittable *Object;
+    color Emission;
+    color Direct;
+    color Indirect;
+};
+
+inline const char *
+AOVName(u32 Index)
+{
+    static const char *Names[AOV_Count] =
+    {
+        "albedo", "normal", "depth", "material", "object",
+        "emission", "direct", "indirect", "samples", "luminance2",
+    };
+    const char *Result = (Index < AOV_Count) ? Names[Index] : "";
+    return Result;
+}
+
+// NOTE: A comma separated list of the names above, or "all".
+inline b32
+AOVsFromNames(const char *List, u32 *AOVs)
+{
+    u32 Result = 0;
+    const char *At = List;
+    while(*At)
+    {
+        const char *End = strchr(At, ',');
+        size_t Length = End ? (size_t)(End - At) : strlen(At);
+        std::string Name(At, Length);
+
+        u32 Found = 0;
+        if(Name == "all")
+        {
+            Found = AOV_All;
+        }
+        for(u32 Index = 0; (Index < AOV_Count) && !Found; ++Index)
+        {
+            if((Name == AOVName(Index)) && ((1u << Index) & AOV_All))
+            {
+                Found = (1u << Index);
+            }
+        }
+        if(!Found)
+        {
+            return false;
+        }
+
+        Result |= Found;
+        At += Length;
+        At += (*At == ',') ? 1 : 0;
+    }
+
+    *AOVs = Result;
+    return true;
+}
+
+// NOTE: The sums over the samples of every pixel of the AOVs that are on,
+// rows top to bottom like camera::Pixels. A pixel only ever gets added to by
+// the thread that renders its row. The ones that are off take no memory.
+class aov_buffer
+{
+  public:
+    void
+    Initialize(u32 AOVs, i32 Width, i32 Height)
+    {
+        aovs = AOVs;
+        width = Width;
+        height = Height;
+        u64 PixelCount = (u64)width*height;
+        for(u32 Index = 0; Index < AOV_Count; ++Index)
+        {
+            u32 Type = (1u << Index);
+            b32 IsID = (Type == AOV_MaterialID) || (Type == AOV_ObjectID);
+            if((aovs & Type) && !IsID)
+            {
+                sums[Index].assign(PixelCount, Vec3d(0, 0, 0));
+            }
+        }
+        if(aovs & AOV_MaterialID) { materials.assign(PixelCount, nullptr); }
+        if(aovs & AOV_ObjectID)   { objects.assign(PixelCount, nullptr); }
+    }
+
+    void
+    Free()
+    {
+        for(std::vector<vec3d> &Sums : sums)
+        {
+            Sums.clear();
+            Sums.shrink_to_fit();
+        }
+        materials.clear();
+        materials.shrink_to_fit();
+        objects.clear();
+        objects.shrink_to_fit();
+        aovs = 0;
+    }
+
+    u32 AOVs() const { return aovs; }
+
+    void
+    Add(u64 Pixel, i32 SampleIndex, const first_hit &Hit, const color &SampleColor)
+    {
+        if(aovs & AOV_Albedo)   { Sum(AOV_Albedo, Pixel) += Vec3d(Hit.Albedo); }
+        if(aovs & AOV_Normal)   { Sum(AOV_Normal, Pixel) += Vec3d(Hit.Normal); }
+        if(aovs & AOV_Depth)    { Sum(AOV_Depth, Pixel) += Vec3d((f64)Hit.Depth); }
+        if(aovs & AOV_Emission) { Sum(AOV_Emission, Pixel) += Vec3d(Hit.Emission); }
+        if(aovs & AOV_Direct)   { Sum(AOV_Direct, Pixel) += Vec3d(Hit.Direct); }
+        if(aovs & AOV_Indirect) { Sum(AOV_Indirect, Pixel) += Vec3d(Hit.Indirect); }
+        if(aovs & AOV_SampleCount) { Sum(AOV_SampleCount, Pixel) += Vec3d(1.0); }
+        if(aovs & AOV_LuminanceSquares)
+        {
+            f64 Luminance = 0.2126*SampleColor.r + 0.7152*SampleColor.g + 0.0722*SampleColor.b;
+            Sum(AOV_LuminanceSquares, Pixel) += Vec3d(Luminance*Luminance);
+        }
+        if(SampleIndex == 0)
+        {
+            if(aovs & AOV_MaterialID) { materials[Pixel] = Hit.Material; }
+            if(aovs & AOV_ObjectID)   { objects[Pixel] = Hit.Object; }
+        }
+    }
+
+    // NOTE: Type's sums, only for the AOVs that are on and aren't IDs.
+    const vec3d *Sums(aov_type Type) const { return sums[Index(Type)].data(); }
+
+    // NOTE: Every AOV in Which that is on and can be written,
+    // <Stem>.<name>.pfm. Sample sums get divided by SamplesPerPixel, the
+    // sample count itself doesn't. Returns false if any of them could not be
+    // written.
+    b32
+    Write(const std::string &Stem, i32 SamplesPerPixel, u32 Which = AOV_All) const
+    {
+        b32 Result = true;
+        u64 PixelCount = (u64)width*height;
+        std::vector<f32> ColorData(PixelCount*3);
+        for(u32 Index = 0; Index < AOV_Count; ++Index)
+        {
+            u32 Type = (1u << Index);
+            if(!(aovs & Which & Type & AOV_All))
+            {
+                continue;
+            }
+
+            if((Type == AOV_MaterialID) || (Type == AOV_ObjectID))
+            {
+                WriteIDs((Type == AOV_MaterialID) ? materials : objects, ColorData);
+            }
+            else
+            {
+                f64 Scale = (Type == AOV_SampleCount) ? 1.0 : (1.0 / SamplesPerPixel);
+                const std::vector<vec3d> &Sums = sums[Index];
+                for(u64 Pixel = 0; Pixel < PixelCount; ++Pixel)
+                {
+                    ColorData[3*Pixel + 0] = (f32)(Sums[Pixel].x*Scale);
+                    ColorData[3*Pixel + 1] = (f32)(Sums[Pixel].y*Scale);
+                    ColorData[3*Pixel + 2] = (f32)(Sums[Pixel].z*Scale);
+                }
+            }
+
+            std::string Filename = Stem + "." + AOVName(Index) + ".pfm";
+            pfm PFMFile = {};
+            PFMFile.Filename = Filename.c_str();
+            PFMFile.Width = width;
+            PFMFile.Height = height;
+            PFMFile.ColorData = ColorData.data();
+            Result = WritePFM(&PFMFile) && Result;
+        }
+
+        return Result;
+    }
+
+  private:
+    u32 aovs = 0;
+    i32 width = 0;
+    i32 height = 0;
+    std::vector<vec3d> sums[AOV_Count];
+    // NOTE: Whatever the first sample of every pixel hit, turned into IDs
+    // when written.
+    std::vector<const void *> materials;
+    std::vector<const void *> objects;
+
+    static u32
+    Index(u32 Type)
+    {
+        u32 Result = 0;
+        while((Type >> Result) > 1) { ++Result; }
+        return Result;
+    }
+
+    vec3d &Sum(aov_type Type, u64 Pixel) { return sums[Index(Type)][Pixel]; }
+
+    void
+    WriteIDs(const std::vector<const void *> &Pointers, std::vector<f32> &ColorData) const
+    {
+        std::unordered_map<const void *, u32> IDs;
+        for(u64 Pixel = 0; Pixel < Pointers.size(); ++Pixel)
+        {
+            u32 ID = 0;
+            if(Pointers[Pixel])
+            {
+                auto Inserted = IDs.emplace(Pointers[Pixel], (u32)IDs.size() + 1);
+                ID = Inserted.first->second;
+            }
+            ColorData[3*Pixel + 0] = (f32)ID;
+            ColorData[3*Pixel + 1] = (f32)ID;
+            ColorData[3*Pixel + 2] = (f32)ID;
+        }
+    }
+};
+
+#define AOV_H
+#endif
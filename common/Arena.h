@@ -0,0 +1,117 @@
+#if !defined(ARENA_H)
+
+#include "defines.h"
+
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// NOTE: Bump allocator for everything a scene is made of: primitives,
+// materials, textures. Objects are packed one after the other into big blocks
+// and all of them go away together when the arena does, destructors first in
+// the reverse order they were made in.
+//
+// New() hands out plain pointers. The arena owns what they point to and the
+// pointers are only good for as long as it is alive, so whoever holds the
+// arena (see hittable_list::Arena) has to keep it around for as long as any
+// of them are used. The scene graph takes the same plain pointers and never
+// owns what they point to either.
+class scene_arena
+{
+  public:
+    explicit scene_arena(u64 BlockSize = (1 << 20)) : blockSize(BlockSize) {}
+    scene_arena(const scene_arena &) = delete;
+    scene_arena &operator=(const scene_arena &) = delete;
+
+    ~scene_arena()
+    {
+        for(destructor *At = destructors; At; At = At->Next)
+        {
+            At->Destroy(At->Object);
+        }
+
+        block *Block = blocks;
+        while(Block)
+        {
+            block *Next = Block->Next;
+            free(Block);
+            Block = Next;
+        }
+    }
+
+    void *
+    Allocate(u64 Size, u64 Alignment)
+    {
+        uintptr_t Base = blocks ? (uintptr_t)(blocks + 1) : 0;
+        uintptr_t At = (Base + used + (Alignment - 1)) & ~(uintptr_t)(Alignment - 1);
+        if(!blocks || ((At + Size) > (Base + blocks->Size)))
+        {
+            // NOTE: Anything bigger than a block gets a block of its own.
+            u64 Needed = Size + Alignment;
+            u64 Capacity = (Needed > blockSize) ? Needed : blockSize;
+            block *Block = (block *)malloc(sizeof(block) + Capacity);
+            ASSERT(Block);
+            Block->Next = blocks;
+            Block->Size = Capacity;
+            blocks = Block;
+            reserved += Capacity;
+
+            Base = (uintptr_t)(Block + 1);
+            At = (Base + (Alignment - 1)) & ~(uintptr_t)(Alignment - 1);
+        }
+
+        used = (At + Size) - Base;
+        allocated += Size;
+
+        void *Result = (void *)At;
+        return Result;
+    }
+
+    template <typename T, typename... args>
+    T *
+    New(args &&...Args)
+    {
+        void *Memory = Allocate(sizeof(T), alignof(T));
+        T *Result = new(Memory) T(std::forward<args>(Args)...);
+
+        if constexpr(!std::is_trivially_destructible_v<T>)
+        {
+            destructor *Destructor = (destructor *)Allocate(sizeof(destructor), alignof(destructor));
+            Destructor->Object = Result;
+            Destructor->Destroy = [](void *Pointer) { ((T *)Pointer)->~T(); };
+            Destructor->Next = destructors;
+            destructors = Destructor;
+        }
+
+        return Result;
+    }
+
+    u64 BytesAllocated() const { return allocated; }
+    u64 BytesReserved() const { return reserved; }
+
+  private:
+    struct alignas(16) block
+    {
+        block *Next;
+        u64 Size;
+    };
+
+    struct destructor
+    {
+        void *Object;
+        void (*Destroy)(void *);
+        destructor *Next;
+    };
+
+    u64 blockSize;
+    block *blocks = nullptr;       // The newest block, which is the one in use.
+    u64 used = 0;                  // Bytes used in the newest block.
+    destructor *destructors = nullptr;
+
+    u64 allocated = 0;
+    u64 reserved = 0;
+};
+
+#define ARENA_H
+#endif
@@ -3,8 +3,65 @@
 #include "defines.h"
 #include "Hittable.h"
 #include "HittableList.h"
+#include "Stats.h"
 
 #include <algorithm>
+#include <future>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// NOTE: Number of buckets the centroids are binned into when looking for the
+// best SAH split along an axis.
+#define BVH_BIN_COUNT 12
+
+// NOTE: Subtrees (and binning passes) with fewer primitives than this are
+// always done on the calling thread. Below this the cost of handing the work
+// to another thread is more than the work itself.
+#define BVH_PARALLEL_MIN_PRIMITIVES 4096
+
+// NOTE: What the builder actually sorts and partitions. The bounding box and
+// its centroid are computed once up front instead of calling the virtual
+// BoundingBox() inside every comparison like the old std::sort based build
+// did.
+struct bvh_primitive
+{
+    hittable *Object;
+    aabb Box;
+    vec3r Centroid;
+};
+
+struct bvh_bin
+{
+    aabb Bounds = aabb::Empty();
+    size_t Count = 0;
+};
+
+struct bvh_bins
+{
+    bvh_bin Axis[3][BVH_BIN_COUNT];
+
+    void
+    Merge(const bvh_bins &Other)
+    {
+        for(i32 A = 0; A < 3; ++A)
+        {
+            for(i32 B = 0; B < BVH_BIN_COUNT; ++B)
+            {
+                Axis[A][B].Bounds.Grow(Other.Axis[A][B].Bounds);
+                Axis[A][B].Count += Other.Axis[A][B].Count;
+            }
+        }
+    }
+};
+
+// NOTE: Bounds of the primitives in a node and the bounds of their centroids.
+// The centroid bounds are what the bins are laid out over.
+struct bvh_range_bounds
+{
+    aabb Bounds = aabb::Empty();
+    aabb CentroidBounds = aabb::Empty();
+};
 
 // NOTE: This is bvh short for Bounding Volume hierarchy. This basically groups
 // multiple objects inside a "Volume". So instead of checking for intersections
@@ -12,133 +69,374 @@
 // then check which of the objects are being hit. If the ray does not hit the
 // volume then it guarantees that the ray does not hit any of the objects it
 // contains either. This is an optimization technique.
+//
+// NOTE: The tree is built top-down with a binned SAH split. The top levels
+// bin their primitives in parallel and every split hands one of its two
+// subtrees to another thread until all the threads have work. ThreadCount of 0
+// uses all the hardware threads, 1 builds everything on the calling thread.
 class bvh_node : public hittable
 {
   public:
     bvh_node() {}
-    bvh_node(const hittable_list &List, f64 Time0, f64 Time1)
-        : bvh_node(List.Objects, 0, List.Objects.size(), Time0, Time1)
+    bvh_node(const hittable_list &List, real Time0, real Time1, i32 ThreadCount = 0)
+        : bvh_node(List.Objects, 0, List.Objects.size(), Time0, Time1, ThreadCount)
     {
     }
-    bvh_node(const std::vector<std::shared_ptr<hittable>> &SrcObjects,
-             size_t Start, size_t End, f64 Time0, f64 Time1);
+    bvh_node(const std::vector<hittable *> &SrcObjects,
+             size_t Start, size_t End, real Time0, real Time1, i32 ThreadCount = 0);
 
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const override;
 
-    virtual b32 BoundingBox(f64 Time0, f64 Time1,
+    virtual b32 BoundingBox(real Time0, real Time1,
                             aabb &OutputBox) const override;
 
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        this->left->GatherEmitters(Emitters);
+        if(this->right != this->left)
+        {
+            this->right->GatherEmitters(Emitters);
+        }
+    }
+
   private:
-    std::shared_ptr<hittable> left;
-    std::shared_ptr<hittable> right;
+    friend class scene_cache;
+
+    // NOTE: The interior nodes below this one belong to it, the primitives
+    // at the leaves belong to whoever made them.
+    std::unique_ptr<bvh_node> leftNode;
+    std::unique_ptr<bvh_node> rightNode;
+    hittable *left = nullptr;
+    hittable *right = nullptr;
     aabb box;
+
+    bvh_node(std::vector<bvh_primitive> &Primitives, size_t Start, size_t End,
+             i32 ThreadCount);
+
+    void Build(std::vector<bvh_primitive> &Primitives, size_t Start, size_t End,
+               i32 ThreadCount);
 };
 
-inline b32
-BoxCompare(const std::shared_ptr<hittable> A,
-           const std::shared_ptr<hittable> B,
-           i32 Axis)
+inline i32
+BVHThreadCount(i32 ThreadCount)
 {
-    b32 Result = false;
+    i32 Result = ThreadCount;
+    if(Result <= 0)
+    {
+        Result = (i32)std::thread::hardware_concurrency();
+        Result = (Result < 1) ? 1 : Result;
+    }
+
+    return Result;
+}
 
-    aabb BoxA;
-    aabb BoxB;
+inline i32
+BVHBinIndex(const aabb &CentroidBounds, i32 Axis, real Centroid)
+{
+    i32 Result = 0;
 
-    if(!A->BoundingBox(0, 0, BoxA) ||
-       !B->BoundingBox(0, 0, BoxB))
+    real Min = CentroidBounds.Min()[Axis];
+    real Extent = CentroidBounds.Max()[Axis] - Min;
+    if(Extent > 0.)
     {
-        ASSERT(!"There was an error here in computing bounding boxes!\n");
-        Result = false;
+        Result = (i32)(BVH_BIN_COUNT*((Centroid - Min) / Extent));
+        Result = (Result >= BVH_BIN_COUNT) ? (BVH_BIN_COUNT - 1) : Result;
+        Result = (Result < 0) ? 0 : Result;
     }
-    else
+
+    return Result;
+}
+
+// NOTE: Runs Func(Start, End, ChunkIndex) over [Start, End) split into
+// ChunkCount contiguous chunks. The last chunk runs on the calling thread.
+template <typename F>
+void
+BVHParallelChunks(size_t Start, size_t End, i32 ChunkCount, F Func)
+{
+    size_t Span = End - Start;
+    size_t ChunkSize = (Span + ChunkCount - 1) / ChunkCount;
+
+    std::vector<std::future<void>> Tasks;
+    for(i32 Chunk = 0; Chunk < ChunkCount - 1; ++Chunk)
     {
-        Result = (BoxA.Min()[Axis] < BoxB.Min()[Axis]);
+        size_t ChunkStart = Start + Chunk*ChunkSize;
+        size_t ChunkEnd = MIN(ChunkStart + ChunkSize, End);
+        if(ChunkStart < ChunkEnd)
+        {
+            Tasks.push_back(std::async(std::launch::async, Func, ChunkStart, ChunkEnd, Chunk));
+        }
     }
 
-    return Result;
+    size_t LastStart = Start + (ChunkCount - 1)*ChunkSize;
+    if(LastStart < End)
+    {
+        Func(LastStart, End, ChunkCount - 1);
+    }
+
+    for(auto &Task : Tasks)
+    {
+        Task.get();
+    }
 }
 
-inline b32
-BoxCompareXAxis(const std::shared_ptr<hittable> A,
-            const std::shared_ptr<hittable> B)
+internal bvh_range_bounds
+BVHRangeBounds(const std::vector<bvh_primitive> &Primitives, size_t Start,
+               size_t End, i32 ThreadCount)
 {
-    b32 Result = BoxCompare(A, B, 0);
+    bvh_range_bounds Result;
+
+    i32 ChunkCount = ((End - Start) >= BVH_PARALLEL_MIN_PRIMITIVES) ? ThreadCount : 1;
+    std::vector<bvh_range_bounds> Partial(ChunkCount);
+
+    BVHParallelChunks(Start, End, ChunkCount,
+        [&Primitives, &Partial](size_t ChunkStart, size_t ChunkEnd, i32 Chunk)
+        {
+            bvh_range_bounds &Bounds = Partial[Chunk];
+            for(size_t Index = ChunkStart; Index < ChunkEnd; ++Index)
+            {
+                Bounds.Bounds.Grow(Primitives[Index].Box);
+                Bounds.CentroidBounds.Grow(Primitives[Index].Centroid);
+            }
+        });
+
+    for(const bvh_range_bounds &Bounds : Partial)
+    {
+        Result.Bounds.Grow(Bounds.Bounds);
+        Result.CentroidBounds.Grow(Bounds.CentroidBounds);
+    }
+
     return Result;
 }
 
-inline b32
-BoxCompareYAxis(const std::shared_ptr<hittable> A,
-            const std::shared_ptr<hittable> B)
+// NOTE: Binning pass. Every chunk fills its own set of bins and they are
+// merged at the end so no two threads ever write to the same bin.
+internal void
+BVHBinPrimitives(const std::vector<bvh_primitive> &Primitives, size_t Start,
+                 size_t End, const aabb &CentroidBounds, i32 ThreadCount,
+                 bvh_bins &Bins)
+{
+    i32 ChunkCount = ((End - Start) >= BVH_PARALLEL_MIN_PRIMITIVES) ? ThreadCount : 1;
+    std::vector<bvh_bins> Partial(ChunkCount);
+
+    BVHParallelChunks(Start, End, ChunkCount,
+        [&Primitives, &Partial, &CentroidBounds](size_t ChunkStart, size_t ChunkEnd, i32 Chunk)
+        {
+            bvh_bins &ChunkBins = Partial[Chunk];
+            for(size_t Index = ChunkStart; Index < ChunkEnd; ++Index)
+            {
+                const bvh_primitive &Primitive = Primitives[Index];
+                for(i32 Axis = 0; Axis < 3; ++Axis)
+                {
+                    i32 Bin = BVHBinIndex(CentroidBounds, Axis, Primitive.Centroid.E[Axis]);
+                    ChunkBins.Axis[Axis][Bin].Bounds.Grow(Primitive.Box);
+                    ++ChunkBins.Axis[Axis][Bin].Count;
+                }
+            }
+        });
+
+    Bins = Partial[0];
+    for(i32 Chunk = 1; Chunk < ChunkCount; ++Chunk)
+    {
+        Bins.Merge(Partial[Chunk]);
+    }
+}
+
+// NOTE: Picks the axis and the bin boundary with the lowest SAH cost:
+// LeftCount*LeftArea + RightCount*RightArea. Primitives whose bin index is
+// <= SplitBin go to the left child.
+internal b32
+BVHFindSAHSplit(const bvh_bins &Bins, i32 &SplitAxis, i32 &SplitBin)
 {
-    b32 Result = BoxCompare(A, B, 1);
+    b32 Result = false;
+    real BestCost = Infinity;
+
+    for(i32 Axis = 0; Axis < 3; ++Axis)
+    {
+        const bvh_bin *AxisBins = Bins.Axis[Axis];
+
+        // Sweep from the right once to get the cost of every right side.
+        real RightCost[BVH_BIN_COUNT];
+        aabb RightBox = aabb::Empty();
+        size_t RightCount = 0;
+        for(i32 Bin = BVH_BIN_COUNT - 1; Bin > 0; --Bin)
+        {
+            RightBox.Grow(AxisBins[Bin].Bounds);
+            RightCount += AxisBins[Bin].Count;
+            RightCost[Bin - 1] = RightCount*RightBox.HalfArea();
+        }
+
+        // Then from the left, combining it with the right side cost.
+        aabb LeftBox = aabb::Empty();
+        size_t LeftCount = 0;
+        size_t TotalCount = RightCount + AxisBins[0].Count;
+        for(i32 Bin = 0; Bin < BVH_BIN_COUNT - 1; ++Bin)
+        {
+            LeftBox.Grow(AxisBins[Bin].Bounds);
+            LeftCount += AxisBins[Bin].Count;
+            if((LeftCount == 0) || (LeftCount == TotalCount))
+            {
+                continue;
+            }
+
+            real Cost = LeftCount*LeftBox.HalfArea() + RightCost[Bin];
+            if(Cost < BestCost)
+            {
+                BestCost = Cost;
+                SplitAxis = Axis;
+                SplitBin = Bin;
+                Result = true;
+            }
+        }
+    }
+
     return Result;
 }
 
-inline b32
-BoxCompareZAxis(const std::shared_ptr<hittable> A,
-            const std::shared_ptr<hittable> B)
+// NOTE: Splits [Start, End) in half by centroid along Axis. Returns the index
+// the right half starts at.
+internal size_t
+BVHMedianSplit(std::vector<bvh_primitive> &Primitives, size_t Start, size_t End,
+               i32 Axis)
 {
-    b32 Result = BoxCompare(A, B, 2);
+    size_t Result = Start + (End - Start)/2;
+    std::nth_element(Primitives.begin() + Start, Primitives.begin() + Result,
+                     Primitives.begin() + End,
+        [Axis](const bvh_primitive &A, const bvh_primitive &B)
+        {
+            return A.Centroid.E[Axis] < B.Centroid.E[Axis];
+        });
+
     return Result;
 }
 
+// NOTE: Binned SAH split of [Start, End). Returns the index the right half
+// starts at, and the axis it split along in Axis. If every centroid ends
+// up in the same bin (coincident centroids) there is nothing to bin on, so
+// fall back to splitting the primitives in half along the longest axis.
+internal size_t
+BVHPartition(std::vector<bvh_primitive> &Primitives, size_t Start, size_t End,
+             const bvh_range_bounds &RangeBounds, i32 ThreadCount, i32 &Axis)
+{
+    bvh_bins Bins;
+    BVHBinPrimitives(Primitives, Start, End, RangeBounds.CentroidBounds,
+                     ThreadCount, Bins);
+
+    i32 SplitAxis = RangeBounds.CentroidBounds.LongestAxis();
+    i32 SplitBin = 0;
+    size_t Mid = Start;
+    if(BVHFindSAHSplit(Bins, SplitAxis, SplitBin))
+    {
+        const aabb &CentroidBounds = RangeBounds.CentroidBounds;
+        auto Middle = std::partition(Primitives.begin() + Start, Primitives.begin() + End,
+            [SplitAxis, SplitBin, &CentroidBounds](const bvh_primitive &Primitive)
+            {
+                return BVHBinIndex(CentroidBounds, SplitAxis,
+                                   Primitive.Centroid.E[SplitAxis]) <= SplitBin;
+            });
+        Mid = (size_t)(Middle - Primitives.begin());
+    }
+
+    if((Mid == Start) || (Mid == End))
+    {
+        Mid = BVHMedianSplit(Primitives, Start, End, SplitAxis);
+    }
+
+    Axis = SplitAxis;
+    return Mid;
+}
+
 // NOTE: Splitting BVH Volumes.
-bvh_node::bvh_node(const std::vector<std::shared_ptr<hittable>> &SrcObjects,
-                   size_t Start, size_t End, f64 Time0, f64 Time1)
+bvh_node::bvh_node(const std::vector<hittable *> &SrcObjects,
+                   size_t Start, size_t End, real Time0, real Time1,
+                   i32 ThreadCount)
 {
-    // Modifiable array of objects.
-    auto tObjects = SrcObjects;
+    RT_STAT_TIMER(Stat_BVHBuild);
+    ThreadCount = BVHThreadCount(ThreadCount);
+
+    // NOTE: Gather the boxes once. Objects are copied into the builder's own
+    // array so the caller's list is left untouched.
+    std::vector<bvh_primitive> Primitives(End - Start);
+    BVHParallelChunks(Start, End,
+                      ((End - Start) >= BVH_PARALLEL_MIN_PRIMITIVES) ? ThreadCount : 1,
+        [&](size_t ChunkStart, size_t ChunkEnd, i32 Chunk)
+        {
+            for(size_t Index = ChunkStart; Index < ChunkEnd; ++Index)
+            {
+                bvh_primitive &Primitive = Primitives[Index - Start];
+                Primitive.Object = SrcObjects[Index];
+                if(!Primitive.Object->BoundingBox(Time0, Time1, Primitive.Box))
+                {
+                    ASSERT(!"No bounding box in bvh_node constructor.\n");
+                }
+                Primitive.Centroid = Primitive.Box.Centroid();
+            }
+        });
+
+    Build(Primitives, 0, Primitives.size(), ThreadCount);
+}
 
-    //  Random Axis
-    i32 RandomAxis = RandomRangeInt(0, 2);
-    auto Comparator = (RandomAxis == 0) ? BoxCompareXAxis
-                                        : ((RandomAxis == 1) ? BoxCompareYAxis
-                                                             : BoxCompareZAxis);
+bvh_node::bvh_node(std::vector<bvh_primitive> &Primitives, size_t Start,
+                   size_t End, i32 ThreadCount)
+{
+    Build(Primitives, Start, End, ThreadCount);
+}
 
-    // NOTE: Splitting the BVH Volumes.
+void
+bvh_node::Build(std::vector<bvh_primitive> &Primitives, size_t Start,
+                size_t End, i32 ThreadCount)
+{
     size_t ObjectSpan = (End - Start);
     if(ObjectSpan == 1)
     {
-        this->left = this->right = tObjects[Start];
+        this->left = this->right = Primitives[Start].Object;
+        this->box = Primitives[Start].Box;
+        return;
     }
-    else if(ObjectSpan == 2)
+
+    bvh_range_bounds RangeBounds = BVHRangeBounds(Primitives, Start, End, ThreadCount);
+    this->box = RangeBounds.Bounds;
+
+    if(ObjectSpan == 2)
     {
-        if(Comparator(tObjects[Start], tObjects[Start+1]))
-        {
-            this->left = tObjects[Start];
-            this->right = tObjects[Start+1];
-        }
-        else
-        {
-            this->left = tObjects[Start+1];
-            this->right = tObjects[Start];
-        }
+        i32 Axis = RangeBounds.CentroidBounds.LongestAxis();
+        b32 InOrder = (Primitives[Start].Centroid.E[Axis] <= Primitives[Start+1].Centroid.E[Axis]);
+        this->left = Primitives[InOrder ? Start : Start+1].Object;
+        this->right = Primitives[InOrder ? Start+1 : Start].Object;
+        return;
     }
-    else
-    {
-        std::sort(tObjects.begin() + Start, tObjects.begin() + End, Comparator);
 
-        auto Mid = Start + ObjectSpan/2;
+    i32 SplitAxis;
+    size_t Mid = BVHPartition(Primitives, Start, End, RangeBounds, ThreadCount, SplitAxis);
 
-        this->left = std::make_shared<bvh_node>(tObjects, Start, Mid, Time0, Time1);
-        this->right = std::make_shared<bvh_node>(tObjects, Mid, End, Time0, Time1);
+    // NOTE: The two subtrees touch disjoint ranges of the primitive array, so
+    // one of them can be built on another thread while this thread builds the
+    // other. The available threads are split between the two halves.
+    i32 LeftThreads = ThreadCount / 2;
+    i32 RightThreads = ThreadCount - LeftThreads;
+    if((ThreadCount > 1) && (ObjectSpan >= BVH_PARALLEL_MIN_PRIMITIVES))
+    {
+        std::future<std::unique_ptr<bvh_node>> LeftTask = std::async(std::launch::async,
+            [&Primitives, Start, Mid, LeftThreads]()
+            {
+                return std::unique_ptr<bvh_node>(new bvh_node(Primitives, Start, Mid, LeftThreads));
+            });
+        this->rightNode.reset(new bvh_node(Primitives, Mid, End, RightThreads));
+        this->leftNode = LeftTask.get();
     }
-
-    // NOTE: Set the bounding boxes of the child bvh nodes.
-    aabb BoxLeft, BoxRight;
-    if(!this->left->BoundingBox(Time0, Time1, BoxLeft) ||
-       !this->right->BoundingBox(Time0, Time1, BoxRight))
+    else
     {
-        ASSERT(!"No bounding box in bvh_node constructor.\n");
+        this->leftNode.reset(new bvh_node(Primitives, Start, Mid, 1));
+        this->rightNode.reset(new bvh_node(Primitives, Mid, End, 1));
     }
 
-    // NOTE: Parent Box contains both the child boxes.
-    this->box = aabb::SurroundingBox(BoxLeft, BoxRight);
+    this->left = this->leftNode.get();
+    this->right = this->rightNode.get();
 }
 
 b32
-bvh_node::BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const
+bvh_node::BoundingBox(real Time0, real Time1, aabb &OutputBox) const
 {
     OutputBox = this->box;
     return true;
@@ -151,6 +449,7 @@ bvh_node::Hit(const ray &Ray, const interval &Interval,
     b32 Result = false;
 
     // Check whether the bounding box of this node is hit
+    RT_STAT(Stat_NodeVisits);
     if(!this->box.Hit(Ray, Interval.Min, Interval.Max))
     {
         Result = false;
@@ -196,5 +495,262 @@ bvh_node::Hit(const ray &Ray, const interval &Interval,
     return Result;
 }
 
+// NOTE: Leaves of the flattened tree hold up to this many primitives.
+#define FLAT_BVH_MAX_LEAF_SIZE 4
+// NOTE: No leaf of the flattened tree is deeper than this, which is what
+// bounds the traversal stack in flat_bvh::Hit. SAH splits can peel a few
+// primitives off at a time and go arbitrarily deep on skewed scenes, so the
+// builder switches to median splits once the remaining depth is just enough
+// for them.
+#define FLAT_BVH_MAX_DEPTH 64
+
+// NOTE: A node of the flattened BVH. It's plain data so a whole tree can be
+// written to disk and used straight out of a memory mapped file. Nodes are
+// stored depth first, so the first child of an interior node is always the
+// node right after it.
+struct flat_bvh_node
+{
+    real Min[3];
+    real Max[3];
+    // Interior node: index of the second child.
+    // Leaf node: index of the first primitive of the leaf.
+    u32 Offset;
+    // 0 for interior nodes.
+    u16 PrimitiveCount;
+    // The axis the interior node was split along. Used to visit the nearer
+    // child first.
+    u16 Axis;
+};
+
+// NOTE: Same tree as bvh_node but laid out in one array and walked with a
+// stack instead of recursing through pointers to child nodes.
+class flat_bvh : public hittable
+{
+  public:
+    // Nodes are owned by Storage (a vector, or the mapped scene cache file).
+    flat_bvh(std::vector<hittable *> Primitives,
+             const flat_bvh_node *Nodes, std::shared_ptr<const void> Storage)
+        : primitives(std::move(Primitives)), nodes(Nodes), storage(Storage)
+    {
+    }
+
+    virtual b32 Hit(const ray &Ray, const interval &Interval,
+                    hit_record &Record) const override;
+
+    virtual b32
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
+    {
+        b32 Result = !primitives.empty();
+        if(Result)
+        {
+            OutputBox = aabb(MakeVec3(nodes[0].Min), MakeVec3(nodes[0].Max));
+        }
+        return Result;
+    }
+
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        for(const auto &Primitive : primitives)
+        {
+            Primitive->GatherEmitters(Emitters);
+        }
+    }
+
+    static std::shared_ptr<flat_bvh> Build(const std::vector<hittable *> &Objects,
+                                           real Time0, real Time1);
+
+    // NOTE: Builds the node array for Primitives and reorders Primitives so
+    // every leaf covers a contiguous range of it.
+    static void BuildNodes(std::vector<bvh_primitive> &Primitives,
+                           std::vector<flat_bvh_node> &Nodes);
+
+  private:
+    std::vector<hittable *> primitives;
+    const flat_bvh_node *nodes;
+    std::shared_ptr<const void> storage;
+
+    static void BuildRecursive(std::vector<bvh_primitive> &Primitives,
+                               size_t Start, size_t End, i32 Depth,
+                               std::vector<flat_bvh_node> &Nodes);
+};
+
+void
+flat_bvh::BuildRecursive(std::vector<bvh_primitive> &Primitives, size_t Start,
+                         size_t End, i32 Depth, std::vector<flat_bvh_node> &Nodes)
+{
+    u32 NodeIndex = (u32)Nodes.size();
+    Nodes.push_back(flat_bvh_node{});
+
+    bvh_range_bounds RangeBounds = BVHRangeBounds(Primitives, Start, End, 1);
+    for(i32 Axis = 0; Axis < 3; ++Axis)
+    {
+        Nodes[NodeIndex].Min[Axis] = RangeBounds.Bounds.Min().E[Axis];
+        Nodes[NodeIndex].Max[Axis] = RangeBounds.Bounds.Max().E[Axis];
+    }
+
+    size_t Span = End - Start;
+    if(Span <= FLAT_BVH_MAX_LEAF_SIZE)
+    {
+        Nodes[NodeIndex].Offset = (u32)Start;
+        Nodes[NodeIndex].PrimitiveCount = (u16)Span;
+        return;
+    }
+
+    // NOTE: How many levels median splits need from here down to leaves.
+    // Neither child of a split needs more than its parent, so once this is
+    // all the depth that's left, median splits all the way down end at
+    // FLAT_BVH_MAX_DEPTH at the deepest.
+    i32 MedianLevels = 0;
+    for(size_t Count = Span; Count > FLAT_BVH_MAX_LEAF_SIZE; Count = (Count + 1)/2)
+    {
+        ++MedianLevels;
+    }
+
+    size_t Mid;
+    i32 SplitAxis = RangeBounds.CentroidBounds.LongestAxis();
+    if((Depth + MedianLevels) >= FLAT_BVH_MAX_DEPTH)
+    {
+        Mid = BVHMedianSplit(Primitives, Start, End, SplitAxis);
+    }
+    else
+    {
+        Mid = BVHPartition(Primitives, Start, End, RangeBounds, 1, SplitAxis);
+    }
+
+    BuildRecursive(Primitives, Start, Mid, Depth + 1, Nodes);
+    Nodes[NodeIndex].Offset = (u32)Nodes.size();
+    Nodes[NodeIndex].Axis = (u16)SplitAxis;
+    BuildRecursive(Primitives, Mid, End, Depth + 1, Nodes);
+}
+
+void
+flat_bvh::BuildNodes(std::vector<bvh_primitive> &Primitives,
+                     std::vector<flat_bvh_node> &Nodes)
+{
+    RT_STAT_TIMER(Stat_BVHBuild);
+    Nodes.clear();
+    Nodes.reserve(2*(Primitives.size() / 2 + 1));
+    if(!Primitives.empty())
+    {
+        BuildRecursive(Primitives, 0, Primitives.size(), 0, Nodes);
+    }
+}
+
+std::shared_ptr<flat_bvh>
+flat_bvh::Build(const std::vector<hittable *> &Objects, real Time0,
+                real Time1)
+{
+    std::vector<bvh_primitive> Primitives(Objects.size());
+    for(size_t Index = 0; Index < Objects.size(); ++Index)
+    {
+        Primitives[Index].Object = Objects[Index];
+        if(!Objects[Index]->BoundingBox(Time0, Time1, Primitives[Index].Box))
+        {
+            ASSERT(!"No bounding box in flat_bvh::Build.\n");
+        }
+        Primitives[Index].Centroid = Primitives[Index].Box.Centroid();
+    }
+
+    auto Nodes = std::make_shared<std::vector<flat_bvh_node>>();
+    BuildNodes(Primitives, *Nodes);
+
+    std::vector<hittable *> Ordered(Primitives.size());
+    for(size_t Index = 0; Index < Primitives.size(); ++Index)
+    {
+        Ordered[Index] = Primitives[Index].Object;
+    }
+
+    auto Result = std::make_shared<flat_bvh>(std::move(Ordered), Nodes->data(), Nodes);
+    return Result;
+}
+
+b32
+flat_bvh::Hit(const ray &Ray, const interval &Interval, hit_record &Record) const
+{
+    b32 Result = false;
+    if(primitives.empty())
+    {
+        return Result;
+    }
+
+    real ClosestSoFar = Interval.Max;
+
+    vec3r Origin = Ray.Origin();
+    vec3r Direction = Ray.Direction();
+    real InvDir[3] = {(real)1 / Direction.x, (real)1 / Direction.y, (real)1 / Direction.z};
+
+    // NOTE: One entry for every interior node above the current one at most.
+    u32 Stack[FLAT_BVH_MAX_DEPTH];
+    i32 StackSize = 0;
+    u32 NodeIndex = 0;
+
+    while(true)
+    {
+        const flat_bvh_node &Node = nodes[NodeIndex];
+        RT_STAT(Stat_NodeVisits);
+
+        // NOTE: Same slab test as aabb::Hit, against the closest hit so far.
+        b32 HitNode = true;
+        real TMin = Interval.Min;
+        real TMax = ClosestSoFar;
+        for(i32 Axis = 0; Axis < 3; ++Axis)
+        {
+            real t0 = (Node.Min[Axis] - Origin.E[Axis])*InvDir[Axis];
+            real t1 = (Node.Max[Axis] - Origin.E[Axis])*InvDir[Axis];
+            if(InvDir[Axis] < 0.0)
+            {
+                Swap(t0, t1);
+            }
+
+            TMin = MAX(t0, TMin);
+            TMax = MIN(t1, TMax);
+            if(TMax <= TMin)
+            {
+                HitNode = false;
+                break;
+            }
+        }
+
+        if(HitNode && (Node.PrimitiveCount > 0))
+        {
+            for(u32 Index = 0; Index < Node.PrimitiveCount; ++Index)
+            {
+                const auto &Primitive = primitives[Node.Offset + Index];
+                if(Primitive->Hit(Ray, interval(Interval.Min, ClosestSoFar), Record))
+                {
+                    Result = true;
+                    ClosestSoFar = Record.t;
+                }
+            }
+        }
+        else if(HitNode)
+        {
+            // NOTE: Visit the child on the near side of the split first, so
+            // ClosestSoFar shrinks early and culls more of the far child.
+            ASSERT(StackSize < FLAT_BVH_MAX_DEPTH);
+            if(InvDir[Node.Axis] < 0.0)
+            {
+                Stack[StackSize++] = NodeIndex + 1;
+                NodeIndex = Node.Offset;
+            }
+            else
+            {
+                Stack[StackSize++] = Node.Offset;
+                NodeIndex = NodeIndex + 1;
+            }
+            continue;
+        }
+
+        if(StackSize == 0)
+        {
+            break;
+        }
+        NodeIndex = Stack[--StackSize];
+    }
+
+    return Result;
+}
+
 #define BVH_H
 #endif
\ No newline at end of file
@@ -0,0 +1,161 @@
+#if !defined(BLUE_NOISE_H)
+
+#include "defines.h"
+
+#include <cmath>
+#include <vector>
+
+#define BLUE_NOISE_TILE_SIZE 64
+
+// NOTE: A tile of blue noise: every value in [0, 1) shows up once, and
+// neighbouring pixels get values as far apart as possible, so the tile has no
+// low frequencies. Made with void-and-cluster (Ulichney 1993): start from a
+// few evenly spread points, then keep putting the next point in the biggest
+// hole, where the Gaussian-blurred point density is the lowest. The order the
+// points go in is their rank, and the rank is the value. The tile wraps
+// around, so it can be tiled over the screen.
+//
+// It is made the first time it's asked for and kept around, which takes a
+// few tens of milliseconds.
+class blue_noise_tile
+{
+  public:
+    static const blue_noise_tile &
+    Get()
+    {
+        static const blue_noise_tile Result;
+        return Result;
+    }
+
+    f64
+    Value(i32 X, i32 Y) const
+    {
+        const i32 Mask = BLUE_NOISE_TILE_SIZE - 1;
+        f64 Result = values[(Y & Mask)*BLUE_NOISE_TILE_SIZE + (X & Mask)];
+        return Result;
+    }
+
+  private:
+    static const i32 Size = BLUE_NOISE_TILE_SIZE;
+    static const i32 Count = Size*Size;
+
+    std::vector<f32> values;
+
+    blue_noise_tile()
+    {
+        // NOTE: The energy every point adds around it. Sigma 1.5 is what
+        // Ulichney found works best.
+        const f64 Sigma = 1.5;
+        std::vector<f32> Kernel(Count);
+        for(i32 Y = 0; Y < Size; ++Y)
+        {
+            for(i32 X = 0; X < Size; ++X)
+            {
+                i32 DX = (X > Size/2) ? (Size - X) : X;
+                i32 DY = (Y > Size/2) ? (Size - Y) : Y;
+                Kernel[Y*Size + X] = (f32)exp(-(f64)(DX*DX + DY*DY) / (2.0*Sigma*Sigma));
+            }
+        }
+
+        std::vector<u8> Points(Count, 0);
+        std::vector<f32> Energy(Count, 0.0f);
+        auto Splat = [&](i32 Index, f32 Sign)
+        {
+            i32 PX = Index % Size;
+            i32 PY = Index / Size;
+            for(i32 Y = 0; Y < Size; ++Y)
+            {
+                const f32 *KernelRow = Kernel.data() + ((Y - PY) & (Size - 1))*Size;
+                f32 *EnergyRow = Energy.data() + Y*Size;
+                for(i32 X = 0; X < Size; ++X)
+                {
+                    EnergyRow[X] += Sign*KernelRow[(X - PX) & (Size - 1)];
+                }
+            }
+        };
+        // Biggest hole is the empty cell with the least energy, tightest
+        // cluster the full cell with the most.
+        auto Find = [&](u8 Occupied, b32 Highest)
+        {
+            i32 Result = -1;
+            for(i32 Index = 0; Index < Count; ++Index)
+            {
+                if((Points[Index] == Occupied) &&
+                   ((Result < 0) || (Highest ? (Energy[Index] > Energy[Result])
+                                             : (Energy[Index] < Energy[Result]))))
+                {
+                    Result = Index;
+                }
+            }
+            return Result;
+        };
+
+        // NOTE: Always the same tile, it's not meant to change with the seed,
+        // so it has its own xorshift instead of the thread's generator.
+        u32 State = 0x5EEDB1E5u;
+        const i32 InitialCount = Count / 10;
+        for(i32 Placed = 0; Placed < InitialCount; )
+        {
+            State ^= State << 13;
+            State ^= State >> 17;
+            State ^= State << 5;
+            i32 Index = (i32)(State % Count);
+            if(!Points[Index])
+            {
+                Points[Index] = 1;
+                Splat(Index, 1.0f);
+                ++Placed;
+            }
+        }
+
+        // NOTE: Even out the random start: move the point in the tightest
+        // cluster to the biggest hole until that point would go straight back.
+        for(;;)
+        {
+            i32 Cluster = Find(1, true);
+            Points[Cluster] = 0;
+            Splat(Cluster, -1.0f);
+
+            i32 Void = Find(0, false);
+            Points[Void] = 1;
+            Splat(Void, 1.0f);
+            if(Void == Cluster)
+            {
+                break;
+            }
+        }
+
+        std::vector<i32> Rank(Count, 0);
+        std::vector<u8> StartPoints = Points;
+        std::vector<f32> StartEnergy = Energy;
+
+        // The starting points get the low ranks, taking out the tightest
+        // cluster first ranks them from the back.
+        for(i32 Next = InitialCount - 1; Next >= 0; --Next)
+        {
+            i32 Cluster = Find(1, true);
+            Points[Cluster] = 0;
+            Splat(Cluster, -1.0f);
+            Rank[Cluster] = Next;
+        }
+
+        Points = StartPoints;
+        Energy = StartEnergy;
+        for(i32 Next = InitialCount; Next < Count; ++Next)
+        {
+            i32 Void = Find(0, false);
+            Points[Void] = 1;
+            Splat(Void, 1.0f);
+            Rank[Void] = Next;
+        }
+
+        values.resize(Count);
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            values[Index] = (f32)((Rank[Index] + 0.5) / Count);
+        }
+    }
+};
+
+#define BLUE_NOISE_H
+#endif
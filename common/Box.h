@@ -9,44 +9,68 @@ class box : public hittable
 {
   public:
     box() {}
-    box(const vec3d &P0, const vec3d &P1, std::shared_ptr<material> MaterialPtr);
+    box(const vec3r &P0, const vec3r &P1, material *MaterialPtr);
 
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const override;
     virtual b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         OutputBox = aabb(box_min, box_max);
         return true;
     }
 
   public:
-    vec3d box_min;
-    vec3d box_max;
-    hittable_list sides;
+    vec3r box_min;
+    vec3r box_max;
+    material *mat = nullptr;
+
+    // NOTE: The six sides are stored in the box itself rather than each one
+    // being allocated on its own and kept in a list.
+    xy_rect front, back;
+    xz_rect top, bottom;
+    yz_rect right, left;
 };
 
-box::box(const vec3d &P0, const vec3d &P1,
-         std::shared_ptr<material> MaterialPtr)
+box::box(const vec3r &P0, const vec3r &P1,
+         material *MaterialPtr)
+    : box_min(P0), box_max(P1), mat(MaterialPtr),
+      front(P0.x, P1.x, P0.y, P1.y, P1.z, MaterialPtr),
+      back(P0.x, P1.x, P0.y, P1.y, P0.z, MaterialPtr),
+      top(P0.x, P1.x, P0.z, P1.z, P1.y, MaterialPtr),
+      bottom(P0.x, P1.x, P0.z, P1.z, P0.y, MaterialPtr),
+      right(P0.y, P1.y, P0.z, P1.z, P1.x, MaterialPtr),
+      left(P0.y, P1.y, P0.z, P1.z, P0.x, MaterialPtr)
 {
-    box_min = P0;
-    box_max = P1;
-
-    sides.Add(std::make_shared<xy_rect>(P0.x, P1.x, P0.y, P1.y, P1.z, MaterialPtr));
-    sides.Add(std::make_shared<xy_rect>(P0.x, P1.x, P0.y, P1.y, P0.z, MaterialPtr));
-
-    sides.Add(std::make_shared<xz_rect>(P0.x, P1.x, P0.z, P1.z, P1.y, MaterialPtr));
-    sides.Add(std::make_shared<xz_rect>(P0.x, P1.x, P0.z, P1.z, P0.y, MaterialPtr));
-
-    sides.Add(std::make_shared<yz_rect>(P0.y, P1.y, P0.z, P1.z, P1.x, MaterialPtr));
-    sides.Add(std::make_shared<yz_rect>(P0.y, P1.y, P0.z, P1.z, P0.x, MaterialPtr));
-
 }
 
 b32
 box::Hit(const ray &Ray, const interval &Interval, hit_record &Record) const
 {
-    b32 Result = sides.Hit(Ray, Interval, Record);
+    // NOTE: Same as a hittable_list of the sides, every hit shrinks the
+    // interval so the closest side ends up in the Record.
+    b32 Result = false;
+    b32 MinSide = false;
+    interval ClosestSoFar = Interval;
+    if(front.Hit(Ray, ClosestSoFar, Record))  { Result = true; ClosestSoFar.Max = Record.t; MinSide = false; }
+    if(back.Hit(Ray, ClosestSoFar, Record))   { Result = true; ClosestSoFar.Max = Record.t; MinSide = true; }
+    if(top.Hit(Ray, ClosestSoFar, Record))    { Result = true; ClosestSoFar.Max = Record.t; MinSide = false; }
+    if(bottom.Hit(Ray, ClosestSoFar, Record)) { Result = true; ClosestSoFar.Max = Record.t; MinSide = true; }
+    if(right.Hit(Ray, ClosestSoFar, Record))  { Result = true; ClosestSoFar.Max = Record.t; MinSide = false; }
+    if(left.Hit(Ray, ClosestSoFar, Record))   { Result = true; ClosestSoFar.Max = Record.t; MinSide = true; }
+
+    // NOTE: The rects face +x, +y, +z, so on the sides at the min corner
+    // that's into the box. Normal faces the ray either way, only which side
+    // counts as the outside flips. Glass and medium boundaries go by it.
+    if(Result && MinSide)
+    {
+        Record.FrontFace = !Record.FrontFace;
+    }
+    if(Result)
+    {
+        Record.Object = this;
+    }
+
     return Result;
 }
 
@@ -58,18 +82,18 @@ box::Hit(const ray &Ray, const interval &Interval, hit_record &Record) const
 class translate : public hittable
 {
   public:
-    translate(std::shared_ptr<hittable> HittablePtr, const vec3d &Displacement)
+    translate(hittable *HittablePtr, const vec3r &Displacement)
         : hittablePtr(HittablePtr), offset(Displacement) {}
 
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const override;
 
-    virtual b32 BoundingBox(f64 Time0, f64 Time1,
+    virtual b32 BoundingBox(real Time0, real Time1,
                             aabb &OutputBox) const override;
 
   public:
-    std::shared_ptr<hittable> hittablePtr;
-    vec3d offset;
+    hittable *hittablePtr;
+    vec3r offset;
 };
 
 b32
@@ -80,8 +104,10 @@ translate::Hit(const ray &Ray, const interval &Interval, hit_record &Record) con
 
     if (hittablePtr->Hit(MovedRay, Interval, Record))
     {
+        // NOTE: Moving doesn't turn the normal, it and FrontFace stay as
+        // they are.
         Record.P += offset;
-        Record.SetFaceNormal(MovedRay, Record.Normal);
+        Record.Object = this;
         Result = true;
     }
 
@@ -89,7 +115,7 @@ translate::Hit(const ray &Ray, const interval &Interval, hit_record &Record) con
 }
 
 b32
-translate::BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const
+translate::BoundingBox(real Time0, real Time1, aabb &OutputBox) const
 {
     b32 Result = false;
     if(hittablePtr->BoundingBox(Time0, Time1, OutputBox))
@@ -104,12 +130,12 @@ translate::BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const
 class rotate_y : public hittable
 {
   public:
-    rotate_y(std::shared_ptr<hittable> P, f64 Angle);
+    rotate_y(hittable *P, real Angle);
 
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const override;
 
-    virtual b32 BoundingBox(f64 Time0, f64 Time1,
+    virtual b32 BoundingBox(real Time0, real Time1,
                             aabb &OutputBox) const override
     {
         OutputBox = bbox;
@@ -119,24 +145,24 @@ class rotate_y : public hittable
     }
 
   public:
-    std::shared_ptr<hittable> hittablePtr;
-    f64 sin_theta;
-    f64 cos_theta;
+    hittable *hittablePtr;
+    real sin_theta;
+    real cos_theta;
     b32 hasBox;
     aabb bbox;
 };
 
-rotate_y::rotate_y(std::shared_ptr<hittable> HittablePtr, f64 AngleInDegrees)
+rotate_y::rotate_y(hittable *HittablePtr, real AngleInDegrees)
     : hittablePtr(HittablePtr)
 {
-    f64 Angle = Deg2Rad(AngleInDegrees);
+    real Angle = Deg2Rad(AngleInDegrees);
     sin_theta = sin(Angle);
     cos_theta = cos(Angle);
 
     hasBox = hittablePtr->BoundingBox(0, 1, bbox);
 
-    vec3d Min = Vec3d( Infinity,  Infinity,  Infinity);
-    vec3d Max = Vec3d(-Infinity, -Infinity, -Infinity);
+    vec3r Min = Vec3r( Infinity,  Infinity,  Infinity);
+    vec3r Max = Vec3r(-Infinity, -Infinity, -Infinity);
 
     // NOTE: Go through all the extreme points, rotate them and get the bounding
     // box of the rotated hittable.
@@ -146,16 +172,16 @@ rotate_y::rotate_y(std::shared_ptr<hittable> HittablePtr, f64 AngleInDegrees)
         {
             for(i32 k = 0; k < 2; ++k)
             {
-                f64 x = i*bbox.Max().x + (1-i)*bbox.Min().x;
-                f64 y = i*bbox.Max().y + (1-i)*bbox.Min().y;
-                f64 z = i*bbox.Max().z + (1-i)*bbox.Min().z;
+                real x = i*bbox.Max().x + (1-i)*bbox.Min().x;
+                real y = i*bbox.Max().y + (1-i)*bbox.Min().y;
+                real z = i*bbox.Max().z + (1-i)*bbox.Min().z;
 
                 // Rotate(prove this on paper on how to get the newX and newZ
                 // when rotating around the Y Axis).
-                f64 newX =  x*cos_theta + z*sin_theta;
-                f64 newZ = -x*sin_theta + z*cos_theta;
+                real newX =  x*cos_theta + z*sin_theta;
+                real newZ = -x*sin_theta + z*cos_theta;
 
-                vec3d tester = Vec3d(newX, y, newZ);
+                vec3r tester = Vec3r(newX, y, newZ);
 
                 for(i32 c = 0; c < 3; ++c)
                 {
@@ -173,8 +199,8 @@ b32
 rotate_y::Hit(const ray &Ray, const interval &Interval,
               hit_record &Record) const
 {
-    vec3d Origin = Ray.Origin();
-    vec3d Direction = Ray.Direction();
+    vec3r Origin = Ray.Origin();
+    vec3r Direction = Ray.Direction();
 
     // NOTE: Rotate the ray in the opposite angle than which is given.
     Origin.x = cos_theta*Ray.Origin().x - sin_theta*Ray.Origin().z;
@@ -187,8 +213,8 @@ rotate_y::Hit(const ray &Ray, const interval &Interval,
     b32 Result = false;
     if(hittablePtr->Hit(RotatedRay, Interval, Record))
     {
-        vec3d P = Record.P;
-        vec3d Normal = Record.Normal;
+        vec3r P = Record.P;
+        vec3r Normal = Record.Normal;
 
         // NOTE: Actually Rotate the Position and Normal of the hit in the
         // correct direction.
@@ -198,8 +224,12 @@ rotate_y::Hit(const ray &Ray, const interval &Interval,
         Normal.x =  cos_theta*Record.Normal.x + sin_theta*Record.Normal.z;
         Normal.z = -sin_theta*Record.Normal.x + cos_theta*Record.Normal.z;
 
+        // NOTE: Rotating keeps which side of the surface the ray is on, so
+        // FrontFace stays as it was. Setting it again from the normal (which
+        // already faces the ray) would make every hit a front face hit.
         Record.P = P;
-        Record.SetFaceNormal(RotatedRay, Normal);
+        Record.Normal = Normal;
+        Record.Object = this;
 
         Result = true;
     }
@@ -1,12 +1,41 @@
 #if !defined(CAMERA_H)
 
 #include "defines.h"
+#include "AOV.h"
 #include "Color.h"
+#include "Denoise.h"
 #include "Hittable.h"
+#include "Environment.h"
 #include "File.h"
+#include "Lights.h"
 #include "Material.h"
-
-#define USE_STRATIFIED_SAMPLING 0
+#include "Medium.h"
+#include "Sampler.h"
+#include "Stats.h"
+#include "Warp.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// NOTE: A rough bounce sends the path off anywhere in a wide lobe, the
+// directions of neighbouring paths don't stay together the way they do off a
+// mirror, so past one the cone spreads at least this much (in radians).
+// Glancing hits stretch the footprint by 1/cos, up to 1/RAY_CONE_MIN_COS.
+#define RAY_CONE_ROUGH_SPREAD ((real)0.1)
+#define RAY_CONE_MIN_COS ((real)0.05)
+
+// NOTE: Rays the calling thread has traced so far, camera rays and bounces,
+// for the rays per second the benchmarks report.
+inline u64 &
+ThreadRaysTraced()
+{
+    thread_local u64 Result = 0;
+    return Result;
+}
 
 class camera
 {
@@ -15,17 +44,33 @@ class camera
     const char *Filename;
     i32 SamplesPerPixel = 10; // Count of random samples around each pixel.
     i32 MaxBounces = 10; // The Maximum number of bounces the rays are allowed to have.
+    i32 ThreadCount = 0; // Threads to render with. 0 uses all the hardware threads.
+    u64 Seed = 0;        // Same seed, same image, whatever the thread count.
+    sampler_type SamplerType = Sampler_Sobol; // Where the random numbers of every sample come from.
+    b32 UseRayDifferentials = true; // Filter textures by ray differentials, not just path spread.
+    const medium *Medium = nullptr; // The medium the camera is in, fog over the whole scene.
+    const light_tree *Lights = nullptr; // Lights to send rough bounces towards, half the time.
+    const environment_map *Environment = nullptr; // What rays that miss see, instead of Background.
+    b32 SampleEnvironment = false; // Send rough bounces towards the bright parts of Environment too.
+    denoise_filter Denoiser = Denoise_None; // Filter the image before it gets written out.
+    u32 AOVs = 0; // aov_types to write out next to the image (see AOV.h).
+    u64 RaysTraced = 0; // How many rays the last Render traced, on all threads.
 
     camera() {}
-    camera(vec3d lookFrom, vec3d lookAt, vec3d globalUpVec, f64 vFov,
-           i32 imageWidth, f64 aspectRatio, f64 defocusAngle, f64 DistToFocus,
-           f64 shutterOpenTime, f64 shutterCloseTime)
+    camera(vec3r lookFrom, vec3r lookAt, vec3r globalUpVec, real vFov,
+           i32 imageWidth, real aspectRatio, real defocusAngle, real DistToFocus,
+           real shutterOpenTime, real shutterCloseTime)
         : LookFrom(lookFrom), LookAt(lookAt), WorldUp(globalUpVec),
           VerticalFOV(vFov), ImageWidth(imageWidth), AspectRatio(aspectRatio),
           DefocusAngle(defocusAngle), FocusDistance(DistToFocus),
           ShutterOpenTime(shutterOpenTime), ShutterCloseTime(shutterCloseTime) {}
 
-    void
+    // NOTE: Threads take scanlines off a shared counter until there are none
+    // left. Every scanline reseeds the thread's random generator with its row
+    // index, so the image does not depend on which thread got which row.
+    // Samples are summed into a float buffer which only gets tonemapped when
+    // the image is written out. Returns false if it couldn't be.
+    b32
     Render(const hittable &World, const color &Background)
     {
         if(!Initialized)
@@ -33,84 +78,165 @@ class camera
             Initialize();
         }
 
-        for(i32 Y = 0; Y < this->ImageHeight; ++Y)
+        i32 Threads = this->ThreadCount;
+        if(Threads <= 0)
         {
-            fprintf(stderr, "\rScanlines Remaining: %d ", (ImageHeight - Y));
-            fflush(stderr);
+            Threads = (i32)std::thread::hardware_concurrency();
+        }
+        Threads = (Threads < 1) ? 1 : Threads;
+        Threads = (Threads > this->ImageHeight) ? this->ImageHeight : Threads;
 
-            for(i32 X = 0; X < this->ImageWidth; ++X)
-            {
-                color PixelColor = Color(0, 0, 0);
+        medium_stack CameraMedia;
+        if(this->Medium)
+        {
+            CameraMedia.Push(this->Medium);
+        }
 
-#if !USE_STRATIFIED_SAMPLING
-                // Take the required number of samples
-                for(i32 SampleIndex = 0;
-                    SampleIndex < SamplesPerPixel;
-                    ++SampleIndex)
-                {
+        // NOTE: The first hits are only kept track of when something needs
+        // them, otherwise RayColor gets no first_hit to fill in.
+        u32 KeptAOVs = this->AOVs;
+        if(this->Denoiser != Denoise_None)
+        {
+            KeptAOVs |= AOV_Albedo | AOV_Normal | AOV_Depth | AOV_LuminanceSquares;
+        }
+        b32 KeepAOVs = (KeptAOVs != 0);
+        if(KeepAOVs)
+        {
+            this->AOVBuffer.Initialize(KeptAOVs, this->ImageWidth, this->ImageHeight);
+        }
 
-                    // Basically sample around a random position inside the
-                    // pixel "square"
-                    ray Ray = GetRandomRayAround(X, Y, 0, 0);
-                    PixelColor += RayColor(Ray, Background, MaxBounces, World);
-                }
+        std::atomic<i32> NextRow(0);
+        std::atomic<i32> RowsDone(0);
+        std::atomic<u64> TotalRays(0);
+        auto RenderRows = [&]()
+        {
+            u64 RaysBefore = ThreadRaysTraced();
+            std::unique_ptr<sampler> Sampler = MakeSampler(this->SamplerType, this->Seed,
+                                                           this->SamplesPerPixel);
+            for(i32 Y = NextRow++; Y < this->ImageHeight; Y = NextRow++)
+            {
+                SeedRandom(this->Seed, (u64)Y);
+                vec3d *Row = this->Pixels + (u64)Y*this->ImageWidth;
 
-#else
-                for(i32 SubI = 0;
-                    SubI < SqrtSamplesPerPixel;
-                    ++SubI)
+                for(i32 X = 0; X < this->ImageWidth; ++X)
                 {
-                    for(i32 SubJ = 0;
-                        SubJ < SqrtSamplesPerPixel;
-                        ++SubJ)
+                    vec3d PixelColor = Vec3d(0, 0, 0);
+
+                    // Take the required number of samples
+                    // NOTE: Always exactly SamplesPerPixel of them, whatever
+                    // the sampler, since that's what the image gets divided by.
+                    for(i32 SampleIndex = 0;
+                        SampleIndex < SamplesPerPixel;
+                        ++SampleIndex)
                     {
-                        ray Ray = GetRandomRayAround(X, Y, SubI, SubJ);
-                        PixelColor += RayColor(Ray, Background, MaxBounces, World);
+
+                        // Basically sample around a random position inside the
+                        // pixel "square"
+                        Sampler->StartPixelSample(X, Y, SampleIndex);
+                        ray Ray = GetRandomRayAround(X, Y, *Sampler);
+                        RT_STAT(Stat_CameraRays);
+                        ray_cone Cone = {0, this->PixelSpread};
+                        if(KeepAOVs)
+                        {
+                            first_hit Hit = {};
+                            color SampleColor = RayColor(Ray, Cone, CameraMedia, Background,
+                                                         MaxBounces, World, *Sampler, &Hit);
+                            PixelColor += Vec3d(SampleColor);
+                            this->AOVBuffer.Add((u64)Y*this->ImageWidth + X, SampleIndex, Hit,
+                                                SampleColor);
+                        }
+                        else
+                        {
+                            PixelColor += Vec3d(RayColor(Ray, Cone, CameraMedia, Background,
+                                                         MaxBounces, World, *Sampler));
+                        }
                     }
+
+                    Row[X] = PixelColor;
                 }
-#endif
-                WriteColor(&this->Data, PixelColor, this->SamplesPerPixel);
+
+                i32 Done = ++RowsDone;
+                fprintf(stderr, "\rScanlines Remaining: %d ", (this->ImageHeight - Done));
+                fflush(stderr);
+            }
+            TotalRays += ThreadRaysTraced() - RaysBefore;
+            RT_STATS_MERGE();
+        };
+
+        {
+            RT_STAT_TIMER(Stat_Trace);
+            std::vector<std::thread> Workers;
+            for(i32 Index = 1; Index < Threads; ++Index)
+            {
+                Workers.emplace_back(RenderRows);
+            }
+            RenderRows();
+            for(std::thread &Worker : Workers)
+            {
+                Worker.join();
             }
         }
+        fprintf(stderr, "\n");
+        this->RaysTraced = TotalRays;
 
-        WritePPM(&this->PPMFile);
+        if(this->Denoiser != Denoise_None)
+        {
+            RT_STAT_TIMER(Stat_Denoise);
+            DenoiseImage(Threads);
+        }
+        b32 Result = true;
+        {
+            RT_STAT_TIMER(Stat_Write);
+            if(this->AOVs)
+            {
+                Result = this->AOVBuffer.Write(ImageStem(), this->SamplesPerPixel, this->AOVs);
+            }
+            Result = WriteImage() && Result;
+        }
         FreeImageData();
+        RT_STATS_PRINT();
+
+        return Result;
     }
 
   private:
     i32 ImageHeight;
-    vec3d Center;       // Camera Center
-    vec3d Pixel00;      // Location of the 0,0 Pixel in the upper left.
-    vec3d PixelDeltaU;  // Offset to pixel to the right.
-    vec3d PixelDeltaV;  // Offset to pixel to the left.
-    vec3d U, V, W;      // Camera Ortho-Normal Basis Vectors.
-    vec3d DefocusDiskU;
-    vec3d DefocusDiskV;
-
-    i32 SqrtSamplesPerPixel;
-    f64 InverseSqrtSPP;
-
-    f64 AspectRatio = 1.0;
-
-    f64 VerticalFOV = 90.0;           // Vertical Field of View of the camera.
-    vec3d LookFrom = Vec3d(0, 0, -1); // Where the camera is Looking From.
-    vec3d LookAt = Vec3d(0, 0, 0);    // Where the camera is Looking At.
-    vec3d WorldUp = Vec3d(0, 1, 0);   // The Global Up Vector.
+    vec3r Center;       // Camera Center
+    vec3r Pixel00;      // Location of the 0,0 Pixel in the upper left.
+    vec3r PixelDeltaU;  // Offset to pixel to the right.
+    vec3r PixelDeltaV;  // Offset to pixel to the left.
+    vec3r U, V, W;      // Camera Ortho-Normal Basis Vectors.
+    vec3r DefocusDiskU;
+    vec3r DefocusDiskV;
+    real PixelSpread;   // Angle one pixel covers, the spread of camera rays.
+    real DifferentialScale;
+
+    real AspectRatio = 1.0;
+
+    real VerticalFOV = 90.0;           // Vertical Field of View of the camera.
+    vec3r LookFrom = Vec3r(0, 0, -1); // Where the camera is Looking From.
+    vec3r LookAt = Vec3r(0, 0, 0);    // Where the camera is Looking At.
+    vec3r WorldUp = Vec3r(0, 1, 0);   // The Global Up Vector.
 
     // NOTE: Depth of Field Parameters
     // This is how we are handling depth of field.
-    f64 DefocusAngle = 0;
-    f64 FocusDistance = 10;
+    real DefocusAngle = 0;
+    real FocusDistance = 10;
 
     // NOTE: Motion Blur
     // A real world camera opens the shutter for a specificn period of time. It
     // takes in all the light in this interval and averages it out and so if the
     // objects are moving, we see some blur.
-    f64 ShutterOpenTime = 0.;
-    f64 ShutterCloseTime = 0.;
+    real ShutterOpenTime = 0.;
+    real ShutterCloseTime = 0.;
 
-    u8 *Data = nullptr;
-    ppm PPMFile;
+    // Sum of the samples of every pixel, rows top to bottom. Always f64, a
+    // few thousand f32 samples summed up would start losing the last ones.
+    vec3d *Pixels = nullptr;
+
+    // NOTE: Sums over the samples of every pixel, like Pixels, of the AOVs
+    // and of what the denoiser needs.
+    aov_buffer AOVBuffer;
 
     b32 Initialized = false;
 
@@ -125,11 +251,11 @@ class camera
 
         // Calculate Viewport Dimensions
         // FocalLength is distance between the camera center and the image plane.
-        f64 VerticalAngle = Deg2Rad(this->VerticalFOV);
-        f64 h = tan(VerticalAngle*0.5);
+        real VerticalAngle = Deg2Rad(this->VerticalFOV);
+        real h = tan(VerticalAngle*0.5);
 
-        f64 ViewportHeight = (2.0*h)*(this->FocusDistance);
-        f64 ViewportWidth = ViewportHeight * ((f64)(this->ImageWidth)/this->ImageHeight);
+        real ViewportHeight = (2.0*h)*(this->FocusDistance);
+        real ViewportWidth = ViewportHeight * ((real)(this->ImageWidth)/this->ImageHeight);
 
         // Calculating the Camera Basis Vectors.
         this->W = Normalize(LookFrom - LookAt);
@@ -138,98 +264,161 @@ class camera
 
         // Calculate the vectors along the horizontal and down the vertical viewport
         // edges.
-        vec3d ViewportU =  ViewportWidth * this->U;
-        vec3d ViewportV = -ViewportHeight * this->V;
+        vec3r ViewportU =  ViewportWidth * this->U;
+        vec3r ViewportV = -ViewportHeight * this->V;
 
         // Calculate the horizontal and vertical delta vectors from pixel to pixel
         this->PixelDeltaU = ViewportU / this->ImageWidth;
         this->PixelDeltaV = ViewportV / this->ImageHeight;
+        // NOTE: With more samples in a pixel every sample stands for less of
+        // it, so the footprints shrink with the square root of the count, down
+        // to an eighth of a pixel (as in PBRT).
+        this->DifferentialScale = MAX(0.125, 1.0 / sqrt((f64)this->SamplesPerPixel));
+        this->PixelSpread = atan(2.0*h / this->ImageHeight)*this->DifferentialScale;
 
         // NOTE: Calculate the location of the upper left pixel. Sets the image
         // plane at the focus distance also.
-        vec3d ViewportUpperLeft = Center - (this->FocusDistance*this->W) - (ViewportU/2) - (ViewportV/2);
+        vec3r ViewportUpperLeft = Center - (this->FocusDistance*this->W) - (ViewportU/2) - (ViewportV/2);
 
         // Pixel Center of the upper left pixel. which is our origin
         this->Pixel00 = ViewportUpperLeft + 0.5*(this->PixelDeltaU + this->PixelDeltaV);
 
         // Calculate the camera defocus disk basis vectors.
-        f64 DefocusRadius = this->FocusDistance*tan(Deg2Rad(0.5*this->DefocusAngle));
+        real DefocusRadius = this->FocusDistance*tan(Deg2Rad(0.5*this->DefocusAngle));
         this->DefocusDiskU = this->U * DefocusRadius;
         this->DefocusDiskV = this->V * DefocusRadius;
 
-        u64 RequiredSize = sizeof(u8)*this->ImageHeight*this->ImageWidth*3;
-        this->Data = (u8 *)malloc(RequiredSize);
-        memset(this->Data, 0, RequiredSize);
-
-        PPMFile = {};
-        PPMFile.Filename = this->Filename;
-        PPMFile.Width = this->ImageWidth;
-        PPMFile.Height = this->ImageHeight;
-        PPMFile.ColorData = (u8 *)this->Data;
-        PPMFile.Size = RequiredSize;
-
-        SqrtSamplesPerPixel = sqrt(SamplesPerPixel);
-        InverseSqrtSPP = 1. / SqrtSamplesPerPixel;
+        u64 RequiredSize = sizeof(vec3d)*this->ImageHeight*this->ImageWidth;
+        this->Pixels = (vec3d *)malloc(RequiredSize);
+        memset(this->Pixels, 0, RequiredSize);
 
         Initialized = true;
     }
 
-    vec3d
-    PixelSampleSquare(i32 SubX, i32 SubY) const
+    vec3r
+    PixelSampleSquare(sampler &Sampler) const
     {
-#if !USE_STRATIFIED_SAMPLING
-        // Random value b/w [-0.5,0.5)
-        f64 X = -0.5 + Rand01();
-        f64 Y = -0.5 + Rand01();
-#else
-        // Returns a random point in the square surrounding a pixel at the
-        // origin, given the two subpixel indices.
-        f64 X = -0.5 + InverseSqrtSPP*(SubX+Rand01());
-        f64 Y = -0.5 + InverseSqrtSPP*(SubY+Rand01());
-#endif
+        // Random value b/w [-0.5,0.5). With the stratified sampler this lands
+        // in the sample's own subpixel square.
+        vec2d Sample = Sampler.Get2D();
+        real X = -0.5 + Sample.x;
+        real Y = -0.5 + Sample.y;
+
         // Random Position Around the Pixel Square
-        vec3d Result = X*this->PixelDeltaU + Y*this->PixelDeltaV;
+        vec3r Result = X*this->PixelDeltaU + Y*this->PixelDeltaV;
 
         return Result;
     }
 
     ray
-    GetRandomRayAround(i32 X, i32 Y, i32 SubX, i32 SubY) const
+    GetRandomRayAround(i32 X, i32 Y, sampler &Sampler) const
     {
         // NOTE: Get a randomly-sampled camera ray for the pixel at location
         // i,j, originating from the camera defocus disk.
-        vec3d PixelCenter = this->Pixel00 + (X*this->PixelDeltaU) + (Y*this->PixelDeltaV);
+        vec3r PixelCenter = this->Pixel00 + (X*this->PixelDeltaU) + (Y*this->PixelDeltaV);
         // Random Position inside the Pixel Square
-        vec3d PixelSample = PixelCenter + PixelSampleSquare(SubX, SubY);
+        vec3r PixelSample = PixelCenter + PixelSampleSquare(Sampler);
 
-        vec3d RayOrigin = (this->DefocusAngle <= 0) ? this->Center : DefocusDiskSample();
-        vec3d RayDirection = PixelSample - RayOrigin;
+        // NOTE: The lens sample is taken even without defocus blur so the
+        // dimensions that follow don't move around.
+        vec2d LensSample = Sampler.Get2D();
+        vec3r RayOrigin = (this->DefocusAngle <= 0) ? this->Center : DefocusDiskSample(LensSample);
+        vec3r RayDirection = PixelSample - RayOrigin;
 
         // NOTE: The way we do motion blur, is that we select a single ray in
         // random times in the interval of the time when the shutter is open.
-        f64 RayTime = RandRange(ShutterOpenTime, ShutterCloseTime);
+        real RayTime = ShutterOpenTime + (ShutterCloseTime - ShutterOpenTime)*Sampler.Get1D();
 
         ray Ray = ray(RayOrigin, RayDirection, RayTime);
+        if(this->UseRayDifferentials)
+        {
+            Ray.HasDifferentials = true;
+            Ray.RxOrigin = RayOrigin;
+            Ray.RyOrigin = RayOrigin;
+            Ray.RxDirection = RayDirection + this->DifferentialScale*this->PixelDeltaU;
+            Ray.RyDirection = RayDirection + this->DifferentialScale*this->PixelDeltaV;
+        }
         return Ray;
     }
 
-    vec3d
-    DefocusDiskSample() const
+    vec3r
+    DefocusDiskSample(const vec2d &Sample) const
     {
         // NOTE: Returns a random point in the camera defocus disk.
-        vec3d P = vec3d::RandomInUnitDisk();
-        vec3d Result = this->Center + (P.x*this->DefocusDiskU + P.y*this->DefocusDiskV);
+        vec3r P = SampleUnitDisk(Sample);
+        vec3r Result = this->Center + (P.x*this->DefocusDiskU + P.y*this->DefocusDiskV);
+
+        return Result;
+    }
+
+    // NOTE: Swaps the direction the material sampled for one towards a light
+    // (see Lights.h) or the bright parts of the environment, with the same
+    // odds for each of those and the material, and returns the density of
+    // the mix, which the path gets weighted by instead of the material's own.
+    // The material's density for a light's direction is its ScatteringPDF,
+    // which is right for the materials that give a PDF at all, they all
+    // sample exactly their own distribution. Always takes the same numbers
+    // off the sampler, whichever way it goes.
+    real
+    SampleLights(const ray &RayIn, const hit_record &Record, ray &Scattered, real PDF,
+                 sampler &Sampler) const
+    {
+        f64 Choice = Sampler.Get1D();
+        f64 Select = Sampler.Get1D();
+        vec2d LightSample = Sampler.Get2D();
+
+        const environment_map *Sky = this->SampleEnvironment ? this->Environment : nullptr;
+        i32 Strategies = 1 + (this->Lights ? 1 : 0) + (Sky ? 1 : 0);
+        i32 Strategy = (i32)(Choice*Strategies);
+        Strategy += this->Lights ? 0 : 1;
+
+        vec3r Normal = Record.Material->Hemispherical() ? Record.Normal : Vec3r(0, 0, 0);
+        if(Strategy == 0)
+        {
+            RT_STAT(Stat_LightBounces);
+            vec3r Direction = this->Lights->Sample(Record.P, Normal, Select, LightSample);
+            Scattered = ray(Record.P, Direction, RayIn.Time());
+            PDF = Record.Material->ScatteringPDF(RayIn, Record, Scattered);
+        }
+        else if((Strategy == 1) && Sky)
+        {
+            RT_STAT(Stat_EnvironmentBounces);
+            real SkyPDF;
+            vec3r Direction = Sky->Sample(LightSample, SkyPDF);
+            Scattered = ray(Record.P, Direction, RayIn.Time());
+            PDF = Record.Material->ScatteringPDF(RayIn, Record, Scattered);
+        }
 
+        real Result = PDF;
+        if(this->Lights)
+        {
+            Result += this->Lights->PDF(Record.P, Normal, Scattered.Direction());
+        }
+        if(Sky)
+        {
+            Result += Sky->PDF(Scattered.Direction());
+        }
+        Result = Result / Strategies;
         return Result;
     }
 
+    // NOTE: FirstHit, if there is one, gets filled in with what Ray hits,
+    // it's only passed in for the camera rays. Emission, if there is one,
+    // gets the part of the result that the first thing Ray gets to gives off
+    // itself, the background for rays that miss, for splitting the light up
+    // into how many bounces it took.
     color
-    RayColor(const ray &Ray, const color &Background, i32 BounceCount,
-             const hittable &World)
+    RayColor(const ray &Ray, const ray_cone &Cone, const medium_stack &Media,
+             const color &Background, i32 BounceCount, const hittable &World,
+             sampler &Sampler, first_hit *FirstHit = nullptr, color *Emission = nullptr) const
     {
         // Render the "Hit" Object
         hit_record Record;
         color Result = Color(0, 0, 0);
+        if(Emission)
+        {
+            *Emission = Color(0, 0, 0);
+        }
 
         // Only Continue if the light ray has not crossed our max bounce
         // threshold.
@@ -248,43 +437,342 @@ class camera
             // surface again. Which means that it will find the nearest surface at
             // t=0.00000001 or whatever floating point approximation the hit
             // function gives us. The simplest hack to address this is just to
-            // ignore hits that are very close to the calculated intersection point:
-            f64 Correction = 0.001;
-            interval HitInterval = interval(Correction, Infinity);
+            // ignore hits that are very close to the calculated intersection
+            // point, but any fixed distance is too much for small scenes and
+            // too little for big ones, more so in f32. Instead scattered rays
+            // start a few ulps off the surface, on the side they leave on (see
+            // OffsetRayOrigin), and every hit in front of the origin counts.
+            interval HitInterval = interval(0, Infinity);
+            b32 HitSurface = World.Hit(Ray, HitInterval, Record);
+            ++ThreadRaysTraced();
+            RT_STAT(HitSurface ? Stat_Hits : Stat_Misses);
+
+            // NOTE: The medium the path is in gets a chance to scatter it
+            // before it gets to the surface (or off into the background).
+            const medium *Medium = Media.Top();
+            real MediumT;
+            if(Medium && Medium->SampleDistance(Ray, HitSurface ? Record.t : Infinity, MediumT))
+            {
+                hit_record Event;
+                Event.t = MediumT;
+                Event.P = Ray.At(MediumT);
+                Event.Normal = Vec3r(1, 0, 0); // arbitrary
+                Event.FrontFace = true;
+                Event.Material = Medium->Phase();
+                Event.U = 0;
+                Event.V = 0;
 
-            if (!World.Hit(Ray, HitInterval, Record))
+                ray Scattered;
+                color Attenuation;
+                real PDF = 0;
+                if(Event.Material->Scatter(Ray, Event, Attenuation, Scattered, PDF, Sampler))
+                {
+                    RT_STAT(Stat_MediumBounces);
+                    color Weight = Attenuation;
+                    if(PDF > 0)
+                    {
+                        if(this->Lights || this->SampleEnvironment)
+                        {
+                            PDF = SampleLights(Ray, Event, Scattered, PDF, Sampler);
+                        }
+                        real ScatteringPDF = Event.Material->ScatteringPDF(Ray, Event, Scattered);
+                        Weight = (PDF > 0) ? Attenuation*(ScatteringPDF / PDF) : Color(0, 0, 0);
+                    }
+                    real Width = Cone.Width + Cone.Spread*(MediumT*Ray.Direction().Magnitude());
+                    ray_cone ScatteredCone = {Width, MAX(Cone.Spread, RAY_CONE_ROUGH_SPREAD)};
+                    if(FirstHit)
+                    {
+                        color NextEmission;
+                        color Next = RayColor(Scattered, ScatteredCone, Media, Background,
+                                              BounceCount-1, World, Sampler, nullptr,
+                                              &NextEmission);
+                        Result = Weight*Next;
+
+                        FirstHit->Albedo = Attenuation;
+                        FirstHit->Normal = -Normalize(Ray.Direction());
+                        FirstHit->Depth = MediumT*Ray.Direction().Magnitude();
+                        FirstHit->Material = Event.Material;
+                        FirstHit->Object = nullptr;
+                        FirstHit->Emission = Color(0, 0, 0);
+                        FirstHit->Direct = Weight*NextEmission;
+                        FirstHit->Indirect = Weight*(Next - NextEmission);
+                    }
+                    else
+                    {
+                        Result = Weight*RayColor(Scattered, ScatteredCone, Media, Background,
+                                                 BounceCount-1, World, Sampler);
+                    }
+                }
+            }
+            else if(HitSurface && !Record.Material)
+            {
+                // NOTE: A boundary with nothing but a medium to it. The path
+                // goes on the same way from the other side, in or out of the
+                // medium, and it doesn't count as a bounce.
+                RT_STAT(Stat_BoundaryCrossings);
+                medium_stack Crossed = Media;
+                if(Record.FrontFace)
+                {
+                    Crossed.Push(Record.Medium);
+                }
+                else
+                {
+                    Crossed.Pop(Record.Medium);
+                }
+
+                ray Continued = Ray;
+                Continued.SetOrigin(OffsetRayOrigin(Record.P, Record.Normal, Ray.Direction(),
+                                                    Record.Error));
+                real Width = Cone.Width + Cone.Spread*(Record.t*Ray.Direction().Magnitude());
+                ray_cone ContinuedCone = {Width, Cone.Spread};
+                Result = RayColor(Continued, ContinuedCone, Crossed, Background, BounceCount,
+                                  World, Sampler, FirstHit, Emission);
+            }
+            else if(!HitSurface)
             {
                 // NOTE: If the Ray hits nothing, then return the background
-                // color that was passed here.
-                Result = Background;
+                // color that was passed here, or the environment if there is
+                // one.
+                Result = this->Environment ? this->Environment->Value(Ray.Direction()) : Background;
+                if(Emission)
+                {
+                    *Emission = Result;
+                }
+                if(FirstHit)
+                {
+                    FirstHit->Albedo = Result;
+                    FirstHit->Normal = -Normalize(Ray.Direction());
+                    FirstHit->Depth = 0;
+                    FirstHit->Material = nullptr;
+                    FirstHit->Object = nullptr;
+                    FirstHit->Emission = Result;
+                    FirstHit->Direct = Color(0, 0, 0);
+                    FirstHit->Indirect = Color(0, 0, 0);
+                }
             }
             else
             {
+                // NOTE: How wide the ray is where it hit, stretched by how
+                // glancing the hit is, in UV units for the textures.
+                real DirectionLength = Ray.Direction().Magnitude();
+                real Width = Cone.Width + Cone.Spread*(Record.t*DirectionLength);
+                real CosTheta = fabs(Dot(Record.Normal, Ray.Direction())) / DirectionLength;
+                CosTheta = MAX(CosTheta, RAY_CONE_MIN_COS);
+                Record.Footprint = (Width*Record.UVPerUnit) / CosTheta;
+
+                // NOTE: The differentials know better where they are around,
+                // the tangent plane takes care of glancing hits too.
+                vec3r Px, Py;
+                if(HitDifferentials(Ray, Record, Px, Py))
+                {
+                    real WidthX = (Px - Record.P).Magnitude();
+                    real WidthY = (Py - Record.P).Magnitude();
+                    real DifferentialWidth = MAX(WidthX, WidthY);
+                    Record.Footprint = DifferentialWidth*Record.UVPerUnit;
+                }
+
                 ray Scattered;
                 color Attenuation;
+                real PDF = 0;
                 // NOTE: Emitters(Lights) don't Scatter Rays but emit color out.
                 color Emitted = Record.Material->Emitted(Record.U, Record.V, Record.P);
 
-                if(!Record.Material->Scatter(Ray, Record, Attenuation, Scattered))
+                b32 Scatters = Record.Material->Scatter(Ray, Record, Attenuation, Scattered, PDF, Sampler);
+                if(Emission)
+                {
+                    *Emission = Emitted;
+                }
+                if(FirstHit)
+                {
+                    FirstHit->Albedo = Scatters ? Attenuation : Emitted;
+                    FirstHit->Normal = Record.Normal;
+                    FirstHit->Depth = Record.t*DirectionLength;
+                    FirstHit->Material = Record.Material;
+                    FirstHit->Object = Record.Object;
+                    FirstHit->Emission = Emitted;
+                    FirstHit->Direct = Color(0, 0, 0);
+                    FirstHit->Indirect = Color(0, 0, 0);
+                }
+
+                if(!Scatters)
                 {
                     // NOTE: This is a light since lights here don't scatter rays
                     Result = Emitted;
                 }
                 else
                 {
-                    Result = Emitted + (Attenuation*RayColor(Scattered, Background,
-                                                             BounceCount-1, World));
+                    RT_STAT(Stat_SurfaceBounces);
+                    color Weight = Attenuation;
+                    if(PDF > 0)
+                    {
+                        if(this->Lights || this->SampleEnvironment)
+                        {
+                            PDF = SampleLights(Ray, Record, Scattered, PDF, Sampler);
+                        }
+                        real ScatteringPDF = Record.Material->ScatteringPDF(Ray, Record, Scattered);
+                        Weight = (PDF > 0) ? Attenuation*(ScatteringPDF / PDF) : Color(0, 0, 0);
+                    }
+
+                    vec3r Origin = OffsetRayOrigin(Record.P, Record.Normal,
+                                                   Scattered.Direction(), Record.Error);
+                    Scattered.SetOrigin(Origin);
+
+                    // NOTE: Going through the boundary of a medium, refracted
+                    // into it or out of it, the path is in or out of the
+                    // medium from there on. Normal is on the side the path
+                    // came from.
+                    medium_stack ScatteredMedia = Media;
+                    if(Record.Medium && (Dot(Scattered.Direction(), Record.Normal) < 0))
+                    {
+                        if(Record.FrontFace)
+                        {
+                            ScatteredMedia.Push(Record.Medium);
+                        }
+                        else
+                        {
+                            ScatteredMedia.Pop(Record.Medium);
+                        }
+                    }
+
+                    // NOTE: Mirrors and glass keep the cone going as it was,
+                    // PDF is 0 for those.
+                    ray_cone ScatteredCone = {Width, Cone.Spread};
+                    if(PDF > 0)
+                    {
+                        ScatteredCone.Spread = MAX(Cone.Spread, RAY_CONE_ROUGH_SPREAD);
+                    }
+                    if(FirstHit)
+                    {
+                        color NextEmission;
+                        color Next = RayColor(Scattered, ScatteredCone, ScatteredMedia,
+                                              Background, BounceCount-1, World, Sampler,
+                                              nullptr, &NextEmission);
+                        Result = Emitted + (Weight*Next);
+                        FirstHit->Direct = Weight*NextEmission;
+                        FirstHit->Indirect = Weight*(Next - NextEmission);
+                    }
+                    else
+                    {
+                        Result = Emitted + (Weight*RayColor(Scattered, ScatteredCone, ScatteredMedia,
+                                                            Background, BounceCount-1, World,
+                                                            Sampler));
+                    }
                 }
             }
         }
+        else
+        {
+            RT_STAT(Stat_BounceLimit);
+        }
+
+        return Result;
+    }
+
+    // NOTE: Files ending in .pfm get the linear average of the samples, the
+    // rest get gamma corrected and clamped 8 bit PPM.
+    b32
+    WriteImage()
+    {
+        b32 Result;
+        u64 PixelCount = (u64)this->ImageWidth*this->ImageHeight;
+        size_t Length = strlen(this->Filename);
+        b32 WritePFMFile = (Length >= 4) && (strcmp(this->Filename + Length - 4, ".pfm") == 0);
+
+        if(WritePFMFile)
+        {
+            f32 *ColorData = (f32 *)malloc(sizeof(f32)*PixelCount*3);
+            f64 Scale = 1.0 / (f64)this->SamplesPerPixel;
+            for(u64 Index = 0; Index < PixelCount; ++Index)
+            {
+                ColorData[3*Index + 0] = (f32)(this->Pixels[Index].r*Scale);
+                ColorData[3*Index + 1] = (f32)(this->Pixels[Index].g*Scale);
+                ColorData[3*Index + 2] = (f32)(this->Pixels[Index].b*Scale);
+            }
+
+            pfm PFMFile = {};
+            PFMFile.Filename = this->Filename;
+            PFMFile.Width = this->ImageWidth;
+            PFMFile.Height = this->ImageHeight;
+            PFMFile.ColorData = ColorData;
+            Result = WritePFM(&PFMFile);
+            free(ColorData);
+        }
+        else
+        {
+            u64 RequiredSize = sizeof(u8)*PixelCount*3;
+            u8 *ColorData = (u8 *)malloc(RequiredSize);
+            u8 *At = ColorData;
+            for(u64 Index = 0; Index < PixelCount; ++Index)
+            {
+                WriteColor(&At, this->Pixels[Index], this->SamplesPerPixel);
+            }
+
+            ppm PPMFile = {};
+            PPMFile.Filename = this->Filename;
+            PPMFile.Width = this->ImageWidth;
+            PPMFile.Height = this->ImageHeight;
+            PPMFile.ColorData = ColorData;
+            PPMFile.Size = RequiredSize;
+            Result = WritePPM(&PPMFile);
+            free(ColorData);
+        }
+
+        return Result;
+    }
+
+    // NOTE: Replaces the sums in Pixels with the sums of the denoised image.
+    void
+    DenoiseImage(i32 Threads)
+    {
+        auto Begin = std::chrono::steady_clock::now();
+
+        u64 PixelCount = (u64)this->ImageWidth*this->ImageHeight;
+        f64 Scale = 1.0 / this->SamplesPerPixel;
+        std::vector<vec3d> Color(PixelCount), Albedo(PixelCount), Normal(PixelCount);
+        std::vector<f64> Variance(PixelCount), Depth(PixelCount);
+        const vec3d *AlbedoSums = this->AOVBuffer.Sums(AOV_Albedo);
+        const vec3d *NormalSums = this->AOVBuffer.Sums(AOV_Normal);
+        const vec3d *DepthSums = this->AOVBuffer.Sums(AOV_Depth);
+        const vec3d *LuminanceSquares = this->AOVBuffer.Sums(AOV_LuminanceSquares);
+        for(u64 Index = 0; Index < PixelCount; ++Index)
+        {
+            Color[Index] = Scale*this->Pixels[Index];
+            Albedo[Index] = Scale*AlbedoSums[Index];
+            Normal[Index] = Scale*NormalSums[Index];
+            Depth[Index] = Scale*DepthSums[Index].x;
+
+            // NOTE: The variance of the mean, from the one of the samples.
+            f64 Mean = 0.2126*Color[Index].r + 0.7152*Color[Index].g + 0.0722*Color[Index].b;
+            f64 SampleVariance = Scale*LuminanceSquares[Index].x - Mean*Mean;
+            SampleVariance = MAX(SampleVariance, 0.0);
+            Variance[Index] = SampleVariance*Scale;
+        }
 
-#if RENDER_SKY
-        // NOTE: Render the Sky.
-        vec3d UnitDirection = Normalize(Ray.Direction());
-        // should be in the range (0,1) for color.
-        f64 a = 0.5*(UnitDirection.y + 1.0);
-        color Result = (1.0 - a)*Color(1.0, 1.0, 1.0) + a*Color(0.5, 0.7, 1.0);
-#endif
+        denoise_input Input = {this->ImageWidth, this->ImageHeight, Color.data(), Variance.data(),
+                               Albedo.data(), Normal.data(), Depth.data()};
+        denoiser Denoiser;
+        Denoiser.Run(Input, this->Denoiser, Threads, Color.data());
+        for(u64 Index = 0; Index < PixelCount; ++Index)
+        {
+            this->Pixels[Index] = (f64)this->SamplesPerPixel*Color[Index];
+        }
+
+        auto End = std::chrono::steady_clock::now();
+        fprintf(stderr, "Denoised (%s) in %.1f ms\n", DenoiseFilterName(this->Denoiser),
+                std::chrono::duration<f64, std::milli>(End - Begin).count());
+    }
+
+    // NOTE: The output file name without its extension, for the AOVs.
+    std::string
+    ImageStem() const
+    {
+        std::string Result = this->Filename;
+        size_t Dot = Result.find_last_of('.');
+        size_t Slash = Result.find_last_of("/\\");
+        if((Dot != std::string::npos) && ((Slash == std::string::npos) || (Dot > Slash)))
+        {
+            Result.resize(Dot);
+        }
 
         return Result;
     }
@@ -292,13 +780,14 @@ class camera
     void
     FreeImageData()
     {
-        if(this->PPMFile.ColorData)
+        if(this->Pixels)
         {
-            free(this->PPMFile.ColorData);
-            this->Data = nullptr;
+            free(this->Pixels);
+            this->Pixels = nullptr;
         }
+        this->AOVBuffer.Free();
 
-        this->PPMFile = {};
+        Initialized = false;
     }
 };
 
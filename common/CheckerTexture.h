@@ -7,33 +7,39 @@ class checker_texture : public texture
 {
   public:
     checker_texture() {}
-    checker_texture(std::shared_ptr<texture> Even, std::shared_ptr<texture> Odd)
+    checker_texture(texture *Even, texture *Odd)
         : even(Even), odd(Odd) {}
 
     checker_texture(color C1, color C2)
-        : even(std::make_shared<solid_color>(C1)),
-          odd(std::make_shared<solid_color>(C2)) {}
+        : ownedOdd(std::make_unique<solid_color>(C2)),
+          ownedEven(std::make_unique<solid_color>(C1)),
+          odd(ownedOdd.get()), even(ownedEven.get()) {}
 
     color
-    Value(f64 U, f64 V, const vec3d &P) const override
+    Value(real U, real V, const vec3r &P, real Footprint) const override
     {
-        f64 Sines = sin(10*P.x)*sin(10*P.y)*sin(10*P.z);
+        real Sines = sin(10*P.x)*sin(10*P.y)*sin(10*P.z);
         color Result;
         if (Sines < 0.)
         {
-            Result = this->odd->Value(U, V, P);
+            Result = this->odd->Value(U, V, P, Footprint);
         }
         else
         {
-            Result = this->even->Value(U, V, P);
+            Result = this->even->Value(U, V, P, Footprint);
         }
 
         return Result;
     }
 
   private:
-    std::shared_ptr<texture> odd;
-    std::shared_ptr<texture> even;
+    friend class scene_cache;
+
+    // NOTE: Only set by the two color constructor.
+    std::unique_ptr<solid_color> ownedOdd;
+    std::unique_ptr<solid_color> ownedEven;
+    texture *odd = nullptr;
+    texture *even = nullptr;
 };
 
 #define CHECKER_TEXTURE_H
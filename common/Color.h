@@ -2,8 +2,8 @@
 
 #include "Vec.h"
 
-using color = vec3d;
-color Color(f64 A, f64 B, f64 C)
+using color = vec3r;
+color Color(real A, real B, real C)
 {
     color Result = {A, B, C};
     return Result;
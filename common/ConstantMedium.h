@@ -11,37 +11,52 @@
 class isotropic : public material
 {
   public:
-    isotropic(color c) : albedo(std::make_shared<solid_color>(c)) {}
-    isotropic(std::shared_ptr<texture> a) : albedo(a) {}
+    isotropic(color c) : ownedAlbedo(std::make_unique<solid_color>(c)), albedo(ownedAlbedo.get()) {}
+    isotropic(texture *a) : albedo(a) {}
     
     virtual b32
     Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
-            ray &ScatteredRay) const override
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
     {
-        ScatteredRay = ray(Record.P, vec3d::RandomUnitVector(), RayIn.Time());
-        Attenuation = albedo->Value(Record.U, Record.V, Record.P);
+        ScatteredRay = ray(Record.P, SampleUnitSphere(Sampler.Get2D()), RayIn.Time());
+        Attenuation = albedo->Value(Record.U, Record.V, Record.P, Record.Footprint);
+        PDF = (real)UnitSpherePdf();
         return true;
     }
 
+    virtual real
+    ScatteringPDF(const ray &RayIn, const hit_record &Record, const ray &Scattered) const override
+    {
+        real Result = (real)UnitSpherePdf();
+        return Result;
+    }
+
   public:
-    std::shared_ptr<texture> albedo;
+    // NOTE: Only set by isotropic(color).
+    std::unique_ptr<solid_color> ownedAlbedo;
+    texture *albedo;
 };
 
 // A Volume with constant density
 class constant_density_medium : public hittable
 {
   public:
-    constant_density_medium(std::shared_ptr<hittable> HittablePtr, f64 Density,
-                            std::shared_ptr<texture> TexPtr)
-        : boundary(HittablePtr), neg_inv_density(-1 / Density),
-          phase_function(std::make_shared<isotropic>(TexPtr))
+    constant_density_medium(hittable *HittablePtr, real Density, texture *TexPtr)
+        : boundary(HittablePtr), ownedPhase(std::make_unique<isotropic>(TexPtr)),
+          phase_function(ownedPhase.get()), neg_inv_density(-1 / Density)
+    {
+    }
+
+    constant_density_medium(hittable *HittablePtr, real Density, color Color)
+        : boundary(HittablePtr), ownedPhase(std::make_unique<isotropic>(Color)),
+          phase_function(ownedPhase.get()), neg_inv_density(-1 / Density)
     {
     }
 
-    constant_density_medium(std::shared_ptr<hittable> HittablePtr, f64 Density,
-                            color Color)
-        : boundary(HittablePtr), neg_inv_density(-1 / Density),
-          phase_function(std::make_shared<isotropic>(Color))
+    // NOTE: Scatters with Phase, a phase_material say, rather than
+    // isotropically.
+    constant_density_medium(hittable *HittablePtr, real Density, material *Phase)
+        : boundary(HittablePtr), phase_function(Phase), neg_inv_density(-1 / Density)
     {
     }
 
@@ -49,7 +64,7 @@ class constant_density_medium : public hittable
                     hit_record &Record) const override;
 
     virtual b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         b32 Result = boundary->BoundingBox(Time0, Time1, OutputBox);
 
@@ -57,9 +72,12 @@ class constant_density_medium : public hittable
     }
 
   public:
-    std::shared_ptr<hittable> boundary;
-    std::shared_ptr<material> phase_function;
-    f64 neg_inv_density;
+    hittable *boundary;
+    // NOTE: Made by the color and texture constructors. A phase passed in
+    // belongs to whoever passed it.
+    std::unique_ptr<isotropic> ownedPhase;
+    material *phase_function;
+    real neg_inv_density;
 };
 
 b32
@@ -109,9 +127,14 @@ constant_density_medium::Hit(const ray &Ray, const interval &Interval,
                                 << "Record.p = " << Record.p << '\n';
                     }
                     */
-                    Record.Normal = Vec3d(1, 0, 0); // arbitrary
+                    Record.Normal = Vec3r(1, 0, 0); // arbitrary
                     Record.FrontFace = true;      // also arbitrary
                     Record.Material = phase_function;
+                    Record.Object = this;
+                    Record.Error = 0;
+                    Record.UVPerUnit = 0;
+                    Record.Curvature = 0;
+                    Record.Medium = nullptr;
 
                     Result = true;
                 }
@@ -0,0 +1,331 @@
+#if !defined(DENOISE_H)
+
+#include "defines.h"
+#include "Vec.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// NOTE: Edge-aware denoising of the rendered image, before it is tonemapped,
+// guided by what the camera rays saw first: the albedo, the normal and the
+// depth there (see camera::AOVs). Those are close to noise free even
+// at a few samples a pixel, since they don't depend on where the paths went
+// after the first hit, so they tell edges apart from noise far better than
+// the colors can.
+//
+// The colors are divided by the albedo first, and the albedo is put back on
+// after, so textures don't get blurred away with the noise: only the light
+// falling on the surfaces gets filtered. Every neighbour is weighted by how
+// close it is, how well its normal, depth and albedo line up with the
+// pixel's (a pixel on another surface gets next to nothing), and how close its
+// brightness is, relative to how noisy the pixel is, so the filter blurs hard
+// where there is a lot of noise and backs off where there is little.
+//
+// Denoise_ATrous is the edge-avoiding a-trous wavelet filter (Dammertz et al.
+// 2010, with the variance guided weights of SVGF): a 5x5 kernel applied four
+// times with the taps 1, 2, 4 and 8 pixels apart, for a footprint of 61x61
+// pixels at 25 taps a pass. Denoise_Bilateral is a plain joint bilateral
+// filter over a 13x13 window, in one pass: 169 taps, for a smaller footprint.
+// It does a little better on small images, the a-trous filter reaches much
+// further for less.
+enum denoise_filter
+{
+    Denoise_None,
+    Denoise_ATrous,
+    Denoise_Bilateral,
+};
+
+inline b32
+DenoiseFilterFromName(const char *Name, denoise_filter *Filter)
+{
+    b32 Result = true;
+    if(strcmp(Name, "atrous") == 0)         { *Filter = Denoise_ATrous; }
+    else if(strcmp(Name, "bilateral") == 0) { *Filter = Denoise_Bilateral; }
+    else if(strcmp(Name, "none") == 0)      { *Filter = Denoise_None; }
+    else                                    { Result = false; }
+
+    return Result;
+}
+
+inline const char *
+DenoiseFilterName(denoise_filter Filter)
+{
+    const char *Result = (Filter == Denoise_ATrous) ? "a-trous" :
+                         (Filter == Denoise_Bilateral) ? "bilateral" : "none";
+    return Result;
+}
+
+// NOTE: Everything is per pixel, rows top to bottom. Color is the mean of
+// the samples, Variance the variance of that mean's luminance (the variance
+// of the samples over their count).
+struct denoise_input
+{
+    i32 Width;
+    i32 Height;
+    const vec3d *Color;
+    const f64 *Variance;
+    const vec3d *Albedo;
+    const vec3d *Normal;
+    const f64 *Depth;
+};
+
+// NOTE: Runs Function(Y) for every row, on ThreadCount threads.
+template <typename function>
+void
+ParallelRows(i32 Height, i32 ThreadCount, function Function)
+{
+    std::atomic<i32> NextRow(0);
+    auto Rows = [&]()
+    {
+        for(i32 Y = NextRow++; Y < Height; Y = NextRow++)
+        {
+            Function(Y);
+        }
+    };
+
+    std::vector<std::thread> Workers;
+    for(i32 Index = 1; Index < ThreadCount; ++Index)
+    {
+        Workers.emplace_back(Rows);
+    }
+    Rows();
+    for(std::thread &Worker : Workers)
+    {
+        Worker.join();
+    }
+}
+
+class denoiser
+{
+  public:
+    // NOTE: How far apart two brightnesses can be, in standard deviations of
+    // the noise, before they stop counting as the same, how sharply the
+    // normals have to line up, how much the depths can differ, in units of
+    // how fast the depth changes across the pixel, and how much the albedos
+    // can. The albedo keeps lights, whose albedo is what they emit, from
+    // running into the surfaces around them.
+    f64 SigmaLuminance = 4.0;
+    f64 NormalPower = 128.0;
+    f64 SigmaDepth = 1.0;
+    f64 SigmaAlbedo = 0.1;
+
+    // NOTE: Output gets the denoised colors, Input.Width*Input.Height of them.
+    void
+    Run(const denoise_input &Input, denoise_filter Filter, i32 ThreadCount, vec3d *Output)
+    {
+        width = Input.Width;
+        height = Input.Height;
+        threads = (ThreadCount < 1) ? 1 : ThreadCount;
+        u64 PixelCount = (u64)width*height;
+
+        Prepare(Input);
+
+        if(Filter == Denoise_ATrous)
+        {
+            std::vector<vec3d> NextLight(PixelCount);
+            std::vector<f64> NextVariance(PixelCount);
+            for(i32 Pass = 0; Pass < 4; ++Pass)
+            {
+                i32 Step = 1 << Pass;
+                ParallelRows(height, threads, [&](i32 Y)
+                {
+                    for(i32 X = 0; X < width; ++X)
+                    {
+                        FilterPixel(X, Y, 2, Step, ATrousKernel, NextLight, NextVariance);
+                    }
+                });
+                light.swap(NextLight);
+                variance.swap(NextVariance);
+            }
+        }
+        else if(Filter == Denoise_Bilateral)
+        {
+            std::vector<vec3d> NextLight(PixelCount);
+            std::vector<f64> NextVariance(PixelCount);
+            ParallelRows(height, threads, [&](i32 Y)
+            {
+                for(i32 X = 0; X < width; ++X)
+                {
+                    FilterPixel(X, Y, 6, 1, GaussianKernel, NextLight, NextVariance);
+                }
+            });
+            light.swap(NextLight);
+        }
+
+        for(u64 Index = 0; Index < PixelCount; ++Index)
+        {
+            Output[Index] = light[Index]*albedo[Index];
+        }
+    }
+
+  private:
+    i32 width = 0;
+    i32 height = 0;
+    i32 threads = 1;
+
+    // NOTE: The colors over the albedo, what is left to filter, and the
+    // variance of its luminance.
+    std::vector<vec3d> light;
+    std::vector<f64> variance;
+    std::vector<vec3d> albedo;
+    std::vector<vec3d> normal;
+    std::vector<f64> depth;
+    // NOTE: How much the depth changes from one pixel to the next around a
+    // pixel, the smaller of the two sides so edges don't count.
+    std::vector<f64> depthSlope;
+
+    static constexpr f64 AlbedoEpsilon = 0.01;
+
+    static f64
+    ATrousKernel(i32 Offset)
+    {
+        static const f64 Weights[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+        f64 Result = Weights[(Offset < 0) ? -Offset : Offset];
+        return Result;
+    }
+
+    static f64
+    GaussianKernel(i32 Offset)
+    {
+        f64 Result = exp(-(f64)Offset*Offset / (2.0*3.0*3.0));
+        return Result;
+    }
+
+    static f64
+    Luminance(const vec3d &Color)
+    {
+        f64 Result = 0.2126*Color.r + 0.7152*Color.g + 0.0722*Color.b;
+        return Result;
+    }
+
+    void
+    Prepare(const denoise_input &Input)
+    {
+        u64 PixelCount = (u64)width*height;
+        light.resize(PixelCount);
+        variance.resize(PixelCount);
+        albedo.resize(PixelCount);
+        normal.resize(PixelCount);
+        depth.assign(Input.Depth, Input.Depth + PixelCount);
+        depthSlope.resize(PixelCount);
+
+        for(u64 Index = 0; Index < PixelCount; ++Index)
+        {
+            vec3d Albedo = Input.Albedo[Index];
+            Albedo = ComponentMax(Albedo, Vec3d(0, 0, 0)) + Vec3d(AlbedoEpsilon);
+            albedo[Index] = Albedo;
+            light[Index] = Input.Color[Index] / Albedo;
+            f64 AlbedoLuminance = Luminance(Albedo);
+            variance[Index] = Input.Variance[Index] / (AlbedoLuminance*AlbedoLuminance);
+
+            vec3d Normal = Input.Normal[Index];
+            f64 Length = Normal.Magnitude();
+            normal[Index] = (Length > 0.0) ? (Normal / Length) : Normal;
+        }
+
+        ParallelRows(height, threads, [&](i32 Y)
+        {
+            for(i32 X = 0; X < width; ++X)
+            {
+                f64 Z = depth[Index(X, Y)];
+                f64 Left = fabs(Z - depth[Index(MAX(X - 1, 0), Y)]);
+                f64 Right = fabs(Z - depth[Index(MIN(X + 1, width - 1), Y)]);
+                f64 Up = fabs(Z - depth[Index(X, MAX(Y - 1, 0))]);
+                f64 Down = fabs(Z - depth[Index(X, MIN(Y + 1, height - 1))]);
+                depthSlope[Index(X, Y)] = MAX(MIN(Left, Right), MIN(Up, Down));
+            }
+        });
+    }
+
+    u64 Index(i32 X, i32 Y) const { return (u64)Y*width + X; }
+
+    // NOTE: The variance that goes into the brightness weight is blurred a
+    // little first, 3x3, a single pixel's estimate of it is noisy itself.
+    f64
+    BlurredVariance(i32 X, i32 Y) const
+    {
+        f64 Sum = 0, WeightSum = 0;
+        for(i32 DY = -1; DY <= 1; ++DY)
+        {
+            for(i32 DX = -1; DX <= 1; ++DX)
+            {
+                i32 SX = X + DX, SY = Y + DY;
+                if((SX >= 0) && (SX < width) && (SY >= 0) && (SY < height))
+                {
+                    f64 Weight = ((DX == 0) ? 2.0 : 1.0)*((DY == 0) ? 2.0 : 1.0);
+                    Sum += Weight*variance[Index(SX, SY)];
+                    WeightSum += Weight;
+                }
+            }
+        }
+
+        f64 Result = Sum / WeightSum;
+        return Result;
+    }
+
+    template <typename kernel>
+    void
+    FilterPixel(i32 X, i32 Y, i32 Radius, i32 Step, kernel Kernel,
+                std::vector<vec3d> &OutLight, std::vector<f64> &OutVariance) const
+    {
+        u64 Center = Index(X, Y);
+        const vec3d &CenterLight = light[Center];
+        const vec3d &CenterNormal = normal[Center];
+        const vec3d &CenterAlbedo = albedo[Center];
+        f64 CenterLuminance = Luminance(CenterLight);
+        f64 CenterDepth = depth[Center];
+        f64 LuminanceScale = SigmaLuminance*sqrt(MAX(BlurredVariance(X, Y), 0.0)) + 1e-6;
+        f64 DepthScale = SigmaDepth*depthSlope[Center];
+        f64 DepthFloor = 1e-3*CenterDepth + 1e-6;
+
+        vec3d Sum = Vec3d(0, 0, 0);
+        f64 VarianceSum = 0;
+        f64 WeightSum = 0;
+        for(i32 DY = -Radius; DY <= Radius; ++DY)
+        {
+            i32 SY = Y + DY*Step;
+            if((SY < 0) || (SY >= height))
+            {
+                continue;
+            }
+            for(i32 DX = -Radius; DX <= Radius; ++DX)
+            {
+                i32 SX = X + DX*Step;
+                if((SX < 0) || (SX >= width))
+                {
+                    continue;
+                }
+
+                u64 Sample = Index(SX, SY);
+                f64 Weight = Kernel(DX)*Kernel(DY);
+                if(Sample != Center)
+                {
+                    f64 Distance = Step*sqrt((f64)(DX*DX + DY*DY));
+                    f64 DepthError = fabs(depth[Sample] - CenterDepth) /
+                                     (DepthScale*Distance + DepthFloor);
+                    f64 LuminanceError = fabs(Luminance(light[Sample]) - CenterLuminance) /
+                                         LuminanceScale;
+                    f64 AlbedoError = (albedo[Sample] - CenterAlbedo).Magnitude() / SigmaAlbedo;
+                    f64 NormalCos = Dot(normal[Sample], CenterNormal);
+                    NormalCos = (NormalCos > 0.0) ? NormalCos : 0.0;
+                    Weight *= pow(NormalCos, NormalPower)*
+                              exp(-DepthError - LuminanceError - AlbedoError);
+                }
+
+                Sum += Weight*light[Sample];
+                VarianceSum += Weight*Weight*variance[Sample];
+                WeightSum += Weight;
+            }
+        }
+
+        // NOTE: The pixel itself always counts, so WeightSum is never 0.
+        OutLight[Center] = Sum / WeightSum;
+        OutVariance[Center] = VarianceSum / (WeightSum*WeightSum);
+    }
+};
+
+#define DENOISE_H
+#endif
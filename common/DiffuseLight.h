@@ -6,29 +6,30 @@
 class diffuse_light : public material
 {
   public:
-    diffuse_light(std::shared_ptr<texture> Tex) : emitTexture(Tex) {}
+    diffuse_light(texture *Tex) : emitTexture(Tex) {}
     diffuse_light(color Color)
-    {
-        std::shared_ptr<texture> ColTex = std::make_shared<solid_color>(Color);
-        emitTexture = ColTex;
-    }
+        : ownedTexture(std::make_unique<solid_color>(Color)), emitTexture(ownedTexture.get()) {}
 
     virtual b32
     Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
-            ray &ScatteredRay) const override
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
     {
         return false;
     }
 
     virtual color
-    Emitted(f64 U, f64 V, const vec3d &P) const override
+    Emitted(real U, real V, const vec3r &P) const override
     {
-        color Result = emitTexture->Value(U, V, P);
+        color Result = emitTexture->Value(U, V, P, 0);
         return Result;
     }
 
   private:
-    std::shared_ptr<texture> emitTexture;
+    friend class scene_cache;
+
+    // NOTE: Backs emitTexture when the light was given a color.
+    std::unique_ptr<solid_color> ownedTexture;
+    texture *emitTexture;
 };
 
 #define DIFFUSE_LIGHT_H
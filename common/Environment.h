@@ -0,0 +1,195 @@
+#if !defined(ENVIRONMENT_H)
+
+#include "defines.h"
+#include "Color.h"
+#include "Vec.h"
+#include "rt_stbimage.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// NOTE: Light from infinitely far away in every direction, out of an HDR
+// lat-long image: the top row is straight up (+y), the bottom one straight
+// down, and the columns go around y the same way the sphere's U does (see
+// sphere::GetSphereUV). Every ray that misses the scene gets the pixel it
+// points at, times Scale.
+//
+// A sky with a sun in it is almost all of its light in a few pixels, which a
+// bounce off a diffuse surface finds once in thousands of tries. So the
+// camera also sends bounces towards the bright parts on purpose (see
+// camera::SampleLights), with Sample(), which picks a pixel in proportion to
+// its brightness: a row first, out of the marginal CDF over the rows, then a
+// pixel in it, out of that row's conditional CDF, both of them piecewise
+// constant. The rows near the poles cover less of the sphere than the ones at
+// the horizon, so every pixel is weighted by sin(theta) at its center too.
+//
+// Value() looks up the nearest pixel without filtering, so the image is
+// exactly the piecewise constant function the CDFs were built from, and the
+// density Sample() returns is exactly how often it picks a direction.
+class environment_map
+{
+  public:
+    explicit environment_map(const char *Filename, real Scale = 1) : scale(Scale)
+    {
+        if(!Image.LoadFloat(Filename))
+        {
+            return;
+        }
+
+        width = Image.Width();
+        height = Image.Height();
+        conditional.resize((u64)height*(width + 1));
+        marginal.resize(height + 1);
+
+        f64 Total = 0;
+        marginal[0] = 0;
+        for(i32 Y = 0; Y < height; ++Y)
+        {
+            f64 SinTheta = sin(pi*(Y + 0.5) / height);
+            f32 *Row = &conditional[(u64)Y*(width + 1)];
+            f64 RowTotal = 0;
+            Row[0] = 0;
+            for(i32 X = 0; X < width; ++X)
+            {
+                const f32 *Pixel = Image.FloatPixelData(X, Y);
+                f64 Luminance = 0.2126*Pixel[0] + 0.7152*Pixel[1] + 0.0722*Pixel[2];
+                RowTotal += (Luminance > 0.0) ? Luminance*SinTheta : 0.0;
+                Row[X + 1] = (f32)RowTotal;
+            }
+
+            // NOTE: A row with nothing in it is never picked, it just gets a
+            // CDF that keeps the search below well defined.
+            for(i32 X = 1; X <= width; ++X)
+            {
+                Row[X] = (RowTotal > 0.0) ? (f32)(Row[X] / RowTotal) : (f32)X / width;
+            }
+            Row[width] = 1;
+
+            Total += RowTotal;
+            marginal[Y + 1] = Total;
+        }
+
+        for(i32 Y = 1; Y <= height; ++Y)
+        {
+            marginal[Y] = (Total > 0.0) ? (marginal[Y] / Total) : (f64)Y / height;
+        }
+        marginal[height] = 1;
+
+        // NOTE: The integral of the function over the unit square, each pixel
+        // is 1/(width*height) of it.
+        integral = Total / ((f64)width*height);
+    }
+
+    b32 Loaded() const { return width > 0; }
+
+    // NOTE: Nothing in the image to send rays towards, all black.
+    b32 CanSample() const { return integral > 0.0; }
+
+    color
+    Value(const vec3r &Direction) const
+    {
+        i32 X, Y;
+        Pixel(Direction, X, Y);
+        const f32 *Texel = Image.FloatPixelData(X, Y);
+        color Result = scale*Color(Texel[0], Texel[1], Texel[2]);
+        return Result;
+    }
+
+    // NOTE: A unit direction towards the environment, with its density per
+    // unit solid angle in PDF. Sample.u picks the row, Sample.v the pixel in
+    // it, each one at a uniform spot inside of the pixel.
+    vec3r
+    Sample(const vec2d &Sample, real &PDF) const
+    {
+        f64 V = Invert(&marginal[0], height, Sample.u);
+        i32 Y = MIN((i32)(V*height), height - 1);
+        const f32 *Row = &conditional[(u64)Y*(width + 1)];
+        f64 U = Invert(Row, width, Sample.v);
+        i32 X = MIN((i32)(U*width), width - 1);
+
+        f64 Theta = pi*V;
+        f64 Phi = 2.0*pi*U;
+        f64 SinTheta = sin(Theta);
+        vec3r Result = Vec3r(-SinTheta*cos(Phi), cos(Theta), SinTheta*sin(Phi));
+
+        PDF = (real)Density(X, Y, SinTheta);
+        return Result;
+    }
+
+    // NOTE: Density of Sample() picking Direction, per unit solid angle.
+    real
+    PDF(const vec3r &Direction) const
+    {
+        i32 X, Y;
+        Pixel(Direction, X, Y);
+        f64 Length = Direction.Magnitude();
+        f64 CosTheta = (Length > 0.0) ? (Direction.y / Length) : 1.0;
+        f64 SinTheta = sqrt(MAX(0.0, 1.0 - CosTheta*CosTheta));
+        real Result = (real)Density(X, Y, SinTheta);
+        return Result;
+    }
+
+  private:
+    rt_image Image;
+    i32 width = 0;
+    i32 height = 0;
+    real scale;
+    f64 integral = 0;
+    // NOTE: height rows of width + 1 entries each, 0 to 1.
+    std::vector<f32> conditional;
+    // NOTE: height + 1 entries, 0 to 1.
+    std::vector<f64> marginal;
+
+    void
+    Pixel(const vec3r &Direction, i32 &X, i32 &Y) const
+    {
+        f64 Length = Direction.Magnitude();
+        f64 CosTheta = (Length > 0.0) ? (Direction.y / Length) : 1.0;
+        CosTheta = (CosTheta < -1.0) ? -1.0 : ((CosTheta > 1.0) ? 1.0 : CosTheta);
+        f64 U = (atan2(-(f64)Direction.z, (f64)Direction.x) + pi) / (2.0*pi);
+        f64 V = acos(CosTheta) / pi;
+
+        X = (i32)(U*width);
+        Y = (i32)(V*height);
+        X = (X < 0) ? 0 : ((X >= width) ? (width - 1) : X);
+        Y = (Y < 0) ? 0 : ((Y >= height) ? (height - 1) : Y);
+    }
+
+    // NOTE: The pixel's share of the function over the unit square, and the
+    // square maps to the sphere with a Jacobian of 2pi*pi*sin(theta).
+    f64
+    Density(i32 X, i32 Y, f64 SinTheta) const
+    {
+        f64 Result = 0;
+        if((integral > 0.0) && (SinTheta > 0.0))
+        {
+            const f32 *Row = &conditional[(u64)Y*(width + 1)];
+            f64 RowShare = (marginal[Y + 1] - marginal[Y])*height;
+            f64 PixelShare = ((f64)Row[X + 1] - Row[X])*width;
+            Result = RowShare*PixelShare / (2.0*pi*pi*SinTheta);
+        }
+
+        return Result;
+    }
+
+    // NOTE: Where in [0, 1) the piecewise constant density with CDF Cdf
+    // (Count + 1 entries) puts the uniform Sample: the first bin that ends
+    // past it, and the same fraction of the way through the bin as Sample
+    // is through the bin's CDF. Empty bins end where they start, so they
+    // never are.
+    template <typename T>
+    static f64
+    Invert(const T *Cdf, i32 Count, f64 Sample)
+    {
+        i32 Bin = (i32)(std::upper_bound(Cdf + 1, Cdf + Count, (T)Sample) - (Cdf + 1));
+        f64 Width = (f64)Cdf[Bin + 1] - Cdf[Bin];
+        f64 Offset = (Width > 0.0) ? ((Sample - Cdf[Bin]) / Width) : 0.5;
+        Offset = (Offset < 0.0) ? 0.0 : ((Offset >= 1.0) ? 0.99999994 : Offset);
+        f64 Result = (Bin + Offset) / Count;
+        return Result;
+    }
+};
+
+#define ENVIRONMENT_H
+#endif
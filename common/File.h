@@ -1,8 +1,18 @@
 #if !defined(FILE_H)
 #include "defines.h"
 #include <cstdio>
+#include <cstring>
 #include <memory>
 
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 struct ppm
 {
     const char *Filename;
@@ -14,28 +24,76 @@ struct ppm
     u64 Size;
 };
 
+// NOTE: Linear, unclamped RGB floats, rows stored top to bottom.
+struct pfm
+{
+    const char *Filename;
+
+    i32 Width;
+    i32 Height;
+
+    f32 *ColorData;
+};
+
 struct file_read_info
 {
     void *Data;
     u64 Size;
 };
 
-void
+// NOTE: Returns false if the file could not be written whole.
+b32
 WritePPM(const ppm *PPM)
 {
     FILE *File = fopen(PPM->Filename, "wb");
     if (!File)
     {
-        printf("There was an error opening file: %s\n", PPM->Filename);
-        return;
+        fprintf(stderr, "There was an error opening file: %s\n", PPM->Filename);
+        return false;
     }
 
     fprintf(File, "P6\n%d %d\n255\n", PPM->Width, PPM->Height);
 
     u64 WriteElements = fwrite(PPM->ColorData, sizeof(u8), PPM->Size, File);
 
-    fclose(File);
+    b32 Result = (WriteElements == PPM->Size) && (fclose(File) == 0);
+    File = nullptr;
+    if (!Result)
+    {
+        fprintf(stderr, "There was an error writing file: %s\n", PPM->Filename);
+    }
+    return Result;
+}
+
+// NOTE: Portable Float Map. A negative scale means little endian, and the rows
+// go from the bottom of the image to the top. Returns false if the file could
+// not be written whole.
+b32
+WritePFM(const pfm *PFM)
+{
+    FILE *File = fopen(PFM->Filename, "wb");
+    if (!File)
+    {
+        fprintf(stderr, "There was an error opening file: %s\n", PFM->Filename);
+        return false;
+    }
+
+    fprintf(File, "PF\n%d %d\n-1.0\n", PFM->Width, PFM->Height);
+
+    b32 Result = true;
+    for(i32 Y = PFM->Height - 1; Y >= 0; --Y)
+    {
+        u64 RowSize = (u64)PFM->Width*3;
+        Result = Result && (fwrite(PFM->ColorData + (u64)Y*RowSize, sizeof(f32), RowSize, File) == RowSize);
+    }
+
+    Result = (fclose(File) == 0) && Result;
     File = nullptr;
+    if (!Result)
+    {
+        fprintf(stderr, "There was an error writing file: %s\n", PFM->Filename);
+    }
+    return Result;
 }
 
 file_read_info
@@ -46,7 +104,7 @@ ReadFile(const char *Filename)
     FILE *File = fopen(Filename, "rb");
     if (!File)
     {
-        printf("There was an error opening file: %s\n", Filename);
+        fprintf(stderr, "There was an error opening file: %s\n", Filename);
         return Result;
     }
 
@@ -80,5 +138,162 @@ ReadFile(const char *Filename)
 
     return Result;
 }
+
+// NOTE: Reads a 3 channel PFM back into top to bottom rows. ColorData is
+// malloc'd, the caller frees it.
+b32
+ReadPFM(const char *Filename, pfm *PFM)
+{
+    b32 Result = false;
+    *PFM = {};
+
+    file_read_info File = ReadFile(Filename);
+    if(!File.Data)
+    {
+        return Result;
+    }
+
+    i32 Width = 0;
+    i32 Height = 0;
+    f64 Scale = 0.0;
+    i32 HeaderSize = 0;
+    const char *Text = (const char *)File.Data;
+    if((File.Size > 3) && (Text[0] == 'P') && (Text[1] == 'F') &&
+       (sscanf(Text + 2, "%d %d %lf%n", &Width, &Height, &Scale, &HeaderSize) == 3))
+    {
+        // NOTE: Exactly one whitespace character ends the header.
+        u64 DataOffset = 2 + HeaderSize + 1;
+        u64 FloatCount = (u64)Width*Height*3;
+        if((Width > 0) && (Height > 0) && (File.Size >= DataOffset + FloatCount*sizeof(f32)))
+        {
+            f32 *ColorData = (f32 *)malloc(FloatCount*sizeof(f32));
+            const u8 *Rows = (const u8 *)File.Data + DataOffset;
+            u64 RowSize = (u64)Width*3*sizeof(f32);
+            for(i32 Y = 0; Y < Height; ++Y)
+            {
+                memcpy(ColorData + (u64)Y*Width*3, Rows + (u64)(Height - 1 - Y)*RowSize, RowSize);
+            }
+
+            if(Scale > 0.0)
+            {
+                // Big endian.
+                u32 *Words = (u32 *)ColorData;
+                for(u64 Index = 0; Index < FloatCount; ++Index)
+                {
+                    u32 Word = Words[Index];
+                    Words[Index] = (Word >> 24) | ((Word >> 8) & 0xFF00u) |
+                                   ((Word << 8) & 0xFF0000u) | (Word << 24);
+                }
+            }
+
+            PFM->Filename = Filename;
+            PFM->Width = Width;
+            PFM->Height = Height;
+            PFM->ColorData = ColorData;
+            Result = true;
+        }
+    }
+
+    if(!Result)
+    {
+        fprintf(stderr, "%s is not a 3 channel PFM file\n", Filename);
+    }
+
+    free(File.Data);
+    return Result;
+}
+
+// NOTE: A read-only memory mapped file. The OS pages the contents in on
+// demand, so nothing is copied up front and unused parts are never read.
+struct mapped_file
+{
+    const void *Data;
+    u64 Size;
+
+#if defined(_WIN32)
+    HANDLE File;
+    HANDLE Mapping;
+#endif
+};
+
+b32
+MapFile(const char *Filename, mapped_file *Mapped)
+{
+    *Mapped = {};
+    b32 Result = false;
+
+#if defined(_WIN32)
+    HANDLE File = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if(File != INVALID_HANDLE_VALUE)
+    {
+        LARGE_INTEGER Size;
+        if(GetFileSizeEx(File, &Size) && (Size.QuadPart > 0))
+        {
+            HANDLE Mapping = CreateFileMappingA(File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(Mapping)
+            {
+                void *Data = MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0);
+                if(Data)
+                {
+                    Mapped->Data = Data;
+                    Mapped->Size = (u64)Size.QuadPart;
+                    Mapped->File = File;
+                    Mapped->Mapping = Mapping;
+                    Result = true;
+                }
+                else
+                {
+                    CloseHandle(Mapping);
+                }
+            }
+        }
+
+        if(!Result)
+        {
+            CloseHandle(File);
+        }
+    }
+#else
+    i32 File = open(Filename, O_RDONLY);
+    if(File >= 0)
+    {
+        struct stat Stat;
+        if((fstat(File, &Stat) == 0) && (Stat.st_size > 0))
+        {
+            void *Data = mmap(nullptr, Stat.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+            if(Data != MAP_FAILED)
+            {
+                Mapped->Data = Data;
+                Mapped->Size = (u64)Stat.st_size;
+                Result = true;
+            }
+        }
+
+        // NOTE: The mapping stays valid after the descriptor is closed.
+        close(File);
+    }
+#endif
+
+    return Result;
+}
+
+void
+UnmapFile(mapped_file *Mapped)
+{
+    if(Mapped->Data)
+    {
+#if defined(_WIN32)
+        UnmapViewOfFile(Mapped->Data);
+        CloseHandle(Mapped->Mapping);
+        CloseHandle(Mapped->File);
+#else
+        munmap((void *)Mapped->Data, Mapped->Size);
+#endif
+    }
+
+    *Mapped = {};
+}
+
 #define FILE_H
 #endif
\ No newline at end of file
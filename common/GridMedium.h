@@ -0,0 +1,434 @@
+#if !defined(GRID_MEDIUM_H)
+
+#include "defines.h"
+
+#include "Hittable.h"
+#include "ConstantMedium.h"
+#include "Phase.h"
+#include "Vec.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// NOTE: Voxel densities are kept in bricks of DENSITY_BRICK_SIZE^3. A brick
+// that has the same value all over (the empty space around smoke, mostly) is
+// just that value, the others are 8 bits a voxel between the brick's own min
+// and max. A mostly empty 512^3 grid takes a few MB instead of 512 MB of
+// floats.
+#define DENSITY_BRICK_LOG2 3
+#define DENSITY_BRICK_SIZE (1 << DENSITY_BRICK_LOG2)
+#define DENSITY_BRICK_VOXELS (DENSITY_BRICK_SIZE*DENSITY_BRICK_SIZE*DENSITY_BRICK_SIZE)
+#define DENSITY_BRICK_UNIFORM 0xFFFFFFFFu
+
+class density_grid
+{
+  public:
+    // NOTE: Voxel(X, Y, Z) gives the density of every voxel, called one brick
+    // at a time, so the dense grid never has to be in memory at once.
+    template <typename F>
+    density_grid(i32 NX, i32 NY, i32 NZ, F Voxel)
+        : nx(NX), ny(NY), nz(NZ),
+          bx((NX + DENSITY_BRICK_SIZE - 1) >> DENSITY_BRICK_LOG2),
+          by((NY + DENSITY_BRICK_SIZE - 1) >> DENSITY_BRICK_LOG2),
+          bz((NZ + DENSITY_BRICK_SIZE - 1) >> DENSITY_BRICK_LOG2)
+    {
+        bricks.resize((size_t)bx*by*bz);
+        f32 Values[DENSITY_BRICK_VOXELS];
+        for(i32 BZ = 0; BZ < bz; ++BZ)
+        {
+            for(i32 BY = 0; BY < by; ++BY)
+            {
+                for(i32 BX = 0; BX < bx; ++BX)
+                {
+                    f32 Min = Infinity, Max = -Infinity;
+                    for(i32 Index = 0; Index < DENSITY_BRICK_VOXELS; ++Index)
+                    {
+                        i32 X = (BX << DENSITY_BRICK_LOG2) + (Index & (DENSITY_BRICK_SIZE - 1));
+                        i32 Y = (BY << DENSITY_BRICK_LOG2) + ((Index >> DENSITY_BRICK_LOG2) & (DENSITY_BRICK_SIZE - 1));
+                        i32 Z = (BZ << DENSITY_BRICK_LOG2) + (Index >> (2*DENSITY_BRICK_LOG2));
+                        b32 Inside = (X < nx) && (Y < ny) && (Z < nz);
+                        // NOTE: Densities are never negative, the tracking
+                        // takes them as probabilities against the majorant.
+                        f32 Value = Inside ? (f32)Voxel(X, Y, Z) : 0.0f;
+                        Value = (Value > 0.0f) ? Value : 0.0f;
+                        Values[Index] = Value;
+                        Min = (Value < Min) ? Value : Min;
+                        Max = (Value > Max) ? Value : Max;
+                    }
+
+                    brick &Brick = bricks[BrickIndex(BX, BY, BZ)];
+                    Brick.Min = Min;
+                    Brick.Max = Max;
+                    Brick.Scale = (Max - Min) / 255.0f;
+                    Brick.Offset = DENSITY_BRICK_UNIFORM;
+                    if(Max > Min)
+                    {
+                        Brick.Offset = (u32)voxels.size();
+                        voxels.resize(voxels.size() + DENSITY_BRICK_VOXELS);
+                        for(i32 Index = 0; Index < DENSITY_BRICK_VOXELS; ++Index)
+                        {
+                            f32 Quantized = (Values[Index] - Min) / Brick.Scale + 0.5f;
+                            voxels[Brick.Offset + Index] = (u8)((Quantized < 255.0f) ? Quantized : 255.0f);
+                        }
+                    }
+                }
+            }
+        }
+
+        // NOTE: The majorant of a brick is the largest density a lookup
+        // anywhere in it can come back with. Trilinear lookups near the edges
+        // reach into the neighbouring bricks, so it's the max over those too.
+        majorants.resize(bricks.size());
+        for(i32 BZ = 0; BZ < bz; ++BZ)
+        {
+            for(i32 BY = 0; BY < by; ++BY)
+            {
+                for(i32 BX = 0; BX < bx; ++BX)
+                {
+                    f32 Max = 0.0f;
+                    for(i32 DZ = -1; DZ <= 1; ++DZ)
+                    {
+                        for(i32 DY = -1; DY <= 1; ++DY)
+                        {
+                            for(i32 DX = -1; DX <= 1; ++DX)
+                            {
+                                i32 X = BX + DX, Y = BY + DY, Z = BZ + DZ;
+                                if((X >= 0) && (X < bx) && (Y >= 0) && (Y < by) &&
+                                   (Z >= 0) && (Z < bz))
+                                {
+                                    f32 Neighbour = bricks[BrickIndex(X, Y, Z)].Max;
+                                    Max = (Neighbour > Max) ? Neighbour : Max;
+                                }
+                            }
+                        }
+                    }
+                    majorants[BrickIndex(BX, BY, BZ)] = Max;
+                }
+            }
+        }
+    }
+
+    // NOTE: Density at the voxel, 0 outside of the grid.
+    f32
+    Voxel(i32 X, i32 Y, i32 Z) const
+    {
+        f32 Result = 0.0f;
+        if(((u32)X < (u32)nx) && ((u32)Y < (u32)ny) && ((u32)Z < (u32)nz))
+        {
+            const brick &Brick = bricks[BrickIndex(X >> DENSITY_BRICK_LOG2,
+                                                   Y >> DENSITY_BRICK_LOG2,
+                                                   Z >> DENSITY_BRICK_LOG2)];
+            Result = Brick.Min;
+            if(Brick.Offset != DENSITY_BRICK_UNIFORM)
+            {
+                i32 Local = (X & (DENSITY_BRICK_SIZE - 1)) |
+                            ((Y & (DENSITY_BRICK_SIZE - 1)) << DENSITY_BRICK_LOG2) |
+                            ((Z & (DENSITY_BRICK_SIZE - 1)) << (2*DENSITY_BRICK_LOG2));
+                Result += Brick.Scale*voxels[Brick.Offset + Local];
+            }
+        }
+
+        return Result;
+    }
+
+    // NOTE: Trilinear between voxel centers, P in voxels from the grid's
+    // corner.
+    real
+    Density(const vec3r &P) const
+    {
+        real X = P.x - 0.5, Y = P.y - 0.5, Z = P.z - 0.5;
+        real FloorX = floor(X), FloorY = floor(Y), FloorZ = floor(Z);
+        real U = X - FloorX, V = Y - FloorY, W = Z - FloorZ;
+        i32 X0 = (i32)FloorX, Y0 = (i32)FloorY, Z0 = (i32)FloorZ;
+
+        real C00 = Voxel(X0, Y0, Z0) + U*(Voxel(X0 + 1, Y0, Z0) - Voxel(X0, Y0, Z0));
+        real C10 = Voxel(X0, Y0 + 1, Z0) + U*(Voxel(X0 + 1, Y0 + 1, Z0) - Voxel(X0, Y0 + 1, Z0));
+        real C01 = Voxel(X0, Y0, Z0 + 1) + U*(Voxel(X0 + 1, Y0, Z0 + 1) - Voxel(X0, Y0, Z0 + 1));
+        real C11 = Voxel(X0, Y0 + 1, Z0 + 1) + U*(Voxel(X0 + 1, Y0 + 1, Z0 + 1) - Voxel(X0, Y0 + 1, Z0 + 1));
+        real C0 = C00 + V*(C10 - C00);
+        real C1 = C01 + V*(C11 - C01);
+
+        real Result = C0 + W*(C1 - C0);
+        return Result;
+    }
+
+    f32 Majorant(i32 BX, i32 BY, i32 BZ) const { return majorants[BrickIndex(BX, BY, BZ)]; }
+
+    i32 Width() const { return nx; }
+    i32 Height() const { return ny; }
+    i32 Depth() const { return nz; }
+    i32 BricksX() const { return bx; }
+    i32 BricksY() const { return by; }
+    i32 BricksZ() const { return bz; }
+
+    u64
+    Bytes() const
+    {
+        u64 Result = bricks.size()*sizeof(brick) + majorants.size()*sizeof(f32) + voxels.size();
+        return Result;
+    }
+
+  private:
+    struct brick
+    {
+        f32 Min;
+        f32 Max;
+        f32 Scale;
+        u32 Offset; // Into voxels, DENSITY_BRICK_UNIFORM if it's all Min.
+    };
+
+    size_t BrickIndex(i32 X, i32 Y, i32 Z) const { return ((size_t)Z*by + Y)*bx + X; }
+
+    std::vector<brick> bricks;
+    std::vector<f32> majorants;
+    std::vector<u8> voxels;
+    i32 nx, ny, nz;
+    i32 bx, by, bz;
+};
+
+// NOTE: A heterogeneous medium in a box, the densities coming out of a
+// density_grid stretched over it. Free flights are sampled with delta
+// (Woodcock) tracking: tentative collisions are drawn against a majorant and
+// kept with probability density/majorant, the rest are null collisions which
+// the path carries on through. The majorant is the one of the brick the ray
+// is in, so the tracking walks the bricks with a DDA, takes long steps where
+// the smoke is thin and skips empty bricks without sampling anything.
+//
+// Transmittance() gives how much light makes it along a segment, by ratio
+// tracking: the same walk, but every tentative collision scales the estimate
+// by 1 - density/majorant instead of ending it. That is much less noisy than
+// checking whether a delta tracked flight made it through, which is all 0s
+// and 1s.
+class grid_medium : public hittable
+{
+  public:
+    grid_medium(std::shared_ptr<density_grid> Grid, const vec3r &Min, const vec3r &Max,
+                real DensityScale, texture *TexPtr)
+        : grid(Grid), bounds(Min, Max), densityScale(DensityScale),
+          ownedPhase(std::make_unique<isotropic>(TexPtr)), phase_function(ownedPhase.get())
+    {
+        SetupGridSpace();
+    }
+
+    grid_medium(std::shared_ptr<density_grid> Grid, const vec3r &Min, const vec3r &Max,
+                real DensityScale, color Color)
+        : grid(Grid), bounds(Min, Max), densityScale(DensityScale),
+          ownedPhase(std::make_unique<isotropic>(Color)), phase_function(ownedPhase.get())
+    {
+        SetupGridSpace();
+    }
+
+    grid_medium(std::shared_ptr<density_grid> Grid, const vec3r &Min, const vec3r &Max,
+                real DensityScale, material *Phase)
+        : grid(Grid), bounds(Min, Max), densityScale(DensityScale), phase_function(Phase)
+    {
+        SetupGridSpace();
+    }
+
+    virtual b32
+    Hit(const ray &Ray, const interval &Interval, hit_record &Record) const override
+    {
+        b32 Result = false;
+        real DirectionLength = Ray.Direction().Magnitude();
+        real HitT = 0;
+
+        Traverse(Ray, Interval.Min, Interval.Max,
+                 [&](const vec3r &GridOrigin, const vec3r &GridDirection,
+                     real T0, real T1, real Majorant)
+                 {
+                     // NOTE: Distances are in ray parameter units, the
+                     // densities are per unit of world distance.
+                     real Sigma = Majorant*DirectionLength;
+                     real T = T0;
+                     for(;;)
+                     {
+                         T -= (real)log(1.0 - Rand01()) / Sigma;
+                         if(T >= T1)
+                         {
+                             return true;
+                         }
+
+                         real Density = densityScale*grid->Density(GridOrigin + T*GridDirection);
+                         if(Rand01()*Majorant < Density)
+                         {
+                             HitT = T;
+                             Result = true;
+                             return false;
+                         }
+                     }
+                 });
+
+        if(Result)
+        {
+            Record.t = HitT;
+            Record.P = Ray.At(HitT);
+            Record.Normal = Vec3r(1, 0, 0); // arbitrary
+            Record.FrontFace = true;        // also arbitrary
+            Record.Material = phase_function;
+            Record.Object = this;
+            Record.U = 0;
+            Record.V = 0;
+            Record.Error = 0;
+            Record.UVPerUnit = 0;
+            Record.Curvature = 0;
+            Record.Medium = nullptr;
+        }
+
+        return Result;
+    }
+
+    // NOTE: Ratio tracked transmittance along Ray between TMin and TMax.
+    real
+    Transmittance(const ray &Ray, real TMin, real TMax) const
+    {
+        real Result = 1;
+        real DirectionLength = Ray.Direction().Magnitude();
+
+        Traverse(Ray, TMin, TMax,
+                 [&](const vec3r &GridOrigin, const vec3r &GridDirection,
+                     real T0, real T1, real Majorant)
+                 {
+                     real Sigma = Majorant*DirectionLength;
+                     real T = T0;
+                     for(;;)
+                     {
+                         T -= (real)log(1.0 - Rand01()) / Sigma;
+                         if(T >= T1)
+                         {
+                             return true;
+                         }
+
+                         real Density = densityScale*grid->Density(GridOrigin + T*GridDirection);
+                         Result *= 1 - (Density / Majorant);
+
+                         // NOTE: Russian roulette once there's little left,
+                         // so thick smoke doesn't cost a collision for every
+                         // majorant step through all of it.
+                         if(Result < 0.1)
+                         {
+                             if(Rand01() < 0.5)
+                             {
+                                 Result = 0;
+                                 return false;
+                             }
+                             Result *= 2;
+                         }
+                     }
+                 });
+
+        return Result;
+    }
+
+    virtual b32
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
+    {
+        OutputBox = bounds;
+        return true;
+    }
+
+  public:
+    std::shared_ptr<density_grid> grid;
+    aabb bounds;
+    real densityScale;
+    // NOTE: Same as for constant_density_medium, set when there's no Phase.
+    std::unique_ptr<isotropic> ownedPhase;
+    material *phase_function;
+
+  private:
+    vec3r voxelsPerUnit;
+
+    void
+    SetupGridSpace()
+    {
+        vec3r Size = bounds.Max() - bounds.Min();
+        voxelsPerUnit = Vec3r(grid->Width() / Size.x, grid->Height() / Size.y,
+                              grid->Depth() / Size.z);
+    }
+
+    // NOTE: Walks the bricks Ray passes through between TMin and TMax, front
+    // to back, calling Segment(GridOrigin, GridDirection, T0, T1, Majorant)
+    // for the part of the ray inside of each brick that has anything in it.
+    // GridOrigin + t*GridDirection is the ray in voxels. Segment returns false
+    // to stop the walk.
+    template <typename F>
+    void
+    Traverse(const ray &Ray, real TMin, real TMax, F Segment) const
+    {
+        if(!bounds.Clip(Ray, TMin, TMax))
+        {
+            return;
+        }
+
+        vec3r GridOrigin = (Ray.Origin() - bounds.Min())*voxelsPerUnit;
+        vec3r GridDirection = Ray.Direction()*voxelsPerUnit;
+
+        // NOTE: Brick DDA (Amanatides and Woo), starting from the brick the
+        // clipped ray enters in.
+        i32 BrickCount[3] = {grid->BricksX(), grid->BricksY(), grid->BricksZ()};
+        vec3r Entry = GridOrigin + TMin*GridDirection;
+        i32 Brick[3], Step[3];
+        real NextT[3], DeltaT[3];
+        for(i32 Axis = 0; Axis < 3; ++Axis)
+        {
+            real BrickDirection = GridDirection[Axis] / DENSITY_BRICK_SIZE;
+            real Position = Entry[Axis] / DENSITY_BRICK_SIZE;
+            i32 Cell = (i32)floor(Position);
+            Cell = (Cell < 0) ? 0 : Cell;
+            Cell = (Cell >= BrickCount[Axis]) ? (BrickCount[Axis] - 1) : Cell;
+            Brick[Axis] = Cell;
+
+            if(BrickDirection > 0)
+            {
+                Step[Axis] = 1;
+                NextT[Axis] = TMin + ((Cell + 1) - Position) / BrickDirection;
+                DeltaT[Axis] = 1 / BrickDirection;
+            }
+            else if(BrickDirection < 0)
+            {
+                Step[Axis] = -1;
+                NextT[Axis] = TMin + (Cell - Position) / BrickDirection;
+                DeltaT[Axis] = -1 / BrickDirection;
+            }
+            else
+            {
+                Step[Axis] = 0;
+                NextT[Axis] = Infinity;
+                DeltaT[Axis] = Infinity;
+            }
+        }
+
+        real T0 = TMin;
+        for(;;)
+        {
+            i32 Axis = (NextT[0] < NextT[1]) ? ((NextT[0] < NextT[2]) ? 0 : 2)
+                                             : ((NextT[1] < NextT[2]) ? 1 : 2);
+            real T1 = (NextT[Axis] < TMax) ? NextT[Axis] : TMax;
+
+            real Majorant = densityScale*grid->Majorant(Brick[0], Brick[1], Brick[2]);
+            if((Majorant > 0) && (T1 > T0))
+            {
+                if(!Segment(GridOrigin, GridDirection, T0, T1, Majorant))
+                {
+                    break;
+                }
+            }
+
+            if(T1 >= TMax)
+            {
+                break;
+            }
+
+            T0 = T1;
+            Brick[Axis] += Step[Axis];
+            if((Brick[Axis] < 0) || (Brick[Axis] >= BrickCount[Axis]))
+            {
+                break;
+            }
+            NextT[Axis] += DeltaT[Axis];
+        }
+    }
+};
+
+#define GRID_MEDIUM_H
+#endif
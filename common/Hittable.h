@@ -4,22 +4,62 @@
 #include "Interval.h"
 #include "AABB.h"
 
+#include <vector>
+
 struct material;
+class medium;
+class hittable;
+
+// NOTE: A primitive that might be a light, as handed out by
+// hittable::GatherEmitters. Whether it actually emits anything is up to its
+// material, the light tree (see Lights.h) checks that.
+struct emitter
+{
+    const hittable *Shape;
+    const material *Material;
+    vec3r Center;
+    real Area;
+};
 
 class hit_record
 {
   public:
     // Intersection point on the surface where the ray hit
-    vec3d P;
-    vec3d Normal;
-    std::shared_ptr<material> Material; // The material of the hit object.
-    f64 t; // the t in ray's eq: A + tB
-    f64 U, V; // U and V surface coordinates of the ray-object hit point.
+    vec3r P;
+    vec3r Normal;
+    // NOTE: The material of the hit object. A plain pointer since hit
+    // records get copied around for every candidate hit, the object that was
+    // hit keeps the material alive.
+    const material *Material;
+    real t; // the t in ray's eq: A + tB
+    real U, V; // U and V surface coordinates of the ray-object hit point.
+    // NOTE: How far P can be from the real surface, per axis, on top of the
+    // rounding of P itself. Rays leaving from P start at least this far off
+    // the surface (see OffsetRayOrigin). Every hittable that makes a hit
+    // record sets it.
+    real Error = 0;
+    // NOTE: How far U and V move per unit of distance along the surface at
+    // P, the larger of the two. Every hittable that makes a hit record sets
+    // it, 0 if it has no UVs. The camera turns it and the width of the ray
+    // into Footprint, the width of the texture lookups at P in UV units.
+    real UVPerUnit = 0;
+    real Footprint = 0;
+    // NOTE: How fast Normal turns as P moves along the surface, dN = k*dP,
+    // for bending ray differentials. 1/radius on spheres (negative seen from
+    // the inside), 0 on flat surfaces. Every hittable sets it.
+    real Curvature = 0;
+    // NOTE: The medium on the inside of the surface, if it is the boundary
+    // of one (see medium_boundary), otherwise null. Every hittable sets it.
+    const medium *Medium = nullptr;
+    // NOTE: What was hit, for the object ID output (see AOV.h). Every
+    // primitive sets it to itself, boxes and instances to themselves on the
+    // way back out, so a whole box or instance is one object.
+    const hittable *Object = nullptr;
     b32 FrontFace;
 
     // NOTE: Sets the hit record normal vector
     // The OutwardNormal is assumed to be of unit length
-    void SetFaceNormal(const ray &Ray, const vec3d &OutwardNormal)
+    void SetFaceNormal(const ray &Ray, const vec3r &OutwardNormal)
     {
         // if the ray direction and the outward pointing normal passed in are
         // opposing vectors, then that means the ray is coming from outside the
@@ -30,13 +70,61 @@ class hit_record
     }
 };
 
+// NOTE: Where the differential rays of Ray cross the tangent plane at the
+// hit. False if Ray has no differentials or they run parallel to the plane.
+inline b32
+HitDifferentials(const ray &Ray, const hit_record &Record, vec3r &Px, vec3r &Py)
+{
+    b32 Result = false;
+    if(Ray.HasDifferentials)
+    {
+        real DenomX = Dot(Record.Normal, Ray.RxDirection);
+        real DenomY = Dot(Record.Normal, Ray.RyDirection);
+        if((DenomX != 0) && (DenomY != 0))
+        {
+            real PlaneD = Dot(Record.Normal, Record.P);
+            real tx = (PlaneD - Dot(Record.Normal, Ray.RxOrigin)) / DenomX;
+            real ty = (PlaneD - Dot(Record.Normal, Ray.RyOrigin)) / DenomY;
+            Px = Ray.RxOrigin + tx*Ray.RxDirection;
+            Py = Ray.RyOrigin + ty*Ray.RyDirection;
+            Result = true;
+        }
+    }
+
+    return Result;
+}
+
 class hittable
 {
   public:
     virtual ~hittable() = default;
     virtual b32 Hit(const ray &Ray, const interval &Interval,
                     hit_record &Record) const = 0;
-    virtual b32 BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const = 0;
+    virtual b32 BoundingBox(real Time0, real Time1, aabb &OutputBox) const = 0;
+
+    // NOTE: Sampling directions towards the hittable from Origin, for the
+    // ones that can be lights. Random() picks a direction that hits it,
+    // PdfValue() is the density, per unit solid angle, of picking Direction
+    // that way, 0 for directions that miss it.
+    virtual real
+    PdfValue(const vec3r &Origin, const vec3r &Direction) const
+    {
+        return 0;
+    }
+
+    virtual vec3r
+    Random(const vec3r &Origin, const vec2d &Sample) const
+    {
+        return Vec3r(1, 0, 0);
+    }
+
+    // NOTE: Adds the primitives that implement the two above, lists and
+    // BVHs pass it on to their members. Anything inside of a transform is
+    // left out, it would have to sample in the transform's space.
+    virtual void
+    GatherEmitters(std::vector<emitter> &Emitters) const
+    {
+    }
 };
 
 #define HITTABLE_H
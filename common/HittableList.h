@@ -2,6 +2,7 @@
 #include "defines.h"
 #include "Hittable.h"
 #include "AABB.h"
+#include "Arena.h"
 
 #include <memory>
 #include <vector>
@@ -9,14 +10,20 @@
 class hittable_list : public hittable
 {
   public:
-    std::vector<std::shared_ptr<hittable>> Objects;
+    // NOTE: The list doesn't own its objects. They belong to Arena, or to
+    // whoever made them, and have to outlive the list.
+    std::vector<hittable *> Objects;
+
+    // NOTE: The arena the objects were allocated from, if they were. Copies
+    // of the list share it, so it lives for as long as any of them do.
+    std::shared_ptr<scene_arena> Arena;
 
     hittable_list() {}
-    hittable_list(std::shared_ptr<hittable> Object) { Add(Object); }
+    hittable_list(hittable *Object) { Add(Object); }
 
     void Clear() { Objects.clear(); }
 
-    void Add(std::shared_ptr<hittable> Object)
+    void Add(hittable *Object)
     {
         Objects.push_back(Object);
     }
@@ -26,7 +33,7 @@ class hittable_list : public hittable
     {
         hit_record TempRecord;
         b32 HitAnything = false;
-        f64 ClosestSoFar = Interval.Max;
+        real ClosestSoFar = Interval.Max;
         i32 Count = 0;
 
         for(const auto &Object : Objects)
@@ -52,8 +59,17 @@ class hittable_list : public hittable
         return HitAnything;
     }
 
+    void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        for(const auto &Object : Objects)
+        {
+            Object->GatherEmitters(Emitters);
+        }
+    }
+
     b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
         b32 Result = true;
         if(Objects.empty())
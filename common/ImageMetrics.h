@@ -0,0 +1,117 @@
+#if !defined(IMAGE_METRICS_H)
+
+#include "defines.h"
+
+#include <cmath>
+#include <vector>
+
+// NOTE: How far an image is from a reference, both linear RGB floats with the
+// same size and layout.
+//
+// RMSE is the plain per pixel error. It can't tell noise that looks like grain
+// apart from noise that looks like blotches, but the eye can, since at normal
+// viewing distances it blurs away the high frequencies. FilteredRMSE is the
+// perceptual one: both images get blurred with a Gaussian about a pixel wide,
+// roughly what the optics of the eye do to the light coming off the screen,
+// then go through the display transform the PPM output uses (gamma 2,
+// clamped), and the difference of what is left gets measured. Blue noise
+// errors mostly cancel out in the blur, white noise errors don't.
+//
+// RelMSE is every squared error over the squared reference value, plus 0.01 so
+// black pixels don't blow it up. Bright parts and dark parts count the same,
+// so a scene with a light in view isn't all about the light.
+struct image_error
+{
+    f64 RMSE;
+    f64 FilteredRMSE;
+    f64 RelMSE;
+};
+
+inline f64
+DisplayValue(f64 Linear)
+{
+    f64 Result = sqrt((Linear > 0.0) ? Linear : 0.0);
+    Result = (Result < 1.0) ? Result : 1.0;
+    return Result;
+}
+
+// NOTE: Separable Gaussian, out to three sigma. The edges are clamped.
+std::vector<f64>
+GaussianBlur(const f32 *Image, i32 Width, i32 Height, f64 Sigma)
+{
+    i32 Radius = (i32)ceil(3.0*Sigma);
+    std::vector<f64> Weights(2*Radius + 1);
+    f64 WeightSum = 0.0;
+    for(i32 Offset = -Radius; Offset <= Radius; ++Offset)
+    {
+        Weights[Offset + Radius] = exp(-(Offset*Offset) / (2.0*Sigma*Sigma));
+        WeightSum += Weights[Offset + Radius];
+    }
+    for(f64 &Weight : Weights)
+    {
+        Weight /= WeightSum;
+    }
+
+    u64 ValueCount = (u64)Width*Height*3;
+    std::vector<f64> Result(Image, Image + ValueCount);
+    std::vector<f64> Temp(ValueCount);
+    for(i32 Pass = 0; Pass < 2; ++Pass)
+    {
+        for(i32 Y = 0; Y < Height; ++Y)
+        {
+            for(i32 X = 0; X < Width; ++X)
+            {
+                for(i32 Channel = 0; Channel < 3; ++Channel)
+                {
+                    f64 Sum = 0.0;
+                    for(i32 Offset = -Radius; Offset <= Radius; ++Offset)
+                    {
+                        i32 SX = (Pass == 0) ? (X + Offset) : X;
+                        i32 SY = (Pass == 0) ? Y : (Y + Offset);
+                        SX = (SX < 0) ? 0 : ((SX >= Width) ? (Width - 1) : SX);
+                        SY = (SY < 0) ? 0 : ((SY >= Height) ? (Height - 1) : SY);
+                        Sum += Weights[Offset + Radius]*Result[((u64)SY*Width + SX)*3 + Channel];
+                    }
+                    Temp[((u64)Y*Width + X)*3 + Channel] = Sum;
+                }
+            }
+        }
+        Result.swap(Temp);
+    }
+
+    return Result;
+}
+
+image_error
+CompareImages(const f32 *Image, const f32 *Reference, i32 Width, i32 Height,
+              f64 Sigma = 1.0)
+{
+    image_error Result = {};
+    u64 ValueCount = (u64)Width*Height*3;
+
+    f64 SquaredSum = 0.0;
+    f64 RelativeSum = 0.0;
+    for(u64 Index = 0; Index < ValueCount; ++Index)
+    {
+        f64 Error = (f64)Image[Index] - (f64)Reference[Index];
+        SquaredSum += Error*Error;
+        RelativeSum += Error*Error / ((f64)Reference[Index]*Reference[Index] + 0.01);
+    }
+    Result.RMSE = sqrt(SquaredSum / (f64)ValueCount);
+    Result.RelMSE = RelativeSum / (f64)ValueCount;
+
+    std::vector<f64> BlurredImage = GaussianBlur(Image, Width, Height, Sigma);
+    std::vector<f64> BlurredReference = GaussianBlur(Reference, Width, Height, Sigma);
+    SquaredSum = 0.0;
+    for(u64 Index = 0; Index < ValueCount; ++Index)
+    {
+        f64 Error = DisplayValue(BlurredImage[Index]) - DisplayValue(BlurredReference[Index]);
+        SquaredSum += Error*Error;
+    }
+    Result.FilteredRMSE = sqrt(SquaredSum / (f64)ValueCount);
+
+    return Result;
+}
+
+#define IMAGE_METRICS_H
+#endif
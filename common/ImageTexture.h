@@ -2,21 +2,27 @@
 
 #include "defines.h"
 #include "Texture.h"
-#include "rt_stbimage.h"
+#include "TextureCache.h"
 #include "Color.h"
 #include "Interval.h"
 
+#include <string>
+
+// NOTE: The image itself lives in the texture cache (see TextureCache.h),
+// which only keeps the tiles that get looked at and picks the mip level from
+// the footprint.
 class image_texture : public texture
 {
   public:
-    image_texture(const char *Filename) : image(Filename) {}
+    image_texture(const char *Filename)
+        : filename(Filename), handle(texture_cache::Get().Open(Filename)) {}
 
     color
-    Value(f64 U, f64 V, const vec3d &P) const override
+    Value(real U, real V, const vec3r &P, real Footprint) const override
     {
         color Result;
 
-        if(image.Height() <= 0)
+        if(handle == TEXTURE_CACHE_NONE)
         {
             // NOTE: If we have no image then return cyan as a debugging aid.
             Result = Color(0, 1, 1);
@@ -27,24 +33,18 @@ class image_texture : public texture
             // NOTE: Flip V to image coordinates.
             V = 1.0 - interval(0, 1).Clamp(V);
 
-            i32 I = (i32)(U*image.Width());
-            i32 J = (i32)(V*image.Height());
-
-            const u8 *Pixel = image.PixelData(I, J);
-
-            f64 ColorScale = 1.0 / 255.;
-
-            Result = Color(Pixel[0]*ColorScale,
-                           Pixel[1]*ColorScale,
-                           Pixel[2]*ColorScale);
+            Result = texture_cache::Get().Sample(handle, U, V, Footprint);
         }
 
         return Result;
     }
 
   private:
-    rt_image image;
+    friend class scene_cache;
+
+    std::string filename;
+    u32 handle;
 };
 
 #define IMAGE_TEXTURE_H
-#endif
\ No newline at end of file
+#endif
@@ -4,25 +4,25 @@
 class interval
 {
   public:
-    f64 Min, Max;
+    real Min, Max;
     interval() : Min(-Infinity), Max(+Infinity){}
-    interval(f64 _Min, f64 _Max) : Min(_Min), Max(_Max) {}
+    interval(real _Min, real _Max) : Min(_Min), Max(_Max) {}
 
-    b32 Contains(f64 X) const
+    b32 Contains(real X) const
     {
         b32 Result = ((X >= Min) && (X <= Max));
         return Result;
     }
 
-    b32 Surrounds(f64 X) const
+    b32 Surrounds(real X) const
     {
         b32 Result = ((X > Min) && (X < Max));
         return Result;
     }
 
-    f64 Clamp(f64 X) const
+    real Clamp(real X) const
     {
-        f64 Result = X;
+        real Result = X;
         if(X < Min)
         {
             Result = Min;
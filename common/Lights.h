@@ -0,0 +1,254 @@
+#if !defined(LIGHTS_H)
+
+#include "defines.h"
+#include "AABB.h"
+#include "Hittable.h"
+#include "Material.h"
+#include "Vec.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+// NOTE: Picks which light to sample from a point, out of any number of them.
+// A uniform pick among thousands of lights almost always lands on one that is
+// far away or behind the point, so the lights go into a binary tree over their
+// bounds and power instead, and the pick walks down it: at every node, one
+// child or the other with the odds of how much each could light the point.
+// That bound is the power of the lights under the child, over the squared
+// distance to its box (no closer than its radius, so a point inside doesn't
+// blow up), times the largest cosine to the normal over the box for materials
+// that only scatter to one side. Every light here emits on both sides, so
+// there is no cone of emitted directions to bound on the light's end.
+//
+// Picking is O(log n) and so is PDF(): the pdf of a direction is the sum over
+// the lights it hits, of the odds of picking each times the density of its
+// own sampling, and the walk to find those lights only goes down the nodes
+// whose box the direction goes through, collecting the odds on the way.
+struct light_tree_node
+{
+    aabb Bounds;
+    real Power;
+    // Interior nodes: the second child, the first one is right after the
+    // node. Leaves: -1 - the index of the light.
+    i32 Child;
+};
+
+class light_tree
+{
+  public:
+    // NOTE: Every emitting primitive World has (see GatherEmitters), bounded
+    // over the shutter Time0..Time1 so moving lights are covered all the way.
+    light_tree(const hittable &World, real Time0, real Time1)
+    {
+        std::vector<emitter> Candidates;
+        World.GatherEmitters(Candidates);
+        for(const emitter &Candidate : Candidates)
+        {
+            color Emitted = Candidate.Material->Emitted(0.5, 0.5, Candidate.Center);
+            f64 Luminance = 0.2126*Emitted.r + 0.7152*Emitted.g + 0.0722*Emitted.b;
+            aabb Bounds;
+            if((Luminance > 0) && Candidate.Shape->BoundingBox(Time0, Time1, Bounds))
+            {
+                lights.push_back(Candidate.Shape);
+                bounds.push_back(Bounds);
+                power.push_back((real)(Luminance*Candidate.Area));
+            }
+        }
+
+        if(!lights.empty())
+        {
+            std::vector<i32> Order(lights.size());
+            for(i32 Index = 0; Index < (i32)Order.size(); ++Index) { Order[Index] = Index; }
+            nodes.reserve(2*lights.size() - 1);
+            Build(Order, 0, (i32)Order.size());
+        }
+    }
+
+    b32 Empty() const { return lights.empty(); }
+    i32 LightCount() const { return (i32)lights.size(); }
+
+    // NOTE: A direction from P towards one of the lights. Normal is the
+    // surface's if its material is Hemispherical(), zero otherwise. Select
+    // picks the light, Sample the point on it.
+    vec3r
+    Sample(const vec3r &P, const vec3r &Normal, f64 Select, const vec2d &Sample) const
+    {
+        i32 Index = 0;
+        f64 U = Select;
+        while(nodes[Index].Child >= 0)
+        {
+            f64 First = FirstChildProbability(Index, P, Normal);
+            if(U < First)
+            {
+                U = U / First;
+                Index = Index + 1;
+            }
+            else
+            {
+                U = (U - First) / (1.0 - First);
+                Index = nodes[Index].Child;
+            }
+            U = (U < 1.0) ? U : OneMinusEpsilon;
+        }
+
+        vec3r Result = lights[-1 - nodes[Index].Child]->Random(P, Sample);
+        return Result;
+    }
+
+    // NOTE: Density of Sample() picking Direction from P, per unit solid angle.
+    real
+    PDF(const vec3r &P, const vec3r &Normal, const vec3r &Direction) const
+    {
+        struct entry
+        {
+            i32 Index;
+            f64 Probability;
+        };
+
+        // NOTE: The tree is split at the median, it is never deeper than 32
+        // for any number of lights an i32 can count.
+        entry Stack[64];
+        i32 Count = 0;
+        Stack[Count++] = {0, 1.0};
+
+        f64 Result = 0;
+        ray Ray(P, Direction, 0);
+        while(Count > 0)
+        {
+            entry Entry = Stack[--Count];
+            const light_tree_node &Node = nodes[Entry.Index];
+            if(!Node.Bounds.Hit(Ray, 0, Infinity))
+            {
+                continue;
+            }
+
+            if(Node.Child < 0)
+            {
+                Result += Entry.Probability*lights[-1 - Node.Child]->PdfValue(P, Direction);
+            }
+            else
+            {
+                f64 First = FirstChildProbability(Entry.Index, P, Normal);
+                if(First > 0)
+                {
+                    Stack[Count++] = {Entry.Index + 1, Entry.Probability*First};
+                }
+                if(First < 1)
+                {
+                    Stack[Count++] = {Node.Child, Entry.Probability*(1.0 - First)};
+                }
+            }
+        }
+
+        return (real)Result;
+    }
+
+  private:
+    std::vector<const hittable *> lights;
+    std::vector<aabb> bounds;
+    std::vector<real> power;
+    std::vector<light_tree_node> nodes;
+
+    static constexpr f64 OneMinusEpsilon = 1.0 - DBL_EPSILON / 2;
+
+    // NOTE: Median split along the longest axis of the centers.
+    i32
+    Build(std::vector<i32> &Order, i32 Start, i32 End)
+    {
+        i32 Result = (i32)nodes.size();
+        nodes.push_back({});
+
+        aabb Bounds = bounds[Order[Start]];
+        aabb Centers = aabb(Center(Bounds), Center(Bounds));
+        real Power = 0;
+        for(i32 Index = Start; Index < End; ++Index)
+        {
+            Bounds = aabb::SurroundingBox(Bounds, bounds[Order[Index]]);
+            vec3r C = Center(bounds[Order[Index]]);
+            Centers = aabb::SurroundingBox(Centers, aabb(C, C));
+            Power += power[Order[Index]];
+        }
+
+        i32 Child = -1 - Order[Start];
+        if((End - Start) > 1)
+        {
+            vec3r Extent = Centers.Max() - Centers.Min();
+            i32 Axis = (Extent.x > Extent.y) ? ((Extent.x > Extent.z) ? 0 : 2)
+                                             : ((Extent.y > Extent.z) ? 1 : 2);
+            i32 Mid = Start + (End - Start) / 2;
+            std::nth_element(Order.begin() + Start, Order.begin() + Mid, Order.begin() + End,
+                             [&](i32 A, i32 B)
+                             {
+                                 return Center(bounds[A])[Axis] < Center(bounds[B])[Axis];
+                             });
+
+            Build(Order, Start, Mid);
+            Child = Build(Order, Mid, End);
+        }
+
+        nodes[Result] = {Bounds, Power, Child};
+        return Result;
+    }
+
+    static vec3r
+    Center(const aabb &Box)
+    {
+        vec3r Result = 0.5*(Box.Min() + Box.Max());
+        return Result;
+    }
+
+    // NOTE: How much the lights under Node could light up P, see the top.
+    static f64
+    Importance(const light_tree_node &Node, const vec3r &P, const vec3r &Normal)
+    {
+        vec3r ToCenter = Center(Node.Bounds) - P;
+        f64 Distance2 = ToCenter.SqMagnitude();
+        f64 Radius2 = 0.25*(Node.Bounds.Max() - Node.Bounds.Min()).SqMagnitude();
+
+        f64 CosBound = 1;
+        if((Distance2 > Radius2) && (Normal.SqMagnitude() > 0))
+        {
+            // NOTE: The angle to the normal, less the angle the box's
+            // bounding sphere covers, is the smallest angle any of it can be
+            // at.
+            f64 Distance = sqrt(Distance2);
+            f64 CosI = Dot(Normal, ToCenter) / Distance;
+            f64 CosU = sqrt(1.0 - Radius2 / Distance2);
+            if(CosI < CosU)
+            {
+                f64 SinI = sqrt(MAX(0.0, 1.0 - CosI*CosI));
+                f64 SinU = sqrt(Radius2 / Distance2);
+                CosBound = CosI*CosU + SinI*SinU;
+                CosBound = (CosBound > 0) ? CosBound : 0;
+            }
+        }
+
+        f64 Result = Node.Power*CosBound / ((Distance2 > Radius2) ? Distance2 : Radius2);
+        return Result;
+    }
+
+    // NOTE: When neither child can light P at all, by the bound, it goes by
+    // power alone. That way the odds over all the lights always add up to 1,
+    // and Sample() and PDF() agree wherever P is.
+    f64
+    FirstChildProbability(i32 Index, const vec3r &P, const vec3r &Normal) const
+    {
+        const light_tree_node &First = nodes[Index + 1];
+        const light_tree_node &Second = nodes[nodes[Index].Child];
+        f64 A = Importance(First, P, Normal);
+        f64 B = Importance(Second, P, Normal);
+        if(!((A + B) > 0))
+        {
+            A = First.Power;
+            B = Second.Power;
+        }
+
+        f64 Result = A / (A + B);
+        return Result;
+    }
+};
+
+#define LIGHTS_H
+#endif
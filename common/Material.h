@@ -6,6 +6,9 @@
 #include "Color.h"
 #include "Vec.h"
 #include "Texture.h"
+#include "Sampler.h"
+#include "Warp.h"
+#include "ONB.h"
 
 // NOTE: Material class for different kinds of materials in the scene.
 // It has two jobs:
@@ -17,7 +20,7 @@ class material
 {
   public:
     virtual color
-    Emitted(f64 U, f64 V, const vec3d &P) const
+    Emitted(real U, real V, const vec3r &P) const
     {
         color Result = Color(0, 0, 0);
         return Result;
@@ -28,60 +31,153 @@ class material
     // NOTE: Produces a scattered ray based on the incident ray. This function
     // basically simulates how the incident ray gets reflected by the surface
     // with this kind of a material.
-    virtual b32 Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation, ray &ScatteredRay) const = 0;
+    // NOTE: Every random number comes from Sampler, and every call asks for
+    // them in the same order no matter what gets hit, so the dimensions of
+    // the sampler line up with the bounces of the path.
+    //
+    // PDF is the density, per unit solid angle, the scattered direction was
+    // picked with. Mirror-like materials pick from a delta distribution that
+    // has no density, they set it to 0 and the attenuation is the whole
+    // weight. Otherwise the path gets weighted by
+    // Attenuation*ScatteringPDF/PDF, which is 1 when the material samples
+    // exactly its own scattering distribution, and stays correct when a
+    // direction comes from somewhere else (a light, say).
+    virtual b32 Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
+                        ray &ScatteredRay, real &PDF, sampler &Sampler) const = 0;
+
+    // NOTE: How much of the light coming in from Scattered's direction goes
+    // out along RayIn, as a density over solid angle. Only used when Scatter
+    // gives a PDF.
+    virtual real
+    ScatteringPDF(const ray &RayIn, const hit_record &Record, const ray &Scattered) const
+    {
+        return 0;
+    }
+
+    // NOTE: True if the material only scatters into the hemisphere Normal
+    // is in, so lights behind the surface can't matter. The light tree uses
+    // it to pick lights (see Lights.h), leaving it false only costs it that.
+    virtual b32
+    Hemispherical() const
+    {
+        return false;
+    }
 };
 
 class lambertian : public material
 {
   public:
-    lambertian(const color &Color) : albedo(std::make_shared<solid_color>(Color)) {}
-    lambertian(const std::shared_ptr<texture> Tex) : albedo(Tex) {}
+    lambertian(const color &Color)
+        : ownedAlbedo(std::make_unique<solid_color>(Color)), albedo(ownedAlbedo.get()) {}
+    lambertian(texture *Tex) : albedo(Tex) {}
 
     b32
     Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
-            ray &ScatteredRay) const override
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
     {
         // Lambertian Law which states that lambertian surfaces reflect light
         // much closer to thenormal of the surface point where the ray was
-        // incident.
-        vec3d ScatteredDirection = Record.Normal + vec3d::RandomUnitVector();
-
-        // NOTE: RandomUnitVector could return the negative of the Record.Normal
-        // in which case the ScatteredDirection will be Zero or NearZero. to
-        // avoid divide by zero errors later along with some other unexpected
-        // issues, we for this here and make sure its not zero.
-        if(ScatteredDirection.NearZero())
-        {
-            ScatteredDirection = Record.Normal;
-        }
+        // incident. The reflected radiance goes with the cosine of the angle
+        // to the normal, so the direction is drawn cosine weighted around it.
+        onb Basis = onb(Record.Normal);
+        vec3r ScatteredDirection = Basis.Local(SampleCosineHemisphere(Sampler.Get2D()));
 
         ScatteredRay = ray(Record.P, ScatteredDirection, RayIn.Time());
-        Attenuation = albedo->Value(Record.U, Record.V, Record.P);
+        Attenuation = albedo->Value(Record.U, Record.V, Record.P, Record.Footprint);
+        PDF = (real)CosineHemispherePdf(Dot(Record.Normal, ScatteredDirection));
 
         return true;
     }
 
+    real
+    ScatteringPDF(const ray &RayIn, const hit_record &Record, const ray &Scattered) const override
+    {
+        real CosTheta = Dot(Record.Normal, Normalize(Scattered.Direction()));
+        real Result = (real)CosineHemispherePdf(CosTheta);
+        return Result;
+    }
+
+    b32 Hemispherical() const override { return true; }
+
   private:
-    std::shared_ptr<texture> albedo;
+    friend class scene_cache;
+
+    // NOTE: Set when the lambertian was made from a color and made the
+    // solid_color for it itself. Otherwise albedo belongs to whoever made it.
+    std::unique_ptr<solid_color> ownedAlbedo;
+    texture *albedo;
 };
 
+// NOTE: Differentials of a mirror bounce, and of a refraction below. The
+// offset rays bounce at their own points on the tangent plane, off a normal
+// turned by the surface's curvature. Whatever Scattered adds on top of the
+// perfect reflection (metal fuzz) is added to the offset rays as well, so the
+// three stay together.
+inline void
+ReflectDifferentials(const ray &RayIn, const hit_record &Record, ray &Scattered)
+{
+    vec3r Px, Py;
+    if(HitDifferentials(RayIn, Record, Px, Py))
+    {
+        vec3r Nx = Normalize(Record.Normal + Record.Curvature*(Px - Record.P));
+        vec3r Ny = Normalize(Record.Normal + Record.Curvature*(Py - Record.P));
+        vec3r Extra = Scattered.Direction() - Reflect(Normalize(RayIn.Direction()), Record.Normal);
+
+        Scattered.HasDifferentials = true;
+        Scattered.RxOrigin = Px;
+        Scattered.RyOrigin = Py;
+        Scattered.RxDirection = Reflect(Normalize(RayIn.RxDirection), Nx) + Extra;
+        Scattered.RyDirection = Reflect(Normalize(RayIn.RyDirection), Ny) + Extra;
+    }
+}
+
+// NOTE: An offset ray that would reflect totally while the main one
+// refracts means the pixel straddles the critical angle, the differentials
+// are dropped then.
+inline void
+RefractDifferentials(const ray &RayIn, const hit_record &Record, real RefractionRatio,
+                     ray &Scattered)
+{
+    vec3r Px, Py;
+    if(HitDifferentials(RayIn, Record, Px, Py))
+    {
+        vec3r Nx = Normalize(Record.Normal + Record.Curvature*(Px - Record.P));
+        vec3r Ny = Normalize(Record.Normal + Record.Curvature*(Py - Record.P));
+        vec3r Dx = Normalize(RayIn.RxDirection);
+        vec3r Dy = Normalize(RayIn.RyDirection);
+
+        real CosX = MIN(Dot(-Dx, Nx), 1.);
+        real CosY = MIN(Dot(-Dy, Ny), 1.);
+        b32 Refracts = (RefractionRatio*sqrt(1. - CosX*CosX) <= 1.) &&
+                       (RefractionRatio*sqrt(1. - CosY*CosY) <= 1.);
+        if(Refracts)
+        {
+            Scattered.HasDifferentials = true;
+            Scattered.RxOrigin = Px;
+            Scattered.RyOrigin = Py;
+            Scattered.RxDirection = Refract(Dx, Nx, RefractionRatio);
+            Scattered.RyDirection = Refract(Dy, Ny, RefractionRatio);
+        }
+    }
+}
+
 // Metals are supposed to Reflect the incident ray not scatter it
 class metal : public material
 {
   public:
-    metal(const color &a, const f64 &Fuzz)
+    metal(const color &a, const real &Fuzz)
         : albedo(a), fuzz((Fuzz < 1) ? Fuzz : 1)
     {
     }
 
     b32
     Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
-            ray &ScatteredRay) const override
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
     {
-        vec3d InDir = Normalize(RayIn.Direction());
-        vec3d ReflectedRay = Reflect(InDir, Record.Normal);
+        vec3r InDir = Normalize(RayIn.Direction());
+        vec3r ReflectedRay = Reflect(InDir, Record.Normal);
 
-        vec3d FuzzVector = fuzz*(vec3d::RandomUnitVector());
+        vec3r FuzzVector = fuzz*SampleUnitSphere(Sampler.Get2D());
 
         // The idea is that basically wherever the reflected ray ends up, we
         // make a sphere there with the radius = fuzz, and then the same
@@ -89,69 +185,81 @@ class metal : public material
         // If the fuzz factor is more, then radius of that sphere will be more
         // which would increase the haziness/fuzziness of the reflections.
         ScatteredRay = ray(Record.P, ReflectedRay + FuzzVector, RayIn.Time());
+        ReflectDifferentials(RayIn, Record, ScatteredRay);
 
         Attenuation = albedo;
+        PDF = 0;
 
         return true;
     }
 
 
   private:
+    friend class scene_cache;
+
     color albedo;
 
     // NOTE: To make the reflections fuzzy or a little bit hazy.
     // The more this fuzz factor, the more distorted/imperfect the reflected
     // vector is
-    f64 fuzz;
+    real fuzz;
 };
 
 class dielectric : public material
 {
   public:
-    dielectric(f64 IndexOfRefraction) : indexOfRefraction(IndexOfRefraction) {}
+    dielectric(real IndexOfRefraction) : indexOfRefraction(IndexOfRefraction) {}
 
     b32
     Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
-            ray &ScatteredRay) const override
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
     {
         Attenuation = Color(1., 1., 1.);
-        f64 RefractionRatio = Record.FrontFace ? (1./indexOfRefraction) : indexOfRefraction;
+        real RefractionRatio = Record.FrontFace ? (1./indexOfRefraction) : indexOfRefraction;
 
-        vec3d UnitDirection = Normalize(RayIn.Direction());
-        f64 CosTheta = MIN(Dot(-UnitDirection, Record.Normal), 1.);
-        f64 SinTheta = sqrt(1. - CosTheta*CosTheta);
+        vec3r UnitDirection = Normalize(RayIn.Direction());
+        real CosTheta = MIN(Dot(-UnitDirection, Record.Normal), 1.);
+        real SinTheta = sqrt(1. - CosTheta*CosTheta);
 
         // NOTE: If this is > 1, then, this would invalidate snell's law.
         // SinTheta cannot be greater than 1.
         b32 TotalInternalReflection = (RefractionRatio*SinTheta > 1.);
 
-        vec3d Direction;
-        if(TotalInternalReflection || (Reflectance(CosTheta, RefractionRatio) > Rand01()))
+        // NOTE: Always drawn, even when it's not needed, to keep the sampler
+        // dimensions of the following bounces the same.
+        real Choice = Sampler.Get1D();
+
+        if(TotalInternalReflection || (Reflectance(CosTheta, RefractionRatio) > Choice))
         {
-            Direction = Reflect(UnitDirection, Record.Normal);
+            ScatteredRay = ray(Record.P, Reflect(UnitDirection, Record.Normal), RayIn.Time());
+            ReflectDifferentials(RayIn, Record, ScatteredRay);
         }
         else
         {
-            Direction = Refract(UnitDirection, Record.Normal, RefractionRatio);
+            ScatteredRay = ray(Record.P, Refract(UnitDirection, Record.Normal, RefractionRatio),
+                               RayIn.Time());
+            RefractDifferentials(RayIn, Record, RefractionRatio, ScatteredRay);
         }
 
-        ScatteredRay = ray(Record.P, Direction, RayIn.Time());
+        PDF = 0;
 
         return true;
     }
 
   private:
-    f64 indexOfRefraction;
+    friend class scene_cache;
+
+    real indexOfRefraction;
 
     // NOTE: Every glass material has varied reflectance based on the angle of
     // incidence, how to get the reflectance is an ugly formula, but we can use
     // schlick approximation here.
-    f64
-    Reflectance(f64 CosTheta, f64 RefractionRatio) const
+    real
+    Reflectance(real CosTheta, real RefractionRatio) const
     {
-        f64 R0 = (1.0-RefractionRatio) / (1.0+RefractionRatio);
+        real R0 = (1.0-RefractionRatio) / (1.0+RefractionRatio);
         R0 = R0*R0;
-        f64 Result = R0 + (1.0-R0)*pow((1.0-CosTheta), 5);
+        real Result = R0 + (1.0-R0)*pow((1.0-CosTheta), 5);
         return Result;
     }
 };
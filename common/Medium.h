@@ -0,0 +1,207 @@
+#if !defined(MEDIUM_H)
+
+#include "defines.h"
+
+#include "Hittable.h"
+#include "ConstantMedium.h"
+#include "Phase.h"
+#include "Vec.h"
+
+#include <cmath>
+#include <memory>
+
+// NOTE: Media the camera tracks itself, as opposed to the ones that are
+// hittables (constant_density_medium, grid_medium). Those have to be found by
+// intersecting their boundary again on every bounce, which for fog around the
+// whole scene means every ray of every path. A medium here is attached to the
+// camera (the one the camera sits in) or to the inside of a surface (see
+// medium_boundary), and the camera keeps a stack of the ones the path is in
+// (see medium_stack), pushing and popping as the path crosses their
+// boundaries. Between two surfaces only the medium on top is sampled, with no
+// intersections at all.
+class medium
+{
+  public:
+    virtual ~medium() = default;
+
+    // NOTE: Samples how far along Ray the next scattering in the medium is.
+    // True with T set if it comes before TMax, false if the ray gets to TMax.
+    // The distances are sampled proportional to the transmittance, so the
+    // transmittance and the pdf cancel out: a ray that gets through gets no
+    // weight, one that scatters gets the albedo from the phase function.
+    virtual b32 SampleDistance(const ray &Ray, real TMax, real &T) const = 0;
+
+    // NOTE: How much of the light makes it along Ray from its origin to TMax.
+    virtual real Transmittance(const ray &Ray, real TMax) const = 0;
+
+    // NOTE: What the path scatters off of at a scattering event.
+    virtual const material *Phase() const = 0;
+};
+
+// NOTE: Same density all over, so the free flights are sampled in closed
+// form and the transmittance is just Beer-Lambert. It can be cut off at a
+// box, past which there's nothing. Fog around a scene with nothing behind it
+// wants that, otherwise the paths that leave the scene keep scattering around
+// in the fog miles away for every bounce they have left.
+class homogeneous_medium : public medium
+{
+  public:
+    homogeneous_medium(real Density, texture *TexPtr)
+        : density(Density), ownedPhase(std::make_unique<isotropic>(TexPtr)),
+          phase_function(ownedPhase.get())
+    {
+    }
+
+    homogeneous_medium(real Density, color Color)
+        : density(Density), ownedPhase(std::make_unique<isotropic>(Color)),
+          phase_function(ownedPhase.get())
+    {
+    }
+
+    homogeneous_medium(real Density, color Color, const aabb &Extent)
+        : density(Density), ownedPhase(std::make_unique<isotropic>(Color)),
+          phase_function(ownedPhase.get()), extent(Extent), bounded(true)
+    {
+    }
+
+    // NOTE: Scatters with Phase (see Phase.h) rather than isotropically.
+    homogeneous_medium(real Density, material *Phase)
+        : density(Density), phase_function(Phase)
+    {
+    }
+
+    homogeneous_medium(real Density, material *Phase, const aabb &Extent)
+        : density(Density), phase_function(Phase), extent(Extent), bounded(true)
+    {
+    }
+
+    virtual b32
+    SampleDistance(const ray &Ray, real TMax, real &T) const override
+    {
+        b32 Result = false;
+        real TMin = 0;
+        if((density > 0) && Clip(Ray, TMin, TMax))
+        {
+            real Distance = -(real)log(1.0 - Rand01()) / density;
+            T = TMin + Distance / Ray.Direction().Magnitude();
+            Result = (T < TMax);
+        }
+
+        return Result;
+    }
+
+    virtual real
+    Transmittance(const ray &Ray, real TMax) const override
+    {
+        real Result = 1;
+        real TMin = 0;
+        if(Clip(Ray, TMin, TMax))
+        {
+            Result = (real)exp(-(f64)density*(TMax - TMin)*Ray.Direction().Magnitude());
+        }
+
+        return Result;
+    }
+
+    virtual const material *Phase() const override { return phase_function; }
+
+  public:
+    real density;
+    // NOTE: Only set when the medium made its own isotropic phase.
+    std::unique_ptr<isotropic> ownedPhase;
+    material *phase_function;
+    aabb extent;
+    b32 bounded = false;
+
+  private:
+    b32
+    Clip(const ray &Ray, real &TMin, real &TMax) const
+    {
+        b32 Result = bounded ? extent.Clip(Ray, TMin, TMax) : (TMin < TMax);
+        return Result;
+    }
+};
+
+// NOTE: Puts Medium on the inside of Boundary. The boundary is still drawn
+// with its own material, a dielectric sphere full of smoke say. With no
+// material at all it's an invisible interface, which the path goes straight
+// through without it counting as a bounce.
+class medium_boundary : public hittable
+{
+  public:
+    medium_boundary(hittable *Boundary, medium *Medium)
+        : boundary(Boundary), interior(Medium)
+    {
+    }
+
+    virtual b32
+    Hit(const ray &Ray, const interval &Interval, hit_record &Record) const override
+    {
+        b32 Result = boundary->Hit(Ray, Interval, Record);
+        if(Result)
+        {
+            Record.Medium = interior;
+        }
+
+        return Result;
+    }
+
+    virtual b32
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
+    {
+        b32 Result = boundary->BoundingBox(Time0, Time1, OutputBox);
+        return Result;
+    }
+
+  public:
+    hittable *boundary;
+    medium *interior;
+};
+
+// NOTE: The media a path is in, innermost on top. Nested boundaries are
+// fine, overlapping ones resolve to whichever was entered last. A path that
+// leaves a medium it never entered (it started inside a boundary that isn't
+// the camera's medium) just ignores it.
+#define MEDIUM_STACK_SIZE 8
+
+struct medium_stack
+{
+    const medium *Media[MEDIUM_STACK_SIZE];
+    i32 Count = 0;
+
+    const medium *
+    Top() const
+    {
+        const medium *Result = (Count > 0) ? Media[Count - 1] : nullptr;
+        return Result;
+    }
+
+    void
+    Push(const medium *Medium)
+    {
+        if(Count < MEDIUM_STACK_SIZE)
+        {
+            Media[Count++] = Medium;
+        }
+    }
+
+    void
+    Pop(const medium *Medium)
+    {
+        for(i32 Index = Count - 1; Index >= 0; --Index)
+        {
+            if(Media[Index] == Medium)
+            {
+                for(i32 Next = Index + 1; Next < Count; ++Next)
+                {
+                    Media[Next - 1] = Media[Next];
+                }
+                --Count;
+                break;
+            }
+        }
+    }
+};
+
+#define MEDIUM_H
+#endif
@@ -3,13 +3,14 @@
 #include "defines.h"
 #include "Vec.h"
 #include "Hittable.h"
+#include "Stats.h"
 
 class moving_sphere : public hittable
 {
   public:
     moving_sphere() {}
-    moving_sphere(vec3d cen0, vec3d cen1, f64 t0, f64 t1, f64 r,
-                  std::shared_ptr<material> matPtr)
+    moving_sphere(vec3r cen0, vec3r cen1, real t0, real t1, real r,
+                  material *matPtr)
         : center0(cen0), center1(cen1), time0(t0), time1(t1), radius(r),
           materialPtr(matPtr)
     {
@@ -28,22 +29,31 @@ class moving_sphere : public hittable
     Hit(const ray &Ray, const interval &Interval,
         hit_record &Record) const override
     {
-        vec3d SpherePosAtTime = Center(Ray.Time());
-        vec3d OC = Ray.Origin() - SpherePosAtTime;
+        RT_STAT(Stat_PrimitiveTests);
+        vec3r SpherePosAtTime = Center(Ray.Time());
+        vec3r OC = Ray.Origin() - SpherePosAtTime;
 
         // (B⋅B) is square magnitude of the vector.
         // a here is the coefficient of t^2 in the above quadratic equation.
-        f64 a = Ray.Direction().SqMagnitude();
+        real a = Ray.Direction().SqMagnitude();
         // B⋅(A−C), b here is the coeffiecient of t in the quadratic equation.
-        f64 Half_b = Dot(OC, Ray.Direction());
-        // c here is the constant in the quadratic equation of t described
-        // above. c = ((A−C)⋅(A−C)−r^2)
-        f64 c = OC.SqMagnitude() - radius * radius;
+        real Half_b = Dot(OC, Ray.Direction());
+        // c here would be the constant in the quadratic equation of t described
+        // above, c = ((A−C)⋅(A−C)−r^2), see the discriminant below.
 
         // NOTE:
         // -b -sqrt(b2 - 4ac) / 2a
         // if h = 2*b, this becomes -h - sqrt(h2 - ac) / a
-        f64 Discriminant = Half_b * Half_b - a * c;
+        //
+        // NOTE: Written like this the discriminant loses everything to
+        // cancellation on big spheres, b^2 and ac are both about r^4 and the
+        // difference is what's left. b^2 - ac is the same thing as
+        // a*(r^2 - |OC - (b/a)B|^2), the squared distance from the center to
+        // the closest point on the line, which stays accurate (Haines et al.,
+        // "Precision Improvements for Ray/Sphere Intersection", Ray Tracing
+        // Gems). That is what makes the ground sphere work in f32.
+        vec3r Closest = OC - (Half_b / a) * Ray.Direction();
+        real Discriminant = a * (radius * radius - Closest.SqMagnitude());
         // Meaning there are no real roots to the quadratic equation. Meaning
         // the ray does not HIT the sphere here.
         if (Discriminant < 0.)
@@ -51,10 +61,10 @@ class moving_sphere : public hittable
             return false;
         }
 
-        f64 SqRootDiscriminant = sqrt(Discriminant);
+        real SqRootDiscriminant = sqrt(Discriminant);
 
         // Find the nearest root that lies within the acceptable range.
-        f64 Root = (-Half_b - SqRootDiscriminant) / a;
+        real Root = (-Half_b - SqRootDiscriminant) / a;
         if (!Interval.Surrounds(Root))
         {
             Root = (-Half_b + SqRootDiscriminant) / a;
@@ -68,41 +78,58 @@ class moving_sphere : public hittable
         // intersection quadratic eq.
         Record.t = Root;
         Record.P = Ray.At(Record.t);
+        // NOTE: Ray.At(t) lands off the surface by about t times an ulp, put
+        // it back on so OffsetRayOrigin only has to cover the last few ulps.
+        // The radius can be negative for hollow glass, hence the fabs.
+        vec3r FromCenter = Record.P - SpherePosAtTime;
+        Record.P = SpherePosAtTime + FromCenter * (fabs(radius) / FromCenter.Magnitude());
+        // Putting it back on rounds to the ulps of the center as well, a
+        // small sphere far from the origin or a huge one like the ground are
+        // only as exact as the bigger of the two.
+        vec3r AbsCenter = Vec3r(fabs(SpherePosAtTime.x), fabs(SpherePosAtTime.y), fabs(SpherePosAtTime.z));
+        real MaxCenter = MAX(MAX(AbsCenter.x, AbsCenter.y), AbsCenter.z);
+        Record.Error = 8 * RealEpsilon * (fabs(radius) + MaxCenter);
         Record.Material = materialPtr;
+        Record.Object = this;
+        Record.UVPerUnit = 0;
 
         // This is a Unit Vector.
-        vec3d OutwardNormal = ((Record.P-SpherePosAtTime) / radius);
+        vec3r OutwardNormal = ((Record.P-SpherePosAtTime) / radius);
         Record.SetFaceNormal(Ray, OutwardNormal);
+        Record.Curvature = (Record.FrontFace ? 1 : -1) / radius;
+        Record.Medium = nullptr;
 
         return true;
     }
 
     b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
-        aabb Box0 = aabb(Center(Time0) - Vec3d(radius),
-                         Center(Time0) + Vec3d(radius));
-        aabb Box1 = aabb(Center(Time1) - Vec3d(radius),
-                         Center(Time1) + Vec3d(radius));
+        aabb Box0 = aabb(Center(Time0) - Vec3r(radius),
+                         Center(Time0) + Vec3r(radius));
+        aabb Box1 = aabb(Center(Time1) - Vec3r(radius),
+                         Center(Time1) + Vec3r(radius));
 
         OutputBox = aabb::SurroundingBox(Box0, Box1);
         return true;
     }
 
     // NOTE: Where is the sphere located at the given time.
-    vec3d
-    Center(f64 Time) const
+    vec3r
+    Center(real Time) const
     {
-        vec3d Result = center0 + ((Time-time0) / (time1-time0))*(center1-center0);
+        vec3r Result = center0 + ((Time-time0) / (time1-time0))*(center1-center0);
         return Result;
     }
 
   private:
+    friend class scene_cache;
+
     // The sphere is moving. It is at center0 at time t0 and center1 at time t1
-    vec3d center0, center1;
-    f64 time0, time1;
-    f64 radius;
-    std::shared_ptr<material> materialPtr;
+    vec3r center0, center1;
+    real time0, time1;
+    real radius;
+    material *materialPtr = nullptr;
 };
 
 #define MOVING_SPHERE_H
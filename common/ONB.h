@@ -0,0 +1,44 @@
+#if !defined(ONB_H)
+
+#include "defines.h"
+#include "Vec.h"
+
+#include <cmath>
+
+// NOTE: An orthonormal basis around a unit vector W, for taking directions
+// sampled around +z (see Warp.h) over to a surface normal. Built without
+// cross products or normalizing, and without a branch on which axis W is
+// closest to (Duff et al., "Building an Orthonormal Basis, Revisited", JCGT
+// 2017). The only discontinuity is the sign flip at W.z = 0, where both bases
+// are fine.
+class onb
+{
+  public:
+    explicit onb(const vec3r &W)
+    {
+        real Sign = (real)copysign(1.0, (f64)W.z);
+        real A = -1 / (Sign + W.z);
+        real B = W.x*W.y*A;
+        u = Vec3r(1 + Sign*W.x*W.x*A, Sign*B, -Sign*W.x);
+        v = Vec3r(B, Sign + W.y*W.y*A, -W.y);
+        w = W;
+    }
+
+    vec3r U() const { return u; }
+    vec3r V() const { return v; }
+    vec3r W() const { return w; }
+
+    // From the basis to world space.
+    vec3r
+    Local(const vec3r &A) const
+    {
+        vec3r Result = A.x*u + A.y*v + A.z*w;
+        return Result;
+    }
+
+  private:
+    vec3r u, v, w;
+};
+
+#define ONB_H
+#endif
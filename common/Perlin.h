@@ -3,15 +3,23 @@
 #include "defines.h"
 #include "Vec.h"
 
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+// NOTE: How many points NoiseBatch does at once. Turbulence's 7 octaves
+// take two batches.
+#define PERLIN_BATCH 4
+
 class perlin
 {
   public:
     perlin()
     {
-        randVec = new vec3d[pointCount];
+        randVec = new vec3r[pointCount];
         for(i32 Index = 0; Index < pointCount; ++Index)
         {
-            randVec[Index] = vec3d::RandRange(-1, 1);
+            randVec[Index] = vec3r::RandRange(-1, 1);
         }
 
         permX = PerlinGeneratePerm();
@@ -19,6 +27,22 @@ class perlin
         permZ = PerlinGeneratePerm();
     }
 
+    // NOTE: Rebuilds the noise from tables saved earlier (the scene cache)
+    // instead of generating new random ones.
+    perlin(const vec3r *RandVec, const i32 *PermX, const i32 *PermY,
+           const i32 *PermZ)
+    {
+        randVec = new vec3r[pointCount];
+        permX = new i32[pointCount];
+        permY = new i32[pointCount];
+        permZ = new i32[pointCount];
+
+        memcpy(randVec, RandVec, sizeof(vec3r)*pointCount);
+        memcpy(permX, PermX, sizeof(i32)*pointCount);
+        memcpy(permY, PermY, sizeof(i32)*pointCount);
+        memcpy(permZ, PermZ, sizeof(i32)*pointCount);
+    }
+
     ~perlin()
     {
         delete[] randVec;
@@ -27,59 +51,136 @@ class perlin
         delete[] permZ;
     }
 
-    f64
-    Noise(const vec3d &P) const
+    real
+    Noise(const vec3r &P) const
     {
-        f64 U = P.x - floor(P.x);
-        f64 V = P.y - floor(P.y);
-        f64 W = P.z - floor(P.z);
+        real Result;
+        NoiseBatch(&P, &Result, 1, pointCount - 1);
+        return Result;
+    }
 
-        i32 I = (i32)(floor(P.x));
-        i32 J = (i32)(floor(P.y));
-        i32 K = (i32)(floor(P.z));
+    // NOTE: Adding multiple perlin noise funtions on top of each other.
+    // The octaves don't depend on each other, so they go through NoiseBatch
+    // a batch at a time.
+    real
+    Turbulence(const vec3r &P, i32 Depth = 7) const
+    {
+        real Accum = 0.;
+        vec3r TempP = P;
+        real Weight = 1.;
 
-        vec3d C[2][2][2];
-        for(i32 dI = 0; dI < 2; ++dI)
+        for(i32 First = 0; First < Depth; First += PERLIN_BATCH)
         {
-            for(i32 dJ = 0; dJ < 2; ++dJ)
+            i32 Count = ((Depth - First) < PERLIN_BATCH) ? (Depth - First) : PERLIN_BATCH;
+            vec3r Points[PERLIN_BATCH];
+            real Values[PERLIN_BATCH];
+            for(i32 I = 0; I < Count; ++I)
             {
-                for(i32 dK = 0; dK < 2; ++dK)
-                {
-                    i32 pX = permX[((I+dI) & (0xFF))];
-                    i32 pY = permY[((J+dJ) & (0xFF))];
-                    i32 pZ = permZ[((K+dK) & (0xFF))];
-                    C[dI][dJ][dK] = randVec[pX ^ pY ^ pZ];
-                }
+                Points[I] = TempP;
+                TempP *= 2;
+            }
+
+            NoiseBatch(Points, Values, Count, pointCount - 1);
+            for(i32 I = 0; I < Count; ++I)
+            {
+                Accum += Weight*Values[I];
+                Weight *= 0.5;
             }
         }
 
-        f64 Result = TrilinearInterp(C, U, V, W);
+        real Result = ABSOLUTE(Accum);
+
         return Result;
     }
 
-    // NOTE: Adding multiple perlin noise funtions on top of each other.
-    f64
-    Turbulence(const vec3d &P, i32 Depth = 7) const
+    // NOTE: The noise at Count points, up to PERLIN_BATCH of them. The lattice
+    // wraps around every Mask + 1 cells (a power of two up to 256), 255 is
+    // the noise itself, smaller ones give a noise that tiles (see
+    // perlin_volume).
+    //
+    // Everything but the table lookups runs over arrays of lanes, one point
+    // each, which the compiler turns into SIMD. The lookups are gathers either
+    // way, but done for all the points up front their latencies overlap
+    // instead of each point waiting on its own. The hash of a corner is
+    // permX[i] ^ permY[j] ^ permZ[k], the two values of each table are looked
+    // up once per point instead of once per corner.
+    void
+    NoiseBatch(const vec3r *P, real *Result, i32 Count, i32 Mask) const
     {
-        f64 Accum = 0.;
-        vec3d TempP = P;
-        f64 Weight = 1.;
+        real U[PERLIN_BATCH], V[PERLIN_BATCH], W[PERLIN_BATCH];
+        real GX[8][PERLIN_BATCH], GY[8][PERLIN_BATCH], GZ[8][PERLIN_BATCH];
 
-        for(i32 I = 0; I < Depth; ++I)
+        for(i32 Lane = 0; Lane < Count; ++Lane)
         {
-            Accum += Weight*Noise(TempP);
-            Weight *= 0.5;
-            TempP *= 2;
+            real FloorX = floor(P[Lane].x);
+            real FloorY = floor(P[Lane].y);
+            real FloorZ = floor(P[Lane].z);
+            U[Lane] = P[Lane].x - FloorX;
+            V[Lane] = P[Lane].y - FloorY;
+            W[Lane] = P[Lane].z - FloorZ;
+
+            i32 I = (i32)FloorX;
+            i32 J = (i32)FloorY;
+            i32 K = (i32)FloorZ;
+            i32 PX[2] = {permX[I & Mask], permX[(I + 1) & Mask]};
+            i32 PY[2] = {permY[J & Mask], permY[(J + 1) & Mask]};
+            i32 PZ[2] = {permZ[K & Mask], permZ[(K + 1) & Mask]};
+
+            for(i32 Corner = 0; Corner < 8; ++Corner)
+            {
+                const vec3r &G = randVec[PX[Corner >> 2] ^ PY[(Corner >> 1) & 1] ^ PZ[Corner & 1]];
+                GX[Corner][Lane] = G.x;
+                GY[Corner][Lane] = G.y;
+                GZ[Corner][Lane] = G.z;
+            }
         }
 
-        f64 Result = ABSOLUTE(Accum);
+        // NOTE: Unused lanes get zeros, so the loop below can always do all
+        // of them.
+        for(i32 Lane = Count; Lane < PERLIN_BATCH; ++Lane)
+        {
+            U[Lane] = V[Lane] = W[Lane] = 0;
+            for(i32 Corner = 0; Corner < 8; ++Corner)
+            {
+                GX[Corner][Lane] = GY[Corner][Lane] = GZ[Corner][Lane] = 0;
+            }
+        }
 
-        return Result;
+        // NOTE: Same sums in the same order as the trilinear loop this used
+        // to be, corner (i, j, k) at index 4i + 2j + k.
+        for(i32 Lane = 0; Lane < PERLIN_BATCH; ++Lane)
+        {
+            // NOTE: Hermitian Smoothing
+            real uu = U[Lane]*U[Lane]*(3 - 2*U[Lane]);
+            real vv = V[Lane]*V[Lane]*(3 - 2*V[Lane]);
+            real ww = W[Lane]*W[Lane]*(3 - 2*W[Lane]);
+
+            real Accum = 0.0;
+            for(i32 Corner = 0; Corner < 8; ++Corner)
+            {
+                i32 i = Corner >> 2, j = (Corner >> 1) & 1, k = Corner & 1;
+                real p1 = i ? uu : (1 - uu);
+                real p2 = j ? vv : (1 - vv);
+                real p3 = k ? ww : (1 - ww);
+                real Dot = GX[Corner][Lane]*(U[Lane] - i) +
+                           GY[Corner][Lane]*(V[Lane] - j) +
+                           GZ[Corner][Lane]*(W[Lane] - k);
+                Accum += p1*p2*p3*Dot;
+            }
+            U[Lane] = Accum;
+        }
+
+        for(i32 Lane = 0; Lane < Count; ++Lane)
+        {
+            Result[Lane] = U[Lane];
+        }
     }
 
   private:
+    friend class scene_cache;
+
     static const i32 pointCount = 256;
-    vec3d *randVec;
+    vec3r *randVec;
     i32 *permX, *permY, *permZ;
 
     static i32 *
@@ -95,45 +196,112 @@ class perlin
         return P;
     }
 
-    static f64
-    TrilinearInterp(vec3d C[2][2][2], f64 U, f64 V, f64 W)
+    static void
+    Permute(i32 *P, i32 N)
     {
-        // NOTE: Hermitian Smoothing
-        f64 uu = U*U*(3 - 2*U);
-        f64 vv = V*V*(3 - 2*V);
-        f64 ww = W*W*(3 - 2*W);
-
+        for(i32 Index = N-1; Index > 0; --Index)
+        {
+            i32 Target = RandomRangeInt(0, Index);
+            i32 Tmp = P[Index];
+            P[Index] = P[Target];
+            P[Target] = Tmp;
+        }
+    }
+};
 
-        f64 Accum = 0.0;
-        for(i32 i = 0; i < 2; ++i)
+// NOTE: One octave of the noise baked into a grid, looked up with trilinear
+// interpolation instead of hashing 8 corners and dotting 8 gradients. The
+// noise it bakes tiles every Period lattice cells (NoiseBatch with a smaller
+// mask), so the grid covers one tile and lookups wrap around it. That makes
+// it a different noise from the perlin it was made from, one that repeats
+// every Period cells, which is the price of a table that fits in memory.
+// SamplesPerCell is how finely it is baked, the trilinear lookup smooths over
+// anything finer, at 4 the difference is a few percent of the noise's range.
+class perlin_volume
+{
+  public:
+    perlin_volume(const perlin &Noise, i32 Period = 32, i32 SamplesPerCell = 4)
+        : size(Period*SamplesPerCell), samplesPerCell((real)SamplesPerCell)
+    {
+        samples.resize((size_t)size*size*size);
+        real Step = (real)1 / SamplesPerCell;
+        for(i32 Z = 0; Z < size; ++Z)
         {
-            for(i32 j = 0; j < 2; ++j)
+            for(i32 Y = 0; Y < size; ++Y)
             {
-                for(i32 k = 0; k < 2; ++k)
+                for(i32 X = 0; X < size; X += PERLIN_BATCH)
                 {
-                    vec3d Weight = Vec3d(U-i, V-j, W-k);
-                    f64 p1 = (i*uu + (1-i)*(1-uu));
-                    f64 p2 = (j*vv + (1-j)*(1-vv));
-                    f64 p3 = (k*ww + (1-k)*(1-ww));
-                    Accum += p1*p2*p3*Dot(C[i][j][k], Weight);
+                    vec3r Points[PERLIN_BATCH];
+                    real Values[PERLIN_BATCH];
+                    i32 Count = ((size - X) < PERLIN_BATCH) ? (size - X) : PERLIN_BATCH;
+                    for(i32 I = 0; I < Count; ++I)
+                    {
+                        Points[I] = Vec3r((X + I)*Step, Y*Step, Z*Step);
+                    }
+
+                    Noise.NoiseBatch(Points, Values, Count, Period - 1);
+                    for(i32 I = 0; I < Count; ++I)
+                    {
+                        samples[((size_t)Z*size + Y)*size + X + I] = (f32)Values[I];
+                    }
                 }
             }
         }
+    }
+
+    real
+    Noise(const vec3r &P) const
+    {
+        real X = P.x*samplesPerCell;
+        real Y = P.y*samplesPerCell;
+        real Z = P.z*samplesPerCell;
+        real FloorX = floor(X), FloorY = floor(Y), FloorZ = floor(Z);
+        real U = X - FloorX, V = Y - FloorY, W = Z - FloorZ;
+
+        // NOTE: size is a power of two, so the wrap is a mask, negative
+        // coordinates included.
+        i32 Mask = size - 1;
+        i32 X0 = (i32)FloorX & Mask, X1 = (X0 + 1) & Mask;
+        i32 Y0 = (i32)FloorY & Mask, Y1 = (Y0 + 1) & Mask;
+        i32 Z0 = (i32)FloorZ & Mask, Z1 = (Z0 + 1) & Mask;
 
-        return Accum;
+        const f32 *Plane0 = &samples[(size_t)Z0*size*size];
+        const f32 *Plane1 = &samples[(size_t)Z1*size*size];
+        real C00 = Plane0[Y0*size + X0] + U*(Plane0[Y0*size + X1] - Plane0[Y0*size + X0]);
+        real C10 = Plane0[Y1*size + X0] + U*(Plane0[Y1*size + X1] - Plane0[Y1*size + X0]);
+        real C01 = Plane1[Y0*size + X0] + U*(Plane1[Y0*size + X1] - Plane1[Y0*size + X0]);
+        real C11 = Plane1[Y1*size + X0] + U*(Plane1[Y1*size + X1] - Plane1[Y1*size + X0]);
+        real C0 = C00 + V*(C10 - C00);
+        real C1 = C01 + V*(C11 - C01);
+
+        real Result = C0 + W*(C1 - C0);
+        return Result;
     }
 
-    static void
-    Permute(i32 *P, i32 N)
+    real
+    Turbulence(const vec3r &P, i32 Depth = 7) const
     {
-        for(i32 Index = N-1; Index > 0; --Index)
+        real Accum = 0.;
+        vec3r TempP = P;
+        real Weight = 1.;
+
+        for(i32 I = 0; I < Depth; ++I)
         {
-            i32 Target = RandomRangeInt(0, Index);
-            i32 Tmp = P[Index];
-            P[Index] = P[Target];
-            P[Target] = Tmp;
+            Accum += Weight*Noise(TempP);
+            Weight *= 0.5;
+            TempP *= 2;
         }
+
+        real Result = ABSOLUTE(Accum);
+        return Result;
     }
+
+    size_t Bytes() const { return samples.size()*sizeof(f32); }
+
+  private:
+    std::vector<f32> samples; // size^3, x fastest.
+    i32 size;
+    real samplesPerCell;
 };
 
 #define PERLIN_H
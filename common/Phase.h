@@ -0,0 +1,238 @@
+#if !defined(PHASE_H)
+
+#include "defines.h"
+#include "Hittable.h"
+#include "Interval.h"
+#include "Material.h"
+#include "ONB.h"
+#include "Texture.h"
+#include "Vec.h"
+#include "Warp.h"
+
+#include <cmath>
+#include <memory>
+#include <vector>
+
+// NOTE: How a medium scatters light, as a density over directions around the
+// direction the light was going in. Everything here only depends on the angle
+// between the two, through its cosine: 1 is straight on, -1 straight back.
+//
+// Sample() picks a direction exactly in proportion to the phase function, so
+// the density it was picked with is the value of the phase function itself
+// and the path weight is just the medium's albedo. Evaluate() is there for
+// directions that were picked some other way, towards a light, say.
+class phase_function
+{
+  public:
+    virtual ~phase_function() = default;
+
+    // Per unit solid angle, integrates to 1 over the sphere.
+    virtual real Evaluate(real CosTheta) const = 0;
+
+    // NOTE: Direction is unit length. Returns a unit direction, its density
+    // in PDF.
+    virtual vec3r Sample(const vec3r &Direction, const vec2d &Sample, real &PDF) const = 0;
+};
+
+// NOTE: Turns a sampled cosine and angle around Direction into a direction.
+inline vec3r
+PhaseDirection(const vec3r &Direction, real CosTheta, real Phi)
+{
+    real SinTheta = (real)sqrt(MAX(0.0, 1.0 - (f64)CosTheta*CosTheta));
+    onb Basis(Direction);
+    vec3r Result = Basis.Local(Vec3r(SinTheta*cos(Phi), SinTheta*sin(Phi), CosTheta));
+    return Result;
+}
+
+class isotropic_phase : public phase_function
+{
+  public:
+    virtual real
+    Evaluate(real CosTheta) const override
+    {
+        real Result = (real)UnitSpherePdf();
+        return Result;
+    }
+
+    virtual vec3r
+    Sample(const vec3r &Direction, const vec2d &Sample, real &PDF) const override
+    {
+        PDF = (real)UnitSpherePdf();
+        vec3r Result = SampleUnitSphere(Sample);
+        return Result;
+    }
+};
+
+// NOTE: Henyey-Greenstein. One parameter, the mean cosine G, from -1 (all
+// back) through 0 (isotropic) to 1 (all forward). Haze and clouds are
+// strongly forward, 0.7 to 0.9. Sampled by inverting its CDF in closed form.
+class henyey_greenstein : public phase_function
+{
+  public:
+    explicit henyey_greenstein(real G) : g(interval(-0.99, 0.99).Clamp(G)) {}
+
+    virtual real
+    Evaluate(real CosTheta) const override
+    {
+        f64 Denominator = 1.0 + (f64)g*g - 2.0*g*CosTheta;
+        real Result = (real)((1.0 - (f64)g*g) / (4.0*pi*Denominator*sqrt(Denominator)));
+        return Result;
+    }
+
+    virtual vec3r
+    Sample(const vec3r &Direction, const vec2d &Sample, real &PDF) const override
+    {
+        f64 CosTheta;
+        if(fabs(g) < 1e-3)
+        {
+            CosTheta = 1.0 - 2.0*Sample.u;
+        }
+        else
+        {
+            f64 Square = (1.0 - (f64)g*g) / (1.0 - g + 2.0*g*Sample.u);
+            CosTheta = (1.0 + (f64)g*g - Square*Square) / (2.0*g);
+        }
+        CosTheta = (CosTheta < -1.0) ? -1.0 : ((CosTheta > 1.0) ? 1.0 : CosTheta);
+
+        PDF = Evaluate((real)CosTheta);
+        vec3r Result = PhaseDirection(Direction, (real)CosTheta, (real)(2.0*pi*Sample.v));
+        return Result;
+    }
+
+    real G() const { return g; }
+
+  private:
+    real g;
+};
+
+// NOTE: A measured (or otherwise computed) phase function, given as values at
+// evenly spaced cosines from -1 to 1, in any scale. It is taken as constant
+// between the midpoints, normalized to integrate to 1, and sampled through
+// the CDF over the bins: pick a bin, then a cosine uniformly inside of it.
+// Binary search per sample, no rejection.
+class tabulated_phase : public phase_function
+{
+  public:
+    explicit tabulated_phase(const std::vector<real> &Values)
+    {
+        i32 Count = (i32)Values.size();
+        Count = (Count < 1) ? 1 : Count;
+        density.resize(Count);
+        cdf.resize(Count + 1);
+
+        // NOTE: Every bin covers 2/Count of the cosines and all the angles
+        // around, so 4pi/Count of the sphere.
+        f64 BinSolidAngle = 4.0*pi / Count;
+        f64 Total = 0;
+        cdf[0] = 0;
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            f64 Value = (Index < (i32)Values.size()) ? (f64)Values[Index] : 1.0;
+            Value = (Value > 0.0) ? Value : 0.0;
+            Total += Value*BinSolidAngle;
+            cdf[Index + 1] = Total;
+        }
+        if(!(Total > 0.0))
+        {
+            // NOTE: Nothing in the table at all, fall back to isotropic.
+            for(i32 Index = 0; Index <= Count; ++Index) { cdf[Index] = (f64)Index / Count; }
+            Total = 1.0;
+        }
+
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            density[Index] = (real)((cdf[Index + 1] - cdf[Index]) / (Total*BinSolidAngle));
+            cdf[Index] /= Total;
+        }
+        cdf[Count] = 1.0;
+    }
+
+    virtual real
+    Evaluate(real CosTheta) const override
+    {
+        real Result = density[Bin(CosTheta)];
+        return Result;
+    }
+
+    virtual vec3r
+    Sample(const vec3r &Direction, const vec2d &Sample, real &PDF) const override
+    {
+        // NOTE: The first bin that ends past the sample. Empty bins end
+        // where they start, so they never are.
+        i32 Count = (i32)density.size();
+        i32 Low = 0, High = Count - 1;
+        while(Low < High)
+        {
+            i32 Middle = (Low + High) / 2;
+            if(cdf[Middle + 1] <= Sample.u) { Low = Middle + 1; }
+            else                            { High = Middle; }
+        }
+
+        f64 Width = cdf[Low + 1] - cdf[Low];
+        f64 Offset = (Width > 0.0) ? ((Sample.u - cdf[Low]) / Width) : 0.5;
+        Offset = (Offset < 0.0) ? 0.0 : ((Offset > 1.0) ? 1.0 : Offset);
+        f64 CosTheta = -1.0 + 2.0*(Low + Offset) / Count;
+
+        PDF = density[Low];
+        vec3r Result = PhaseDirection(Direction, (real)CosTheta, (real)(2.0*pi*Sample.v));
+        return Result;
+    }
+
+  private:
+    std::vector<real> density; // Per unit solid angle, in every bin.
+    std::vector<f64> cdf;      // Count + 1 entries, 0 to 1.
+
+    i32
+    Bin(real CosTheta) const
+    {
+        i32 Count = (i32)density.size();
+        i32 Result = (i32)floor((CosTheta + 1)*0.5*Count);
+        Result = (Result < 0) ? 0 : Result;
+        Result = (Result >= Count) ? (Count - 1) : Result;
+        return Result;
+    }
+};
+
+// NOTE: The material media hand out at their scattering events (see
+// medium::Phase): the albedo from a texture, the direction from a phase
+// function. isotropic is the same thing with the phase function built in.
+class phase_material : public material
+{
+  public:
+    phase_material(texture *Albedo, phase_function *Phase)
+        : albedo(Albedo), phase(Phase)
+    {
+    }
+
+    phase_material(color Albedo, phase_function *Phase)
+        : ownedAlbedo(std::make_unique<solid_color>(Albedo)), albedo(ownedAlbedo.get()), phase(Phase)
+    {
+    }
+
+    virtual b32
+    Scatter(const ray &RayIn, const hit_record &Record, color &Attenuation,
+            ray &ScatteredRay, real &PDF, sampler &Sampler) const override
+    {
+        vec3r Direction = Normalize(RayIn.Direction());
+        ScatteredRay = ray(Record.P, phase->Sample(Direction, Sampler.Get2D(), PDF), RayIn.Time());
+        Attenuation = albedo->Value(Record.U, Record.V, Record.P, Record.Footprint);
+        return true;
+    }
+
+    virtual real
+    ScatteringPDF(const ray &RayIn, const hit_record &Record, const ray &Scattered) const override
+    {
+        real CosTheta = Dot(Normalize(RayIn.Direction()), Normalize(Scattered.Direction()));
+        real Result = phase->Evaluate(CosTheta);
+        return Result;
+    }
+
+  public:
+    // NOTE: Only set when Albedo was a color.
+    std::unique_ptr<solid_color> ownedAlbedo;
+    texture *albedo;
+    phase_function *phase;
+};
+
+#define PHASE_H
+#endif
@@ -2,11 +2,14 @@
 #include "defines.h"
 #include "Vec.h"
 
+#include <cmath>
+#include <cstring>
+
 struct ray
 {
   public:
     ray() {}
-    ray(const vec3d &Origin, const vec3d &Direction, f64 Time = 0.0)
+    ray(const vec3r &Origin, const vec3r &Direction, real Time = 0.0)
     {
         orig = Origin;
         dir = Direction;
@@ -14,22 +17,98 @@ struct ray
     }
 
 
-    inline vec3d Origin() const { return this->orig; }
-    inline vec3d Direction() const { return dir; }
-    inline f64 Time() const { return time; }
+    inline vec3r Origin() const { return this->orig; }
+    inline vec3r Direction() const { return dir; }
+    inline real Time() const { return time; }
 
-    inline vec3d At(double t) const
+    inline vec3r At(real t) const
     {
-        vec3d Result = orig + dir*t;
+        vec3r Result = orig + dir*t;
         return Result;
     }
 
+    // NOTE: Moves the origin, keeping the direction and the differentials.
+    inline void SetOrigin(const vec3r &Origin) { orig = Origin; }
+
+    // NOTE: Ray differentials (Igehy, "Tracing Ray Differentials", 1999).
+    // The rays a pixel over in x and in y, carried along through mirror and
+    // glass bounces. Where they cross the tangent plane at a hit tells how big
+    // the pixel is there, which is what the textures get filtered over (see
+    // HitDifferentials). Only camera rays start out with them, and only when
+    // the camera's UseRayDifferentials is on. Rough bounces drop them.
+    b32 HasDifferentials = false;
+    vec3r RxOrigin, RyOrigin;
+    vec3r RxDirection, RyDirection;
+
 
   private:
-    vec3d orig;
-    vec3d dir;
-    f64 time;
+    vec3r orig;
+    vec3r dir;
+    real time;
+};
+
+// NOTE: The cone of directions a ray stands for (path spread, Amanatides,
+// "Ray Tracing with Cones", 1984). Camera rays start out a pixel wide in
+// angle, so the footprint of a ray is Width + Spread*distance where it hits,
+// which is what the texture lookups there get filtered over.
+struct ray_cone
+{
+    real Width;  // Width of the footprint at the ray's origin.
+    real Spread; // How much wider it gets per unit of distance.
 };
 
+// NOTE: Where a ray leaving the surface at P should start so it can't hit
+// that same surface again (Wachter & Binder, "A Fast and Robust Method for
+// Avoiding Self-Intersection", Ray Tracing Gems). The hit point is only
+// accurate to a few ulps of its coordinates, so it gets pushed off along the
+// normal by a fixed number of ulps, which scales with how big the coordinates
+// are, unlike a fixed epsilon on t which is too much close to the origin and
+// too little far away from it. Right next to zero the ulps get tiny, so there
+// it moves by a small fixed distance instead.
+//
+// Error is how far off the surface the hittable says P may already be (see
+// hit_record), the origin first moves that far along the normal. Normal can
+// face either way, the origin goes to the side Direction leaves on.
+#if RT_SINGLE_PRECISION
+typedef i32 real_bits;
+#define RAY_OFFSET_ULPS 256.0f
+#define RAY_OFFSET_NEAR_ZERO (1.0f / 65536.0f)
+#else
+typedef i64 real_bits;
+#define RAY_OFFSET_ULPS 4194304.0
+#define RAY_OFFSET_NEAR_ZERO (1.0 / 4294967296.0)
+#endif
+#define RAY_OFFSET_ORIGIN ((real)(1.0 / 32.0))
+
+inline vec3r
+OffsetRayOrigin(const vec3r &P, const vec3r &Normal, const vec3r &Direction, real Error)
+{
+    b32 Outwards = (Normal.x*Direction.x + Normal.y*Direction.y + Normal.z*Direction.z) >= 0;
+    real Offset[3];
+    for(i32 Axis = 0; Axis < 3; ++Axis)
+    {
+        real Push = Outwards ? Normal.E[Axis] : -Normal.E[Axis];
+        real Value = P.E[Axis] + Error*Push;
+        if(fabs(Value) < RAY_OFFSET_ORIGIN)
+        {
+            Offset[Axis] = Value + RAY_OFFSET_NEAR_ZERO*Push;
+        }
+        else
+        {
+            // NOTE: Adding to the bits of a float moves it by that many ulps,
+            // away from zero for positive integers on positive values, so the
+            // sign of the value flips the direction.
+            real_bits Ulps = (real_bits)(RAY_OFFSET_ULPS*Push);
+            real_bits Bits;
+            memcpy(&Bits, &Value, sizeof(Bits));
+            Bits += (Value < 0) ? -Ulps : Ulps;
+            memcpy(&Offset[Axis], &Bits, sizeof(Bits));
+        }
+    }
+
+    vec3r Result = Vec3r(Offset[0], Offset[1], Offset[2]);
+    return Result;
+}
+
 #define RAY_H
 #endif
\ No newline at end of file
@@ -0,0 +1,473 @@
+#if !defined(SAMPLER_H)
+
+#include "defines.h"
+#include "Vec.h"
+#include "BlueNoise.h"
+
+#include <cmath>
+#include <cstring>
+#include <memory>
+
+// NOTE: Samplers hand out the random numbers a camera sample uses, one
+// "dimension" at a time: the pixel position, then the lens, then the time,
+// then whatever every bounce asks for. The camera calls StartPixelSample()
+// before every sample and the dimension count restarts from zero, so the
+// N-th number a path asks for always comes from the same dimension of the
+// sequence. Which sequence is what makes the difference:
+//
+// - independent: plain Rand01(), every number on its own. This is what the
+//   renderer always did.
+// - halton: radical inverses in the first few prime bases, one base per
+//   dimension. Every pixel gets the same points, so each pixel has its
+//   sequence shifted by a random per pixel/dimension offset (Cranley-Patterson
+//   rotation) to stop neighbouring pixels from making the same mistakes.
+// - sobol: the first two Sobol dimensions, which together are a (0,2)
+//   sequence, Owen scrambled with a hash (Laine-Karras / Burley 2020).
+//   Dimensions are consumed in pairs and every pair gets its own scramble and
+//   its own shuffled sample order, which decorrelates the pairs from each
+//   other ("padding"). Any prefix of a power of two samples is stratified in
+//   every elementary interval of each pair.
+// - stratified: jittered strata, for any sample count. 1D dimensions split
+//   [0, 1) into SamplesPerPixel strata. 2D dimensions use the smallest
+//   near-square grid with at least that many cells, and when the count isn't
+//   a product of the grid sides only some cells get a sample. Every
+//   dimension shuffles which sample goes to which stratum, per pixel, so
+//   no two dimensions are correlated ("padding"), and the cells that get
+//   left out change from pixel to pixel. Every sample is still uniform on its
+//   own, so leaving cells out doesn't bias anything.
+// - bluenoise: for previews at a handful of samples. Every pixel gets the
+//   same scrambled Sobol points, shifted by a blue noise tile (Georgiev &
+//   Fajardo 2016, blue-noise dithered sampling). Neighbouring pixels get
+//   shifts far apart from each other, so their errors are too and what noise
+//   is left is high frequency, which the eye mostly blurs away. Per pixel it
+//   is about as good as sobol, it just looks cleaner at low sample counts.
+//   The gain is biggest where the integrand is smooth (sky light, defocus)
+//   and small where a few bounces hitting a small light decide everything.
+//
+// Samplers are not thread safe, every render thread makes its own.
+enum sampler_type : u32
+{
+    Sampler_Independent,
+    Sampler_Halton,
+    Sampler_Sobol,
+    Sampler_BlueNoise,
+    Sampler_Stratified,
+};
+
+inline u32
+ReverseBits32(u32 Value)
+{
+    Value = (Value << 16) | (Value >> 16);
+    Value = ((Value & 0x00FF00FFu) << 8) | ((Value & 0xFF00FF00u) >> 8);
+    Value = ((Value & 0x0F0F0F0Fu) << 4) | ((Value & 0xF0F0F0F0u) >> 4);
+    Value = ((Value & 0x33333333u) << 2) | ((Value & 0xCCCCCCCCu) >> 2);
+    Value = ((Value & 0x55555555u) << 1) | ((Value & 0xAAAAAAAAu) >> 1);
+    return Value;
+}
+
+// NOTE: Good enough avalanche for seeding scrambles (Chris Wellons' lowbias32).
+inline u32
+HashU32(u32 Value)
+{
+    Value ^= Value >> 16;
+    Value *= 0x7FEB352Du;
+    Value ^= Value >> 15;
+    Value *= 0x846CA68Bu;
+    Value ^= Value >> 16;
+    return Value;
+}
+
+inline u32
+HashCombine(u32 Seed, u32 Value)
+{
+    u32 Result = Seed ^ (HashU32(Value) + 0x9E3779B9u + (Seed << 6) + (Seed >> 2));
+    return Result;
+}
+
+// Maps 32 random bits to [0, 1).
+inline f64
+BitsToUnit(u32 Bits)
+{
+    f64 Result = Bits*(1.0 / 4294967296.0);
+    return Result;
+}
+
+// NOTE: Owen scrambling of a 32 bit fixed point number, working on its bits
+// reversed. Flipping a digit based on a hash of all the digits above it is the
+// same as a random permutation of every level of the elementary intervals, and
+// with the bits reversed a multiply carries the higher digits into the lower
+// ones (Laine-Karras). Staying with the reversed bits saves reversing twice.
+inline u32
+LaineKarrasPermutation(u32 Reversed, u32 Seed)
+{
+    Reversed += Seed;
+    Reversed ^= Reversed*0x6C50B47Cu;
+    Reversed ^= Reversed*0xB82F1E52u;
+    Reversed ^= Reversed*0xC7AFE638u;
+    Reversed ^= Reversed*0x8D22F6E6u;
+    return Reversed;
+}
+
+inline u32
+NestedUniformScramble(u32 Value, u32 Seed)
+{
+    u32 Result = ReverseBits32(LaineKarrasPermutation(ReverseBits32(Value), Seed));
+    return Result;
+}
+
+// NOTE: The first two Sobol dimensions, with their bits reversed. The first
+// one is the van der Corput sequence, so reversed it is the index itself, the
+// second one has the direction numbers of the primitive polynomial x + 1.
+inline u32
+Sobol0Reversed(u32 Index)
+{
+    u32 Result = Index;
+    return Result;
+}
+
+// NOTE: Its generator matrix is Pascal's triangle mod 2, which splits into
+// the same block pattern at every power of two, so instead of xoring in one
+// direction number per index bit it takes five shift-and-xor steps.
+inline u32
+Sobol1Reversed(u32 Index)
+{
+    u32 Result = Index;
+    Result ^= (Result >> 1) & 0x55555555u;
+    Result ^= (Result >> 2) & 0x33333333u;
+    Result ^= (Result >> 4) & 0x0F0F0F0Fu;
+    Result ^= (Result >> 8) & 0x00FF00FFu;
+    Result ^= (Result >> 16) & 0x0000FFFFu;
+    return Result;
+}
+
+// NOTE: Element Index of a random permutation of [0, Count), picked by Seed,
+// without building the permutation (Kensler 2013, "Correlated Multi-Jittered
+// Sampling"). Hashes inside the next power of two up and walks until the
+// result lands below Count.
+inline u32
+PermutationElement(u32 Index, u32 Count, u32 Seed)
+{
+    u32 Mask = Count - 1;
+    Mask |= Mask >> 1;
+    Mask |= Mask >> 2;
+    Mask |= Mask >> 4;
+    Mask |= Mask >> 8;
+    Mask |= Mask >> 16;
+    do
+    {
+        Index ^= Seed;
+        Index *= 0xE170893Du;
+        Index ^= Seed >> 16;
+        Index ^= (Index & Mask) >> 4;
+        Index ^= Seed >> 8;
+        Index *= 0x0929EB3Fu;
+        Index ^= Seed >> 23;
+        Index ^= (Index & Mask) >> 1;
+        Index *= 1 | (Seed >> 27);
+        Index *= 0x6935FA69u;
+        Index ^= (Index & Mask) >> 11;
+        Index *= 0x74DCB303u;
+        Index ^= (Index & Mask) >> 2;
+        Index *= 0x9E501CC3u;
+        Index ^= (Index & Mask) >> 2;
+        Index *= 0xC860A3DFu;
+        Index &= Mask;
+        Index ^= Index >> 5;
+    } while(Index >= Count);
+
+    u32 Result = (Index + Seed) % Count;
+    return Result;
+}
+
+inline f64
+RadicalInverse(u32 Base, u64 Index)
+{
+    f64 InverseBase = 1.0 / (f64)Base;
+    f64 Scale = InverseBase;
+    f64 Result = 0.0;
+    while(Index)
+    {
+        u64 Next = Index / Base;
+        u64 Digit = Index - Next*Base;
+        Result += Digit*Scale;
+        Scale *= InverseBase;
+        Index = Next;
+    }
+    // NOTE: Keep it in [0, 1) after the rounding of the sum above.
+    Result = (Result < 1.0) ? Result : 0x1.fffffffffffffp-1;
+    return Result;
+}
+
+class sampler
+{
+  public:
+    explicit sampler(u64 Seed = 0) : seed(HashCombine((u32)Seed, (u32)(Seed >> 32))) {}
+    virtual ~sampler() = default;
+
+    void
+    StartPixelSample(i32 X, i32 Y, i32 SampleIndex)
+    {
+        this->PixelX = X;
+        this->PixelY = Y;
+        this->PixelHash = HashCombine(HashCombine(this->seed, (u32)X), (u32)Y);
+        this->SampleIndex = SampleIndex;
+        this->Dimension = 0;
+    }
+
+    virtual f64 Get1D() = 0;
+    virtual vec2d Get2D() = 0;
+
+  protected:
+    u32 seed;
+    i32 PixelX = 0;
+    i32 PixelY = 0;
+    u32 PixelHash = 0;  // Seed and pixel hashed together, the base of every scramble.
+    i32 SampleIndex = 0;
+    u32 Dimension = 0;
+};
+
+class independent_sampler : public sampler
+{
+  public:
+    f64
+    Get1D() override
+    {
+        f64 Result = Rand01();
+        return Result;
+    }
+
+    vec2d
+    Get2D() override
+    {
+        f64 U = Rand01();
+        f64 V = Rand01();
+        vec2d Result = Vec2d(U, V);
+        return Result;
+    }
+};
+
+class halton_sampler : public sampler
+{
+  public:
+    explicit halton_sampler(u64 Seed) : sampler(Seed) {}
+
+    f64
+    Get1D() override
+    {
+        f64 Result = Sample(this->Dimension++);
+        return Result;
+    }
+
+    vec2d
+    Get2D() override
+    {
+        f64 U = Sample(this->Dimension++);
+        f64 V = Sample(this->Dimension++);
+        vec2d Result = Vec2d(U, V);
+        return Result;
+    }
+
+  private:
+    f64
+    Sample(u32 Dim) const
+    {
+        static const u32 Primes[] =
+        {
+            2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53,
+            59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 103, 107, 109, 113, 127, 131,
+        };
+        const u32 PrimeCount = sizeof(Primes) / sizeof(Primes[0]);
+
+        u32 Hash = HashCombine(this->PixelHash, Dim);
+
+        f64 Result;
+        if(Dim < PrimeCount)
+        {
+            // NOTE: Cranley-Patterson rotation, toroidal shift by a per
+            // pixel/dimension offset.
+            Result = RadicalInverse(Primes[Dim], (u64)this->SampleIndex) + BitsToUnit(Hash);
+            Result = (Result >= 1.0) ? (Result - 1.0) : Result;
+        }
+        else
+        {
+            // NOTE: The higher bases are badly correlated with each other for
+            // the first few hundred indices, deep bounces don't gain anything
+            // from them anyway.
+            Result = BitsToUnit(HashCombine(Hash, (u32)this->SampleIndex));
+        }
+
+        return Result;
+    }
+};
+
+class sobol_sampler : public sampler
+{
+  public:
+    explicit sobol_sampler(u64 Seed) : sampler(Seed) {}
+
+    f64
+    Get1D() override
+    {
+        u32 Hash = DimensionHash(this->Dimension++);
+        u32 Index = NestedUniformScramble((u32)this->SampleIndex, Hash);
+        u32 Bits = LaineKarrasPermutation(Sobol0Reversed(Index), HashU32(Hash));
+        f64 Result = BitsToUnit(ReverseBits32(Bits));
+        return Result;
+    }
+
+    vec2d
+    Get2D() override
+    {
+        u32 Hash = DimensionHash(this->Dimension);
+        this->Dimension += 2;
+
+        // NOTE: Shuffling the index with an Owen scramble keeps every power of
+        // two prefix of the samples the same set of points, only their order
+        // changes from one dimension pair to the next.
+        u32 Index = NestedUniformScramble((u32)this->SampleIndex, Hash);
+        u32 BitsU = LaineKarrasPermutation(Sobol0Reversed(Index), HashCombine(Hash, 0));
+        u32 BitsV = LaineKarrasPermutation(Sobol1Reversed(Index), HashCombine(Hash, 1));
+        f64 U = BitsToUnit(ReverseBits32(BitsU));
+        f64 V = BitsToUnit(ReverseBits32(BitsV));
+        vec2d Result = Vec2d(U, V);
+        return Result;
+    }
+
+  private:
+    u32
+    DimensionHash(u32 Dim) const
+    {
+        u32 Result = HashCombine(this->PixelHash, Dim);
+        return Result;
+    }
+};
+
+class blue_noise_sampler : public sampler
+{
+  public:
+    explicit blue_noise_sampler(u64 Seed) : sampler(Seed), tile(blue_noise_tile::Get()) {}
+
+    f64
+    Get1D() override
+    {
+        u32 Hash = HashCombine(this->seed, this->Dimension++);
+        u32 Index = NestedUniformScramble((u32)this->SampleIndex, Hash);
+        u32 Bits = LaineKarrasPermutation(Sobol0Reversed(Index), HashU32(Hash));
+        f64 Result = Shift(BitsToUnit(ReverseBits32(Bits)), Hash);
+        return Result;
+    }
+
+    vec2d
+    Get2D() override
+    {
+        u32 Hash = HashCombine(this->seed, this->Dimension);
+        this->Dimension += 2;
+
+        u32 Index = NestedUniformScramble((u32)this->SampleIndex, Hash);
+        u32 BitsU = LaineKarrasPermutation(Sobol0Reversed(Index), HashCombine(Hash, 0));
+        u32 BitsV = LaineKarrasPermutation(Sobol1Reversed(Index), HashCombine(Hash, 1));
+        f64 U = Shift(BitsToUnit(ReverseBits32(BitsU)), HashU32(Hash));
+        f64 V = Shift(BitsToUnit(ReverseBits32(BitsV)), HashU32(Hash + 1));
+        vec2d Result = Vec2d(U, V);
+        return Result;
+    }
+
+  private:
+    const blue_noise_tile &tile;
+
+    // NOTE: Cranley-Patterson rotation by the tile. Every dimension reads the
+    // tile at its own offset so the dimensions don't all shift together.
+    f64
+    Shift(f64 Value, u32 Hash) const
+    {
+        i32 OffsetX = (i32)(Hash & 0xFFFF);
+        i32 OffsetY = (i32)(Hash >> 16);
+        f64 Result = Value + this->tile.Value(this->PixelX + OffsetX, this->PixelY + OffsetY);
+        Result = (Result >= 1.0) ? (Result - 1.0) : Result;
+        return Result;
+    }
+};
+
+class stratified_sampler : public sampler
+{
+  public:
+    stratified_sampler(i32 SamplesPerPixel, u64 Seed)
+        : sampler(Seed), samplesPerPixel((SamplesPerPixel > 0) ? (u32)SamplesPerPixel : 1)
+    {
+        gridX = (u32)ceil(sqrt((f64)this->samplesPerPixel));
+        gridY = (this->samplesPerPixel + gridX - 1) / gridX;
+    }
+
+    f64
+    Get1D() override
+    {
+        u32 Hash = HashCombine(this->PixelHash, this->Dimension++);
+        u32 Stratum = PermutationElement((u32)this->SampleIndex, this->samplesPerPixel, Hash);
+        f64 Jitter = BitsToUnit(HashCombine(Hash, (u32)this->SampleIndex));
+        f64 Result = (Stratum + Jitter) / (f64)this->samplesPerPixel;
+        return Result;
+    }
+
+    vec2d
+    Get2D() override
+    {
+        u32 Hash = HashCombine(this->PixelHash, this->Dimension);
+        this->Dimension += 2;
+
+        u32 Cell = PermutationElement((u32)this->SampleIndex, this->gridX*this->gridY, Hash);
+        u32 Jitter = HashCombine(Hash, (u32)this->SampleIndex);
+        f64 U = ((Cell % this->gridX) + BitsToUnit(Jitter)) / (f64)this->gridX;
+        f64 V = ((Cell / this->gridX) + BitsToUnit(HashU32(Jitter))) / (f64)this->gridY;
+        vec2d Result = Vec2d(U, V);
+        return Result;
+    }
+
+  private:
+    u32 samplesPerPixel;
+    u32 gridX;
+    u32 gridY;
+};
+
+inline std::unique_ptr<sampler>
+MakeSampler(sampler_type Type, u64 Seed, i32 SamplesPerPixel)
+{
+    std::unique_ptr<sampler> Result;
+    switch(Type)
+    {
+        case Sampler_Independent: { Result = std::make_unique<independent_sampler>(); } break;
+        case Sampler_Halton:      { Result = std::make_unique<halton_sampler>(Seed); } break;
+        case Sampler_Sobol:       { Result = std::make_unique<sobol_sampler>(Seed); } break;
+        case Sampler_BlueNoise:   { Result = std::make_unique<blue_noise_sampler>(Seed); } break;
+        case Sampler_Stratified:  { Result = std::make_unique<stratified_sampler>(SamplesPerPixel, Seed); } break;
+    }
+    return Result;
+}
+
+// NOTE: "pmj02" is taken as another name for sobol: Owen scrambled Sobol pairs
+// are (0,2) sequences, the same stratification progressive multi-jittered
+// (0,2) points are built to have, without the tables.
+inline b32
+SamplerTypeFromName(const char *Name, sampler_type *Type)
+{
+    b32 Result = true;
+    if(strcmp(Name, "independent") == 0)                                 { *Type = Sampler_Independent; }
+    else if(strcmp(Name, "halton") == 0)                                 { *Type = Sampler_Halton; }
+    else if((strcmp(Name, "sobol") == 0) || (strcmp(Name, "pmj02") == 0)) { *Type = Sampler_Sobol; }
+    else if(strcmp(Name, "bluenoise") == 0)                              { *Type = Sampler_BlueNoise; }
+    else if(strcmp(Name, "stratified") == 0)                             { *Type = Sampler_Stratified; }
+    else                                                                 { Result = false; }
+    return Result;
+}
+
+inline const char *
+SamplerTypeName(sampler_type Type)
+{
+    const char *Result = (Type == Sampler_Independent) ? "independent" :
+                         (Type == Sampler_Halton) ? "halton" :
+                         (Type == Sampler_Sobol) ? "sobol" :
+                         (Type == Sampler_BlueNoise) ? "bluenoise" : "stratified";
+    return Result;
+}
+
+#define SAMPLER_H
+#endif
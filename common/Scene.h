@@ -0,0 +1,75 @@
+#if !defined(SCENE_H)
+
+#include "defines.h"
+#include "HittableList.h"
+#include "Camera.h"
+
+#include <string>
+
+// NOTE: Everything a scene needs besides its objects: where the camera is, what
+// it looks like and how the image gets rendered.
+struct scene_settings
+{
+    // Positioning and Orienting the Camera.
+    vec3r LookFrom = Vec3r(0, 0, 0);
+    vec3r LookAt = Vec3r(0, 0, -1);
+    // The Global UP Vector used for calculating the camera's basis vectors.
+    vec3r Up = Vec3r(0, 1, 0);
+    // NOTE: Decrease this FOV Vertical to zoom in.
+    real VerticalFOV = 40.0;
+    real AspectRatio = (16.0 / 9.0);
+
+    // NOTE: Depth of Field Parameters
+    // When objects are far from the focal distance then rays emanating from the
+    // camera after intersecting the focal plane diverge a lot(if the ray
+    // origins are different as we are doing here using the defocus disk), the
+    // divergence will be more for objects away from the focal plane hence
+    // blurring will be more for those objects.
+    // NOTE: Aperture basically. More this angle, more will be defocus blur.
+    real DefocusAngle = 0.0;
+    // NOTE: Objects close to this distance will be in focus.
+    real FocusDistance = 10.0;
+
+    // NOTE: Motion Blur Parameters
+    // This is the time interval when the shutter of the virtual camera is open.
+    real ShutterOpenTime = 0.;
+    real ShutterCloseTime = 1.;
+
+    i32 ImageWidth = 400;
+    i32 SamplesPerPixel = 100;
+    i32 MaxBounces = 50;
+    color Background = Color(0, 0, 0);
+    // NOTE: An HDR lat-long image lighting the scene from far away instead of
+    // Background (see Environment.h), .pfm or whatever stb reads (.hdr).
+    std::string EnvironmentFile;
+    real EnvironmentScale = 1;
+    // NOTE: The medium the camera is in, if any. Fog that fills the scene
+    // goes here rather than into a medium boundary around all of it.
+    std::shared_ptr<medium> Medium;
+};
+
+struct scene
+{
+    scene_settings Settings;
+    hittable_list World;
+    // NOTE: The lights in World, for the camera to sample.
+    std::shared_ptr<light_tree> Lights;
+    // NOTE: Settings.EnvironmentFile, loaded.
+    std::shared_ptr<environment_map> Environment;
+};
+
+camera
+MakeCamera(const scene_settings &Settings)
+{
+    camera Result = camera(Settings.LookFrom, Settings.LookAt, Settings.Up,
+                           Settings.VerticalFOV, Settings.ImageWidth, Settings.AspectRatio,
+                           Settings.DefocusAngle, Settings.FocusDistance,
+                           Settings.ShutterOpenTime, Settings.ShutterCloseTime);
+    Result.SamplesPerPixel = Settings.SamplesPerPixel;
+    Result.MaxBounces = Settings.MaxBounces;
+    Result.Medium = Settings.Medium.get();
+    return Result;
+}
+
+#define SCENE_H
+#endif
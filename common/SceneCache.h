@@ -0,0 +1,1083 @@
+#if !defined(SCENE_CACHE_H)
+
+#include "defines.h"
+#include "File.h"
+#include "HittableList.h"
+#include "BVH.h"
+#include "Scene.h"
+#include "Sphere.h"
+#include "MovingSphere.h"
+#include "AARect.h"
+#include "Box.h"
+#include "ConstantMedium.h"
+#include "Medium.h"
+#include "Material.h"
+#include "DiffuseLight.h"
+#include "Texture.h"
+#include "CheckerTexture.h"
+#include "NoiseTexture.h"
+#include "ImageTexture.h"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// NOTE: Binary scene + BVH cache.
+// The first run builds the scene like always and writes it out: a texture,
+// material and object table, the perlin tables of every noise texture, and the
+// flattened BVH of every group of objects (the top level list and every
+// bvh_node in the scene). Later runs memory map the file, recreate the objects
+// from the tables and use the BVH nodes straight out of the mapping, so nothing
+// gets rebuilt.
+//
+// Every table is an array of plain structs so the file can be used in place.
+// The file is only used if its SceneHash matches the hash of the scene being
+// asked for, its BVHs were built for the shutter the scene is rendered with,
+// and its version matches SCENE_CACHE_VERSION. Bump the version
+// whenever a record layout changes. The records are f64 whatever the build,
+// but the BVH nodes are used in place and are made of reals, so a file is
+// also only used by builds with the same precision (RealSize).
+//
+// The same file is also the binary form of a scene file (see SceneFile.h), in
+// which case it carries the scene's settings as well and is read with
+// SCENE_CACHE_ANY_HASH.
+#define SCENE_CACHE_MAGIC 0x4548434143454E53ull // "SNECACHE"
+#define SCENE_CACHE_VERSION 7
+#define SCENE_CACHE_NONE 0xFFFFFFFFu
+#define SCENE_CACHE_ANY_HASH 0ull
+
+enum scene_cache_texture_type : u32
+{
+    SceneCacheTexture_SolidColor,
+    SceneCacheTexture_Checker,
+    SceneCacheTexture_Noise,
+    SceneCacheTexture_Image,
+};
+
+enum scene_cache_material_type : u32
+{
+    SceneCacheMaterial_Lambertian,
+    SceneCacheMaterial_Metal,
+    SceneCacheMaterial_Dielectric,
+    SceneCacheMaterial_DiffuseLight,
+    SceneCacheMaterial_Isotropic,
+    // A phase_material with a Henyey-Greenstein phase function.
+    SceneCacheMaterial_HenyeyGreenstein,
+};
+
+enum scene_cache_object_type : u32
+{
+    SceneCacheObject_Sphere,
+    SceneCacheObject_MovingSphere,
+    SceneCacheObject_XYRect,
+    SceneCacheObject_XZRect,
+    SceneCacheObject_YZRect,
+    SceneCacheObject_Box,
+    SceneCacheObject_Translate,
+    SceneCacheObject_RotateY,
+    SceneCacheObject_ConstantMedium,
+    // A list of objects with its own flat BVH. Both hittable_list and bvh_node
+    // end up as groups.
+    SceneCacheObject_Group,
+    // A homogeneous_medium inside of a boundary.
+    SceneCacheObject_MediumBoundary,
+};
+
+struct scene_cache_texture
+{
+    u32 Type;
+    // Checker: Even and Odd texture. Noise: perlin table. Image: offset and
+    // length of the file name in the string table.
+    u32 A;
+    u32 B;
+    u32 Pad;
+    // Solid Color: the color. Noise: the frequency.
+    f64 Params[3];
+};
+
+struct scene_cache_material
+{
+    u32 Type;
+    u32 Texture;
+    // Metal: albedo and fuzz. Dielectric: index of refraction.
+    // Henyey-Greenstein: g.
+    f64 Params[4];
+};
+
+struct scene_cache_object
+{
+    u32 Type;
+    // Primitives: their material, SCENE_CACHE_NONE for bare boundaries.
+    // Constant Medium and Medium Boundary: the phase function.
+    u32 Material;
+    // Group: first entry in the children table. Translate, RotateY,
+    // ConstantMedium and MediumBoundary: the object they wrap.
+    u32 First;
+    // Group: number of children.
+    u32 Count;
+    // Group: the root node of its BVH in the node table.
+    u32 Node;
+    u32 Pad;
+    // Sphere: center, radius.
+    // Moving Sphere: center0, center1, time0, time1, radius.
+    // Rects: the two ranges and k, in constructor order.
+    // Box: min and max corner.
+    // Translate: offset. RotateY: angle in degrees.
+    // Constant Medium and Medium Boundary: density.
+    f64 Params[9];
+};
+
+struct scene_cache_perlin
+{
+    f64 RandVec[256][3];
+    i32 PermX[256];
+    i32 PermY[256];
+    i32 PermZ[256];
+};
+
+// NOTE: scene_settings, spelled out so the layout does not depend on vec3d.
+struct scene_cache_settings
+{
+    f64 LookFrom[3];
+    f64 LookAt[3];
+    f64 Up[3];
+    f64 VerticalFOV;
+    f64 AspectRatio;
+    f64 DefocusAngle;
+    f64 FocusDistance;
+    f64 ShutterOpenTime;
+    f64 ShutterCloseTime;
+    f64 Background[3];
+    i32 ImageWidth;
+    i32 SamplesPerPixel;
+    i32 MaxBounces;
+    i32 Pad;
+    f64 EnvironmentScale;
+    // Where the environment's file name is in the strings, and how long it is.
+    u32 EnvironmentFile;
+    u32 EnvironmentFileLength;
+};
+
+struct scene_cache_section
+{
+    u64 Offset;
+    u64 Count;
+};
+
+struct scene_cache_header
+{
+    u64 Magic;
+    u32 Version;
+    // The object the world list is made of.
+    u32 Root;
+    u64 SceneHash;
+    // The shutter the group BVHs were built for, moving objects are boxed
+    // over all of it.
+    f64 Time0;
+    f64 Time1;
+
+    scene_cache_section Textures;
+    scene_cache_section Materials;
+    scene_cache_section Objects;
+    scene_cache_section Children;
+    scene_cache_section Nodes;
+    scene_cache_section Perlins;
+    scene_cache_section Strings;
+
+    u32 HasSettings;
+    u32 RealSize;
+    scene_cache_settings Settings;
+};
+
+class scene_cache
+{
+  public:
+    // NOTE: 64 bit FNV-1a. Used to build the cache key out of whatever
+    // describes the scene (a scene file's contents, a scene function's name).
+    static u64 HashBytes(const void *Data, u64 Size, u64 Hash = 0xcbf29ce484222325ull);
+    static u64 HashString(const char *String, u64 Hash = 0xcbf29ce484222325ull);
+
+    // NOTE: Settings are optional on both ends. Reading with a Settings
+    // pointer fills it in only if the file has them. The BVHs are built over
+    // Time0..Time1, which has to be the shutter the world is rendered with.
+    // Reading with a Shutter only takes a file built for that one, a file
+    // with settings always has to be built for the shutter in them.
+    static b32 Write(const char *Filename, u64 SceneHash, const hittable_list &World,
+                     real Time0, real Time1, const scene_settings *Settings = nullptr);
+    static b32 Read(const char *Filename, u64 SceneHash, hittable_list &World,
+                    scene_settings *Settings = nullptr, const interval *Shutter = nullptr);
+
+    // NOTE: Loads the world from the cache file if it is there and was made
+    // for this SceneHash and shutter. Otherwise calls BuildScene and writes
+    // the cache for the next run.
+    static hittable_list LoadOrBuild(const char *Filename, u64 SceneHash, real Time0, real Time1,
+                                     hittable_list (*BuildScene)());
+
+  private:
+    struct writer
+    {
+        std::vector<scene_cache_texture> Textures;
+        std::vector<scene_cache_material> Materials;
+        std::vector<scene_cache_object> Objects;
+        std::vector<u32> Children;
+        std::vector<flat_bvh_node> Nodes;
+        std::vector<scene_cache_perlin> Perlins;
+        std::string Strings;
+
+        // Shared textures, materials and objects are written once.
+        std::unordered_map<const void *, u32> Indices;
+        real Time0;
+        real Time1;
+        b32 Failed = false;
+    };
+
+    static u32 AddTexture(writer &Writer, texture *Texture);
+    static u32 AddMaterial(writer &Writer, material *Material);
+    static u32 AddObject(writer &Writer, hittable *Object);
+    static u32 AddGroup(writer &Writer, const void *Key,
+                        const std::vector<hittable *> &Members);
+    static void CollectGroup(hittable *Object, std::vector<hittable *> &Members);
+
+    template <typename T>
+    static b32 SectionIsValid(const mapped_file &Mapped, const scene_cache_section &Section);
+    static b32 SettingsAreValid(const scene_cache_settings &Settings,
+                                const scene_cache_section &Strings);
+    static u64 CheckNodes(const flat_bvh_node *Nodes, u64 NodeCount, u64 Node, i32 Depth,
+                          u32 PrimitiveCount);
+};
+
+u64
+scene_cache::HashBytes(const void *Data, u64 Size, u64 Hash)
+{
+    const u8 *Bytes = (const u8 *)Data;
+    for(u64 Index = 0; Index < Size; ++Index)
+    {
+        Hash ^= Bytes[Index];
+        Hash *= 0x100000001b3ull;
+    }
+
+    return Hash;
+}
+
+u64
+scene_cache::HashString(const char *String, u64 Hash)
+{
+    u64 Result = HashBytes(String, strlen(String), Hash);
+    return Result;
+}
+
+u32
+scene_cache::AddTexture(writer &Writer, texture *Texture)
+{
+    auto Found = Writer.Indices.find(Texture);
+    if(Found != Writer.Indices.end())
+    {
+        return Found->second;
+    }
+
+    scene_cache_texture Record = {};
+    if(auto Solid = dynamic_cast<solid_color *>(Texture))
+    {
+        Record.Type = SceneCacheTexture_SolidColor;
+        for(i32 I = 0; I < 3; ++I) { Record.Params[I] = Solid->color_value.E[I]; }
+    }
+    else if(auto Checker = dynamic_cast<checker_texture *>(Texture))
+    {
+        Record.Type = SceneCacheTexture_Checker;
+        Record.A = AddTexture(Writer, Checker->even);
+        Record.B = AddTexture(Writer, Checker->odd);
+    }
+    else if(auto Noise = dynamic_cast<noise_texture *>(Texture))
+    {
+        Record.Type = SceneCacheTexture_Noise;
+        Record.Params[0] = Noise->frequency;
+        Record.A = (u32)Writer.Perlins.size();
+
+        scene_cache_perlin Tables;
+        const perlin &P = Noise->noise;
+        for(i32 I = 0; I < perlin::pointCount; ++I)
+        {
+            Tables.RandVec[I][0] = P.randVec[I].x;
+            Tables.RandVec[I][1] = P.randVec[I].y;
+            Tables.RandVec[I][2] = P.randVec[I].z;
+            Tables.PermX[I] = P.permX[I];
+            Tables.PermY[I] = P.permY[I];
+            Tables.PermZ[I] = P.permZ[I];
+        }
+        Writer.Perlins.push_back(Tables);
+    }
+    else if(auto Image = dynamic_cast<image_texture *>(Texture))
+    {
+        Record.Type = SceneCacheTexture_Image;
+        Record.A = (u32)Writer.Strings.size();
+        Record.B = (u32)Image->filename.size();
+        Writer.Strings += Image->filename;
+    }
+    else
+    {
+        fprintf(stderr, "Scene Cache: Unsupported texture type.\n");
+        Writer.Failed = true;
+    }
+
+    u32 Result = (u32)Writer.Textures.size();
+    Writer.Textures.push_back(Record);
+    Writer.Indices[Texture] = Result;
+    return Result;
+}
+
+u32
+scene_cache::AddMaterial(writer &Writer, material *Material)
+{
+    auto Found = Writer.Indices.find(Material);
+    if(Found != Writer.Indices.end())
+    {
+        return Found->second;
+    }
+
+    if(!Material)
+    {
+        return SCENE_CACHE_NONE;
+    }
+
+    scene_cache_material Record = {};
+    Record.Texture = SCENE_CACHE_NONE;
+    if(auto Lambertian = dynamic_cast<lambertian *>(Material))
+    {
+        Record.Type = SceneCacheMaterial_Lambertian;
+        Record.Texture = AddTexture(Writer, Lambertian->albedo);
+    }
+    else if(auto Metal = dynamic_cast<metal *>(Material))
+    {
+        Record.Type = SceneCacheMaterial_Metal;
+        for(i32 I = 0; I < 3; ++I) { Record.Params[I] = Metal->albedo.E[I]; }
+        Record.Params[3] = Metal->fuzz;
+    }
+    else if(auto Dielectric = dynamic_cast<dielectric *>(Material))
+    {
+        Record.Type = SceneCacheMaterial_Dielectric;
+        Record.Params[0] = Dielectric->indexOfRefraction;
+    }
+    else if(auto Light = dynamic_cast<diffuse_light *>(Material))
+    {
+        Record.Type = SceneCacheMaterial_DiffuseLight;
+        Record.Texture = AddTexture(Writer, Light->emitTexture);
+    }
+    else if(auto Isotropic = dynamic_cast<isotropic *>(Material))
+    {
+        Record.Type = SceneCacheMaterial_Isotropic;
+        Record.Texture = AddTexture(Writer, Isotropic->albedo);
+    }
+    else if(auto Phase = dynamic_cast<phase_material *>(Material))
+    {
+        // NOTE: isotropic_phase is Henyey-Greenstein with g = 0. Tables are
+        // not stored, a scene with one just doesn't get cached.
+        auto HG = dynamic_cast<henyey_greenstein *>(Phase->phase);
+        if(HG || dynamic_cast<isotropic_phase *>(Phase->phase))
+        {
+            Record.Type = SceneCacheMaterial_HenyeyGreenstein;
+            Record.Texture = AddTexture(Writer, Phase->albedo);
+            Record.Params[0] = HG ? HG->G() : 0.0;
+        }
+        else
+        {
+            fprintf(stderr, "Scene Cache: Unsupported phase function.\n");
+            Writer.Failed = true;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Scene Cache: Unsupported material type.\n");
+        Writer.Failed = true;
+    }
+
+    u32 Result = (u32)Writer.Materials.size();
+    Writer.Materials.push_back(Record);
+    Writer.Indices[Material] = Result;
+    return Result;
+}
+
+// NOTE: Collapses nested bvh_nodes and lists into one flat list of members.
+// The group gets a new BVH over all of them anyway.
+void
+scene_cache::CollectGroup(hittable *Object, std::vector<hittable *> &Members)
+{
+    if(auto Node = dynamic_cast<bvh_node *>(Object))
+    {
+        CollectGroup(Node->left, Members);
+        if(Node->right != Node->left)
+        {
+            CollectGroup(Node->right, Members);
+        }
+    }
+    else if(auto List = dynamic_cast<hittable_list *>(Object))
+    {
+        for(const auto &Member : List->Objects)
+        {
+            CollectGroup(Member, Members);
+        }
+    }
+    else
+    {
+        Members.push_back(Object);
+    }
+}
+
+u32
+scene_cache::AddGroup(writer &Writer, const void *Key,
+                      const std::vector<hittable *> &Members)
+{
+    std::vector<bvh_primitive> Primitives(Members.size());
+    std::unordered_map<const hittable *, u32> MemberIndex;
+    for(size_t Index = 0; Index < Members.size(); ++Index)
+    {
+        MemberIndex[Members[Index]] = AddObject(Writer, Members[Index]);
+
+        Primitives[Index].Object = Members[Index];
+        if(!Members[Index]->BoundingBox(Writer.Time0, Writer.Time1, Primitives[Index].Box))
+        {
+            fprintf(stderr, "Scene Cache: Group member without a bounding box.\n");
+            Writer.Failed = true;
+        }
+        Primitives[Index].Centroid = Primitives[Index].Box.Centroid();
+    }
+
+    std::vector<flat_bvh_node> Nodes;
+    flat_bvh::BuildNodes(Primitives, Nodes);
+
+    scene_cache_object Record = {};
+    Record.Type = SceneCacheObject_Group;
+    Record.Material = SCENE_CACHE_NONE;
+    Record.First = (u32)Writer.Children.size();
+    Record.Count = (u32)Primitives.size();
+    Record.Node = (u32)Writer.Nodes.size();
+
+    // NOTE: BuildNodes reordered the primitives into leaf order. The node
+    // offsets are relative to the group so they are stored as they are.
+    for(const bvh_primitive &Primitive : Primitives)
+    {
+        Writer.Children.push_back(MemberIndex[Primitive.Object]);
+    }
+    Writer.Nodes.insert(Writer.Nodes.end(), Nodes.begin(), Nodes.end());
+
+    u32 Result = (u32)Writer.Objects.size();
+    Writer.Objects.push_back(Record);
+    if(Key)
+    {
+        Writer.Indices[Key] = Result;
+    }
+    return Result;
+}
+
+u32
+scene_cache::AddObject(writer &Writer, hittable *Object)
+{
+    auto Found = Writer.Indices.find(Object);
+    if(Found != Writer.Indices.end())
+    {
+        return Found->second;
+    }
+
+    if(dynamic_cast<bvh_node *>(Object) ||
+       dynamic_cast<hittable_list *>(Object))
+    {
+        std::vector<hittable *> Members;
+        CollectGroup(Object, Members);
+
+        u32 Result = AddGroup(Writer, Object, Members);
+        return Result;
+    }
+
+    scene_cache_object Record = {};
+    Record.Material = SCENE_CACHE_NONE;
+    Record.First = SCENE_CACHE_NONE;
+    if(auto Sphere = dynamic_cast<sphere *>(Object))
+    {
+        Record.Type = SceneCacheObject_Sphere;
+        Record.Material = AddMaterial(Writer, Sphere->mat);
+        for(i32 I = 0; I < 3; ++I) { Record.Params[I] = Sphere->center.E[I]; }
+        Record.Params[3] = Sphere->radius;
+    }
+    else if(auto Moving = dynamic_cast<moving_sphere *>(Object))
+    {
+        Record.Type = SceneCacheObject_MovingSphere;
+        Record.Material = AddMaterial(Writer, Moving->materialPtr);
+        for(i32 I = 0; I < 3; ++I)
+        {
+            Record.Params[I] = Moving->center0.E[I];
+            Record.Params[3 + I] = Moving->center1.E[I];
+        }
+        Record.Params[6] = Moving->time0;
+        Record.Params[7] = Moving->time1;
+        Record.Params[8] = Moving->radius;
+    }
+    else if(auto XY = dynamic_cast<xy_rect *>(Object))
+    {
+        Record.Type = SceneCacheObject_XYRect;
+        Record.Material = AddMaterial(Writer, XY->mp);
+        f64 Params[] = {XY->x0, XY->x1, XY->y0, XY->y1, XY->k};
+        memcpy(Record.Params, Params, sizeof(Params));
+    }
+    else if(auto XZ = dynamic_cast<xz_rect *>(Object))
+    {
+        Record.Type = SceneCacheObject_XZRect;
+        Record.Material = AddMaterial(Writer, XZ->mp);
+        f64 Params[] = {XZ->x0, XZ->x1, XZ->z0, XZ->z1, XZ->k};
+        memcpy(Record.Params, Params, sizeof(Params));
+    }
+    else if(auto YZ = dynamic_cast<yz_rect *>(Object))
+    {
+        Record.Type = SceneCacheObject_YZRect;
+        Record.Material = AddMaterial(Writer, YZ->mp);
+        f64 Params[] = {YZ->y0, YZ->y1, YZ->z0, YZ->z1, YZ->k};
+        memcpy(Record.Params, Params, sizeof(Params));
+    }
+    else if(auto Box = dynamic_cast<box *>(Object))
+    {
+        Record.Type = SceneCacheObject_Box;
+        Record.Material = AddMaterial(Writer, Box->mat);
+        for(i32 I = 0; I < 3; ++I)
+        {
+            Record.Params[I] = Box->box_min.E[I];
+            Record.Params[3 + I] = Box->box_max.E[I];
+        }
+    }
+    else if(auto Translate = dynamic_cast<translate *>(Object))
+    {
+        Record.Type = SceneCacheObject_Translate;
+        Record.First = AddObject(Writer, Translate->hittablePtr);
+        for(i32 I = 0; I < 3; ++I) { Record.Params[I] = Translate->offset.E[I]; }
+    }
+    else if(auto Rotate = dynamic_cast<rotate_y *>(Object))
+    {
+        Record.Type = SceneCacheObject_RotateY;
+        Record.First = AddObject(Writer, Rotate->hittablePtr);
+        Record.Params[0] = atan2(Rotate->sin_theta, Rotate->cos_theta)*(180.0 / pi);
+    }
+    else if(auto Medium = dynamic_cast<constant_density_medium *>(Object))
+    {
+        Record.Type = SceneCacheObject_ConstantMedium;
+        Record.First = AddObject(Writer, Medium->boundary);
+        Record.Material = AddMaterial(Writer, Medium->phase_function);
+        Record.Params[0] = -1.0 / Medium->neg_inv_density;
+    }
+    else if(auto Boundary = dynamic_cast<medium_boundary *>(Object))
+    {
+        auto Homogeneous = dynamic_cast<homogeneous_medium *>(Boundary->interior);
+        if(Homogeneous && !Homogeneous->bounded)
+        {
+            Record.Type = SceneCacheObject_MediumBoundary;
+            Record.First = AddObject(Writer, Boundary->boundary);
+            Record.Material = AddMaterial(Writer, Homogeneous->phase_function);
+            Record.Params[0] = Homogeneous->density;
+        }
+        else
+        {
+            fprintf(stderr, "Scene Cache: Unsupported medium type.\n");
+            Writer.Failed = true;
+        }
+    }
+    else
+    {
+        fprintf(stderr, "Scene Cache: Unsupported hittable type.\n");
+        Writer.Failed = true;
+    }
+
+    u32 Result = (u32)Writer.Objects.size();
+    Writer.Objects.push_back(Record);
+    Writer.Indices[Object] = Result;
+    return Result;
+}
+
+b32
+scene_cache::Write(const char *Filename, u64 SceneHash, const hittable_list &World,
+                   real Time0, real Time1, const scene_settings *Settings)
+{
+    writer Writer;
+    Writer.Time0 = Time0;
+    Writer.Time1 = Time1;
+    u32 Root = AddGroup(Writer, nullptr, World.Objects);
+    if(Writer.Failed)
+    {
+        return false;
+    }
+
+    FILE *File = fopen(Filename, "wb");
+    if(!File)
+    {
+        fprintf(stderr, "There was an error opening file: %s\n", Filename);
+        return false;
+    }
+
+    scene_cache_header Header = {};
+    Header.Magic = SCENE_CACHE_MAGIC;
+    Header.Version = SCENE_CACHE_VERSION;
+    Header.RealSize = sizeof(real);
+    Header.Root = Root;
+    Header.SceneHash = SceneHash;
+    Header.Time0 = Time0;
+    Header.Time1 = Time1;
+    if(Settings)
+    {
+        scene_cache_settings &Record = Header.Settings;
+        Header.HasSettings = true;
+        for(i32 I = 0; I < 3; ++I)
+        {
+            Record.LookFrom[I] = Settings->LookFrom.E[I];
+            Record.LookAt[I] = Settings->LookAt.E[I];
+            Record.Up[I] = Settings->Up.E[I];
+            Record.Background[I] = Settings->Background.E[I];
+        }
+        Record.VerticalFOV = Settings->VerticalFOV;
+        Record.AspectRatio = Settings->AspectRatio;
+        Record.DefocusAngle = Settings->DefocusAngle;
+        Record.FocusDistance = Settings->FocusDistance;
+        Record.ShutterOpenTime = Settings->ShutterOpenTime;
+        Record.ShutterCloseTime = Settings->ShutterCloseTime;
+        Record.ImageWidth = Settings->ImageWidth;
+        Record.SamplesPerPixel = Settings->SamplesPerPixel;
+        Record.MaxBounces = Settings->MaxBounces;
+        Record.EnvironmentScale = Settings->EnvironmentScale;
+        Record.EnvironmentFile = (u32)Writer.Strings.size();
+        Record.EnvironmentFileLength = (u32)Settings->EnvironmentFile.size();
+        Writer.Strings += Settings->EnvironmentFile;
+    }
+
+    // NOTE: Sections are laid out one after the other, each one starting at a
+    // 16 byte boundary so they can be used in place from the mapped file.
+    u64 Offset = sizeof(scene_cache_header);
+    auto PlaceSection = [&Offset](scene_cache_section &Section, u64 Count, u64 ElementSize)
+    {
+        Offset = (Offset + 15) & ~15ull;
+        Section.Offset = Offset;
+        Section.Count = Count;
+        Offset += Count*ElementSize;
+    };
+    PlaceSection(Header.Textures, Writer.Textures.size(), sizeof(scene_cache_texture));
+    PlaceSection(Header.Materials, Writer.Materials.size(), sizeof(scene_cache_material));
+    PlaceSection(Header.Objects, Writer.Objects.size(), sizeof(scene_cache_object));
+    PlaceSection(Header.Children, Writer.Children.size(), sizeof(u32));
+    PlaceSection(Header.Nodes, Writer.Nodes.size(), sizeof(flat_bvh_node));
+    PlaceSection(Header.Perlins, Writer.Perlins.size(), sizeof(scene_cache_perlin));
+    PlaceSection(Header.Strings, Writer.Strings.size(), sizeof(char));
+
+    b32 Result = (fwrite(&Header, sizeof(Header), 1, File) == 1);
+    u64 Written = sizeof(Header);
+    auto WriteSection = [&](const scene_cache_section &Section, const void *Data, u64 ElementSize)
+    {
+        static const u8 Zeros[16] = {};
+        Result = Result && (fwrite(Zeros, 1, Section.Offset - Written, File) == (Section.Offset - Written));
+        if(Section.Count > 0)
+        {
+            Result = Result && (fwrite(Data, ElementSize, Section.Count, File) == Section.Count);
+        }
+        Written = Section.Offset + Section.Count*ElementSize;
+    };
+    WriteSection(Header.Textures, Writer.Textures.data(), sizeof(scene_cache_texture));
+    WriteSection(Header.Materials, Writer.Materials.data(), sizeof(scene_cache_material));
+    WriteSection(Header.Objects, Writer.Objects.data(), sizeof(scene_cache_object));
+    WriteSection(Header.Children, Writer.Children.data(), sizeof(u32));
+    WriteSection(Header.Nodes, Writer.Nodes.data(), sizeof(flat_bvh_node));
+    WriteSection(Header.Perlins, Writer.Perlins.data(), sizeof(scene_cache_perlin));
+    WriteSection(Header.Strings, Writer.Strings.data(), sizeof(char));
+
+    fclose(File);
+    if(!Result)
+    {
+        remove(Filename);
+    }
+
+    return Result;
+}
+
+template <typename T>
+b32
+scene_cache::SectionIsValid(const mapped_file &Mapped, const scene_cache_section &Section)
+{
+    b32 Result = ((Section.Offset % alignof(T)) == 0) &&
+                 (Section.Offset <= Mapped.Size) &&
+                 (Section.Count <= (Mapped.Size - Section.Offset) / sizeof(T));
+    return Result;
+}
+
+// NOTE: Same limits as a scene file's (see scene_file::ParseCamera).
+b32
+scene_cache::SettingsAreValid(const scene_cache_settings &Settings,
+                              const scene_cache_section &Strings)
+{
+    b32 Result = (Settings.ImageWidth > 0) && (Settings.SamplesPerPixel > 0) &&
+                 (Settings.AspectRatio > 0) &&
+                 (Settings.VerticalFOV > 0) && (Settings.VerticalFOV < 180) &&
+                 (((u64)Settings.EnvironmentFile + Settings.EnvironmentFileLength) <= Strings.Count);
+    return Result;
+}
+
+// NOTE: Walks the BVH of a group from Node down and returns the index of the
+// first node after it, or 0 if it's not a tree flat_bvh can walk: children
+// out of the table, leaves with primitives out of the group, interior nodes
+// too deep for its stack, or anything but the depth first layout BuildNodes
+// writes, where the second child comes right after the whole first one.
+u64
+scene_cache::CheckNodes(const flat_bvh_node *Nodes, u64 NodeCount, u64 Node, i32 Depth,
+                        u32 PrimitiveCount)
+{
+    u64 Result = 0;
+    const flat_bvh_node &Check = Nodes[Node];
+    if(Check.PrimitiveCount > 0)
+    {
+        if(((u64)Check.Offset + Check.PrimitiveCount) <= PrimitiveCount)
+        {
+            Result = Node + 1;
+        }
+    }
+    else if((Depth < FLAT_BVH_MAX_DEPTH) && (Check.Axis < 3) && ((Node + 1) < NodeCount))
+    {
+        u64 SecondChild = CheckNodes(Nodes, NodeCount, Node + 1, Depth + 1, PrimitiveCount);
+        if((SecondChild != 0) && (SecondChild == Check.Offset) && (SecondChild < NodeCount))
+        {
+            Result = CheckNodes(Nodes, NodeCount, SecondChild, Depth + 1, PrimitiveCount);
+        }
+    }
+
+    return Result;
+}
+
+b32
+scene_cache::Read(const char *Filename, u64 SceneHash, hittable_list &World,
+                  scene_settings *Settings, const interval *Shutter)
+{
+    mapped_file Mapped;
+    if(!MapFile(Filename, &Mapped))
+    {
+        return false;
+    }
+
+    // NOTE: The mapping lives as long as any flat_bvh that points into it.
+    std::shared_ptr<mapped_file> Storage(new mapped_file(Mapped),
+        [](mapped_file *File)
+        {
+            UnmapFile(File);
+            delete File;
+        });
+
+    const u8 *Base = (const u8 *)Mapped.Data;
+    const scene_cache_header *Header = (const scene_cache_header *)Base;
+    b32 Valid = (Mapped.Size >= sizeof(scene_cache_header)) &&
+                (Header->Magic == SCENE_CACHE_MAGIC) &&
+                (Header->Version == SCENE_CACHE_VERSION) &&
+                (Header->RealSize == sizeof(real)) &&
+                ((SceneHash == SCENE_CACHE_ANY_HASH) || (Header->SceneHash == SceneHash)) &&
+                (!Shutter || ((Header->Time0 == (f64)Shutter->Min) &&
+                              (Header->Time1 == (f64)Shutter->Max))) &&
+                SectionIsValid<scene_cache_texture>(Mapped, Header->Textures) &&
+                SectionIsValid<scene_cache_material>(Mapped, Header->Materials) &&
+                SectionIsValid<scene_cache_object>(Mapped, Header->Objects) &&
+                SectionIsValid<u32>(Mapped, Header->Children) &&
+                SectionIsValid<flat_bvh_node>(Mapped, Header->Nodes) &&
+                SectionIsValid<scene_cache_perlin>(Mapped, Header->Perlins) &&
+                SectionIsValid<char>(Mapped, Header->Strings) &&
+                (Header->Root < Header->Objects.Count) &&
+                (!Header->HasSettings || SettingsAreValid(Header->Settings, Header->Strings)) &&
+                (!Header->HasSettings || ((Header->Settings.ShutterOpenTime == Header->Time0) &&
+                                          (Header->Settings.ShutterCloseTime == Header->Time1)));
+    if(!Valid)
+    {
+        return false;
+    }
+
+    auto *Textures = (const scene_cache_texture *)(Base + Header->Textures.Offset);
+    auto *Materials = (const scene_cache_material *)(Base + Header->Materials.Offset);
+    auto *Objects = (const scene_cache_object *)(Base + Header->Objects.Offset);
+    auto *Children = (const u32 *)(Base + Header->Children.Offset);
+    auto *Nodes = (const flat_bvh_node *)(Base + Header->Nodes.Offset);
+    auto *Perlins = (const scene_cache_perlin *)(Base + Header->Perlins.Offset);
+    auto *Strings = (const char *)(Base + Header->Strings.Offset);
+
+    std::shared_ptr<scene_arena> Arena = std::make_shared<scene_arena>();
+
+    // NOTE: Records only ever point at records written before them, so every
+    // table can be rebuilt front to back in one pass. Anything pointing
+    // elsewhere, out of its table or at a record that isn't loaded yet, means
+    // the file is broken and it isn't used.
+    std::vector<texture *> LoadedTextures(Header->Textures.Count);
+    for(u64 Index = 0; Index < Header->Textures.Count; ++Index)
+    {
+        const scene_cache_texture &Record = Textures[Index];
+        switch(Record.Type)
+        {
+            case SceneCacheTexture_SolidColor:
+            {
+                LoadedTextures[Index] = Arena->New<solid_color>(
+                    Color(Record.Params[0], Record.Params[1], Record.Params[2]));
+            } break;
+
+            case SceneCacheTexture_Checker:
+            {
+                if((Record.A >= Index) || (Record.B >= Index))
+                {
+                    return false;
+                }
+                LoadedTextures[Index] = Arena->New<checker_texture>(
+                    LoadedTextures[Record.A], LoadedTextures[Record.B]);
+            } break;
+
+            case SceneCacheTexture_Noise:
+            {
+                if(Record.A >= Header->Perlins.Count)
+                {
+                    return false;
+                }
+
+                // NOTE: The permutations index the other tables.
+                const scene_cache_perlin &Tables = Perlins[Record.A];
+                vec3r RandVec[256];
+                for(i32 I = 0; I < 256; ++I)
+                {
+                    if(((u32)Tables.PermX[I] >= 256) || ((u32)Tables.PermY[I] >= 256) ||
+                       ((u32)Tables.PermZ[I] >= 256))
+                    {
+                        return false;
+                    }
+                    RandVec[I] = Vec3r(MakeVec3(Tables.RandVec[I]));
+                }
+                LoadedTextures[Index] = Arena->New<noise_texture>(
+                    Record.Params[0], RandVec, Tables.PermX, Tables.PermY, Tables.PermZ);
+            } break;
+
+            case SceneCacheTexture_Image:
+            {
+                if(((u64)Record.A + Record.B) > Header->Strings.Count)
+                {
+                    return false;
+                }
+                std::string Path(Strings + Record.A, Record.B);
+                LoadedTextures[Index] = Arena->New<image_texture>(Path.c_str());
+            } break;
+
+            default: { return false; }
+        }
+    }
+
+    std::vector<material *> LoadedMaterials(Header->Materials.Count);
+    for(u64 Index = 0; Index < Header->Materials.Count; ++Index)
+    {
+        const scene_cache_material &Record = Materials[Index];
+        const f64 *P = Record.Params;
+        b32 HasTexture = (Record.Type != SceneCacheMaterial_Metal) &&
+                         (Record.Type != SceneCacheMaterial_Dielectric);
+        if(HasTexture && (Record.Texture >= Header->Textures.Count))
+        {
+            return false;
+        }
+
+        switch(Record.Type)
+        {
+            case SceneCacheMaterial_Lambertian:
+            {
+                LoadedMaterials[Index] = Arena->New<lambertian>(LoadedTextures[Record.Texture]);
+            } break;
+
+            case SceneCacheMaterial_Metal:
+            {
+                LoadedMaterials[Index] = Arena->New<metal>(Color(P[0], P[1], P[2]), P[3]);
+            } break;
+
+            case SceneCacheMaterial_Dielectric:
+            {
+                LoadedMaterials[Index] = Arena->New<dielectric>(P[0]);
+            } break;
+
+            case SceneCacheMaterial_DiffuseLight:
+            {
+                LoadedMaterials[Index] = Arena->New<diffuse_light>(LoadedTextures[Record.Texture]);
+            } break;
+
+            case SceneCacheMaterial_Isotropic:
+            {
+                LoadedMaterials[Index] = Arena->New<isotropic>(LoadedTextures[Record.Texture]);
+            } break;
+
+            case SceneCacheMaterial_HenyeyGreenstein:
+            {
+                LoadedMaterials[Index] = Arena->New<phase_material>(
+                    LoadedTextures[Record.Texture], Arena->New<henyey_greenstein>(P[0]));
+            } break;
+
+            default: { return false; }
+        }
+    }
+
+    std::vector<hittable *> LoadedObjects(Header->Objects.Count);
+    for(u64 Index = 0; Index < Header->Objects.Count; ++Index)
+    {
+        const scene_cache_object &Record = Objects[Index];
+        const f64 *P = Record.Params;
+        material *Material = nullptr;
+        if(Record.Material != SCENE_CACHE_NONE)
+        {
+            if(Record.Material >= Header->Materials.Count)
+            {
+                return false;
+            }
+            Material = LoadedMaterials[Record.Material];
+        }
+
+        // NOTE: Whatever wraps another object, the object has to be loaded.
+        b32 Wraps = (Record.Type == SceneCacheObject_Translate) ||
+                    (Record.Type == SceneCacheObject_RotateY) ||
+                    (Record.Type == SceneCacheObject_ConstantMedium) ||
+                    (Record.Type == SceneCacheObject_MediumBoundary);
+        if(Wraps && (Record.First >= Index))
+        {
+            return false;
+        }
+
+        switch(Record.Type)
+        {
+            case SceneCacheObject_Sphere:
+            {
+                LoadedObjects[Index] = Arena->New<sphere>(Vec3r(P[0], P[1], P[2]), P[3], Material);
+            } break;
+
+            case SceneCacheObject_MovingSphere:
+            {
+                LoadedObjects[Index] = Arena->New<moving_sphere>(Vec3r(P[0], P[1], P[2]),
+                                                                 Vec3r(P[3], P[4], P[5]),
+                                                                 P[6], P[7], P[8], Material);
+            } break;
+
+            case SceneCacheObject_XYRect:
+            {
+                LoadedObjects[Index] = Arena->New<xy_rect>(P[0], P[1], P[2], P[3], P[4], Material);
+            } break;
+
+            case SceneCacheObject_XZRect:
+            {
+                LoadedObjects[Index] = Arena->New<xz_rect>(P[0], P[1], P[2], P[3], P[4], Material);
+            } break;
+
+            case SceneCacheObject_YZRect:
+            {
+                LoadedObjects[Index] = Arena->New<yz_rect>(P[0], P[1], P[2], P[3], P[4], Material);
+            } break;
+
+            case SceneCacheObject_Box:
+            {
+                LoadedObjects[Index] = Arena->New<box>(Vec3r(P[0], P[1], P[2]),
+                                                       Vec3r(P[3], P[4], P[5]), Material);
+            } break;
+
+            case SceneCacheObject_Translate:
+            {
+                LoadedObjects[Index] = Arena->New<translate>(LoadedObjects[Record.First],
+                                                             Vec3r(P[0], P[1], P[2]));
+            } break;
+
+            case SceneCacheObject_RotateY:
+            {
+                LoadedObjects[Index] = Arena->New<rotate_y>(LoadedObjects[Record.First], P[0]);
+            } break;
+
+            case SceneCacheObject_ConstantMedium:
+            {
+                LoadedObjects[Index] = Arena->New<constant_density_medium>(
+                    LoadedObjects[Record.First], P[0], Material);
+            } break;
+
+            case SceneCacheObject_MediumBoundary:
+            {
+                LoadedObjects[Index] = Arena->New<medium_boundary>(
+                    LoadedObjects[Record.First],
+                    Arena->New<homogeneous_medium>(P[0], Material));
+            } break;
+
+            case SceneCacheObject_Group:
+            {
+                if((Record.First + (u64)Record.Count > Header->Children.Count) ||
+                   ((Record.Count > 0) && (Record.Node >= Header->Nodes.Count)))
+                {
+                    return false;
+                }
+
+                // NOTE: Node offsets are relative to the group's first node.
+                if((Record.Count > 0) &&
+                   (CheckNodes(Nodes + Record.Node, Header->Nodes.Count - Record.Node, 0, 0,
+                               Record.Count) == 0))
+                {
+                    return false;
+                }
+
+                std::vector<hittable *> Members(Record.Count);
+                for(u32 Member = 0; Member < Record.Count; ++Member)
+                {
+                    u32 Child = Children[Record.First + Member];
+                    if(Child >= Index)
+                    {
+                        return false;
+                    }
+                    Members[Member] = LoadedObjects[Child];
+                }
+                LoadedObjects[Index] = Arena->New<flat_bvh>(std::move(Members),
+                                                            Nodes + Record.Node, Storage);
+            } break;
+
+            default: { return false; }
+        }
+    }
+
+    World.Clear();
+    World.Add(LoadedObjects[Header->Root]);
+    World.Arena = Arena;
+
+    if(Settings && Header->HasSettings)
+    {
+        const scene_cache_settings &Record = Header->Settings;
+        Settings->LookFrom = Vec3r(MakeVec3(Record.LookFrom));
+        Settings->LookAt = Vec3r(MakeVec3(Record.LookAt));
+        Settings->Up = Vec3r(MakeVec3(Record.Up));
+        Settings->Background = Vec3r(MakeVec3(Record.Background));
+        Settings->VerticalFOV = Record.VerticalFOV;
+        Settings->AspectRatio = Record.AspectRatio;
+        Settings->DefocusAngle = Record.DefocusAngle;
+        Settings->FocusDistance = Record.FocusDistance;
+        Settings->ShutterOpenTime = Record.ShutterOpenTime;
+        Settings->ShutterCloseTime = Record.ShutterCloseTime;
+        Settings->ImageWidth = Record.ImageWidth;
+        Settings->SamplesPerPixel = Record.SamplesPerPixel;
+        Settings->MaxBounces = Record.MaxBounces;
+        Settings->EnvironmentScale = Record.EnvironmentScale;
+        Settings->EnvironmentFile.assign(Strings + Record.EnvironmentFile,
+                                         Record.EnvironmentFileLength);
+    }
+
+    return true;
+}
+
+hittable_list
+scene_cache::LoadOrBuild(const char *Filename, u64 SceneHash, real Time0, real Time1,
+                         hittable_list (*BuildScene)())
+{
+    hittable_list Result;
+    interval Shutter = interval(Time0, Time1);
+    if(Read(Filename, SceneHash, Result, nullptr, &Shutter))
+    {
+        fprintf(stderr, "Loaded the scene from the cache: %s\n", Filename);
+    }
+    else
+    {
+        hittable_list World = BuildScene();
+
+        // NOTE: Read back what was just written so the first run renders the
+        // exact same thing as every later run does.
+        if(!Write(Filename, SceneHash, World, Time0, Time1) ||
+           !Read(Filename, SceneHash, Result, nullptr, &Shutter))
+        {
+            fprintf(stderr, "Could not write the scene cache: %s\n", Filename);
+            Result = World;
+        }
+    }
+
+    return Result;
+}
+
+#define SCENE_CACHE_H
+#endif
@@ -0,0 +1,987 @@
+#if !defined(SCENE_FILE_H)
+
+#include "defines.h"
+#include "File.h"
+#include "Scene.h"
+#include "SceneCache.h"
+#include "GridMedium.h"
+
+#include <charconv>
+#include <cstdarg>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// NOTE: Text scene files.
+// One statement per line, '#' starts a comment. Names are whatever does not
+// have spaces in it, file paths can be put in double quotes. Anything that
+// takes a <color> also takes the name of a texture instead of the 3 numbers.
+//
+//   camera   lookfrom x y z  lookat x y z  up x y z  vfov deg  aspect a
+//            defocus_angle deg  focus_distance d  shutter t0 t1
+//   render   width w  samples n  bounces n  background r g b
+//            environment "<path>"  environment_scale s
+//
+//   texture  <name> solid r g b
+//   texture  <name> checker <even texture> <odd texture>
+//   texture  <name> noise <frequency>
+//   texture  <name> image "<path relative to the scene file>"
+//
+//   material <name> lambertian <color>
+//   material <name> metal r g b <fuzz>
+//   material <name> dielectric <index of refraction>
+//   material <name> light <color>
+//   material <name> isotropic <color>
+//   material <name> henyey_greenstein <color> <g>
+//
+//   sphere        <material> cx cy cz radius
+//   moving_sphere <material> x0 y0 z0 x1 y1 z1 t0 t1 radius
+//   xy_rect       <material> x0 x1 y0 y1 k      (xz_rect, yz_rect alike)
+//   box           <material> minx miny minz maxx maxy maxz
+//   medium        <object> <density> <phase>
+//   grid_medium   "<raw file>" nx ny nz minx miny minz maxx maxy maxz <density> <phase>
+//   instance      <object>
+//
+//   object <name>
+//       ...any of the object statements above...
+//   end
+//
+// Every object statement can be followed by transforms, which are applied in
+// the order they are written: "rotate_y deg" and "translate x y z". An object
+// block is not part of the scene itself, it is put there with "instance" or
+// used as the boundary of a "medium", as often as needed.
+//
+// The <phase> of a medium is a color, which scatters the same in every
+// direction, or the name of a henyey_greenstein material, whose g is the mean
+// cosine of the scattering angle: 0 isotropic, towards 1 forward like haze.
+//
+// The environment is an HDR lat-long image, .pfm or .hdr, with +y at the top,
+// which lights the scene from every direction instead of the background color.
+// environment_scale multiplies it.
+//
+// The raw file of a grid_medium is nx*ny*nz little endian 32 bit floats, x
+// fastest, scaled by <density>. It only gets read through a mapping while the
+// bricks are built (see GridMedium.h), it is not loaded whole.
+//
+// The file is parsed in one pass straight out of the memory mapped file. No
+// tokens get copied or kept around besides the names in the lookup tables, so
+// loading time grows linearly with the file size.
+//
+// The binary form of a scene file is a scene cache file with the settings in it
+// (see SceneCache.h). Load() takes either one. Text files also get a
+// <file>.rtcache next to them, keyed on the hash of the text, so the parsing
+// and BVH building only happens after the file changed.
+class scene_file
+{
+  public:
+    static b32 Load(const char *Filename, scene &Scene, b32 UseCache = true);
+    static b32 Parse(const char *Text, u64 Size, const char *Filename, scene &Scene);
+    static b32 WriteBinary(const char *Filename, const scene &Scene, u64 SourceHash = 0);
+
+  private:
+    struct parser
+    {
+        const char *At;
+        const char *End;
+        const char *Filename;
+        std::string Directory;
+        scene_arena *Arena;
+        i32 Line = 1;
+        b32 Failed = false;
+
+        std::unordered_map<std::string_view, texture *> Textures;
+        std::unordered_map<std::string_view, material *> Materials;
+        std::unordered_map<std::string_view, hittable *> Objects;
+
+        // NOTE: Set while inside an object block.
+        std::string_view ObjectName;
+        std::vector<hittable *> ObjectMembers;
+    };
+
+    static b32 Error(parser &Parser, const char *Format, ...);
+    static b32 NextToken(parser &Parser, std::string_view &Token);
+    static b32 NextStatement(parser &Parser);
+    static b32 EndStatement(parser &Parser);
+
+    static b32 ReadNumber(parser &Parser, real &Number);
+    static b32 ReadInteger(parser &Parser, i32 &Number);
+    static b32 ReadVec3(parser &Parser, vec3r &Vector);
+    static b32 ReadName(parser &Parser, std::string_view &Name);
+    static texture *ReadColor(parser &Parser);
+    static material *ReadPhase(parser &Parser);
+    static material *ReadMaterial(parser &Parser);
+    static hittable *ReadObjectName(parser &Parser);
+
+    static b32 ParseCamera(parser &Parser, scene_settings &Settings);
+    static b32 ParseRender(parser &Parser, scene_settings &Settings);
+    static b32 ParseTexture(parser &Parser);
+    static b32 ParseMaterial(parser &Parser);
+    static hittable *ParseTransforms(parser &Parser, hittable *Object);
+    static hittable *ParseObject(parser &Parser, std::string_view Keyword);
+};
+
+b32
+scene_file::Error(parser &Parser, const char *Format, ...)
+{
+    fprintf(stderr, "%s(%d): ", Parser.Filename, Parser.Line);
+
+    va_list Args;
+    va_start(Args, Format);
+    vfprintf(stderr, Format, Args);
+    va_end(Args);
+
+    fprintf(stderr, "\n");
+    Parser.Failed = true;
+    return false;
+}
+
+// NOTE: The next token on the current line. Returns false at the end of the
+// line without going past it.
+b32
+scene_file::NextToken(parser &Parser, std::string_view &Token)
+{
+    const char *At = Parser.At;
+    while((At < Parser.End) && ((*At == ' ') || (*At == '\t') || (*At == '\r')))
+    {
+        ++At;
+    }
+
+    if((At == Parser.End) || (*At == '\n') || (*At == '#'))
+    {
+        while((At < Parser.End) && (*At != '\n'))
+        {
+            ++At;
+        }
+        Parser.At = At;
+        return false;
+    }
+
+    const char *Begin = At;
+    if(*At == '"')
+    {
+        ++Begin;
+        ++At;
+        while((At < Parser.End) && (*At != '"') && (*At != '\n'))
+        {
+            ++At;
+        }
+        if((At == Parser.End) || (*At != '"'))
+        {
+            Parser.At = At;
+            return Error(Parser, "Missing closing quote.");
+        }
+        Token = std::string_view(Begin, At - Begin);
+        Parser.At = At + 1;
+    }
+    else
+    {
+        while((At < Parser.End) && (*At != ' ') && (*At != '\t') &&
+              (*At != '\r') && (*At != '\n') && (*At != '#'))
+        {
+            ++At;
+        }
+        Token = std::string_view(Begin, At - Begin);
+        Parser.At = At;
+    }
+
+    return true;
+}
+
+// NOTE: Skips to the next line that has something on it.
+b32
+scene_file::NextStatement(parser &Parser)
+{
+    std::string_view Token;
+    while(Parser.At < Parser.End)
+    {
+        const char *LineStart = Parser.At;
+        if(NextToken(Parser, Token))
+        {
+            Parser.At = LineStart;
+            return true;
+        }
+
+        if(Parser.Failed)
+        {
+            return false;
+        }
+
+        if(Parser.At < Parser.End)
+        {
+            ++Parser.At;
+            ++Parser.Line;
+        }
+    }
+
+    return false;
+}
+
+b32
+scene_file::EndStatement(parser &Parser)
+{
+    std::string_view Token;
+    if(NextToken(Parser, Token))
+    {
+        return Error(Parser, "Unexpected '%.*s'.", (i32)Token.size(), Token.data());
+    }
+
+    return !Parser.Failed;
+}
+
+b32
+scene_file::ReadNumber(parser &Parser, real &Number)
+{
+    std::string_view Token;
+    if(!NextToken(Parser, Token))
+    {
+        return Error(Parser, "Expected a number.");
+    }
+
+    const char *Begin = Token.data();
+    const char *End = Begin + Token.size();
+    auto [Ptr, Code] = std::from_chars(Begin, End, Number);
+    if((Code != std::errc()) || (Ptr != End))
+    {
+        return Error(Parser, "Expected a number, got '%.*s'.", (i32)Token.size(), Token.data());
+    }
+
+    return true;
+}
+
+b32
+scene_file::ReadInteger(parser &Parser, i32 &Number)
+{
+    std::string_view Token;
+    if(!NextToken(Parser, Token))
+    {
+        return Error(Parser, "Expected a number.");
+    }
+
+    const char *Begin = Token.data();
+    const char *End = Begin + Token.size();
+    auto [Ptr, Code] = std::from_chars(Begin, End, Number);
+    if((Code != std::errc()) || (Ptr != End))
+    {
+        return Error(Parser, "Expected a whole number, got '%.*s'.", (i32)Token.size(), Token.data());
+    }
+
+    return true;
+}
+
+b32
+scene_file::ReadVec3(parser &Parser, vec3r &Vector)
+{
+    b32 Result = ReadNumber(Parser, Vector.x) &&
+                 ReadNumber(Parser, Vector.y) &&
+                 ReadNumber(Parser, Vector.z);
+    return Result;
+}
+
+b32
+scene_file::ReadName(parser &Parser, std::string_view &Name)
+{
+    if(!NextToken(Parser, Name))
+    {
+        return Error(Parser, "Expected a name.");
+    }
+
+    return true;
+}
+
+// NOTE: Either 3 numbers, which make a solid color, or the name of a texture.
+texture *
+scene_file::ReadColor(parser &Parser)
+{
+    const char *Start = Parser.At;
+    std::string_view Token;
+    if(!NextToken(Parser, Token))
+    {
+        Error(Parser, "Expected a color or a texture.");
+        return nullptr;
+    }
+
+    auto Found = Parser.Textures.find(Token);
+    if(Found != Parser.Textures.end())
+    {
+        return Found->second;
+    }
+
+    Parser.At = Start;
+    vec3r Value;
+    if(!ReadVec3(Parser, Value))
+    {
+        return nullptr;
+    }
+
+    auto Result = Parser.Arena->New<solid_color>(Value);
+    return Result;
+}
+
+// NOTE: What a medium scatters with: the name of a material, or a color or
+// texture, which scatters isotropically.
+material *
+scene_file::ReadPhase(parser &Parser)
+{
+    const char *Start = Parser.At;
+    std::string_view Token;
+    if(NextToken(Parser, Token))
+    {
+        auto Found = Parser.Materials.find(Token);
+        if(Found != Parser.Materials.end())
+        {
+            return Found->second;
+        }
+    }
+
+    Parser.At = Start;
+    material *Result = nullptr;
+    texture *Albedo = ReadColor(Parser);
+    if(Albedo)
+    {
+        Result = Parser.Arena->New<isotropic>(Albedo);
+    }
+    return Result;
+}
+
+material *
+scene_file::ReadMaterial(parser &Parser)
+{
+    std::string_view Name;
+    if(!ReadName(Parser, Name))
+    {
+        return nullptr;
+    }
+
+    auto Found = Parser.Materials.find(Name);
+    if(Found == Parser.Materials.end())
+    {
+        Error(Parser, "Unknown material '%.*s'.", (i32)Name.size(), Name.data());
+        return nullptr;
+    }
+
+    return Found->second;
+}
+
+hittable *
+scene_file::ReadObjectName(parser &Parser)
+{
+    std::string_view Name;
+    if(!ReadName(Parser, Name))
+    {
+        return nullptr;
+    }
+
+    auto Found = Parser.Objects.find(Name);
+    if(Found == Parser.Objects.end())
+    {
+        Error(Parser, "Unknown object '%.*s'.", (i32)Name.size(), Name.data());
+        return nullptr;
+    }
+
+    return Found->second;
+}
+
+b32
+scene_file::ParseCamera(parser &Parser, scene_settings &Settings)
+{
+    std::string_view Key;
+    while(NextToken(Parser, Key))
+    {
+        b32 Valid = true;
+        if(Key == "lookfrom")            { Valid = ReadVec3(Parser, Settings.LookFrom); }
+        else if(Key == "lookat")         { Valid = ReadVec3(Parser, Settings.LookAt); }
+        else if(Key == "up")             { Valid = ReadVec3(Parser, Settings.Up); }
+        else if(Key == "vfov")
+        {
+            Valid = ReadNumber(Parser, Settings.VerticalFOV);
+            if(Valid && !((Settings.VerticalFOV > 0) && (Settings.VerticalFOV < 180)))
+            {
+                return Error(Parser, "The vfov has to be between 0 and 180 degrees.");
+            }
+        }
+        else if(Key == "aspect")
+        {
+            Valid = ReadNumber(Parser, Settings.AspectRatio);
+            if(Valid && !(Settings.AspectRatio > 0))
+            {
+                return Error(Parser, "The aspect ratio has to be positive.");
+            }
+        }
+        else if(Key == "defocus_angle")  { Valid = ReadNumber(Parser, Settings.DefocusAngle); }
+        else if(Key == "focus_distance") { Valid = ReadNumber(Parser, Settings.FocusDistance); }
+        else if(Key == "shutter")
+        {
+            Valid = ReadNumber(Parser, Settings.ShutterOpenTime) &&
+                    ReadNumber(Parser, Settings.ShutterCloseTime);
+        }
+        else
+        {
+            return Error(Parser, "Unknown camera setting '%.*s'.", (i32)Key.size(), Key.data());
+        }
+
+        if(!Valid)
+        {
+            return false;
+        }
+    }
+
+    return !Parser.Failed;
+}
+
+b32
+scene_file::ParseRender(parser &Parser, scene_settings &Settings)
+{
+    std::string_view Key;
+    while(NextToken(Parser, Key))
+    {
+        b32 Valid = true;
+        if(Key == "width")
+        {
+            Valid = ReadInteger(Parser, Settings.ImageWidth);
+            if(Valid && (Settings.ImageWidth <= 0))
+            {
+                return Error(Parser, "The width has to be positive.");
+            }
+        }
+        else if(Key == "samples")
+        {
+            Valid = ReadInteger(Parser, Settings.SamplesPerPixel);
+            if(Valid && (Settings.SamplesPerPixel <= 0))
+            {
+                return Error(Parser, "The samples have to be positive.");
+            }
+        }
+        else if(Key == "bounces")    { Valid = ReadInteger(Parser, Settings.MaxBounces); }
+        else if(Key == "background") { Valid = ReadVec3(Parser, Settings.Background); }
+        else if(Key == "environment_scale") { Valid = ReadNumber(Parser, Settings.EnvironmentScale); }
+        else if(Key == "environment")
+        {
+            std::string_view Path;
+            Valid = ReadName(Parser, Path);
+            if(Valid)
+            {
+                b32 IsAbsolute = (Path[0] == '/') || (Path[0] == '\\') ||
+                                 ((Path.size() > 1) && (Path[1] == ':'));
+                Settings.EnvironmentFile = IsAbsolute ? std::string(Path) : Parser.Directory + std::string(Path);
+            }
+        }
+        else
+        {
+            return Error(Parser, "Unknown render setting '%.*s'.", (i32)Key.size(), Key.data());
+        }
+
+        if(!Valid)
+        {
+            return false;
+        }
+    }
+
+    return !Parser.Failed;
+}
+
+b32
+scene_file::ParseTexture(parser &Parser)
+{
+    std::string_view Name, Type;
+    if(!ReadName(Parser, Name) || !ReadName(Parser, Type))
+    {
+        return false;
+    }
+
+    texture *Texture = nullptr;
+    if(Type == "solid")
+    {
+        vec3r Value;
+        if(ReadVec3(Parser, Value))
+        {
+            Texture = Parser.Arena->New<solid_color>(Value);
+        }
+    }
+    else if(Type == "checker")
+    {
+        texture *Even = ReadColor(Parser);
+        texture *Odd = Even ? ReadColor(Parser) : nullptr;
+        if(Odd)
+        {
+            Texture = Parser.Arena->New<checker_texture>(Even, Odd);
+        }
+    }
+    else if(Type == "noise")
+    {
+        real Frequency;
+        if(ReadNumber(Parser, Frequency))
+        {
+            Texture = Parser.Arena->New<noise_texture>(Frequency);
+        }
+    }
+    else if(Type == "image")
+    {
+        std::string_view Path;
+        if(ReadName(Parser, Path))
+        {
+            b32 IsAbsolute = (Path[0] == '/') || (Path[0] == '\\') ||
+                             ((Path.size() > 1) && (Path[1] == ':'));
+            std::string FullPath = IsAbsolute ? std::string(Path) : Parser.Directory + std::string(Path);
+            Texture = Parser.Arena->New<image_texture>(FullPath.c_str());
+        }
+    }
+    else
+    {
+        return Error(Parser, "Unknown texture type '%.*s'.", (i32)Type.size(), Type.data());
+    }
+
+    if(!Texture)
+    {
+        return false;
+    }
+
+    Parser.Textures[Name] = Texture;
+    return true;
+}
+
+b32
+scene_file::ParseMaterial(parser &Parser)
+{
+    std::string_view Name, Type;
+    if(!ReadName(Parser, Name) || !ReadName(Parser, Type))
+    {
+        return false;
+    }
+
+    material *Material = nullptr;
+    if(Type == "lambertian")
+    {
+        texture *Albedo = ReadColor(Parser);
+        if(Albedo)
+        {
+            Material = Parser.Arena->New<lambertian>(Albedo);
+        }
+    }
+    else if(Type == "metal")
+    {
+        vec3r Albedo;
+        real Fuzz;
+        if(ReadVec3(Parser, Albedo) && ReadNumber(Parser, Fuzz))
+        {
+            Material = Parser.Arena->New<metal>(Albedo, Fuzz);
+        }
+    }
+    else if(Type == "dielectric")
+    {
+        real IndexOfRefraction;
+        if(ReadNumber(Parser, IndexOfRefraction))
+        {
+            Material = Parser.Arena->New<dielectric>(IndexOfRefraction);
+        }
+    }
+    else if(Type == "light")
+    {
+        texture *Emit = ReadColor(Parser);
+        if(Emit)
+        {
+            Material = Parser.Arena->New<diffuse_light>(Emit);
+        }
+    }
+    else if(Type == "isotropic")
+    {
+        texture *Albedo = ReadColor(Parser);
+        if(Albedo)
+        {
+            Material = Parser.Arena->New<isotropic>(Albedo);
+        }
+    }
+    else if(Type == "henyey_greenstein")
+    {
+        texture *Albedo = ReadColor(Parser);
+        real G;
+        if(Albedo && ReadNumber(Parser, G))
+        {
+            if((G <= -1) || (G >= 1))
+            {
+                return Error(Parser, "The g of henyey_greenstein has to be between -1 and 1.");
+            }
+            Material = Parser.Arena->New<phase_material>(Albedo, Parser.Arena->New<henyey_greenstein>(G));
+        }
+    }
+    else
+    {
+        return Error(Parser, "Unknown material type '%.*s'.", (i32)Type.size(), Type.data());
+    }
+
+    if(!Material)
+    {
+        return false;
+    }
+
+    Parser.Materials[Name] = Material;
+    return true;
+}
+
+// NOTE: Wraps Object in the transforms left on the line, in order.
+hittable *
+scene_file::ParseTransforms(parser &Parser, hittable *Object)
+{
+    hittable *Result = Object;
+    std::string_view Transform;
+    while(Result && NextToken(Parser, Transform))
+    {
+        if(Transform == "rotate_y")
+        {
+            real Angle;
+            Result = ReadNumber(Parser, Angle) ? Parser.Arena->New<rotate_y>(Result, Angle) : nullptr;
+        }
+        else if(Transform == "translate")
+        {
+            vec3r Offset;
+            Result = ReadVec3(Parser, Offset) ? Parser.Arena->New<translate>(Result, Offset) : nullptr;
+        }
+        else
+        {
+            Error(Parser, "Unknown transform '%.*s'.", (i32)Transform.size(), Transform.data());
+            Result = nullptr;
+        }
+    }
+
+    if(Parser.Failed)
+    {
+        Result = nullptr;
+    }
+
+    return Result;
+}
+
+// NOTE: Any statement that makes an object, along with its transforms.
+// Returns null if Keyword is not one of them or if the statement is broken.
+hittable *
+scene_file::ParseObject(parser &Parser, std::string_view Keyword)
+{
+    hittable *Result = nullptr;
+    if(Keyword == "sphere")
+    {
+        material *Material = ReadMaterial(Parser);
+        vec3r Center;
+        real Radius;
+        if(Material && ReadVec3(Parser, Center) && ReadNumber(Parser, Radius))
+        {
+            Result = Parser.Arena->New<sphere>(Center, Radius, Material);
+        }
+    }
+    else if(Keyword == "moving_sphere")
+    {
+        material *Material = ReadMaterial(Parser);
+        vec3r Center0, Center1;
+        real Time0, Time1, Radius;
+        if(Material && ReadVec3(Parser, Center0) && ReadVec3(Parser, Center1) &&
+           ReadNumber(Parser, Time0) && ReadNumber(Parser, Time1) && ReadNumber(Parser, Radius))
+        {
+            Result = Parser.Arena->New<moving_sphere>(Center0, Center1, Time0, Time1, Radius, Material);
+        }
+    }
+    else if((Keyword == "xy_rect") || (Keyword == "xz_rect") || (Keyword == "yz_rect"))
+    {
+        material *Material = ReadMaterial(Parser);
+        real P[5];
+        b32 Valid = (Material != nullptr);
+        for(i32 Index = 0; Valid && (Index < 5); ++Index)
+        {
+            Valid = ReadNumber(Parser, P[Index]);
+        }
+
+        if(Valid)
+        {
+            if(Keyword == "xy_rect")      { Result = Parser.Arena->New<xy_rect>(P[0], P[1], P[2], P[3], P[4], Material); }
+            else if(Keyword == "xz_rect") { Result = Parser.Arena->New<xz_rect>(P[0], P[1], P[2], P[3], P[4], Material); }
+            else                          { Result = Parser.Arena->New<yz_rect>(P[0], P[1], P[2], P[3], P[4], Material); }
+        }
+    }
+    else if(Keyword == "box")
+    {
+        material *Material = ReadMaterial(Parser);
+        vec3r Min, Max;
+        if(Material && ReadVec3(Parser, Min) && ReadVec3(Parser, Max))
+        {
+            Result = Parser.Arena->New<box>(Min, Max, Material);
+        }
+    }
+    else if(Keyword == "instance")
+    {
+        Result = ReadObjectName(Parser);
+    }
+    else if(Keyword == "medium")
+    {
+        hittable *Boundary = ReadObjectName(Parser);
+        real Density;
+        if(Boundary && ReadNumber(Parser, Density))
+        {
+            material *Phase = ReadPhase(Parser);
+            if(Phase)
+            {
+                // NOTE: The transforms go on the boundary, the medium itself
+                // is whatever is inside of it.
+                Boundary = ParseTransforms(Parser, Boundary);
+                if(Boundary)
+                {
+                    Result = Parser.Arena->New<constant_density_medium>(Boundary, Density, Phase);
+                }
+            }
+        }
+        return Result;
+    }
+    else if(Keyword == "grid_medium")
+    {
+        std::string_view Path;
+        i32 NX, NY, NZ;
+        vec3r Min, Max;
+        real Density;
+        if(ReadName(Parser, Path) && ReadInteger(Parser, NX) && ReadInteger(Parser, NY) &&
+           ReadInteger(Parser, NZ) && ReadVec3(Parser, Min) && ReadVec3(Parser, Max) &&
+           ReadNumber(Parser, Density))
+        {
+            material *Phase = ReadPhase(Parser);
+            if(Phase)
+            {
+                b32 IsAbsolute = (Path[0] == '/') || (Path[0] == '\\') ||
+                                 ((Path.size() > 1) && (Path[1] == ':'));
+                std::string FullPath = IsAbsolute ? std::string(Path) : Parser.Directory + std::string(Path);
+
+                mapped_file Mapped;
+                u64 Expected = (u64)NX*NY*NZ*sizeof(f32);
+                if((NX <= 0) || (NY <= 0) || (NZ <= 0))
+                {
+                    Error(Parser, "Grid sizes have to be positive.");
+                }
+                else if(!MapFile(FullPath.c_str(), &Mapped))
+                {
+                    Error(Parser, "Could not open the grid '%s'.", FullPath.c_str());
+                }
+                else
+                {
+                    if(Mapped.Size < Expected)
+                    {
+                        Error(Parser, "The grid '%s' is %llu bytes, %dx%dx%d floats need %llu.",
+                              FullPath.c_str(), (unsigned long long)Mapped.Size, NX, NY, NZ,
+                              (unsigned long long)Expected);
+                    }
+                    else
+                    {
+                        const u8 *Voxels = (const u8 *)Mapped.Data;
+                        std::shared_ptr<density_grid> Grid = std::make_shared<density_grid>(
+                            NX, NY, NZ,
+                            [&](i32 X, i32 Y, i32 Z)
+                            {
+                                f32 Value;
+                                memcpy(&Value, Voxels + (((u64)Z*NY + Y)*NX + X)*sizeof(f32), sizeof(f32));
+                                return Value;
+                            });
+                        Result = Parser.Arena->New<grid_medium>(Grid, Min, Max, Density, Phase);
+                    }
+                    UnmapFile(&Mapped);
+                }
+            }
+        }
+    }
+    else
+    {
+        return nullptr;
+    }
+
+    Result = Result ? ParseTransforms(Parser, Result) : nullptr;
+    return Result;
+}
+
+b32
+scene_file::Parse(const char *Text, u64 Size, const char *Filename, scene &Scene)
+{
+    parser Parser;
+    Parser.At = Text;
+    Parser.End = Text + Size;
+    Parser.Filename = Filename;
+
+    std::shared_ptr<scene_arena> Arena = std::make_shared<scene_arena>();
+    Parser.Arena = Arena.get();
+
+    Parser.Directory = Filename;
+    size_t Slash = Parser.Directory.find_last_of("/\\");
+    Parser.Directory.resize((Slash == std::string::npos) ? 0 : (Slash + 1));
+
+    hittable_list Objects;
+    b32 InObject = false;
+    while(NextStatement(Parser))
+    {
+        std::string_view Keyword;
+        NextToken(Parser, Keyword);
+
+        b32 Valid = true;
+        if(Keyword == "camera")
+        {
+            Valid = ParseCamera(Parser, Scene.Settings);
+        }
+        else if(Keyword == "render")
+        {
+            Valid = ParseRender(Parser, Scene.Settings);
+        }
+        else if(Keyword == "texture")
+        {
+            Valid = ParseTexture(Parser) && EndStatement(Parser);
+        }
+        else if(Keyword == "material")
+        {
+            Valid = ParseMaterial(Parser) && EndStatement(Parser);
+        }
+        else if(Keyword == "object")
+        {
+            if(InObject)
+            {
+                return Error(Parser, "Object blocks can not be nested.");
+            }
+
+            Valid = ReadName(Parser, Parser.ObjectName) && EndStatement(Parser);
+            InObject = true;
+        }
+        else if(Keyword == "end")
+        {
+            if(!InObject)
+            {
+                return Error(Parser, "'end' without an object block.");
+            }
+            if(Parser.ObjectMembers.empty())
+            {
+                return Error(Parser, "Object '%.*s' is empty.",
+                             (i32)Parser.ObjectName.size(), Parser.ObjectName.data());
+            }
+
+            hittable *Object = nullptr;
+            if(Parser.ObjectMembers.size() == 1)
+            {
+                Object = Parser.ObjectMembers[0];
+            }
+            else
+            {
+                Object = Parser.Arena->New<bvh_node>(Parser.ObjectMembers, 0, Parser.ObjectMembers.size(),
+                                                     Scene.Settings.ShutterOpenTime,
+                                                     Scene.Settings.ShutterCloseTime);
+            }
+            Parser.Objects[Parser.ObjectName] = Object;
+            Parser.ObjectMembers.clear();
+            InObject = false;
+
+            Valid = EndStatement(Parser);
+        }
+        else
+        {
+            hittable *Object = ParseObject(Parser, Keyword);
+            if(!Object)
+            {
+                if(!Parser.Failed)
+                {
+                    Error(Parser, "Unknown statement '%.*s'.", (i32)Keyword.size(), Keyword.data());
+                }
+                return false;
+            }
+
+            if(InObject)
+            {
+                Parser.ObjectMembers.push_back(Object);
+            }
+            else
+            {
+                Objects.Add(Object);
+            }
+        }
+
+        if(!Valid)
+        {
+            return false;
+        }
+    }
+
+    if(Parser.Failed)
+    {
+        return false;
+    }
+    if(InObject)
+    {
+        return Error(Parser, "Object '%.*s' is missing its 'end'.",
+                     (i32)Parser.ObjectName.size(), Parser.ObjectName.data());
+    }
+
+    Scene.World.Clear();
+    if(Objects.Objects.size() > 1)
+    {
+        Scene.World.Add(Parser.Arena->New<bvh_node>(Objects, Scene.Settings.ShutterOpenTime,
+                                                    Scene.Settings.ShutterCloseTime));
+    }
+    else
+    {
+        Scene.World = Objects;
+    }
+    Scene.World.Arena = Arena;
+
+    return true;
+}
+
+b32
+scene_file::WriteBinary(const char *Filename, const scene &Scene, u64 SourceHash)
+{
+    b32 Result = scene_cache::Write(Filename, SourceHash, Scene.World, Scene.Settings.ShutterOpenTime,
+                                    Scene.Settings.ShutterCloseTime, &Scene.Settings);
+    return Result;
+}
+
+b32
+scene_file::Load(const char *Filename, scene &Scene, b32 UseCache)
+{
+    mapped_file Mapped;
+    if(!MapFile(Filename, &Mapped))
+    {
+        fprintf(stderr, "Could not open the scene file: %s\n", Filename);
+        return false;
+    }
+
+    b32 Result = false;
+    if((Mapped.Size >= sizeof(u64)) && (*(const u64 *)Mapped.Data == SCENE_CACHE_MAGIC))
+    {
+        UnmapFile(&Mapped);
+        Result = scene_cache::Read(Filename, SCENE_CACHE_ANY_HASH, Scene.World, &Scene.Settings);
+        if(!Result)
+        {
+            fprintf(stderr, "Could not read the binary scene file: %s\n", Filename);
+        }
+        return Result;
+    }
+
+    u64 Hash = scene_cache::HashBytes(Mapped.Data, Mapped.Size);
+    std::string CacheFilename = std::string(Filename) + ".rtcache";
+    if(UseCache &&
+       scene_cache::Read(CacheFilename.c_str(), Hash, Scene.World, &Scene.Settings))
+    {
+        fprintf(stderr, "Loaded the scene from the cache: %s\n", CacheFilename.c_str());
+        UnmapFile(&Mapped);
+        return true;
+    }
+
+    Result = Parse((const char *)Mapped.Data, Mapped.Size, Filename, Scene);
+    UnmapFile(&Mapped);
+
+    if(Result && UseCache)
+    {
+        // NOTE: Render what is in the cache on the first run too, so it looks
+        // the same as every run after it.
+        scene Cached;
+        if(!WriteBinary(CacheFilename.c_str(), Scene, Hash) ||
+           !scene_cache::Read(CacheFilename.c_str(), Hash, Cached.World, &Cached.Settings))
+        {
+            fprintf(stderr, "Could not write the scene cache: %s\n", CacheFilename.c_str());
+        }
+        else
+        {
+            Scene = Cached;
+        }
+    }
+
+    return Result;
+}
+
+#define SCENE_FILE_H
+#endif
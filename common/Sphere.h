@@ -1,12 +1,15 @@
 #if !defined(SPHERE_H)
 #include "defines.h"
 #include "Hittable.h"
+#include "ONB.h"
+#include "Stats.h"
+#include "Warp.h"
 #include <cmath>
 
 class sphere : public hittable
 {
   public:
-    sphere(vec3d Center, f64 Radius, std::shared_ptr<material> Material)
+    sphere(vec3r Center, real Radius, material *Material)
         : center(Center), radius(Radius), mat(Material)
     {
     }
@@ -23,21 +26,30 @@ class sphere : public hittable
     b32
     Hit(const ray &Ray, const interval &Interval, hit_record &Record) const override
     {
-        vec3d OC = Ray.Origin() - center;
+        RT_STAT(Stat_PrimitiveTests);
+        vec3r OC = Ray.Origin() - center;
 
         // (B⋅B) is square magnitude of the vector.
         // a here is the coefficient of t^2 in the above quadratic equation.
-        f64 a = Ray.Direction().SqMagnitude();
+        real a = Ray.Direction().SqMagnitude();
         // B⋅(A−C), b here is the coeffiecient of t in the quadratic equation.
-        f64 Half_b = Dot(OC, Ray.Direction());
-        // c here is the constant in the quadratic equation of t described
-        // above. c = ((A−C)⋅(A−C)−r^2)
-        f64 c = OC.SqMagnitude() - radius*radius;
+        real Half_b = Dot(OC, Ray.Direction());
+        // c here would be the constant in the quadratic equation of t described
+        // above, c = ((A−C)⋅(A−C)−r^2), see the discriminant below.
 
         // NOTE:
         // -b -sqrt(b2 - 4ac) / 2a
         // if h = 2*b, this becomes -h - sqrt(h2 - ac) / a
-        f64 Discriminant = Half_b*Half_b - a*c;
+        //
+        // NOTE: Written like this the discriminant loses everything to
+        // cancellation on big spheres, b^2 and ac are both about r^4 and the
+        // difference is what's left. b^2 - ac is the same thing as
+        // a*(r^2 - |OC - (b/a)B|^2), the squared distance from the center to
+        // the closest point on the line, which stays accurate (Haines et al.,
+        // "Precision Improvements for Ray/Sphere Intersection", Ray Tracing
+        // Gems). That is what makes the ground sphere work in f32.
+        vec3r Closest = OC - (Half_b / a)*Ray.Direction();
+        real Discriminant = a*(radius*radius - Closest.SqMagnitude());
         // Meaning there are no real roots to the quadratic equation. Meaning
         // the ray does not HIT the sphere here.
         if(Discriminant < 0.)
@@ -45,10 +57,10 @@ class sphere : public hittable
             return false;
         }
 
-        f64 SqRootDiscriminant = sqrt(Discriminant);
+        real SqRootDiscriminant = sqrt(Discriminant);
 
         // Find the nearest root that lies within the acceptable range.
-        f64 Root = (-Half_b - SqRootDiscriminant) / a;
+        real Root = (-Half_b - SqRootDiscriminant) / a;
         if(!Interval.Surrounds(Root))
         {
             Root = (-Half_b + SqRootDiscriminant) / a;
@@ -62,37 +74,118 @@ class sphere : public hittable
         // intersection quadratic eq.
         Record.t = Root;
         Record.P = Ray.At(Record.t);
+        // NOTE: Ray.At(t) lands off the surface by about t times an ulp, put
+        // it back on so OffsetRayOrigin only has to cover the last few ulps.
+        // The radius can be negative for hollow glass, hence the fabs.
+        Record.P = center + (Record.P - center)*(fabs(radius) / (Record.P - center).Magnitude());
+        // Putting it back on rounds to the ulps of the center as well, a
+        // small sphere far from the origin or a huge one like the ground are
+        // only as exact as the bigger of the two.
+        vec3r AbsCenter = Vec3r(fabs(center.x), fabs(center.y), fabs(center.z));
+        // NOTE: MAX isn't parenthesized, hence the local.
+        real MaxCenter = MAX(MAX(AbsCenter.x, AbsCenter.y), AbsCenter.z);
+        Record.Error = 8*RealEpsilon*(fabs(radius) + MaxCenter);
 
         // This is a Unit Vector.
-        vec3d OutwardNormal = ((Record.P - center) / radius);
+        vec3r OutwardNormal = ((Record.P - center) / radius);
         Record.SetFaceNormal(Ray, OutwardNormal);
+        Record.Curvature = (Record.FrontFace ? 1 : -1) / radius;
+        Record.Medium = nullptr;
 
         // NOTE: Update the UV Texture Coordinates.
         GetSphereUV(OutwardNormal, Record .U, Record.V);
+        // V goes pole to pole over half the circumference, U around the
+        // equator over all of it, twice the distance for twice the range.
+        Record.UVPerUnit = 1 / (pi*fabs(radius));
         Record.Material = mat;
+        Record.Object = this;
 
         return true;
     }
 
     b32
-    BoundingBox(f64 Time0, f64 Time1, aabb &OutputBox) const override
+    BoundingBox(real Time0, real Time1, aabb &OutputBox) const override
     {
-        OutputBox = aabb(center - Vec3d(radius),
-                         center + Vec3d(radius));
+        OutputBox = aabb(center - Vec3r(radius),
+                         center + Vec3r(radius));
         return true;
     }
 
+    // NOTE: Uniform over the cone of directions the sphere covers seen from
+    // Origin, everything from inside of it.
+    real
+    PdfValue(const vec3r &Origin, const vec3r &Direction) const override
+    {
+        real Result = 0;
+        hit_record Record;
+        if(Hit(ray(Origin, Direction, 0), interval(0, Infinity), Record))
+        {
+            Result = (real)(1.0 / ConeSolidAngle(Origin));
+        }
+
+        return Result;
+    }
+
+    vec3r
+    Random(const vec3r &Origin, const vec2d &Sample) const override
+    {
+        vec3r Result;
+        f64 Distance2 = (center - Origin).SqMagnitude();
+        f64 Radius2 = (f64)radius*radius;
+        if(Distance2 <= Radius2)
+        {
+            Result = SampleUnitSphere(Sample);
+        }
+        else
+        {
+            // NOTE: 1 - cos(theta max), without the cancellation for small or
+            // far away spheres.
+            f64 OneMinusCosMax = (Radius2 / Distance2) / (1.0 + sqrt(1.0 - Radius2 / Distance2));
+            f64 Z = 1.0 - Sample.u*OneMinusCosMax;
+            f64 R = sqrt(MAX(0.0, 1.0 - Z*Z));
+            f64 Phi = 2.0*pi*Sample.v;
+            onb Basis(Normalize(center - Origin));
+            Result = Basis.Local(Vec3r(R*cos(Phi), R*sin(Phi), Z));
+        }
+
+        return Result;
+    }
+
+    void
+    GatherEmitters(std::vector<emitter> &Emitters) const override
+    {
+        if(mat)
+        {
+            Emitters.push_back({this, mat, center, (real)(4.0*pi*radius*radius)});
+        }
+    }
+
   private:
-    vec3d center;
-    f64 radius;
-    std::shared_ptr<material> mat;
+    friend class scene_cache;
+
+    vec3r center;
+    real radius;
+    material *mat = nullptr;
+
+    f64
+    ConeSolidAngle(const vec3r &Origin) const
+    {
+        f64 Distance2 = (center - Origin).SqMagnitude();
+        f64 Radius2 = (f64)radius*radius;
+        f64 Result = 4.0*pi;
+        if(Distance2 > Radius2)
+        {
+            Result = 2.0*pi*(Radius2 / Distance2) / (1.0 + sqrt(1.0 - Radius2 / Distance2));
+        }
+        return Result;
+    }
 
     static void
-    GetSphereUV(const vec3d &P, f64 &U, f64 &V)
+    GetSphereUV(const vec3r &P, real &U, real &V)
     {
         // NOTE: This Angle returned should be measured from -Y Axis. Therefore,
         // a point like (0, -1, 0) should return Theta as 0.
-        f64 Theta = acos(-P.y);
+        real Theta = acos(-P.y);
 
         // IMPORTANT: NOTE:
         // In a sphere, if P = (-1, 0, 0) then u = 0
@@ -107,7 +200,7 @@ class sphere : public hittable
         // be in the Second Quadrant as far as atan2 is concerned and return
         // 0.75pi We want it to return 0.25pi according to our requirements
         // here.
-        f64 Phi = atan2(-P.z, P.x) + pi;
+        real Phi = atan2(-P.z, P.x) + pi;
 
         // The Azimuthal angle in the sphere goes in the XZ plane from 0 to 2*pi
         U = Phi / (2*pi);
@@ -0,0 +1,198 @@
+#if !defined(STATS_H)
+
+#include "defines.h"
+
+// NOTE: Counters for what a render spends its rays on, for building with
+// RT_STATS=1 (the RT_STATS CMake option) while working on the renderer. With
+// it off, which is the default, every RT_STAT* macro is empty and none of the
+// code below gets compiled, so the renderer is exactly what it is without
+// them.
+//
+// Every thread counts into its own thread_local counters, no atomics and no
+// shared cache lines on the hot paths. Render threads fold theirs into the
+// totals once, when they are done (RT_STATS_MERGE), and RT_STATS_PRINT prints
+// the totals as a table and clears them, after camera::Render.
+//
+// There are no shadow rays in this renderer, a bounce either goes where the
+// material sends it or towards a light (see camera::SampleLights), so the
+// ones that went towards a light or the environment are counted out of the
+// bounces instead.
+#if !defined(RT_STATS)
+#define RT_STATS 0
+#endif
+
+#if RT_STATS
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+enum stat_counter
+{
+    Stat_CameraRays,
+    Stat_SurfaceBounces,
+    Stat_MediumBounces,
+    Stat_LightBounces,       // Out of the bounces, towards the lights.
+    Stat_EnvironmentBounces, // Out of the bounces, towards the environment.
+    Stat_BoundaryCrossings,  // Carried on through a boundary with only a medium to it.
+    Stat_BounceLimit,        // Paths cut off by the bounce limit.
+    Stat_Hits,
+    Stat_Misses,
+    Stat_NodeVisits,         // BVH nodes whose box got tested.
+    Stat_PrimitiveTests,     // Calls into the Hit of a shape.
+
+    Stat_CounterCount,
+};
+
+enum stat_stage
+{
+    Stat_BVHBuild,
+    Stat_Trace,
+    Stat_Denoise,
+    Stat_Write,
+
+    Stat_StageCount,
+};
+
+struct stats
+{
+    u64 Counts[Stat_CounterCount];
+    f64 Seconds[Stat_StageCount];
+};
+
+inline stats &
+ThreadStats()
+{
+    thread_local stats Result = {};
+    return Result;
+}
+
+// NOTE: What the threads have merged so far.
+struct stats_totals
+{
+    std::mutex Mutex;
+    stats Stats;
+};
+
+inline stats_totals &
+StatsTotals()
+{
+    static stats_totals Result;
+    return Result;
+}
+
+// NOTE: Adds the calling thread's counts to the totals and clears them.
+inline void
+MergeThreadStats()
+{
+    stats &Thread = ThreadStats();
+    stats_totals &Totals = StatsTotals();
+    std::lock_guard<std::mutex> Lock(Totals.Mutex);
+    for(i32 Index = 0; Index < Stat_CounterCount; ++Index)
+    {
+        Totals.Stats.Counts[Index] += Thread.Counts[Index];
+    }
+    for(i32 Index = 0; Index < Stat_StageCount; ++Index)
+    {
+        Totals.Stats.Seconds[Index] += Thread.Seconds[Index];
+    }
+    Thread = {};
+}
+
+// NOTE: Adds the time from when it is made to when it goes out of scope to
+// Stage.
+class stat_timer
+{
+  public:
+    explicit stat_timer(stat_stage Stage) : stage(Stage), begin(std::chrono::steady_clock::now()) {}
+
+    ~stat_timer()
+    {
+        auto End = std::chrono::steady_clock::now();
+        ThreadStats().Seconds[stage] += std::chrono::duration<f64>(End - begin).count();
+    }
+
+  private:
+    stat_stage stage;
+    std::chrono::steady_clock::time_point begin;
+};
+
+inline void
+PrintStats()
+{
+    MergeThreadStats();
+    stats_totals &Totals = StatsTotals();
+    std::lock_guard<std::mutex> Lock(Totals.Mutex);
+    const u64 *Counts = Totals.Stats.Counts;
+    const f64 *Seconds = Totals.Stats.Seconds;
+
+    u64 Traced = Counts[Stat_Hits] + Counts[Stat_Misses];
+    f64 PerRay = (Traced > 0) ? (1.0 / (f64)Traced) : 0.0;
+    f64 Paths = (f64)Counts[Stat_CameraRays];
+    f64 PerPath = (Paths > 0) ? (1.0 / Paths) : 0.0;
+    auto Percent = [](u64 Part, u64 Whole)
+    {
+        return (Whole > 0) ? (100.0*(f64)Part / (f64)Whole) : 0.0;
+    };
+
+    u64 Bounces = Counts[Stat_SurfaceBounces] + Counts[Stat_MediumBounces];
+    fprintf(stderr,
+            "Render statistics\n"
+            "  rays traced            %14llu  %8.2f per path\n"
+            "    camera               %14llu\n"
+            "    surface bounces      %14llu\n"
+            "    medium bounces       %14llu\n"
+            "    boundary crossings   %14llu\n"
+            "  bounces towards\n"
+            "    lights               %14llu  %7.1f%%\n"
+            "    the environment      %14llu  %7.1f%%\n"
+            "  cut off at max bounces %14llu\n"
+            "  hits                   %14llu  %7.1f%%\n"
+            "  misses                 %14llu  %7.1f%%\n"
+            "  BVH node visits        %14llu  %8.2f per ray\n"
+            "  primitive tests        %14llu  %8.2f per ray\n"
+            "  average path depth     %14.2f  bounces\n"
+            "  BVH build              %14.1f  ms\n"
+            "  trace                  %14.1f  ms\n"
+            "  denoise                %14.1f  ms\n"
+            "  write                  %14.1f  ms\n",
+            (unsigned long long)Traced, (f64)Traced*PerPath,
+            (unsigned long long)Counts[Stat_CameraRays],
+            (unsigned long long)Counts[Stat_SurfaceBounces],
+            (unsigned long long)Counts[Stat_MediumBounces],
+            (unsigned long long)Counts[Stat_BoundaryCrossings],
+            (unsigned long long)Counts[Stat_LightBounces], Percent(Counts[Stat_LightBounces], Bounces),
+            (unsigned long long)Counts[Stat_EnvironmentBounces],
+            Percent(Counts[Stat_EnvironmentBounces], Bounces),
+            (unsigned long long)Counts[Stat_BounceLimit],
+            (unsigned long long)Counts[Stat_Hits], Percent(Counts[Stat_Hits], Traced),
+            (unsigned long long)Counts[Stat_Misses], Percent(Counts[Stat_Misses], Traced),
+            (unsigned long long)Counts[Stat_NodeVisits], (f64)Counts[Stat_NodeVisits]*PerRay,
+            (unsigned long long)Counts[Stat_PrimitiveTests],
+            (f64)Counts[Stat_PrimitiveTests]*PerRay,
+            (f64)Bounces*PerPath,
+            1000.0*Seconds[Stat_BVHBuild], 1000.0*Seconds[Stat_Trace],
+            1000.0*Seconds[Stat_Denoise], 1000.0*Seconds[Stat_Write]);
+
+    Totals.Stats = {};
+}
+
+#define RT_STAT_CONCAT_(A, B) A##B
+#define RT_STAT_CONCAT(A, B) RT_STAT_CONCAT_(A, B)
+
+#define RT_STAT(Counter) (++ThreadStats().Counts[Counter])
+#define RT_STAT_TIMER(Stage) stat_timer RT_STAT_CONCAT(StatTimer, __LINE__)(Stage)
+#define RT_STATS_MERGE() MergeThreadStats()
+#define RT_STATS_PRINT() PrintStats()
+
+#else
+
+#define RT_STAT(Counter) ((void)0)
+#define RT_STAT_TIMER(Stage) ((void)0)
+#define RT_STATS_MERGE() ((void)0)
+#define RT_STATS_PRINT() ((void)0)
+
+#endif
+
+#define STATS_H
+#endif
@@ -7,8 +7,11 @@
 class texture
 {
   public:
-    // NOTE: Color of the texture at UV coordinates and position.
-    virtual color Value(f64 U, f64 V, const vec3d &P) const = 0;
+    // NOTE: Color of the texture at UV coordinates and position. Footprint is
+    // how wide an area around U, V the lookup stands for, in UV units (see
+    // hit_record::Footprint), textures with detail to lose average over it.
+    // 0 is a point sample.
+    virtual color Value(real U, real V, const vec3r &P, real Footprint) const = 0;
 };
 
 class solid_color : public texture
@@ -16,16 +19,18 @@ class solid_color : public texture
   public:
     solid_color() {}
     solid_color(color C) : color_value(C) {}
-    solid_color(f64 Red, f64 Green, f64 Blue)
+    solid_color(real Red, real Green, real Blue)
         : solid_color(Color(Red, Green, Blue)) {}
 
-    virtual color Value(f64 U, f64 V, const vec3d &P) const override
+    virtual color Value(real U, real V, const vec3r &P, real Footprint) const override
     {
         color Result = color_value;
         return Result;
     }
 
   private:
+    friend class scene_cache;
+
     color color_value;
 };
 
@@ -0,0 +1,730 @@
+#if !defined(TEXTURE_CACHE_H)
+
+#include "defines.h"
+#include "Color.h"
+#include "rt_stbimage.h"
+
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// NOTE: Tiled, mip mapped texture store with a bounded amount of memory.
+//
+// Every image is cut into TEXTURE_TILE_SIZE square tiles at every mip level,
+// and only the tiles lookups actually touch are in memory, in an LRU cache
+// that holds at most Budget bytes of them. Opening a texture only reads the
+// image header. The first lookup into it decodes the image once, builds the
+// mip chain and writes all the tiles out to a tile file next to the image
+// (<image>.rttiles, or an anonymous temporary file when that can't be written
+// or tile files are turned off), and from then on tiles are read from that
+// file as they are needed. Later runs find the tile file and never decode at
+// all. The decode is the one time a whole image is in memory.
+//
+// Lookups are trilinear: the footprint of the lookup, in UV units, picks the
+// pair of mip levels whose texels are about that size, so minified textures
+// read a few small tiles instead of scattering over the full resolution one.
+//
+// The cache is also where images get shared. Opening a path that was opened
+// before, however it is spelled, returns the same handle. Every image is
+// hashed as well, and an image with the same content as one opened earlier
+// under another path becomes an alias of it, sharing its tile file and its
+// tiles. The hashing and the decode happen on a few worker threads as soon as
+// a texture is opened, so they overlap with building the rest of the scene;
+// WaitForTextures waits for them to finish.
+//
+// Textures have to be opened before rendering starts. The tiles themselves are
+// shared between the render threads, every thread keeps a handful of the tiles
+// it used last on the side so most lookups don't touch the shared cache and
+// its lock at all. Those can keep a tile alive for a little while after the
+// cache drops it, so the budget can be overshot by a few tiles per thread.
+#define TEXTURE_TILE_SIZE 64
+#define TEXTURE_TILE_BYTES (TEXTURE_TILE_SIZE*TEXTURE_TILE_SIZE*3)
+#define TEXTURE_TILES_MAGIC 0x53454C4954585452ull // "RTXTILES"
+#define TEXTURE_TILES_VERSION 2
+#define TEXTURE_CACHE_NONE 0xFFFFFFFFu
+#define TEXTURE_CACHE_DEFAULT_MB 256
+#define TEXTURE_CACHE_THREAD_TILES 16
+// NOTE: Every worker can have a whole decoded image in memory at once.
+#define TEXTURE_CACHE_MAX_WORKERS 4
+
+struct texture_tiles_header
+{
+    u64 Magic;
+    u32 Version;
+    i32 Width, Height;
+    i32 LevelCount;
+    // Size and hash of the image file the tiles were made from, a different
+    // file means the tiles are stale.
+    u64 SourceSize;
+    u64 SourceHash;
+};
+
+struct texture_tile
+{
+    u8 Texels[TEXTURE_TILE_BYTES];
+};
+
+struct texture_cache_stats
+{
+    u64 Requests;  // Tile requests that got past the per thread tiles.
+    u64 Loads;     // Tiles read from the tile files.
+    u64 Evictions;
+    u64 ResidentBytes;
+    u64 PeakBytes;
+    u64 Duplicates; // Images that turned out to be copies of another one.
+};
+
+class texture_cache
+{
+  public:
+    static texture_cache &
+    Get()
+    {
+        static texture_cache Cache;
+        return Cache;
+    }
+
+    ~texture_cache()
+    {
+        {
+            std::lock_guard<std::mutex> Guard(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(std::thread &Worker : workers)
+        {
+            Worker.join();
+        }
+
+        for(std::unique_ptr<entry> &Entry : entries)
+        {
+            if(Entry->Tiles)
+            {
+                fclose(Entry->Tiles);
+            }
+        }
+    }
+
+    void
+    SetBudget(u64 Bytes)
+    {
+        std::lock_guard<std::mutex> Guard(lock);
+        budget = Bytes;
+        EvictOverBudget();
+    }
+
+    // NOTE: Whether textures opened from now on read and write tile files
+    // next to their images.
+    void SetUseTileFiles(b32 Use) { useTileFiles = Use; }
+
+    // NOTE: Reads the size of the image and returns the handle to look it up
+    // with, or TEXTURE_CACHE_NONE if it isn't a readable image. Opening the
+    // same file again returns the same handle. The image gets hashed and
+    // decoded in the background.
+    u32
+    Open(const char *Filename)
+    {
+        std::string Path = CanonicalPath(Filename);
+        std::lock_guard<std::mutex> Guard(lock);
+
+        auto Found = handles.find(Path);
+        if(Found != handles.end())
+        {
+            return Found->second;
+        }
+
+        u32 Result = TEXTURE_CACHE_NONE;
+        i32 Width = 0, Height = 0, Channels = 0;
+        if(stbi_info(Path.c_str(), &Width, &Height, &Channels) && (Width > 0) && (Height > 0))
+        {
+            std::unique_ptr<entry> Entry(new entry());
+            Entry->Filename = Path;
+            Entry->Width = Width;
+            Entry->Height = Height;
+            Entry->UseTileFile = useTileFiles;
+
+            u64 FirstTile = 0;
+            i32 LevelWidth = Width, LevelHeight = Height;
+            for(;;)
+            {
+                texture_level Level;
+                Level.Width = LevelWidth;
+                Level.Height = LevelHeight;
+                Level.TilesX = (LevelWidth + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+                Level.TilesY = (LevelHeight + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+                Level.FirstTile = FirstTile;
+                Entry->Levels.push_back(Level);
+                FirstTile += (u64)Level.TilesX*Level.TilesY;
+
+                if((LevelWidth == 1) && (LevelHeight == 1))
+                {
+                    break;
+                }
+                LevelWidth = MAX(1, LevelWidth / 2);
+                LevelHeight = MAX(1, LevelHeight / 2);
+            }
+
+            Result = (u32)entries.size();
+            entries.push_back(std::move(Entry));
+
+            pending.push_back(Result);
+            i32 MaxWorkers = (i32)std::thread::hardware_concurrency();
+            MaxWorkers = (MaxWorkers < 1) ? 1 : MaxWorkers;
+            MaxWorkers = (MaxWorkers > TEXTURE_CACHE_MAX_WORKERS) ? TEXTURE_CACHE_MAX_WORKERS : MaxWorkers;
+            if((i32)workers.size() < MaxWorkers)
+            {
+                workers.emplace_back([this]() { PrepareTextures(); });
+            }
+            wake.notify_one();
+        }
+        else
+        {
+            fprintf(stderr, "Texture Cache: Could not read %s\n", Filename);
+        }
+
+        handles[Path] = Result;
+        return Result;
+    }
+
+    // NOTE: Blocks until every texture opened so far is hashed and has its
+    // tile file.
+    void
+    WaitForTextures()
+    {
+        std::unique_lock<std::mutex> Guard(lock);
+        idle.wait(Guard, [this]() { return pending.empty() && (busy == 0); });
+    }
+
+    // NOTE: Trilinear lookup. U and V are in [0, 1] with V going down the
+    // image, Footprint is how wide the lookup is in UV units, 0 for a point.
+    color
+    Sample(u32 Handle, real U, real V, real Footprint)
+    {
+        u32 Alias = entries[Handle]->Alias.load(std::memory_order_relaxed);
+        Handle = (Alias != TEXTURE_CACHE_NONE) ? Alias : Handle;
+        entry &Entry = *entries[Handle];
+        i32 LastLevel = (i32)Entry.Levels.size() - 1;
+
+        i32 Size = MAX(Entry.Width, Entry.Height);
+        f64 Texels = (f64)Footprint*Size;
+        f64 LOD = (Texels > 1.0) ? log2(Texels) : 0.0;
+        LOD = MIN(LOD, (f64)LastLevel);
+
+        i32 Level = (i32)LOD;
+        real Blend = (real)(LOD - Level);
+
+        color Result = Bilinear(Entry, Handle, Level, U, V);
+        if((Blend > 0) && (Level < LastLevel))
+        {
+            color Coarser = Bilinear(Entry, Handle, Level + 1, U, V);
+            Result = (1 - Blend)*Result + Blend*Coarser;
+        }
+
+        return Result;
+    }
+
+    i32
+    Width(u32 Handle) const
+    {
+        i32 Result = entries[Handle]->Width;
+        return Result;
+    }
+
+    i32
+    Height(u32 Handle) const
+    {
+        i32 Result = entries[Handle]->Height;
+        return Result;
+    }
+
+    i32
+    TextureCount() const
+    {
+        i32 Result = (i32)entries.size();
+        return Result;
+    }
+
+    texture_cache_stats
+    Stats()
+    {
+        std::lock_guard<std::mutex> Guard(lock);
+        texture_cache_stats Result = stats;
+        Result.ResidentBytes = resident;
+        return Result;
+    }
+
+  private:
+    struct texture_level
+    {
+        i32 Width, Height;
+        i32 TilesX, TilesY;
+        u64 FirstTile; // Index of the level's first tile in the tile file.
+    };
+
+    struct entry
+    {
+        std::string Filename;
+        i32 Width, Height;
+        std::vector<texture_level> Levels;
+        b32 UseTileFile;
+        // The texture this one is a copy of, if any. Lookups go there.
+        std::atomic<u32> Alias{TEXTURE_CACHE_NONE};
+
+        // Opened by the worker that prepares the texture, or by the first
+        // tile read if that comes first. Reads from the file are serialized by
+        // FileLock, and Failed keeps a bad image from being retried.
+        std::mutex FileLock;
+        FILE *Tiles = nullptr;
+        b32 Failed = false;
+    };
+
+    struct cached_tile
+    {
+        std::shared_ptr<const texture_tile> Tile;
+        std::list<u64>::iterator Use;
+    };
+
+    struct thread_tile
+    {
+        u64 Key = ~0ull;
+        std::shared_ptr<const texture_tile> Tile;
+    };
+
+    std::mutex lock; // Guards everything below but the entries' files.
+    std::vector<std::unique_ptr<entry>> entries;
+    std::unordered_map<std::string, u32> handles;
+    std::unordered_map<u64, cached_tile> tiles;
+    std::list<u64> uses; // Tile keys, most recently used first.
+    u64 budget = (u64)TEXTURE_CACHE_DEFAULT_MB << 20;
+    u64 resident = 0;
+    texture_cache_stats stats = {};
+    b32 useTileFiles = true;
+
+    // NOTE: Textures waiting to be prepared by the workers.
+    std::unordered_map<u64, u32> contents; // Source hash to the first texture with it.
+    std::deque<u32> pending;
+    std::vector<std::thread> workers;
+    std::condition_variable wake, idle;
+    i32 busy = 0;
+    b32 stopping = false;
+
+    static std::string
+    CanonicalPath(const char *Filename)
+    {
+        std::string Result = Filename;
+#if defined(_WIN32)
+        char Buffer[_MAX_PATH];
+        if(_fullpath(Buffer, Filename, _MAX_PATH))
+        {
+            Result = Buffer;
+        }
+#else
+        char *Resolved = realpath(Filename, nullptr);
+        if(Resolved)
+        {
+            Result = Resolved;
+            free(Resolved);
+        }
+#endif
+        return Result;
+    }
+
+    // NOTE: FNV-1a of the whole file, like the scene cache hashes.
+    static u64
+    HashFile(const char *Filename, u64 &Size)
+    {
+        u64 Result = 0xcbf29ce484222325ull;
+        Size = 0;
+        FILE *File = fopen(Filename, "rb");
+        if(File)
+        {
+            std::vector<u8> Buffer(1 << 16);
+            size_t Read;
+            while((Read = fread(Buffer.data(), 1, Buffer.size(), File)) > 0)
+            {
+                for(size_t Index = 0; Index < Read; ++Index)
+                {
+                    Result ^= Buffer[Index];
+                    Result *= 0x100000001b3ull;
+                }
+                Size += Read;
+            }
+            fclose(File);
+        }
+        return Result;
+    }
+
+    // NOTE: Worker loop. Hashes each opened image, makes it an alias if an
+    // image with the same content is already there, and otherwise gets its
+    // tile file ready.
+    void
+    PrepareTextures()
+    {
+        for(;;)
+        {
+            entry *Entry = nullptr;
+            u32 Handle;
+            {
+                std::unique_lock<std::mutex> Guard(lock);
+                wake.wait(Guard, [this]() { return stopping || !pending.empty(); });
+                if(stopping)
+                {
+                    return;
+                }
+                Handle = pending.front();
+                pending.pop_front();
+                Entry = entries[Handle].get();
+                ++busy;
+            }
+
+            {
+                std::lock_guard<std::mutex> FileGuard(Entry->FileLock);
+                u64 Size;
+                u64 Hash = HashFile(Entry->Filename.c_str(), Size);
+
+                u32 Original = TEXTURE_CACHE_NONE;
+                {
+                    std::lock_guard<std::mutex> Guard(lock);
+                    auto Found = contents.find(Hash);
+                    if(Found == contents.end())
+                    {
+                        contents[Hash] = Handle;
+                    }
+                    else if((entries[Found->second]->Width == Entry->Width) &&
+                            (entries[Found->second]->Height == Entry->Height))
+                    {
+                        Original = Found->second;
+                        ++stats.Duplicates;
+                    }
+                }
+
+                if(Original != TEXTURE_CACHE_NONE)
+                {
+                    Entry->Alias.store(Original);
+                }
+                else if(!Entry->Tiles && !Entry->Failed)
+                {
+                    Entry->Tiles = OpenTileFile(*Entry, Hash, Size);
+                    Entry->Failed = (Entry->Tiles == nullptr);
+                }
+            }
+
+            {
+                std::lock_guard<std::mutex> Guard(lock);
+                --busy;
+                if(pending.empty() && (busy == 0))
+                {
+                    idle.notify_all();
+                }
+            }
+        }
+    }
+
+    // NOTE: Texture, level and tile position packed into one key.
+    static u64
+    TileKey(u32 Handle, i32 Level, i32 TileX, i32 TileY)
+    {
+        u64 Result = ((u64)Handle << 40) | ((u64)Level << 32) | ((u64)TileY << 16) | (u64)TileX;
+        return Result;
+    }
+
+    color
+    Bilinear(entry &Entry, u32 Handle, i32 Level, real U, real V)
+    {
+        const texture_level &L = Entry.Levels[Level];
+        real X = U*L.Width - (real)0.5;
+        real Y = V*L.Height - (real)0.5;
+        real FloorX = floor(X);
+        real FloorY = floor(Y);
+        real FX = X - FloorX;
+        real FY = Y - FloorY;
+        i32 X0 = (i32)FloorX, Y0 = (i32)FloorY;
+
+        color C00 = Texel(Entry, Handle, Level, X0, Y0);
+        color C10 = Texel(Entry, Handle, Level, X0 + 1, Y0);
+        color C01 = Texel(Entry, Handle, Level, X0, Y0 + 1);
+        color C11 = Texel(Entry, Handle, Level, X0 + 1, Y0 + 1);
+
+        color Result = (1 - FY)*((1 - FX)*C00 + FX*C10) + FY*((1 - FX)*C01 + FX*C11);
+        return Result;
+    }
+
+    // NOTE: One texel, clamped to the edges of the level.
+    color
+    Texel(entry &Entry, u32 Handle, i32 Level, i32 X, i32 Y)
+    {
+        const texture_level &L = Entry.Levels[Level];
+        X = (X < 0) ? 0 : ((X >= L.Width) ? (L.Width - 1) : X);
+        Y = (Y < 0) ? 0 : ((Y >= L.Height) ? (L.Height - 1) : Y);
+
+        const texture_tile *Tile = FindTile(Entry, Handle, Level,
+                                            X / TEXTURE_TILE_SIZE, Y / TEXTURE_TILE_SIZE);
+
+        color Result;
+        if(Tile)
+        {
+            i32 Offset = 3*((Y % TEXTURE_TILE_SIZE)*TEXTURE_TILE_SIZE + (X % TEXTURE_TILE_SIZE));
+            real ColorScale = (real)(1.0 / 255.0);
+            Result = Color(Tile->Texels[Offset + 0]*ColorScale,
+                           Tile->Texels[Offset + 1]*ColorScale,
+                           Tile->Texels[Offset + 2]*ColorScale);
+        }
+        else
+        {
+            // NOTE: Magenta for an image that went away or couldn't be
+            // decoded after it was opened, same as rt_image's error pixel.
+            Result = Color(1, 0, 1);
+        }
+
+        return Result;
+    }
+
+    const texture_tile *
+    FindTile(entry &Entry, u32 Handle, i32 Level, i32 TileX, i32 TileY)
+    {
+        u64 Key = TileKey(Handle, Level, TileX, TileY);
+
+        // NOTE: The thread's own tiles first, direct mapped on the key.
+        thread_local thread_tile ThreadTiles[TEXTURE_CACHE_THREAD_TILES];
+        thread_tile &Slot = ThreadTiles[(Key ^ (Key >> 29)) % TEXTURE_CACHE_THREAD_TILES];
+        if(Slot.Key == Key)
+        {
+            return Slot.Tile.get();
+        }
+
+        std::shared_ptr<const texture_tile> Tile;
+        {
+            std::lock_guard<std::mutex> Guard(lock);
+            ++stats.Requests;
+            auto Found = tiles.find(Key);
+            if(Found != tiles.end())
+            {
+                uses.splice(uses.begin(), uses, Found->second.Use);
+                Tile = Found->second.Tile;
+            }
+        }
+
+        if(!Tile)
+        {
+            // NOTE: Read outside the cache lock so other threads can keep
+            // looking up tiles that are there. Two threads missing on the same
+            // tile both read it, the second one just uses the first one's.
+            std::shared_ptr<texture_tile> Loaded = LoadTile(Entry, Level, TileX, TileY);
+            if(!Loaded)
+            {
+                return nullptr;
+            }
+
+            std::lock_guard<std::mutex> Guard(lock);
+            ++stats.Loads;
+            auto Found = tiles.find(Key);
+            if(Found != tiles.end())
+            {
+                Tile = Found->second.Tile;
+            }
+            else
+            {
+                uses.push_front(Key);
+                tiles[Key] = cached_tile{Loaded, uses.begin()};
+                resident += sizeof(texture_tile);
+                stats.PeakBytes = MAX(stats.PeakBytes, resident);
+                Tile = Loaded;
+                EvictOverBudget();
+            }
+        }
+
+        Slot.Key = Key;
+        Slot.Tile = Tile;
+        return Tile.get();
+    }
+
+    // NOTE: Drops the least recently used tiles. The cache lock is held.
+    void
+    EvictOverBudget()
+    {
+        // Always leave the newest tile, even with a budget smaller than one.
+        while((resident > budget) && (uses.size() > 1))
+        {
+            tiles.erase(uses.back());
+            uses.pop_back();
+            resident -= sizeof(texture_tile);
+            ++stats.Evictions;
+        }
+    }
+
+    std::shared_ptr<texture_tile>
+    LoadTile(entry &Entry, i32 Level, i32 TileX, i32 TileY)
+    {
+        std::lock_guard<std::mutex> Guard(Entry.FileLock);
+
+        std::shared_ptr<texture_tile> Result;
+        if(!Entry.Tiles && !Entry.Failed)
+        {
+            u64 Size;
+            u64 Hash = HashFile(Entry.Filename.c_str(), Size);
+            Entry.Tiles = OpenTileFile(Entry, Hash, Size);
+            Entry.Failed = (Entry.Tiles == nullptr);
+        }
+
+        if(Entry.Tiles)
+        {
+            const texture_level &L = Entry.Levels[Level];
+            u64 Index = L.FirstTile + (u64)TileY*L.TilesX + TileX;
+            u64 Offset = sizeof(texture_tiles_header) + Index*TEXTURE_TILE_BYTES;
+
+            Result = std::make_shared<texture_tile>();
+            if((SeekFile(Entry.Tiles, Offset) != 0) ||
+               (fread(Result->Texels, TEXTURE_TILE_BYTES, 1, Entry.Tiles) != 1))
+            {
+                fprintf(stderr, "Texture Cache: Could not read a tile of %s\n", Entry.Filename.c_str());
+                Result = nullptr;
+            }
+        }
+
+        return Result;
+    }
+
+    static i32
+    SeekFile(FILE *File, u64 Offset)
+    {
+#if defined(_WIN32)
+        i32 Result = _fseeki64(File, (__int64)Offset, SEEK_SET);
+#else
+        i32 Result = fseeko(File, (off_t)Offset, SEEK_SET);
+#endif
+        return Result;
+    }
+
+    // NOTE: The tile file of an image if there is a good one, otherwise
+    // decodes the image and writes one.
+    FILE *
+    OpenTileFile(entry &Entry, u64 SourceHash, u64 SourceSize)
+    {
+        std::string TilesFilename = Entry.Filename + ".rttiles";
+
+        if(Entry.UseTileFile)
+        {
+            FILE *File = fopen(TilesFilename.c_str(), "rb");
+            if(File)
+            {
+                texture_tiles_header Header = {};
+                b32 Valid = (fread(&Header, sizeof(Header), 1, File) == 1) &&
+                            (Header.Magic == TEXTURE_TILES_MAGIC) &&
+                            (Header.Version == TEXTURE_TILES_VERSION) &&
+                            (Header.Width == Entry.Width) && (Header.Height == Entry.Height) &&
+                            (Header.LevelCount == (i32)Entry.Levels.size()) &&
+                            (Header.SourceSize == SourceSize) &&
+                            (Header.SourceHash == SourceHash);
+                if(Valid)
+                {
+                    return File;
+                }
+                fclose(File);
+            }
+        }
+
+        rt_image Image(Entry.Filename.c_str());
+        if((Image.Width() != Entry.Width) || (Image.Height() != Entry.Height))
+        {
+            fprintf(stderr, "Texture Cache: Could not decode %s\n", Entry.Filename.c_str());
+            return nullptr;
+        }
+
+        FILE *File = Entry.UseTileFile ? fopen(TilesFilename.c_str(), "w+b") : nullptr;
+        File = File ? File : tmpfile();
+        if(!File)
+        {
+            fprintf(stderr, "Texture Cache: Could not write the tiles of %s\n", Entry.Filename.c_str());
+            return nullptr;
+        }
+
+        texture_tiles_header Header = {};
+        Header.Magic = TEXTURE_TILES_MAGIC;
+        Header.Version = TEXTURE_TILES_VERSION;
+        Header.Width = Entry.Width;
+        Header.Height = Entry.Height;
+        Header.LevelCount = (i32)Entry.Levels.size();
+        Header.SourceSize = SourceSize;
+        Header.SourceHash = SourceHash;
+        b32 Written = (fwrite(&Header, sizeof(Header), 1, File) == 1);
+
+        // NOTE: Each level is a 2x2 box filter of the one above it, edge
+        // texels repeat on odd sizes.
+        std::vector<u8> Pixels((u64)Entry.Width*Entry.Height*3);
+        for(i32 Y = 0; Y < Entry.Height; ++Y)
+        {
+            memcpy(&Pixels[(u64)Y*Entry.Width*3], Image.PixelData(0, Y), (u64)Entry.Width*3);
+        }
+
+        texture_tile Tile;
+        for(size_t LevelIndex = 0; Written && (LevelIndex < Entry.Levels.size()); ++LevelIndex)
+        {
+            const texture_level &L = Entry.Levels[LevelIndex];
+            if(LevelIndex > 0)
+            {
+                const texture_level &Above = Entry.Levels[LevelIndex - 1];
+                std::vector<u8> Smaller((u64)L.Width*L.Height*3);
+                for(i32 Y = 0; Y < L.Height; ++Y)
+                {
+                    i32 Y0 = MIN(2*Y, Above.Height - 1);
+                    i32 Y1 = MIN(2*Y + 1, Above.Height - 1);
+                    for(i32 X = 0; X < L.Width; ++X)
+                    {
+                        i32 X0 = MIN(2*X, Above.Width - 1);
+                        i32 X1 = MIN(2*X + 1, Above.Width - 1);
+                        for(i32 Channel = 0; Channel < 3; ++Channel)
+                        {
+                            u32 Sum = Pixels[((u64)Y0*Above.Width + X0)*3 + Channel] +
+                                      Pixels[((u64)Y0*Above.Width + X1)*3 + Channel] +
+                                      Pixels[((u64)Y1*Above.Width + X0)*3 + Channel] +
+                                      Pixels[((u64)Y1*Above.Width + X1)*3 + Channel];
+                            Smaller[((u64)Y*L.Width + X)*3 + Channel] = (u8)((Sum + 2) / 4);
+                        }
+                    }
+                }
+                Pixels.swap(Smaller);
+            }
+
+            for(i32 TileY = 0; Written && (TileY < L.TilesY); ++TileY)
+            {
+                for(i32 TileX = 0; Written && (TileX < L.TilesX); ++TileX)
+                {
+                    for(i32 Y = 0; Y < TEXTURE_TILE_SIZE; ++Y)
+                    {
+                        i32 SourceY = MIN(TileY*TEXTURE_TILE_SIZE + Y, L.Height - 1);
+                        for(i32 X = 0; X < TEXTURE_TILE_SIZE; ++X)
+                        {
+                            i32 SourceX = MIN(TileX*TEXTURE_TILE_SIZE + X, L.Width - 1);
+                            memcpy(&Tile.Texels[(Y*TEXTURE_TILE_SIZE + X)*3],
+                                   &Pixels[((u64)SourceY*L.Width + SourceX)*3], 3);
+                        }
+                    }
+                    Written = (fwrite(Tile.Texels, TEXTURE_TILE_BYTES, 1, File) == 1);
+                }
+            }
+        }
+
+        if(!Written || (fflush(File) != 0))
+        {
+            fprintf(stderr, "Texture Cache: Could not write the tiles of %s\n", Entry.Filename.c_str());
+            fclose(File);
+            File = nullptr;
+        }
+
+        return File;
+    }
+};
+
+#define TEXTURE_CACHE_H
+#endif
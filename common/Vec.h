@@ -1,5 +1,6 @@
 #if !defined(VEC_H)
 #include "defines.h"
+#include "VecSIMD.h"
 
 template <typename T>
 struct vec2
@@ -68,6 +69,8 @@ struct vec3
         struct { vec2<T> rg; T Unused_4; };
         struct { T Unused_5; vec2<T> gb; };
         T E[3];
+        // NOTE: The SIMD register view for f32 and f64, see VecSIMD.h.
+        typename simd_lanes<T>::vec3 Lanes;
     };
 
     inline vec3<T> operator+=(const vec3<T>& A);
@@ -93,6 +96,8 @@ typedef vec3<i32> vec3i;
 typedef vec3<f32> vec3f;
 typedef vec3<f64> vec3d;
 typedef vec3<u32> vec3u;
+typedef vec3<real> vec3r;
+#define Vec3r Vec3<real>
 #define Vec3d Vec3<f64>
 #define Vec3f Vec3<f32>
 #define Vec3u Vec3<u32>
@@ -103,6 +108,7 @@ template <typename T> SHU_EXPORT vec3<T> Vec3(T A);
 template <typename T> SHU_EXPORT vec3<T> Vec3(T x, T y, T z);
 template <typename T> SHU_EXPORT vec3<T> MakeVec3(const T *const Ptr);
 template <typename T> SHU_EXPORT vec3<T> Vec3(const vec2<T>& xy, T z);
+template <typename T, typename S> SHU_EXPORT vec3<T> Vec3(const vec3<S>& A);
 template <typename T> SHU_EXPORT vec3<T> ToVec3(const vec2<T>& A);
 template <typename T> SHU_EXPORT vec2<T> ToVec2(const vec3<T>& A);
 template <typename T> SHU_EXPORT T Dot(const vec3<T>& A, const vec3<T>& B);
@@ -122,6 +128,8 @@ template <typename T> SHU_EXPORT T SqMagnitude(const vec3<T> &A);
 template <typename T> SHU_EXPORT T Magnitude(const vec3<T> &A);
 
 template <typename T> SHU_EXPORT vec3<T> Normalize(const vec3<T> &A);
+template <typename T> SHU_EXPORT vec3<T> ComponentMin(const vec3<T> &A, const vec3<T> &B);
+template <typename T> SHU_EXPORT vec3<T> ComponentMax(const vec3<T> &A, const vec3<T> &B);
 template <typename T> SHU_EXPORT vec3<T> Reflect(const vec3<T> &Incident, const vec3<T> &Normal);
 template <typename T> SHU_EXPORT vec3<T> Refract(const vec3<T> &Incident, const vec3<T> &Normal, const f64 N1ByN2);
 
@@ -140,9 +148,13 @@ struct vec4
         struct { vec2<T> xy; vec2<T> zw; };
         struct { vec2<T> rg; vec2<T> ba; };
         struct { vec2<T> uv; vec2<T> st; };
-        struct { vec3<T> xyz; T Reserved_0; };
-        struct { vec3<T> rgb; T Reserved_1; };
+        // NOTE: Not wrapped in a struct with the w after it, with SIMD on
+        // vec3<f32> is four lanes wide and that would make vec4 twice as big.
+        // Assigning to xyz then writes over w as well.
+        vec3<T> xyz;
+        vec3<T> rgb;
         T E[4];
+        typename simd_lanes<T>::vec4 Lanes;
     };
 
     inline vec4<T> operator+=(const vec4<T>& A);
@@ -419,6 +431,16 @@ Vec3(const vec2<T>& xy, T z)
     return Result;
 }
 
+// NOTE: Converts between scalar types, Vec3d(SomeVec3f).
+template <typename T, typename S>
+vec3<T>
+Vec3(const vec3<S>& A)
+{
+    vec3<T> Result = Vec3((T)A.x, (T)A.y, (T)A.z);
+
+    return Result;
+}
+
 template <typename T>
 vec3<T>
 ToVec3(const vec2<T>& A)
@@ -463,10 +485,9 @@ template <typename T>
 vec3<T>
 Cross(const vec3<T> &A, const vec3<T> &B)
 {
-    vec3<T> Result;
-    Result.x = A.y*B.z - A.z*B.y;
-    Result.y = A.z*B.x - A.x*B.z;
-    Result.z = A.x*B.y - A.y*B.x;
+    vec3<T> Result = Vec3(A.y*B.z - A.z*B.y,
+                          A.z*B.x - A.x*B.z,
+                          A.x*B.y - A.y*B.x);
     return Result;
 }
 
@@ -571,12 +592,7 @@ template <typename T, typename S>
 vec3<T>
 operator*(S B, const vec3<T> &A)
 {
-    vec3<T> Result;
-
-    Result.x = B * A.x;
-    Result.y = B * A.y;
-    Result.z = B * A.z;
-
+    vec3<T> Result = Vec3((T)(B * A.x), (T)(B * A.y), (T)(B * A.z));
     return Result;
 }
 
@@ -584,12 +600,7 @@ template <typename T, typename S>
 vec3<T>
 operator*(const vec3<T>& A, S B)
 {
-    vec3<T> Result;
-
-    Result.x = B * A.x;
-    Result.y = B * A.y;
-    Result.z = B * A.z;
-
+    vec3<T> Result = Vec3((T)(B * A.x), (T)(B * A.y), (T)(B * A.z));
     return Result;
 }
 
@@ -666,14 +677,9 @@ template <typename T>
 vec3<T>
 operator/(const vec3<T> &A, const i32 B)
 {
-    vec3<T> Result;
-
     ASSERT(B != 0);
 
-    Result.x = A.x / B;
-    Result.y = A.y / B;
-    Result.z = A.z / B;
-
+    vec3<T> Result = Vec3((T)(A.x / B), (T)(A.y / B), (T)(A.z / B));
     return Result;
 }
 
@@ -741,8 +747,9 @@ template <typename T>
 T
 vec3<T>::Magnitude() const
 {
-    // NOTE: Change this to use ouw own Square Root function
-    T Result = sqrtf(this->x*this->x + this->y*this->y + this->z*this->z);
+    // NOTE: Change this to use ouw own Square Root function. Not sqrtf, it
+    // would round f64 vectors down to f32 precision.
+    T Result = (T)sqrt(this->x*this->x + this->y*this->y + this->z*this->z);
     return Result;
 }
 
@@ -750,12 +757,7 @@ template <typename T>
 vec3<T>
 vec3<T>::One()
 {
-    vec3<T> Result;
-
-    Result.x = (T)1.0;
-    Result.y = (T)1.0;
-    Result.z = (T)1.0;
-
+    vec3<T> Result = Vec3((T)1.0, (T)1.0, (T)1.0);
     return Result;
 }
 
@@ -771,7 +773,7 @@ template <typename T>
 T
 Magnitude(const vec3<T> &A)
 {
-    T Result = sqrtf(A.x*A.x + A.y*A.y + A.z*A.z);
+    T Result = (T)sqrt(A.x*A.x + A.y*A.y + A.z*A.z);
     return Result;
 }
 
@@ -779,10 +781,11 @@ template <typename T>
 vec3<T>
 vec3<T>::Rand01()
 {
-    vec3<T> Result;
-    Result.x = Rand01Generic<T>();
-    Result.y = Rand01Generic<T>();
-    Result.z = Rand01Generic<T>();
+    // NOTE: One at a time, the order arguments get evaluated in isn't fixed.
+    T X = Rand01Generic<T>();
+    T Y = Rand01Generic<T>();
+    T Z = Rand01Generic<T>();
+    vec3<T> Result = Vec3(X, Y, Z);
     return Result;
 }
 
@@ -790,38 +793,39 @@ template <typename T>
 vec3<T>
 vec3<T>::RandRange(T Min, T Max)
 {
-    vec3<T> Result;
-    Result.x = Min + ((Max - Min)*Rand01Generic<T>());
-    Result.y = Min + ((Max - Min)*Rand01Generic<T>());
-    Result.z = Min + ((Max - Min)*Rand01Generic<T>());
+    T X = Min + ((Max - Min)*Rand01Generic<T>());
+    T Y = Min + ((Max - Min)*Rand01Generic<T>());
+    T Z = Min + ((Max - Min)*Rand01Generic<T>());
+    vec3<T> Result = Vec3(X, Y, Z);
     return Result;
 }
 
+// NOTE: The Random* directions below are closed form, a fixed number of
+// Rand01() calls each and no rejection loop. Warp.h has the same maps taking
+// their numbers from a sampler instead.
+
+// NOTE: A uniform direction, with the distance from the center going as the
+// cube root of a uniform so that the volume is covered evenly.
 template <typename T>
 vec3<T>
 vec3<T>::RandomInUnitSphere()
 {
-    vec3<T> Result;
-    while(1)
-    {
-        Result = vec3<T>::RandRange(-1, 1);
-        // NOTE: Rejection Sampling. Reject all vectors that are outside the
-        // unit sphere. Meaning they all have magnitudes more than the radius 1.
-        if(Result.SqMagnitude() < (T)1)
-        {
-            break;
-        }
-    }
-
+    vec3<T> Direction = RandomUnitVector();
+    T Radius = (T)cbrt(Rand01Generic<T>());
+    vec3<T> Result = Radius*Direction;
     return Result;
 }
 
+// NOTE: z uniform in [-1, 1] and the angle around z uniform, which is uniform
+// on the sphere (Archimedes' hat-box theorem).
 template <typename T>
 inline vec3<T>
 vec3<T>::RandomUnitVector()
 {
-    vec3<T> Result = RandomInUnitSphere();
-    Result = Normalize(Result);
+    T Z = (T)1 - (T)2*Rand01Generic<T>();
+    T Phi = (T)(2.0*pi)*Rand01Generic<T>();
+    T R = (T)sqrt(MAX((T)0, (T)1 - Z*Z));
+    vec3<T> Result = Vec3((T)(R*cos(Phi)), (T)(R*sin(Phi)), Z);
 
     return Result;
 }
@@ -832,29 +836,35 @@ vec3<T>::RandomInUnitHemisphere(const vec3<T> &Normal)
 {
     vec3<T> Result = RandomUnitVector();
     T DotP = DotStatic(Result, Normal);
-    if(DotP < (T)0)
-    {
-        Result = -Result;
-    }
+    // NOTE: Flips it to the side of the normal without a branch.
+    Result = (T)copysign((T)1, DotP)*Result;
 
     return Result;
 }
 
+// NOTE: Shirley-Chiu concentric map from the square to the disk.
 template <typename T>
 inline vec3<T>
 vec3<T>::RandomInUnitDisk()
 {
-    vec3<T> Result;
-    while(true)
-    {
-        Result.x = ::RandRange((T)-1, (T)1);
-        Result.y = ::RandRange((T)-1, (T)1);
-        Result.z = 0;
+    T A = (T)2*Rand01Generic<T>() - (T)1;
+    T B = (T)2*Rand01Generic<T>() - (T)1;
 
-        if(Result.SqMagnitude() < 1.)
+    vec3<T> Result = Vec3((T)0, (T)0, (T)0);
+    if((A != (T)0) || (B != (T)0))
+    {
+        T R, Theta;
+        if(fabs(A) > fabs(B))
+        {
+            R = A;
+            Theta = (T)(pi / 4.0)*(B / A);
+        }
+        else
         {
-            break;
+            R = B;
+            Theta = (T)(pi / 2.0) - (T)(pi / 4.0)*(A / B);
         }
+        Result = Vec3((T)(R*cos(Theta)), (T)(R*sin(Theta)), (T)0);
     }
 
     return Result;
@@ -876,6 +886,23 @@ Normalize(const vec3<T> &A)
     return Result;
 }
 
+// NOTE: Per component MIN/MAX, for growing bounding boxes.
+template <typename T>
+vec3<T>
+ComponentMin(const vec3<T> &A, const vec3<T> &B)
+{
+    vec3<T> Result = Vec3(MIN(A.x, B.x), MIN(A.y, B.y), MIN(A.z, B.z));
+    return Result;
+}
+
+template <typename T>
+vec3<T>
+ComponentMax(const vec3<T> &A, const vec3<T> &B)
+{
+    vec3<T> Result = Vec3(MAX(A.x, B.x), MAX(A.y, B.y), MAX(A.z, B.z));
+    return Result;
+}
+
 // ----------------------------------------------------------------------------------------------------------------
 // Vec4
 // ----------------------------------------------------------------------------------------------------------------
@@ -1027,6 +1054,250 @@ vec4<T>::operator[](size_t Index)
 
     return this->E[Index];
 }
+
+// ----------------------------------------------------------------------------------------------------------------
+// SIMD
+// ----------------------------------------------------------------------------------------------------------------
+// NOTE: Plain overloads for vec3<f32>, vec3<f64> and vec4<f32>. Overload
+// resolution picks a non-template function over the templates above when
+// both match exactly, so nothing that calls these has to change. Mixed types
+// (2*V, 0.5*vec3f) still go to the templates. Each of these does the same
+// operations in the same order as the scalar version, renders come out bit
+// for bit the same with RT_SIMD on or off.
+#if RT_SIMD != RT_SIMD_NONE
+#define RT_SIMD_VEC3(T)                                                       \
+    template <>                                                               \
+    inline vec3<T>                                                            \
+    Vec3<T>(T x, T y, T z)                                                    \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdSet(x, y, z);                                      \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    template <>                                                               \
+    inline vec3<T>                                                            \
+    Vec3<T>(T A)                                                              \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdSplat(A);                                          \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator+(const vec3<T> &A, const vec3<T> &B)                             \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdAdd(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator-(const vec3<T> &A, const vec3<T> &B)                             \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdSub(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator-(const vec3<T> &A)                                               \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdNeg(A.Lanes);                                      \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator*(const vec3<T> &A, const vec3<T> &B)                             \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdMul(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator*(const vec3<T> &A, T B)                                          \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdMul(A.Lanes, SimdSplat(B));                        \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator*(T B, const vec3<T> &A)                                          \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdMul(SimdSplat(B), A.Lanes);                        \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator/(const vec3<T> &A, const vec3<T> &B)                             \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdDiv(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    operator/(const vec3<T> &A, T B)                                          \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdDiv(A.Lanes, SimdSplat(B));                        \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline T                                                                  \
+    Dot(const vec3<T> &A, const vec3<T> &B)                                   \
+    {                                                                         \
+        T Result = SimdDot3(A.Lanes, B.Lanes);                                \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline T                                                                  \
+    DotStatic(const vec3<T> &A, const vec3<T> &B)                             \
+    {                                                                         \
+        T Result = SimdDot3(A.Lanes, B.Lanes);                                \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    template <>                                                               \
+    inline T                                                                  \
+    vec3<T>::Dot(const vec3<T> &A)                                            \
+    {                                                                         \
+        T Result = SimdDot3(A.Lanes, this->Lanes);                            \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    template <>                                                               \
+    inline T                                                                  \
+    vec3<T>::SqMagnitude() const                                              \
+    {                                                                         \
+        T Result = SimdDot3(this->Lanes, this->Lanes);                        \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    template <>                                                               \
+    inline T                                                                  \
+    vec3<T>::Magnitude() const                                                \
+    {                                                                         \
+        T Result = (T)sqrt(SimdDot3(this->Lanes, this->Lanes));               \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline T                                                                  \
+    SqMagnitude(const vec3<T> &A)                                             \
+    {                                                                         \
+        T Result = SimdDot3(A.Lanes, A.Lanes);                                \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline T                                                                  \
+    Magnitude(const vec3<T> &A)                                               \
+    {                                                                         \
+        T Result = (T)sqrt(SimdDot3(A.Lanes, A.Lanes));                       \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    Normalize(const vec3<T> &A)                                               \
+    {                                                                         \
+        vec3<T> Result = A;                                                   \
+        T SqMagnitude = SimdDot3(A.Lanes, A.Lanes);                           \
+        if(SqMagnitude > (T)0)                                                \
+        {                                                                     \
+            T OneByMagnitude = (T)((T)1.0 / sqrt(SqMagnitude));               \
+            Result.Lanes = SimdMul(A.Lanes, SimdSplat(OneByMagnitude));       \
+        }                                                                     \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    ComponentMin(const vec3<T> &A, const vec3<T> &B)                          \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdMin(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }                                                                         \
+                                                                              \
+    inline vec3<T>                                                            \
+    ComponentMax(const vec3<T> &A, const vec3<T> &B)                          \
+    {                                                                         \
+        vec3<T> Result;                                                       \
+        Result.Lanes = SimdMax(A.Lanes, B.Lanes);                             \
+        return Result;                                                        \
+    }
+
+RT_SIMD_VEC3(f32)
+RT_SIMD_VEC3(f64)
+#undef RT_SIMD_VEC3
+
+#if RT_SIMD_HAS_CROSS3
+inline vec3<f32>
+Cross(const vec3<f32> &A, const vec3<f32> &B)
+{
+    vec3<f32> Result;
+    Result.Lanes = SimdCross3(A.Lanes, B.Lanes);
+    return Result;
+}
+#endif
+
+inline vec4<f32>
+operator+(const vec4<f32> &A, const vec4<f32> &B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdAdd(A.Lanes, B.Lanes);
+    return Result;
+}
+
+inline vec4<f32>
+operator-(const vec4<f32> &A, const vec4<f32> &B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdSub(A.Lanes, B.Lanes);
+    return Result;
+}
+
+inline vec4<f32>
+operator*(const vec4<f32> &A, const vec4<f32> &B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdMul(A.Lanes, B.Lanes);
+    return Result;
+}
+
+inline vec4<f32>
+operator*(const vec4<f32> &A, f32 B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdMul(A.Lanes, SimdSplat(B));
+    return Result;
+}
+
+inline vec4<f32>
+operator/(const vec4<f32> &A, const vec4<f32> &B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdDiv(A.Lanes, B.Lanes);
+    return Result;
+}
+
+inline vec4<f32>
+operator/(const vec4<f32> &A, f32 B)
+{
+    vec4<f32> Result;
+    Result.Lanes = SimdDiv(A.Lanes, SimdSplat(B));
+    return Result;
+}
+
+inline f32
+Dot(const vec4<f32> &A, const vec4<f32> &B)
+{
+    f32 Result = SimdDot4(A.Lanes, B.Lanes);
+    return Result;
+}
+#endif
 #endif
 
 #define VEC_H
@@ -0,0 +1,290 @@
+#if !defined(VEC_SIMD_H)
+
+#include "defines.h"
+
+// NOTE: Which instruction set the vec3<f32>, vec3<f64> and vec4<f32>
+// overloads in Vec.h use, picked from what the compiler targets unless RT_SIMD
+// is defined. The CMake option of the same name is off by default, which
+// builds with RT_SIMD=0 and the plain scalar code: the compiler vectorizes and
+// schedules that well enough on its own that the SSE overloads came out
+// slower (see --experiment vec). Turn it on to get them. AVX builds use the
+// same SSE intrinsics, the compiler turns them into the VEX encoded three
+// operand forms on its own. A 256 bit vec3<f64> would need 32 byte alignment,
+// which malloc'd buffers don't have.
+#define RT_SIMD_NONE 0
+#define RT_SIMD_SSE 1
+#define RT_SIMD_NEON 2
+
+#if !defined(RT_SIMD)
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define RT_SIMD RT_SIMD_SSE
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define RT_SIMD RT_SIMD_NEON
+#else
+#define RT_SIMD RT_SIMD_NONE
+#endif
+#endif
+
+#if RT_SIMD == RT_SIMD_SSE
+#include <emmintrin.h>
+#elif RT_SIMD == RT_SIMD_NEON
+#include <arm_neon.h>
+#endif
+
+// NOTE: The register a vector type is kept in, as a union member next to
+// x, y, z. Types without SIMD overloads get an empty struct, which leaves
+// their size and alignment alone. With SIMD on vec3<f32> grows from 12 to 16
+// bytes and vec3<f64> from 24 to 32, the last lane is padding. Vec3(x, y, z)
+// sets it to 0 (see SimdSet), and so does everything built on it; the f32
+// Vec3(A) fills it with A. The operators carry on whatever is in it, and
+// vectors that get their fields written one at a time leave whatever was in
+// memory there. None of that shows up in the results, nothing reads the lane
+// back: the horizontal operations (Dot, SqMagnitude) leave it out.
+template <typename T>
+struct simd_lanes
+{
+    struct vec3 {};
+    struct vec4 {};
+};
+
+#if RT_SIMD == RT_SIMD_SSE
+typedef __m128 simd_f32x4;
+// x, y in the first register, z in the low half of the second.
+struct simd_f64x3
+{
+    __m128d XY;
+    __m128d ZW;
+};
+#elif RT_SIMD == RT_SIMD_NEON
+typedef float32x4_t simd_f32x4;
+struct simd_f64x3
+{
+    float64x2_t XY;
+    float64x2_t ZW;
+};
+#endif
+
+#if RT_SIMD != RT_SIMD_NONE
+template <>
+struct simd_lanes<f32>
+{
+    typedef simd_f32x4 vec3;
+    typedef simd_f32x4 vec4;
+};
+
+template <>
+struct simd_lanes<f64>
+{
+    typedef simd_f64x3 vec3;
+    struct vec4 {};
+};
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------
+// f32, four lanes
+// ----------------------------------------------------------------------------------------------------------------
+#if RT_SIMD == RT_SIMD_SSE
+inline simd_f32x4 SimdSet(f32 X, f32 Y, f32 Z, f32 W) { return _mm_setr_ps(X, Y, Z, W); }
+inline simd_f32x4 SimdSplat(f32 A) { return _mm_set1_ps(A); }
+inline simd_f32x4 SimdAdd(simd_f32x4 A, simd_f32x4 B) { return _mm_add_ps(A, B); }
+inline simd_f32x4 SimdSub(simd_f32x4 A, simd_f32x4 B) { return _mm_sub_ps(A, B); }
+inline simd_f32x4 SimdMul(simd_f32x4 A, simd_f32x4 B) { return _mm_mul_ps(A, B); }
+inline simd_f32x4 SimdDiv(simd_f32x4 A, simd_f32x4 B) { return _mm_div_ps(A, B); }
+inline simd_f32x4 SimdNeg(simd_f32x4 A) { return _mm_xor_ps(A, _mm_set1_ps(-0.0f)); }
+// NOTE: Same as MIN/MAX, A < B ? A : B, including which side a NaN ends up on.
+inline simd_f32x4 SimdMin(simd_f32x4 A, simd_f32x4 B) { return _mm_min_ps(A, B); }
+inline simd_f32x4 SimdMax(simd_f32x4 A, simd_f32x4 B) { return _mm_max_ps(A, B); }
+
+// NOTE: x*x' + y*y' + z*z', added up in the same order as the scalar code so
+// the results match it bit for bit.
+inline f32
+SimdDot3(simd_f32x4 A, simd_f32x4 B)
+{
+    __m128 M = _mm_mul_ps(A, B);
+    __m128 Y = _mm_shuffle_ps(M, M, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 Z = _mm_shuffle_ps(M, M, _MM_SHUFFLE(2, 2, 2, 2));
+    f32 Result = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(M, Y), Z));
+    return Result;
+}
+
+inline f32
+SimdDot4(simd_f32x4 A, simd_f32x4 B)
+{
+    __m128 M = _mm_mul_ps(A, B);
+    __m128 Y = _mm_shuffle_ps(M, M, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 Z = _mm_shuffle_ps(M, M, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 W = _mm_shuffle_ps(M, M, _MM_SHUFFLE(3, 3, 3, 3));
+    f32 Result = _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(_mm_add_ss(M, Y), Z), W));
+    return Result;
+}
+
+// NOTE: A*B.yzx - A.yzx*B comes out as the cross product in zxy order, one
+// more shuffle puts it back.
+#define RT_SIMD_HAS_CROSS3 1
+inline simd_f32x4
+SimdCross3(simd_f32x4 A, simd_f32x4 B)
+{
+    __m128 AYZX = _mm_shuffle_ps(A, A, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 BYZX = _mm_shuffle_ps(B, B, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 C = _mm_sub_ps(_mm_mul_ps(A, BYZX), _mm_mul_ps(AYZX, B));
+    __m128 Result = _mm_shuffle_ps(C, C, _MM_SHUFFLE(3, 0, 2, 1));
+    return Result;
+}
+#elif RT_SIMD == RT_SIMD_NEON
+inline simd_f32x4
+SimdSet(f32 X, f32 Y, f32 Z, f32 W)
+{
+    f32 Values[4] = {X, Y, Z, W};
+    return vld1q_f32(Values);
+}
+inline simd_f32x4 SimdSplat(f32 A) { return vdupq_n_f32(A); }
+inline simd_f32x4 SimdAdd(simd_f32x4 A, simd_f32x4 B) { return vaddq_f32(A, B); }
+inline simd_f32x4 SimdSub(simd_f32x4 A, simd_f32x4 B) { return vsubq_f32(A, B); }
+inline simd_f32x4 SimdMul(simd_f32x4 A, simd_f32x4 B) { return vmulq_f32(A, B); }
+inline simd_f32x4 SimdDiv(simd_f32x4 A, simd_f32x4 B) { return vdivq_f32(A, B); }
+inline simd_f32x4 SimdNeg(simd_f32x4 A) { return vnegq_f32(A); }
+// NOTE: Not vminq/vmaxq, those return NaN if either side is one, MIN/MAX
+// return B.
+inline simd_f32x4 SimdMin(simd_f32x4 A, simd_f32x4 B) { return vbslq_f32(vcltq_f32(A, B), A, B); }
+inline simd_f32x4 SimdMax(simd_f32x4 A, simd_f32x4 B) { return vbslq_f32(vcgtq_f32(A, B), A, B); }
+
+inline f32
+SimdDot3(simd_f32x4 A, simd_f32x4 B)
+{
+    float32x4_t M = vmulq_f32(A, B);
+    f32 Result = (vgetq_lane_f32(M, 0) + vgetq_lane_f32(M, 1)) + vgetq_lane_f32(M, 2);
+    return Result;
+}
+
+inline f32
+SimdDot4(simd_f32x4 A, simd_f32x4 B)
+{
+    float32x4_t M = vmulq_f32(A, B);
+    f32 Result = ((vgetq_lane_f32(M, 0) + vgetq_lane_f32(M, 1)) +
+                  vgetq_lane_f32(M, 2)) + vgetq_lane_f32(M, 3);
+    return Result;
+}
+#endif
+
+#if RT_SIMD != RT_SIMD_NONE
+// NOTE: vec3<f32>, the padding lane starts out 0.
+inline simd_f32x4 SimdSet(f32 X, f32 Y, f32 Z) { return SimdSet(X, Y, Z, 0.0f); }
+#endif
+
+// ----------------------------------------------------------------------------------------------------------------
+// f64, three lanes in two registers
+// ----------------------------------------------------------------------------------------------------------------
+#if RT_SIMD == RT_SIMD_SSE
+// NOTE: The z half only ever uses the _sd forms, so the padding lane never
+// goes through the FPU and can't be a slow denormal.
+inline simd_f64x3
+SimdSet(f64 X, f64 Y, f64 Z)
+{
+    simd_f64x3 Result = {_mm_setr_pd(X, Y), _mm_set_sd(Z)};
+    return Result;
+}
+
+inline simd_f64x3
+SimdSplat(f64 A)
+{
+    simd_f64x3 Result = {_mm_set1_pd(A), _mm_set_sd(A)};
+    return Result;
+}
+
+#define RT_SIMD_F64_OP(Name, Op)                                     \
+    inline simd_f64x3                                                \
+    Name(const simd_f64x3 &A, const simd_f64x3 &B)                   \
+    {                                                                \
+        simd_f64x3 Result = {_mm_##Op##_pd(A.XY, B.XY),             \
+                             _mm_##Op##_sd(A.ZW, B.ZW)};            \
+        return Result;                                               \
+    }
+RT_SIMD_F64_OP(SimdAdd, add)
+RT_SIMD_F64_OP(SimdSub, sub)
+RT_SIMD_F64_OP(SimdMul, mul)
+RT_SIMD_F64_OP(SimdDiv, div)
+RT_SIMD_F64_OP(SimdMin, min)
+RT_SIMD_F64_OP(SimdMax, max)
+#undef RT_SIMD_F64_OP
+
+inline simd_f64x3
+SimdNeg(const simd_f64x3 &A)
+{
+    __m128d Sign = _mm_set1_pd(-0.0);
+    simd_f64x3 Result = {_mm_xor_pd(A.XY, Sign), _mm_xor_pd(A.ZW, Sign)};
+    return Result;
+}
+
+inline f64
+SimdDot3(const simd_f64x3 &A, const simd_f64x3 &B)
+{
+    __m128d M = _mm_mul_pd(A.XY, B.XY);
+    __m128d Sum = _mm_add_sd(M, _mm_unpackhi_pd(M, M));
+    Sum = _mm_add_sd(Sum, _mm_mul_sd(A.ZW, B.ZW));
+    f64 Result = _mm_cvtsd_f64(Sum);
+    return Result;
+}
+#elif RT_SIMD == RT_SIMD_NEON
+inline simd_f64x3
+SimdSet(f64 X, f64 Y, f64 Z)
+{
+    f64 Values[4] = {X, Y, Z, 0.0};
+    simd_f64x3 Result = {vld1q_f64(Values), vld1q_f64(Values + 2)};
+    return Result;
+}
+
+inline simd_f64x3
+SimdSplat(f64 A)
+{
+    simd_f64x3 Result = {vdupq_n_f64(A), vdupq_n_f64(A)};
+    return Result;
+}
+
+#define RT_SIMD_F64_OP(Name, Op)                                     \
+    inline simd_f64x3                                                \
+    Name(const simd_f64x3 &A, const simd_f64x3 &B)                   \
+    {                                                                \
+        simd_f64x3 Result = {Op(A.XY, B.XY), Op(A.ZW, B.ZW)};        \
+        return Result;                                               \
+    }
+RT_SIMD_F64_OP(SimdAdd, vaddq_f64)
+RT_SIMD_F64_OP(SimdSub, vsubq_f64)
+RT_SIMD_F64_OP(SimdMul, vmulq_f64)
+RT_SIMD_F64_OP(SimdDiv, vdivq_f64)
+#undef RT_SIMD_F64_OP
+
+inline simd_f64x3
+SimdMin(const simd_f64x3 &A, const simd_f64x3 &B)
+{
+    simd_f64x3 Result = {vbslq_f64(vcltq_f64(A.XY, B.XY), A.XY, B.XY),
+                         vbslq_f64(vcltq_f64(A.ZW, B.ZW), A.ZW, B.ZW)};
+    return Result;
+}
+
+inline simd_f64x3
+SimdMax(const simd_f64x3 &A, const simd_f64x3 &B)
+{
+    simd_f64x3 Result = {vbslq_f64(vcgtq_f64(A.XY, B.XY), A.XY, B.XY),
+                         vbslq_f64(vcgtq_f64(A.ZW, B.ZW), A.ZW, B.ZW)};
+    return Result;
+}
+
+inline simd_f64x3
+SimdNeg(const simd_f64x3 &A)
+{
+    simd_f64x3 Result = {vnegq_f64(A.XY), vnegq_f64(A.ZW)};
+    return Result;
+}
+
+inline f64
+SimdDot3(const simd_f64x3 &A, const simd_f64x3 &B)
+{
+    float64x2_t M = vmulq_f64(A.XY, B.XY);
+    f64 Result = (vgetq_lane_f64(M, 0) + vgetq_lane_f64(M, 1)) +
+                 vgetq_lane_f64(A.ZW, 0)*vgetq_lane_f64(B.ZW, 0);
+    return Result;
+}
+#endif
+
+#define VEC_SIMD_H
+#endif
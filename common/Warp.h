@@ -0,0 +1,132 @@
+#if !defined(WARP_H)
+
+#include "defines.h"
+#include "Vec.h"
+
+#include <cmath>
+
+// NOTE: Warps from the unit square to the shapes the renderer scatters rays
+// over. All of them are closed form, two uniforms in and a point out, no
+// rejection loops. That way every call takes the same number of random
+// numbers, which the samplers need to keep dimensions lined up with bounces,
+// and the stratification of the samples going in carries over to the
+// directions coming out.
+//
+// The Pdf functions give the density of each warp, with respect to area for
+// the disk and to solid angle for the sphere and hemispheres.
+
+// Uniform on the sphere: z is uniform in [-1, 1] (Archimedes), the angle
+// around z uniform in [0, 2pi).
+inline vec3r
+SampleUnitSphere(const vec2d &Sample)
+{
+    f64 Z = 1.0 - 2.0*Sample.u;
+    f64 R = sqrt(MAX(0.0, 1.0 - Z*Z));
+    f64 Phi = 2.0*pi*Sample.v;
+    vec3r Result = Vec3r(R*cos(Phi), R*sin(Phi), Z);
+    return Result;
+}
+
+inline f64
+UnitSpherePdf()
+{
+    f64 Result = 1.0 / (4.0*pi);
+    return Result;
+}
+
+// NOTE: Shirley-Chiu concentric map. Squares around the center of the unit
+// square go to circles around the center of the disk, so it keeps areas and
+// adjacency better than the polar map (r = sqrt(u)), which squeezes one edge
+// of the square into the center. The two wedges are picked with selects
+// rather than branches, so a mix of samples doesn't mispredict.
+inline vec3r
+SampleUnitDisk(const vec2d &Sample)
+{
+    f64 A = 2.0*Sample.u - 1.0;
+    f64 B = 2.0*Sample.v - 1.0;
+
+    b32 Horizontal = fabs(A) > fabs(B);
+    f64 R = Horizontal ? A : B;
+    f64 Other = Horizontal ? B : A;
+    f64 Ratio = (R != 0.0) ? (Other / R) : 0.0;
+    f64 Theta = Horizontal ? (pi / 4.0)*Ratio : (pi / 2.0) - (pi / 4.0)*Ratio;
+
+    vec3r Result = Vec3r(R*cos(Theta), R*sin(Theta), 0.0);
+    return Result;
+}
+
+inline f64
+UnitDiskPdf()
+{
+    f64 Result = 1.0 / pi;
+    return Result;
+}
+
+// NOTE: Cosine weighted around +z (Malley's method): a uniform point on the
+// disk lifted straight up onto the hemisphere.
+inline vec3r
+SampleCosineHemisphere(const vec2d &Sample)
+{
+    vec3r Result = SampleUnitDisk(Sample);
+    Result.z = (real)sqrt(MAX(0.0, 1.0 - (f64)Result.x*Result.x - (f64)Result.y*Result.y));
+    return Result;
+}
+
+inline f64
+CosineHemispherePdf(f64 CosTheta)
+{
+    f64 Result = (CosTheta > 0.0) ? (CosTheta / pi) : 0.0;
+    return Result;
+}
+
+// Uniform around +z.
+inline vec3r
+SampleUniformHemisphere(const vec2d &Sample)
+{
+    f64 Z = Sample.u;
+    f64 R = sqrt(MAX(0.0, 1.0 - Z*Z));
+    f64 Phi = 2.0*pi*Sample.v;
+    vec3r Result = Vec3r(R*cos(Phi), R*sin(Phi), Z);
+    return Result;
+}
+
+inline f64
+UniformHemispherePdf()
+{
+    f64 Result = 1.0 / (2.0*pi);
+    return Result;
+}
+
+// NOTE: Batch versions, for warping a whole buffer of samples at once. The
+// loops have no branches that depend on earlier iterations and nothing that
+// aliases, so the compiler is free to vectorize them (it does the arithmetic,
+// the sin/cos calls only go wide with a vector math library).
+inline void
+SampleUnitSphere(const vec2d *Samples, vec3r *Results, i32 Count)
+{
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        Results[Index] = SampleUnitSphere(Samples[Index]);
+    }
+}
+
+inline void
+SampleUnitDisk(const vec2d *Samples, vec3r *Results, i32 Count)
+{
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        Results[Index] = SampleUnitDisk(Samples[Index]);
+    }
+}
+
+inline void
+SampleCosineHemisphere(const vec2d *Samples, vec3r *Results, i32 Count)
+{
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        Results[Index] = SampleCosineHemisphere(Samples[Index]);
+    }
+}
+
+#define WARP_H
+#endif
@@ -25,11 +25,28 @@ typedef int64_t int64;
 typedef float f32;
 typedef double f64;
 
+// NOTE: The scalar the renderer does its geometry and shading in. Building
+// with RT_SINGLE_PRECISION=1 (the CMake option of the same name) switches
+// rays, hit records, bounding boxes, the BVH, materials and textures to f32,
+// which halves their size and doubles how many fit in a SIMD register.
+// Things that add up lots of values, like the image accumulation buffer and
+// the error metrics, stay f64 either way.
+#if !defined(RT_SINGLE_PRECISION)
+#define RT_SINGLE_PRECISION 0
+#endif
+
+#if RT_SINGLE_PRECISION
+typedef f32 real;
+#else
+typedef f64 real;
+#endif
+
 #define internal static
 
 // Constants
 const f64 Infinity = std::numeric_limits<f64>::infinity();
 const f64 pi = 3.1415926535897932385;
+const real RealEpsilon = std::numeric_limits<real>::epsilon();
 
 // Utility Functions
 inline f64
@@ -42,21 +59,75 @@ Deg2Rad(const f64 Degrees)
 // CPP Random sometimes gives faulty results.
 #define USE_CPP_RANDOM 0
 
+// NOTE: Every thread has its own generator, so threads never share random
+// state. SeedRandom() picks the sequence: the renderer seeds each scanline
+// with (Seed, Row) so an image comes out the same no matter how many threads
+// rendered it.
 #if USE_CPP_RANDOM
 #include <random>
+inline std::mt19937_64 &
+RandomGenerator()
+{
+    thread_local std::mt19937_64 Generator;
+    return Generator;
+}
+
+inline void
+SeedRandom(u64 Seed, u64 Stream = 0)
+{
+    std::seed_seq Sequence{(u32)Seed, (u32)(Seed >> 32), (u32)Stream, (u32)(Stream >> 32)};
+    RandomGenerator().seed(Sequence);
+}
+
 inline f64
 Rand01()
 {
-    static std::uniform_real_distribution<f64> Distribution(0., 1.);
-    static std::mt19937 Generator;
-    f64 Result = Distribution(Generator);
+    std::uniform_real_distribution<f64> Distribution(0., 1.);
+    f64 Result = Distribution(RandomGenerator());
     return Result;
 }
 #else
+// NOTE: PCG32 (pcg-random.org). 64 bits of state, 2^63 selectable streams.
+struct pcg32
+{
+    u64 State = 0x853c49e6748fea9bull;
+    u64 Increment = 0xda3e39cb94b95bdbull;
+};
+
+inline pcg32 &
+RandomGenerator()
+{
+    thread_local pcg32 Generator;
+    return Generator;
+}
+
+inline u32
+RandU32()
+{
+    pcg32 &Generator = RandomGenerator();
+    u64 OldState = Generator.State;
+    Generator.State = OldState*6364136223846793005ull + Generator.Increment;
+    u32 XorShifted = (u32)(((OldState >> 18u) ^ OldState) >> 27u);
+    u32 Rotation = (u32)(OldState >> 59u);
+    u32 Result = (XorShifted >> Rotation) | (XorShifted << ((-(i32)Rotation) & 31));
+    return Result;
+}
+
+inline void
+SeedRandom(u64 Seed, u64 Stream = 0)
+{
+    pcg32 &Generator = RandomGenerator();
+    Generator.State = 0;
+    Generator.Increment = (Stream << 1u) | 1u;
+    RandU32();
+    Generator.State += Seed;
+    RandU32();
+}
+
 inline f64
 Rand01()
 {
-    f64 Result = rand() / (RAND_MAX + 1.);
+    f64 Result = RandU32()*(1.0 / 4294967296.0);
     return Result;
 }
 #endif
@@ -72,7 +143,7 @@ template <typename T>
 inline T
 Rand01Generic()
 {
-    T Result = (T)rand() / ((T)RAND_MAX + (T)1);
+    T Result = (T)Rand01();
     return Result;
 }
 
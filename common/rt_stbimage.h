@@ -6,6 +6,7 @@
 #endif
 
 #include "defines.h"
+#include "File.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_FAILURE_USERMSG
@@ -13,6 +14,7 @@
 
 #include <cstdlib>
 #include <cstdio>
+#include <cstring>
 
 class rt_image
 {
@@ -27,8 +29,18 @@ class rt_image
             STBI_FREE(Data);
             Data = nullptr;
         }
+        if(FloatData != nullptr)
+        {
+            // NOTE: ReadPFM mallocs, stb may not.
+            if(FloatFromPFM) { free(FloatData); }
+            else             { STBI_FREE(FloatData); }
+            FloatData = nullptr;
+        }
     }
 
+    rt_image(const rt_image &) = delete;
+    rt_image &operator=(const rt_image &) = delete;
+
     b32
     Load(const char *Filename)
     {
@@ -40,17 +52,46 @@ class rt_image
         return Result;
     }
 
+    // NOTE: Linear float RGB, for HDR images (environment maps). .pfm files
+    // are read here, anything else goes through stb, which reads .hdr and
+    // turns 8 bit images linear. Rows go top to bottom like Load()'s.
+    b32
+    LoadFloat(const char *Filename)
+    {
+        size_t Length = strlen(Filename);
+        if((Length >= 4) && (strcmp(Filename + Length - 4, ".pfm") == 0))
+        {
+            pfm PFM = {};
+            if(ReadPFM(Filename, &PFM))
+            {
+                FloatData = PFM.ColorData;
+                ImageWidth = PFM.Width;
+                ImageHeight = PFM.Height;
+                FloatFromPFM = true;
+            }
+        }
+        else
+        {
+            auto N = BytesPerPixel;
+            FloatData = stbi_loadf(Filename, &ImageWidth, &ImageHeight, &N, BytesPerPixel);
+        }
+        BytesPerScanline = ImageWidth * BytesPerPixel;
+
+        b32 Result = (FloatData != nullptr);
+        return Result;
+    }
+
     i32
     Width() const
     {
-        i32 Result = Data == nullptr ? 0 : ImageWidth;
+        i32 Result = ((Data == nullptr) && (FloatData == nullptr)) ? 0 : ImageWidth;
         return Result;
     }
 
     i32
     Height() const
     {
-        i32 Result = Data == nullptr ? 0 : ImageHeight;
+        i32 Result = ((Data == nullptr) && (FloatData == nullptr)) ? 0 : ImageHeight;
         return Result;
     }
 
@@ -75,9 +116,32 @@ class rt_image
         return Result;
     }
 
+    // NOTE: Only for images that came from LoadFloat().
+    const f32 *
+    FloatPixelData(i32 X, i32 Y) const
+    {
+        const f32 *Result = nullptr;
+
+        static f32 Magenta[] = { 1, 0, 1 };
+        if(FloatData != nullptr)
+        {
+            X = Clamp(X, 0, ImageWidth);
+            Y = Clamp(Y, 0, ImageHeight);
+            Result = FloatData + Y*BytesPerScanline + X*BytesPerPixel;
+        }
+        else
+        {
+            Result = Magenta;
+        }
+
+        return Result;
+    }
+
   private:
     const i32 BytesPerPixel = 3;
     u8 *Data;
+    f32 *FloatData = nullptr;
+    b32 FloatFromPFM = false;
     i32 ImageWidth, ImageHeight;
     i32 BytesPerScanline;
 
@@ -87,7 +151,7 @@ class rt_image
         // Return the value clamped to the range [low, high)
         i32 Result = X;
         if(X < Low) { Result = Low; }
-        else if(X > High) { Result = High - 1; }
+        else if(X >= High) { Result = High - 1; }
 
         return Result;
     }
@@ -13,69 +13,86 @@
 #include <AARect.h>
 #include <Box.h>
 #include <ConstantMedium.h>
+#include <GridMedium.h>
+#include <Medium.h>
+#include <Environment.h>
 #include <BVH.h>
 #include <MonteCarlo.h>
+#include <SceneCache.h>
+#include <SceneFile.h>
+#include <ImageMetrics.h>
+
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 hittable_list
 RandomScene()
 {
     // World.
     hittable_list Result;
+    Result.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Result.Arena;
 
-    auto CheckerTex = std::make_shared<checker_texture>(Color(0.2, 0.3, 0.1),
-                                                        Color(0.9, 0.9, 0.9));
+    auto CheckerTex = Arena.New<checker_texture>(Color(0.2, 0.3, 0.1),
+                                                 Color(0.9, 0.9, 0.9));
 
-    auto GroundMaterial = std::make_shared<lambertian>(CheckerTex);
-    Result.Add(std::make_shared<sphere>(Vec3d(0, -1000, 0), 1000, GroundMaterial));
+    auto GroundMaterial = Arena.New<lambertian>(CheckerTex);
+    Result.Add(Arena.New<sphere>(Vec3r(0, -1000, 0), 1000, GroundMaterial));
 
     for(i32 X = -11; X < 11; X++)
     {
         for(i32 Y = -11; Y < 11; Y++)
         {
             auto ChooseMaterial = Rand01();
-            vec3d Center = Vec3d(X + 0.9*Rand01(), 0.2, Y + 0.9*Rand01());
+            vec3r Center = Vec3r(X + 0.9*Rand01(), 0.2, Y + 0.9*Rand01());
 
-            if((Center - Vec3d(4, 0.2, 0)).Magnitude() > 0.9)
+            if((Center - Vec3r(4, 0.2, 0)).Magnitude() > 0.9)
             {
-                std::shared_ptr<material> SphereMaterial;
+                material *SphereMaterial = nullptr;
                 if (ChooseMaterial < 0.8)
                 {
                     // diffuse
-                    vec3d albedo = color::Rand01() * color::Rand01();
-                    SphereMaterial = std::make_shared<lambertian>(albedo);
+                    vec3r albedo = color::Rand01() * color::Rand01();
+                    SphereMaterial = Arena.New<lambertian>(albedo);
 
                     // Where the sphere goes at time t1, since it is moving.
-                    vec3d RandomHalfY = Vec3d(0, RandRange(0, 0.5), 0);
-                    vec3d Center1 = Center + RandomHalfY;
+                    vec3r RandomHalfY = Vec3r(0, RandRange(0, 0.5), 0);
+                    vec3r Center1 = Center + RandomHalfY;
                     moving_sphere MovingSphere = moving_sphere(Center, Center1, 0, 1, 0.2, SphereMaterial);
-                    Result.Add(std::make_shared<moving_sphere>(MovingSphere));
+                    Result.Add(Arena.New<moving_sphere>(MovingSphere));
                 }
                 else if (ChooseMaterial < 0.95)
                 {
                     // metal
-                    vec3d albedo = color::RandRange(0.5, 1);
-                    f64 fuzz = RandRange(0, 0.5);
-                    SphereMaterial = std::make_shared<metal>(albedo, fuzz);
-                    Result.Add(std::make_shared<sphere>(Center, 0.2, SphereMaterial));
+                    vec3r albedo = color::RandRange(0.5, 1);
+                    real fuzz = RandRange(0, 0.5);
+                    SphereMaterial = Arena.New<metal>(albedo, fuzz);
+                    Result.Add(Arena.New<sphere>(Center, 0.2, SphereMaterial));
                 }
                 else
                 {
                     // glass
-                    SphereMaterial = std::make_shared<dielectric>(1.5);
-                    Result.Add(std::make_shared<sphere>(Center, 0.2, SphereMaterial));
+                    SphereMaterial = Arena.New<dielectric>(1.5);
+                    Result.Add(Arena.New<sphere>(Center, 0.2, SphereMaterial));
                 }
             }
         }
     }
 
-    auto material1 = std::make_shared<dielectric>(1.5);
-    Result.Add(std::make_shared<sphere>(Vec3d(0, 1, 0), 1.0, material1));
+    auto material1 = Arena.New<dielectric>(1.5);
+    Result.Add(Arena.New<sphere>(Vec3r(0, 1, 0), 1.0, material1));
 
-    auto material2 = std::make_shared<lambertian>(Vec3d(0.4, 0.2, 0.1));
-    Result.Add(std::make_shared<sphere>(Vec3d(-4, 1, 0), 1.0, material2));
+    auto material2 = Arena.New<lambertian>(Vec3r(0.4, 0.2, 0.1));
+    Result.Add(Arena.New<sphere>(Vec3r(-4, 1, 0), 1.0, material2));
 
-    auto material3 = std::make_shared<metal>(Vec3d(0.7, 0.6, 0.5), 0.0);
-    Result.Add(std::make_shared<sphere>(Vec3d(4, 1, 0), 1.0, material3));
+    auto material3 = Arena.New<metal>(Vec3r(0.7, 0.6, 0.5), 0.0);
+    Result.Add(Arena.New<sphere>(Vec3r(4, 1, 0), 1.0, material3));
 
     return Result;
 }
@@ -84,12 +101,14 @@ hittable_list
 TwoSpheres()
 {
     hittable_list Result;
+    Result.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Result.Arena;
 
-    auto CheckerTex = std::make_shared<checker_texture>(Color(0.2, 0.3, 0.1),
-                                                        Color(0.9, 0.9, 0.9));
+    auto CheckerTex = Arena.New<checker_texture>(Color(0.2, 0.3, 0.1),
+                                                 Color(0.9, 0.9, 0.9));
 
-    Result.Add(std::make_shared<sphere>(Vec3d(0, -10, 0), 10, std::make_shared<lambertian>(CheckerTex)));
-    Result.Add(std::make_shared<sphere>(Vec3d(0,  10, 0), 10, std::make_shared<lambertian>(CheckerTex)));
+    Result.Add(Arena.New<sphere>(Vec3r(0, -10, 0), 10, Arena.New<lambertian>(CheckerTex)));
+    Result.Add(Arena.New<sphere>(Vec3r(0,  10, 0), 10, Arena.New<lambertian>(CheckerTex)));
 
     return Result;
 }
@@ -98,12 +117,14 @@ hittable_list
 EarthScene()
 {
     hittable_list Result;
+    Result.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Result.Arena;
 
-    auto EarthTex = std::make_shared<image_texture>("../images/earthmap.jpg");
-    auto EarthSurface = std::make_shared<lambertian>(EarthTex);
-    auto Globe = std::make_shared<sphere>(Vec3d(0, 0, 0), 2, EarthSurface);
+    auto EarthTex = Arena.New<image_texture>("../images/earthmap.jpg");
+    auto EarthSurface = Arena.New<lambertian>(EarthTex);
+    auto Globe = Arena.New<sphere>(Vec3r(0, 0, 0), 2, EarthSurface);
 
-    Result = hittable_list(Globe);
+    Result.Add(Globe);
 
     return Result;
 }
@@ -112,11 +133,13 @@ hittable_list
 TwoPerlinSpheres()
 {
     hittable_list Result;
+    Result.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Result.Arena;
 
-    auto PerlinTex = std::make_shared<noise_texture>(4.0);
+    auto PerlinTex = Arena.New<noise_texture>(4.0);
 
-    Result.Add(std::make_shared<sphere>(Vec3d(0, -1000, 0), 1000, std::make_shared<lambertian>(PerlinTex)));
-    Result.Add(std::make_shared<sphere>(Vec3d(0, 2, 0), 2, std::make_shared<lambertian>(PerlinTex)));
+    Result.Add(Arena.New<sphere>(Vec3r(0, -1000, 0), 1000, Arena.New<lambertian>(PerlinTex)));
+    Result.Add(Arena.New<sphere>(Vec3r(0, 2, 0), 2, Arena.New<lambertian>(PerlinTex)));
 
     return Result;
 }
@@ -125,8 +148,10 @@ hittable_list
 SimpleLight()
 {
     hittable_list Objects;
+    Objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Objects.Arena;
 
-    std::shared_ptr<noise_texture> PerlinTex = std::make_shared<noise_texture>(4.);
+    noise_texture *PerlinTex = Arena.New<noise_texture>(4.);
 
     // IMPORTANT: NOTE:
     // In this scene, there is a simple diffuse light and two lambertian
@@ -142,13 +167,13 @@ SimpleLight()
     // was Rasterization, then this is what Attenuation factor does by dividing
     // the color of the surface by the distance squared between the surface
     // pixel and the light.;
-    Objects.Add(std::make_shared<sphere>(Vec3d(0, -1000, 0), 1000, std::make_shared<lambertian>(PerlinTex)));
-    Objects.Add(std::make_shared<sphere>(Vec3d(0, 2, 0), 2, std::make_shared<lambertian>(PerlinTex)));
+    Objects.Add(Arena.New<sphere>(Vec3r(0, -1000, 0), 1000, Arena.New<lambertian>(PerlinTex)));
+    Objects.Add(Arena.New<sphere>(Vec3r(0, 2, 0), 2, Arena.New<lambertian>(PerlinTex)));
 
 
-    std::shared_ptr<material> DiffLight = std::make_shared<diffuse_light>(Color(4, 4, 4));
-    Objects.Add(std::make_shared<sphere>(Vec3d(0, 7, 0), 1, DiffLight));
-    Objects.Add(std::make_shared<xy_rect>(3, 5, 1, 3, -2, DiffLight));
+    material *DiffLight = Arena.New<diffuse_light>(Color(4, 4, 4));
+    Objects.Add(Arena.New<sphere>(Vec3r(0, 7, 0), 1, DiffLight));
+    Objects.Add(Arena.New<xy_rect>(3, 5, 1, 3, -2, DiffLight));
 
     return Objects;
 }
@@ -157,28 +182,30 @@ hittable_list
 CornellBox()
 {
     hittable_list Objects;
-
-    auto RedMat = std::make_shared<lambertian>(Color(.65, .05, .05));
-    auto GreenMat = std::make_shared<lambertian>(Color(.12, .45, .15));
-    auto WhiteMat = std::make_shared<lambertian>(Color(.73, .73, .73));
-    auto Light = std::make_shared<diffuse_light>(Color(15, 15, 15));
-    auto BlueMat = std::make_shared<lambertian>(Color(.12, .15, .55));
-
-    Objects.Add(std::make_shared<yz_rect>(0, 555, 0, 555, 555, GreenMat));  // Left Wall
-    Objects.Add(std::make_shared<yz_rect>(0, 555, 0, 555, 0, RedMat));      // Right wall
-    Objects.Add(std::make_shared<xz_rect>(213, 343, 227, 332, 554, Light)); // Light at the top
-    Objects.Add(std::make_shared<xz_rect>(0, 555, 0, 555, 0, WhiteMat));    // Bottom Wall
-    Objects.Add(std::make_shared<xz_rect>(0, 555, 0, 555, 555, WhiteMat));   // Top Wall
-    Objects.Add(std::make_shared<xy_rect>(0, 555, 0, 555, 555, WhiteMat));  // Front Wall
-
-    std::shared_ptr<hittable> Box1 = std::make_shared<box>(Vec3d(0,0,0), Vec3d(165,330,165), WhiteMat);
-    Box1 = std::make_shared<rotate_y>(Box1, 15);
-    Box1 = std::make_shared<translate>(Box1, Vec3d(265,0,295));
+    Objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Objects.Arena;
+
+    auto RedMat = Arena.New<lambertian>(Color(.65, .05, .05));
+    auto GreenMat = Arena.New<lambertian>(Color(.12, .45, .15));
+    auto WhiteMat = Arena.New<lambertian>(Color(.73, .73, .73));
+    auto Light = Arena.New<diffuse_light>(Color(15, 15, 15));
+    auto BlueMat = Arena.New<lambertian>(Color(.12, .15, .55));
+
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 555, GreenMat));  // Left Wall
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 0, RedMat));      // Right wall
+    Objects.Add(Arena.New<xz_rect>(213, 343, 227, 332, 554, Light)); // Light at the top
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 0, WhiteMat));    // Bottom Wall
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 555, WhiteMat));   // Top Wall
+    Objects.Add(Arena.New<xy_rect>(0, 555, 0, 555, 555, WhiteMat));  // Front Wall
+
+    hittable *Box1 = Arena.New<box>(Vec3r(0,0,0), Vec3r(165,330,165), WhiteMat);
+    Box1 = Arena.New<rotate_y>(Box1, 15);
+    Box1 = Arena.New<translate>(Box1, Vec3r(265,0,295));
     Objects.Add(Box1);
 
-    std::shared_ptr<hittable> Box2 = std::make_shared<box>(Vec3d(0,0,0), Vec3d(165,165,165), BlueMat);
-    Box2 = std::make_shared<rotate_y>(Box2, -18);
-    Box2 = std::make_shared<translate>(Box2, Vec3d(130,0,65));
+    hittable *Box2 = Arena.New<box>(Vec3r(0,0,0), Vec3r(165,165,165), BlueMat);
+    Box2 = Arena.New<rotate_y>(Box2, -18);
+    Box2 = Arena.New<translate>(Box2, Vec3r(130,0,65));
     Objects.Add(Box2);
 
     return Objects;
@@ -188,39 +215,135 @@ hittable_list
 CornellSmoke()
 {
     hittable_list Objects;
+    Objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Objects.Arena;
 
-    std::shared_ptr<material> Red = std::make_shared<lambertian>(Color(.65, .05, .05));
-    std::shared_ptr<material> White = std::make_shared<lambertian>(Color(.73, .73, .73));
-    std::shared_ptr<material> Green = std::make_shared<lambertian>(Color(.12, .45, .15));
-    std::shared_ptr<material> Light = std::make_shared<diffuse_light>(Color(7, 7, 7));
+    material *Red = Arena.New<lambertian>(Color(.65, .05, .05));
+    material *White = Arena.New<lambertian>(Color(.73, .73, .73));
+    material *Green = Arena.New<lambertian>(Color(.12, .45, .15));
+    material *Light = Arena.New<diffuse_light>(Color(7, 7, 7));
 
-    Objects.Add(std::make_shared<yz_rect>(0, 555, 0, 555, 555, Green));
-    Objects.Add(std::make_shared<yz_rect>(0, 555, 0, 555, 0, Red));
-    Objects.Add(std::make_shared<xz_rect>(113, 443, 127, 432, 554, Light));
-    Objects.Add(std::make_shared<xz_rect>(0, 555, 0, 555, 555, White));
-    Objects.Add(std::make_shared<xz_rect>(0, 555, 0, 555, 0, White));
-    Objects.Add(std::make_shared<xy_rect>(0, 555, 0, 555, 555, White));
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 555, Green));
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 0, Red));
+    Objects.Add(Arena.New<xz_rect>(113, 443, 127, 432, 554, Light));
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 555, White));
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 0, White));
+    Objects.Add(Arena.New<xy_rect>(0, 555, 0, 555, 555, White));
 
-    std::shared_ptr<hittable> Box1 = std::make_shared<box>(Vec3d(0,0,0), Vec3d(165,330,165), White);
-    Box1 = std::make_shared<rotate_y>(Box1, 15);
-    Box1 = std::make_shared<translate>(Box1, Vec3d(265, 0, 295));
+    hittable *Box1 = Arena.New<box>(Vec3r(0,0,0), Vec3r(165,330,165), White);
+    Box1 = Arena.New<rotate_y>(Box1, 15);
+    Box1 = Arena.New<translate>(Box1, Vec3r(265, 0, 295));
 
-    std::shared_ptr<hittable> Box2 = std::make_shared<box>(Vec3d(0,0,0), Vec3d(165,165,165), White);
-    Box2 = std::make_shared<rotate_y>(Box2, -18);
-    Box2 = std::make_shared<translate>(Box2, Vec3d(130, 0, 65));
+    hittable *Box2 = Arena.New<box>(Vec3r(0,0,0), Vec3r(165,165,165), White);
+    Box2 = Arena.New<rotate_y>(Box2, -18);
+    Box2 = Arena.New<translate>(Box2, Vec3r(130, 0, 65));
 
-    Objects.Add(std::make_shared<constant_density_medium>(Box1, 0.01, Color(0, 0, 0)));
-    Objects.Add(std::make_shared<constant_density_medium>(Box2, 0.01, Color(1, 1, 1)));
+    Objects.Add(Arena.New<constant_density_medium>(Box1, 0.01, Color(0, 0, 0)));
+    Objects.Add(Arena.New<constant_density_medium>(Box2, 0.01, Color(1, 1, 1)));
 
     return Objects;
 }
 
+// NOTE: A density grid of turbulent noise fading out towards the edges of a
+// ball, so most of the bricks around it are empty.
+std::shared_ptr<density_grid>
+CloudGrid(i32 Resolution)
+{
+    perlin Noise;
+    real Center = 0.5*Resolution;
+    std::shared_ptr<density_grid> Result = std::make_shared<density_grid>(
+        Resolution, Resolution, Resolution,
+        [&](i32 X, i32 Y, i32 Z)
+        {
+            vec3r P = Vec3r(X + 0.5, Y + 0.5, Z + 0.5);
+            real Distance = (P - Vec3r(Center, Center, Center)).Magnitude() / Center;
+            real Falloff = 1 - Distance*Distance;
+            real Density = 0;
+            if(Falloff > 0)
+            {
+                Density = Falloff*(4*Noise.Turbulence((4.0 / Resolution)*P) - 0.5);
+            }
+            return (f32)Density;
+        });
+
+    return Result;
+}
+
+hittable_list
+CornellCloud()
+{
+    hittable_list Objects;
+    Objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Objects.Arena;
+
+    material *Red = Arena.New<lambertian>(Color(.65, .05, .05));
+    material *White = Arena.New<lambertian>(Color(.73, .73, .73));
+    material *Green = Arena.New<lambertian>(Color(.12, .45, .15));
+    material *Light = Arena.New<diffuse_light>(Color(7, 7, 7));
+
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 555, Green));
+    Objects.Add(Arena.New<yz_rect>(0, 555, 0, 555, 0, Red));
+    Objects.Add(Arena.New<xz_rect>(113, 443, 127, 432, 554, Light));
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 555, White));
+    Objects.Add(Arena.New<xz_rect>(0, 555, 0, 555, 0, White));
+    Objects.Add(Arena.New<xy_rect>(0, 555, 0, 555, 555, White));
+
+    Objects.Add(Arena.New<grid_medium>(CloudGrid(128), Vec3r(90, 60, 90), Vec3r(465, 435, 465),
+                                       0.02, Color(0.5, 0.5, 0.5)));
+
+    return Objects;
+}
+
+// NOTE: 1024 small lights of all colors and strengths over a floor with
+// spheres on it, nothing else lights the scene. Bouncing around until a path
+// happens to run into one of them takes forever, this is what the light tree
+// (see Lights.h) is for.
+hittable_list
+ManyLights()
+{
+    hittable_list Objects;
+    Objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Objects.Arena;
+
+    Objects.Add(Arena.New<xz_rect>(-30, 30, -30, 30, 0, Arena.New<lambertian>(Color(.5, .5, .5))));
+
+    hittable_list Spheres;
+    for(i32 X = 0; X < 12; ++X)
+    {
+        for(i32 Z = 0; Z < 12; ++Z)
+        {
+            real Radius = RandRange(0.4, 1.0);
+            vec3r Center = Vec3r(-22 + 4*X + RandRange(-1, 1), Radius, -22 + 4*Z + RandRange(-1, 1));
+            Spheres.Add(Arena.New<sphere>(Center, Radius, Arena.New<lambertian>(color::RandRange(0.2, 0.9))));
+        }
+    }
+    Objects.Add(Arena.New<bvh_node>(Spheres, 0, 1));
+
+    hittable_list Lights;
+    for(i32 X = 0; X < 32; ++X)
+    {
+        for(i32 Z = 0; Z < 32; ++Z)
+        {
+            vec3r Center = Vec3r(-24 + 1.5*X + RandRange(-0.5, 0.5), RandRange(2.5, 5),
+                                 -24 + 1.5*Z + RandRange(-0.5, 0.5));
+            color Emit = RandRange(20, 200)*color::RandRange(0.1, 1);
+            Lights.Add(Arena.New<sphere>(Center, 0.08, Arena.New<diffuse_light>(Emit)));
+        }
+    }
+    Objects.Add(Arena.New<bvh_node>(Lights, 0, 1));
+
+    return Objects;
+}
 
 hittable_list
 RT_TheNextWeek_FinalScene()
 {
+    hittable_list objects;
+    objects.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *objects.Arena;
+
     hittable_list boxes1;
-    auto ground = std::make_shared<lambertian>(Color(0.48, 0.83, 0.53));
+    auto ground = Arena.New<lambertian>(Color(0.48, 0.83, 0.53));
 
     const int boxes_per_side = 20;
     for (int i = 0; i < boxes_per_side; i++) {
@@ -233,52 +356,738 @@ RT_TheNextWeek_FinalScene()
             auto y1 = RandRange(1,101);
             auto z1 = z0 + w;
 
-            boxes1.Add(std::make_shared<box>(Vec3d(x0,y0,z0), Vec3d(x1,y1,z1), ground));
+            boxes1.Add(Arena.New<box>(Vec3r(x0,y0,z0), Vec3r(x1,y1,z1), ground));
         }
     }
 
-    hittable_list objects;
-
-    objects.Add(std::make_shared<bvh_node>(boxes1, 0, 1));
+    objects.Add(Arena.New<bvh_node>(boxes1, 0, 1));
 
-    auto light = std::make_shared<diffuse_light>(Color(7, 7, 7));
-    objects.Add(std::make_shared<xz_rect>(123, 423, 147, 412, 554, light));
+    auto light = Arena.New<diffuse_light>(Color(7, 7, 7));
+    objects.Add(Arena.New<xz_rect>(123, 423, 147, 412, 554, light));
 
-    auto center1 = Vec3d(400, 400, 200);
-    auto center2 = center1 + Vec3d(30,0,0);
-    auto moving_sphere_material = std::make_shared<lambertian>(Color(0.7, 0.3, 0.1));
-    objects.Add(std::make_shared<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
+    auto center1 = Vec3r(400, 400, 200);
+    auto center2 = center1 + Vec3r(30,0,0);
+    auto moving_sphere_material = Arena.New<lambertian>(Color(0.7, 0.3, 0.1));
+    objects.Add(Arena.New<moving_sphere>(center1, center2, 0, 1, 50, moving_sphere_material));
 
-    objects.Add(std::make_shared<sphere>(Vec3d(260, 150, 45), 50, std::make_shared<dielectric>(1.5)));
-    objects.Add(std::make_shared<sphere>(
-        Vec3d(0, 150, 145), 50, std::make_shared<metal>(Color(0.8, 0.8, 0.9), 1.0)
+    objects.Add(Arena.New<sphere>(Vec3r(260, 150, 45), 50, Arena.New<dielectric>(1.5)));
+    objects.Add(Arena.New<sphere>(
+        Vec3r(0, 150, 145), 50, Arena.New<metal>(Color(0.8, 0.8, 0.9), 1.0)
     ));
 
-    auto boundary = std::make_shared<sphere>(Vec3d(360,150,145), 70, std::make_shared<dielectric>(1.5));
-    objects.Add(boundary);
-    objects.Add(std::make_shared<constant_density_medium>(boundary, 0.2, Color(0.2, 0.4, 0.9)));
-    boundary = std::make_shared<sphere>(Vec3d(0, 0, 0), 5000, std::make_shared<dielectric>(1.5));
-    objects.Add(std::make_shared<constant_density_medium>(boundary, .0001, Color(1,1,1)));
+    // NOTE: A glass ball full of blue smoke. The thin fog over the whole
+    // scene is the camera's medium (see BuiltinScene).
+    auto boundary = Arena.New<sphere>(Vec3r(360,150,145), 70, Arena.New<dielectric>(1.5));
+    objects.Add(Arena.New<medium_boundary>(
+        boundary, Arena.New<homogeneous_medium>(0.2, Color(0.2, 0.4, 0.9))));
 
-    auto emat = std::make_shared<lambertian>(std::make_shared<image_texture>("earthmap.jpg"));
-    objects.Add(std::make_shared<sphere>(Vec3d(400,200,400), 100, emat));
-    auto pertext = std::make_shared<noise_texture>(0.1);
-    objects.Add(std::make_shared<sphere>(Vec3d(220,280,300), 80, std::make_shared<lambertian>(pertext)));
+    auto emat = Arena.New<lambertian>(Arena.New<image_texture>("earthmap.jpg"));
+    objects.Add(Arena.New<sphere>(Vec3r(400,200,400), 100, emat));
+    auto pertext = Arena.New<noise_texture>(0.1);
+    objects.Add(Arena.New<sphere>(Vec3r(220,280,300), 80, Arena.New<lambertian>(pertext)));
 
     hittable_list boxes2;
-    auto white = std::make_shared<lambertian>(Color(.73, .73, .73));
+    auto white = Arena.New<lambertian>(Color(.73, .73, .73));
     int ns = 1000;
     for (int j = 0; j < ns; j++) {
-        boxes2.Add(std::make_shared<sphere>(vec3d::RandRange(0,165), 10, white));
+        boxes2.Add(Arena.New<sphere>(vec3r::RandRange(0,165), 10, white));
     }
 
-    objects.Add(std::make_shared<translate>(
-        std::make_shared<rotate_y>(std::make_shared<bvh_node>(boxes2, 0.0, 1.0), 15),
-        Vec3d(-100, 270, 395)));
+    objects.Add(Arena.New<translate>(
+        Arena.New<rotate_y>(Arena.New<bvh_node>(boxes2, 0.0, 1.0), 15),
+        Vec3r(-100, 270, 395)));
 
     return objects;
 }
 
+// NOTE: Prints how many primitives per second the bvh_node builder gets through
+// on a big scene of random spheres, going from 1 thread up to all the hardware
+// threads.
+void
+BVHBuildThroughput(i32 PrimitiveCount = 1'000'000)
+{
+    hittable_list Spheres;
+    Spheres.Arena = std::make_shared<scene_arena>();
+    scene_arena &Arena = *Spheres.Arena;
+
+    auto White = Arena.New<lambertian>(Color(.73, .73, .73));
+    for(i32 Index = 0; Index < PrimitiveCount; ++Index)
+    {
+        Spheres.Add(Arena.New<sphere>(vec3r::RandRange(-1000, 1000), 1, White));
+    }
+
+    i32 MaxThreads = BVHThreadCount(0);
+    for(i32 Threads = 1; ; Threads *= 2)
+    {
+        Threads = MIN(Threads, MaxThreads);
+
+        auto Begin = std::chrono::steady_clock::now();
+        bvh_node Root = bvh_node(Spheres, 0, 1, Threads);
+        auto End = std::chrono::steady_clock::now();
+
+        f64 Seconds = std::chrono::duration<f64>(End - Begin).count();
+        printf("BVH Build: %d primitives, %2d threads: %9.3f ms, %7.3f M primitives/sec\n",
+               PrimitiveCount, Threads, Seconds*1000., (PrimitiveCount / Seconds)*1e-6);
+
+        if(Threads == MaxThreads)
+        {
+            break;
+        }
+    }
+}
+
+// NOTE: Times one of the vector helpers over Count inputs, Passes times, and
+// prints nanoseconds per call. Checksum is added up from the results so the
+// compiler can't drop the work, and doubles as a check that a RT_SIMD=0 build
+// computes the same thing.
+template <typename F>
+void
+TimeVecOp(const char *Name, const char *Type, i32 Count, i32 Passes, F Op, i32 ItemsPerCall = 1)
+{
+    f64 Checksum = 0.0;
+    auto Begin = std::chrono::steady_clock::now();
+    for(i32 Pass = 0; Pass < Passes; ++Pass)
+    {
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            Checksum += Op(Index);
+        }
+    }
+    auto End = std::chrono::steady_clock::now();
+
+    f64 Seconds = std::chrono::duration<f64>(End - Begin).count();
+    printf("%-18s %-4s %7.2f ns/call  checksum %.9g\n",
+           Name, Type, (Seconds*1e9) / ((f64)Count*Passes*ItemsPerCall), Checksum);
+}
+
+template <typename T>
+void
+VecThroughput(const char *Type, i32 Count, i32 Passes)
+{
+    SeedRandom(1);
+    std::vector<vec3<T>> A(Count), B(Count), N(Count);
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        A[Index] = vec3<T>::RandRange(-1, 1);
+        B[Index] = vec3<T>::RandRange(-1, 1);
+        N[Index] = vec3<T>::RandomUnitVector();
+    }
+
+    TimeVecOp("Add, Mul", Type, Count, Passes, [&](i32 I) { return (A[I]*(T)0.5 + B[I]).x; });
+    TimeVecOp("Dot", Type, Count, Passes, [&](i32 I) { return Dot(A[I], B[I]); });
+    TimeVecOp("Cross", Type, Count, Passes, [&](i32 I) { return Cross(A[I], B[I]).y; });
+    TimeVecOp("Normalize", Type, Count, Passes, [&](i32 I) { return Normalize(A[I]).z; });
+    TimeVecOp("Min, Max", Type, Count, Passes,
+              [&](i32 I) { return (ComponentMin(A[I], B[I]) + ComponentMax(A[I], B[I])).x; });
+    TimeVecOp("Reflect", Type, Count, Passes, [&](i32 I) { return Reflect(A[I], N[I]).x; });
+    TimeVecOp("Refract", Type, Count, Passes,
+              [&](i32 I) { return Refract(Normalize(A[I]), N[I], 1.0/1.5).x; });
+    SeedRandom(2);
+    TimeVecOp("RandomUnitVector", Type, Count, Passes,
+              [&](i32 I) { return vec3<T>::RandomUnitVector().x; });
+    TimeVecOp("RandomInUnitSphere", Type, Count, Passes,
+              [&](i32 I) { return vec3<T>::RandomInUnitSphere().x; });
+    TimeVecOp("RandomInUnitDisk", Type, Count, Passes,
+              [&](i32 I) { return vec3<T>::RandomInUnitDisk().x; });
+    // NOTE: The rejection loop these used to be, for comparison.
+    TimeVecOp("rejection sphere", Type, Count, Passes,
+              [&](i32 I)
+              {
+                  vec3<T> P;
+                  do
+                  {
+                      P = vec3<T>::RandRange(-1, 1);
+                  } while(P.SqMagnitude() >= (T)1);
+                  return P.x;
+              });
+}
+
+// NOTE: Throughput of the vec3 operations the renderer leans on, in f32 and
+// f64, and of aabb::SurroundingBox the way the BVH builder uses it. Build with
+// RT_SIMD=OFF and run again to compare against the plain scalar code.
+void
+VecMathThroughput(i32 Count = 4096, i32 Passes = 2000)
+{
+    printf("vec3 with %s, sizeof(vec3f) %d, sizeof(vec3d) %d\n",
+           (RT_SIMD == RT_SIMD_SSE) ? "SSE" : ((RT_SIMD == RT_SIMD_NEON) ? "NEON" : "no SIMD"),
+           (i32)sizeof(vec3f), (i32)sizeof(vec3d));
+    VecThroughput<f32>("f32", Count, Passes);
+    VecThroughput<f64>("f64", Count, Passes);
+
+    SeedRandom(3);
+    std::vector<aabb> Boxes(Count);
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        vec3r Min = vec3r::RandRange(-100, 100);
+        Boxes[Index] = aabb(Min, Min + vec3r::RandRange(0, 10));
+    }
+    // NOTE: The warps from Warp.h, one at a time and a buffer at once. The
+    // batch timings are per sample too.
+    std::vector<vec2d> Samples(Count);
+    std::vector<vec3r> Warped(Count);
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        Samples[Index] = Vec2(Rand01(), Rand01());
+    }
+    const char *RealType = (sizeof(real) == 4) ? "f32" : "f64";
+    TimeVecOp("cosine hemisphere", RealType, Count, Passes,
+              [&](i32 I) { return SampleCosineHemisphere(Samples[I]).z; });
+    TimeVecOp("cosine batch", RealType, 1, Passes,
+              [&](i32 I)
+              {
+                  SampleCosineHemisphere(Samples.data(), Warped.data(), Count);
+                  return Warped[Count - 1].z;
+              }, Count);
+    TimeVecOp("unit sphere batch", RealType, 1, Passes,
+              [&](i32 I)
+              {
+                  SampleUnitSphere(Samples.data(), Warped.data(), Count);
+                  return Warped[Count - 1].z;
+              }, Count);
+
+    aabb Bounds = aabb::Empty();
+    TimeVecOp("SurroundingBox", RealType, Count, Passes,
+              [&](i32 I)
+              {
+                  Bounds = aabb::SurroundingBox(Bounds, Boxes[I]);
+                  return Bounds.Max().x;
+              });
+}
+
+// NOTE: Cost of the perlin noise per point and per noise_texture::Value, one
+// point at a time, in batches, and out of a baked perlin_volume. The baked
+// turbulence is compared against the noise it was baked from (the tiling
+// one) for how far off the trilinear lookup is.
+void
+NoiseThroughput(i32 Count = 4096, i32 Passes = 200)
+{
+    const char *RealType = (sizeof(real) == 4) ? "f32" : "f64";
+    SeedRandom(4);
+    noise_texture Texture(4);
+    perlin Noise;
+    std::vector<vec3r> Points(Count);
+    std::vector<real> Values(Count);
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        Points[Index] = vec3r::RandRange(0, 50);
+    }
+
+    TimeVecOp("Noise", RealType, Count, Passes,
+              [&](i32 I) { return Noise.Noise(Points[I]); });
+    TimeVecOp("NoiseBatch", RealType, Count / PERLIN_BATCH, Passes,
+              [&](i32 I)
+              {
+                  Noise.NoiseBatch(&Points[I*PERLIN_BATCH], &Values[I*PERLIN_BATCH],
+                                   PERLIN_BATCH, 255);
+                  return Values[I*PERLIN_BATCH];
+              }, PERLIN_BATCH);
+    TimeVecOp("Turbulence 1 by 1", RealType, Count, Passes,
+              [&](i32 I)
+              {
+                  real Accum = 0, Weight = 1;
+                  vec3r P = Points[I];
+                  for(i32 Octave = 0; Octave < 7; ++Octave)
+                  {
+                      Accum += Weight*Noise.Noise(P);
+                      Weight *= 0.5;
+                      P *= 2;
+                  }
+                  return (real)fabs(Accum);
+              });
+    TimeVecOp("Turbulence", RealType, Count, Passes,
+              [&](i32 I) { return Noise.Turbulence(Points[I]); });
+    TimeVecOp("Value", RealType, Count, Passes,
+              [&](i32 I) { return Texture.Value(0, 0, Points[I], 0).x; });
+
+    auto Begin = std::chrono::steady_clock::now();
+    perlin_volume Volume(Noise);
+    auto End = std::chrono::steady_clock::now();
+    printf("baked %.1f MB in %.0f ms\n", (f64)Volume.Bytes() / (1 << 20),
+           std::chrono::duration<f64, std::milli>(End - Begin).count());
+
+    TimeVecOp("Turbulence baked", RealType, Count, Passes,
+              [&](i32 I) { return Volume.Turbulence(Points[I]); });
+    TimeVecOp("Value baked", RealType, Count, Passes,
+              [&](i32 I)
+              {
+                  vec3r P = 4*Points[I];
+                  return (real)(0.5*(1.0 + sin(P.z + 10.0*Volume.Turbulence(P))));
+              });
+
+    f64 SumSquares = 0, SumExact = 0;
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        real Exact = 0, Weight = 1;
+        vec3r P = Points[Index];
+        for(i32 Octave = 0; Octave < 7; ++Octave)
+        {
+            real Value;
+            Noise.NoiseBatch(&P, &Value, 1, 31);
+            Exact += Weight*Value;
+            Weight *= 0.5;
+            P *= 2;
+        }
+        f64 Difference = fabs(Exact) - Volume.Turbulence(Points[Index]);
+        SumSquares += Difference*Difference;
+        SumExact += Exact*Exact;
+    }
+    printf("baked turbulence RMS error %.4f (RMS of the turbulence %.4f)\n",
+           sqrt(SumSquares / Count), sqrt(SumExact / Count));
+}
+
+// NOTE: Transmittance through the CornellCloud grid along random rays, by
+// ratio tracking and by checking whether a delta tracked flight gets through,
+// against a finely ray marched reference. Same cost per estimate, roughly, but
+// the ratio tracked one has a small fraction of the error.
+void
+MediumEstimators(i32 RayCount = 256, i32 Estimates = 64)
+{
+    SeedRandom(5);
+    auto Begin = std::chrono::steady_clock::now();
+    std::shared_ptr<density_grid> Grid = CloudGrid(128);
+    auto End = std::chrono::steady_clock::now();
+    printf("grid 128^3: %.2f MB in bricks (%.2f MB dense), built in %.0f ms\n",
+           (f64)Grid->Bytes() / (1 << 20), (128.0*128*128*sizeof(f32)) / (1 << 20),
+           std::chrono::duration<f64, std::milli>(End - Begin).count());
+
+    vec3r Min = Vec3r(0, 0, 0), Max = Vec3r(1, 1, 1);
+    grid_medium Medium(Grid, Min, Max, 16, Color(1, 1, 1));
+
+    // NOTE: Rays between two random points on a sphere around the box.
+    std::vector<ray> Rays(RayCount);
+    std::vector<f64> Reference(RayCount);
+    for(i32 Index = 0; Index < RayCount; ++Index)
+    {
+        vec3r From = Vec3r(0.5, 0.5, 0.5) + vec3r::RandomUnitVector();
+        vec3r To = Vec3r(0.5, 0.5, 0.5) + 0.5*vec3r::RandomUnitVector();
+        Rays[Index] = ray(From, To - From, 0);
+
+        i32 Steps = 4096;
+        f64 Optical = 0;
+        for(i32 Step = 0; Step < Steps; ++Step)
+        {
+            vec3r P = Rays[Index].At((Step + 0.5) / Steps);
+            b32 Inside = (P.x >= 0) && (P.x < 1) && (P.y >= 0) && (P.y < 1) &&
+                         (P.z >= 0) && (P.z < 1);
+            if(Inside)
+            {
+                Optical += 16*Grid->Density(128*P)*(Rays[Index].Direction().Magnitude() / Steps);
+            }
+        }
+        Reference[Index] = exp(-Optical);
+    }
+
+    auto Measure = [&](const char *Name, auto Estimate)
+    {
+        f64 SquaredError = 0, SumError = 0;
+        auto Begin = std::chrono::steady_clock::now();
+        for(i32 Index = 0; Index < RayCount; ++Index)
+        {
+            for(i32 Sample = 0; Sample < Estimates; ++Sample)
+            {
+                f64 Error = Estimate(Rays[Index]) - Reference[Index];
+                SquaredError += Error*Error;
+                SumError += Error;
+            }
+        }
+        auto End = std::chrono::steady_clock::now();
+        f64 Count = (f64)RayCount*Estimates;
+        printf("%-18s %8.1f ns/estimate  RMS error %.4f  bias %+.4f\n", Name,
+               std::chrono::duration<f64, std::nano>(End - Begin).count() / Count,
+               sqrt(SquaredError / Count), SumError / Count);
+    };
+
+    Measure("ratio tracking", [&](const ray &Ray)
+    {
+        return (f64)Medium.Transmittance(Ray, 0, 1);
+    });
+    Measure("delta tracking", [&](const ray &Ray)
+    {
+        hit_record Record;
+        return Medium.Hit(Ray, interval(0, 1), Record) ? 0.0 : 1.0;
+    });
+}
+
+// NOTE: Checks the phase functions against their own definitions and shows
+// what sampling them buys. Per phase function: the integral over the sphere
+// by uniform sampling (should be 1), the mean cosine of the sampled
+// directions (g, for Henyey-Greenstein), and how far the pdf Sample() reports
+// is from Evaluate() in that direction. Then the single scattered light off a
+// forward lobe (cos^8 around the incoming direction), estimated by sampling
+// the sphere uniformly and by sampling the phase function, and the tabulated
+// HG against the analytic one.
+void
+PhaseSampling(i32 Count = 1'000'000)
+{
+    SeedRandom(6);
+    vec3r Direction = Normalize(Vec3r(1, 2, 3));
+
+    std::vector<real> Table(256);
+    henyey_greenstein Forward(0.85);
+    for(i32 Index = 0; Index < (i32)Table.size(); ++Index)
+    {
+        Table[Index] = Forward.Evaluate((real)(-1.0 + 2.0*(Index + 0.5) / Table.size()));
+    }
+
+    struct named_phase
+    {
+        const char *Name;
+        std::shared_ptr<phase_function> Phase;
+    };
+    named_phase Phases[] =
+    {
+        {"isotropic", std::make_shared<isotropic_phase>()},
+        {"HG g=-0.5", std::make_shared<henyey_greenstein>(-0.5)},
+        {"HG g=0.3", std::make_shared<henyey_greenstein>(0.3)},
+        {"HG g=0.85", std::make_shared<henyey_greenstein>(0.85)},
+        {"table HG 0.85", std::make_shared<tabulated_phase>(Table)},
+    };
+
+    auto Light = [&](const vec3r &W)
+    {
+        f64 Cos = Dot(W, Direction);
+        f64 Result = (Cos > 0) ? pow(Cos, 8) : 0.0;
+        return Result;
+    };
+
+    printf("%-14s %9s %9s %10s %22s %22s\n", "phase", "integral", "mean cos",
+           "pdf error", "uniform mean (var)", "sampled mean (var)");
+    for(const named_phase &Entry : Phases)
+    {
+        const phase_function &Phase = *Entry.Phase;
+        f64 Integral = 0, MeanCos = 0, PDFError = 0;
+        f64 UniformSum = 0, UniformSquares = 0, SampledSum = 0, SampledSquares = 0;
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            vec3r Uniform = SampleUnitSphere(Vec2d(Rand01(), Rand01()));
+            f64 Value = Phase.Evaluate(Dot(Uniform, Direction)) / UnitSpherePdf();
+            Integral += Value;
+            f64 UniformEstimate = Value*Light(Uniform);
+            UniformSum += UniformEstimate;
+            UniformSquares += UniformEstimate*UniformEstimate;
+
+            real PDF;
+            vec3r Sampled = Phase.Sample(Direction, Vec2d(Rand01(), Rand01()), PDF);
+            real Cos = Dot(Sampled, Direction);
+            MeanCos += Cos;
+            f64 Error = fabs(PDF - Phase.Evaluate(Cos)) / Phase.Evaluate(Cos);
+            PDFError = (Error > PDFError) ? Error : PDFError;
+            f64 SampledEstimate = (Phase.Evaluate(Cos) / PDF)*Light(Sampled);
+            SampledSum += SampledEstimate;
+            SampledSquares += SampledEstimate*SampledEstimate;
+        }
+
+        f64 UniformMean = UniformSum / Count, SampledMean = SampledSum / Count;
+        printf("%-14s %9.4f %9.4f %10.2e %11.5f (%8.2e) %11.5f (%8.2e)\n", Entry.Name,
+               Integral / Count, MeanCos / Count, PDFError,
+               UniformMean, UniformSquares / Count - UniformMean*UniformMean,
+               SampledMean, SampledSquares / Count - SampledMean*SampledMean);
+    }
+
+    // NOTE: The table is piecewise constant, so it is off the most where HG is
+    // steepest, right around cos = 1.
+    tabulated_phase Tabulated(Table);
+    f64 SumSquares = 0, MaxError = 0;
+    i32 Steps = 10000;
+    for(i32 Step = 0; Step < Steps; ++Step)
+    {
+        real Cos = (real)(-1.0 + 2.0*(Step + 0.5) / Steps);
+        f64 Error = fabs(Tabulated.Evaluate(Cos) - Forward.Evaluate(Cos)) / Forward.Evaluate(Cos);
+        SumSquares += Error*Error;
+        MaxError = (Error > MaxError) ? Error : MaxError;
+    }
+    printf("table of %zu vs analytic HG 0.85: RMS relative error %.4f, max %.4f\n",
+           Table.size(), sqrt(SumSquares / Steps), MaxError);
+}
+
+// NOTE: The light tree on its own. How the cost of picking a light and of
+// the pdf grows with the number of lights (random little spheres in a box),
+// that the pdf integrates to 1 over the sphere, and, on the floor of
+// ManyLights, the noise in the direct light from all its lights when the
+// light is picked by the tree, by power alone (an alias table would pick the
+// same, just faster) and uniformly, with the spheres in the way.
+void
+LightSampling()
+{
+    auto RandomLights = [](i32 Count, real Radius, real Size)
+    {
+        hittable_list Result;
+        Result.Arena = std::make_shared<scene_arena>();
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            vec3r Center = Vec3r(RandRange(-Size, Size), RandRange(-Size, Size), RandRange(-Size, Size));
+            color Emit = RandRange(1, 10)*Color(1, 1, 1);
+            Result.Add(Result.Arena->New<sphere>(Center, Radius,
+                                                 Result.Arena->New<diffuse_light>(Emit)));
+        }
+        return Result;
+    };
+
+    SeedRandom(7);
+    printf("%8s %10s %12s %12s\n", "lights", "build ms", "sample ns", "pdf ns");
+    for(i32 Count : {64, 1024, 16384, 65536})
+    {
+        hittable_list Lights = RandomLights(Count, 0.05, 20);
+        auto Begin = std::chrono::steady_clock::now();
+        light_tree Tree(Lights, 0, 1);
+        auto End = std::chrono::steady_clock::now();
+        f64 BuildMs = std::chrono::duration<f64, std::milli>(End - Begin).count();
+
+        i32 Samples = 200000;
+        std::vector<vec3r> Points(256), Directions(Samples);
+        for(vec3r &P : Points) { P = Vec3r(RandRange(-20, 20), RandRange(-20, 20), RandRange(-20, 20)); }
+
+        Begin = std::chrono::steady_clock::now();
+        for(i32 Index = 0; Index < Samples; ++Index)
+        {
+            Directions[Index] = Tree.Sample(Points[Index & 255], Vec3r(0, 0, 0), Rand01(),
+                                            Vec2d(Rand01(), Rand01()));
+        }
+        End = std::chrono::steady_clock::now();
+        f64 SampleNs = std::chrono::duration<f64, std::nano>(End - Begin).count() / Samples;
+
+        f64 Sum = 0;
+        Begin = std::chrono::steady_clock::now();
+        for(i32 Index = 0; Index < Samples; ++Index)
+        {
+            Sum += Tree.PDF(Points[Index & 255], Vec3r(0, 0, 0), Directions[Index]);
+        }
+        End = std::chrono::steady_clock::now();
+        f64 PDFNs = std::chrono::duration<f64, std::nano>(End - Begin).count() / Samples;
+        printf("%8d %10.2f %12.1f %12.1f%s\n", Count, BuildMs, SampleNs, PDFNs, (Sum > 0) ? "" : " ?");
+    }
+
+    {
+        hittable_list Lights = RandomLights(64, 0.3, 4);
+        light_tree Tree(Lights, 0, 1);
+        i32 Samples = 1'000'000;
+        f64 Integral = 0;
+        for(i32 Index = 0; Index < Samples; ++Index)
+        {
+            vec3r Direction = SampleUnitSphere(Vec2d(Rand01(), Rand01()));
+            Integral += Tree.PDF(Vec3r(0.1, 0.2, 0.3), Vec3r(0, 0, 0), Direction) / UnitSpherePdf();
+        }
+        printf("pdf over the sphere, 64 lights: %.4f\n", Integral / Samples);
+    }
+
+    hittable_list World = ManyLights();
+    light_tree Tree(World, 0, 1);
+    std::vector<emitter> Candidates;
+    World.GatherEmitters(Candidates);
+    std::vector<const hittable *> Shapes;
+    std::vector<f64> Power;
+    for(const emitter &Candidate : Candidates)
+    {
+        color Emit = Candidate.Material->Emitted(0.5, 0.5, Candidate.Center);
+        f64 Luminance = 0.2126*Emit.r + 0.7152*Emit.g + 0.0722*Emit.b;
+        if(Luminance > 0)
+        {
+            Shapes.push_back(Candidate.Shape);
+            Power.push_back(Luminance*Candidate.Area);
+        }
+    }
+    f64 TotalPower = 0;
+    for(f64 P : Power) { TotalPower += P; }
+    std::vector<f64> PowerCDF(Power.size() + 1, 0.0);
+    for(size_t Index = 0; Index < Power.size(); ++Index) { PowerCDF[Index + 1] = PowerCDF[Index] + Power[Index] / TotalPower; }
+
+    vec3r Up = Vec3r(0, 1, 0);
+    auto Light = [&](const vec3r &P, const vec3r &Direction)
+    {
+        f64 Result = 0;
+        hit_record Record;
+        real Cos = Dot(Up, Direction) / Direction.Magnitude();
+        if((Cos > 0) && World.Hit(ray(P, Direction, 0), interval(0, Infinity), Record))
+        {
+            color Emit = Record.Material->Emitted(Record.U, Record.V, Record.P);
+            Result = (0.2126*Emit.r + 0.7152*Emit.g + 0.0722*Emit.b)*Cos;
+        }
+        return Result;
+    };
+    // NOTE: Uniform and power picks, as mixtures over every light.
+    auto MixturePDF = [&](const vec3r &P, const vec3r &Direction, b32 ByPower)
+    {
+        f64 Result = 0;
+        for(size_t Index = 0; Index < Shapes.size(); ++Index)
+        {
+            f64 Odds = ByPower ? (Power[Index] / TotalPower) : (1.0 / Shapes.size());
+            Result += Odds*Shapes[Index]->PdfValue(P, Direction);
+        }
+        return Result;
+    };
+
+    i32 PointCount = 32, Samples = 1024;
+    const char *Names[] = {"uniform pick", "power pick", "light tree"};
+    for(i32 Strategy = 0; Strategy < 3; ++Strategy)
+    {
+        SeedRandom(8);
+        f64 RelativeVariance = 0;
+        for(i32 Point = 0; Point < PointCount; ++Point)
+        {
+            vec3r P = Vec3r(RandRange(-20, 20), 0, RandRange(-20, 20));
+            f64 Sum = 0, SumSquares = 0;
+            for(i32 Sample = 0; Sample < Samples; ++Sample)
+            {
+                f64 Select = Rand01();
+                vec2d PointSample = Vec2d(Rand01(), Rand01());
+                vec3r Direction;
+                f64 PDF;
+                if(Strategy == 2)
+                {
+                    Direction = Tree.Sample(P, Up, Select, PointSample);
+                    PDF = Tree.PDF(P, Up, Direction);
+                }
+                else
+                {
+                    size_t Index = (size_t)(Select*Shapes.size());
+                    if(Strategy == 1)
+                    {
+                        Index = std::upper_bound(PowerCDF.begin(), PowerCDF.end(), Select) - PowerCDF.begin() - 1;
+                        Index = (Index < Shapes.size()) ? Index : (Shapes.size() - 1);
+                    }
+                    Direction = Shapes[Index]->Random(P, PointSample);
+                    PDF = MixturePDF(P, Direction, Strategy == 1);
+                }
+                f64 Estimate = (PDF > 0) ? (Light(P, Direction) / PDF) : 0.0;
+                Sum += Estimate;
+                SumSquares += Estimate*Estimate;
+            }
+            f64 Mean = Sum / Samples;
+            f64 Variance = SumSquares / Samples - Mean*Mean;
+            RelativeVariance += (Mean > 0) ? (Variance / (Mean*Mean)) : 0.0;
+        }
+        printf("%-13s relative variance of the direct light %8.2f\n", Names[Strategy],
+               RelativeVariance / PointCount);
+    }
+}
+
+// NOTE: The environment map on its own, on a made up sky: a blue gradient
+// with a small sun 30 degrees up that has almost all of the light. That the
+// pdf integrates to 1 over the sphere and agrees with what Sample() says, and
+// the noise in the light falling on a floor facing up when the directions
+// come from the cosine (what a diffuse bounce does), from the map, and from
+// the half and half mix the camera uses.
+void
+EnvironmentSampling()
+{
+    i32 Width = 512, Height = 256;
+    std::vector<f32> Pixels((u64)Width*Height*3);
+    vec3r Sun = Normalize(Vec3r(0.6, 0.5, -0.4));
+    for(i32 Y = 0; Y < Height; ++Y)
+    {
+        for(i32 X = 0; X < Width; ++X)
+        {
+            f64 Theta = pi*(Y + 0.5) / Height;
+            f64 Phi = 2.0*pi*(X + 0.5) / Width;
+            vec3r Direction = Vec3r(-sin(Theta)*cos(Phi), cos(Theta), sin(Theta)*sin(Phi));
+            f64 Up = (Direction.y > 0) ? Direction.y : 0.0;
+            color Sky = (Direction.y > 0) ? ((1.0 - Up)*Color(1, 1, 1) + Up*Color(0.3, 0.5, 1.0))
+                                          : Color(0.1, 0.1, 0.1);
+            if(Dot(Direction, Sun) > cos(Deg2Rad(2.0)))
+            {
+                Sky = Color(20000, 18000, 15000);
+            }
+            f32 *Pixel = &Pixels[3*((u64)Y*Width + X)];
+            Pixel[0] = (f32)Sky.r;
+            Pixel[1] = (f32)Sky.g;
+            Pixel[2] = (f32)Sky.b;
+        }
+    }
+
+    const char *Filename = "environment_experiment.pfm";
+    pfm File = {Filename, Width, Height, Pixels.data()};
+    WritePFM(&File);
+    environment_map Environment(Filename);
+    remove(Filename);
+    if(!Environment.Loaded())
+    {
+        return;
+    }
+
+    // NOTE: Every pixel's pdf times its solid angle, at 4x4 points in it.
+    f64 Integral = 0;
+    for(i32 Y = 0; Y < 4*Height; ++Y)
+    {
+        f64 Theta0 = pi*Y / (4*Height), Theta1 = pi*(Y + 1) / (4*Height);
+        f64 Theta = 0.5*(Theta0 + Theta1);
+        f64 SolidAngle = (2.0*pi / (4*Width))*(cos(Theta0) - cos(Theta1));
+        for(i32 X = 0; X < 4*Width; ++X)
+        {
+            f64 Phi = 2.0*pi*(X + 0.5) / (4*Width);
+            vec3r Direction = Vec3r(-sin(Theta)*cos(Phi), cos(Theta), sin(Theta)*sin(Phi));
+            Integral += Environment.PDF(Direction)*SolidAngle;
+        }
+    }
+    printf("pdf over the sphere: %.4f\n", Integral);
+
+    SeedRandom(9);
+    i32 Samples = 1'000'000;
+    f64 WorstRatio = 0;
+    auto Begin = std::chrono::steady_clock::now();
+    for(i32 Index = 0; Index < Samples; ++Index)
+    {
+        real PDF;
+        vec3r Direction = Environment.Sample(Vec2d(Rand01(), Rand01()), PDF);
+        f64 Ratio = fabs(Environment.PDF(Direction) / PDF - 1.0);
+        WorstRatio = (Ratio > WorstRatio) ? Ratio : WorstRatio;
+    }
+    auto End = std::chrono::steady_clock::now();
+    printf("sample + pdf: %.1f ns, largest relative difference of the two pdfs %.2e\n",
+           std::chrono::duration<f64, std::nano>(End - Begin).count() / Samples, WorstRatio);
+
+    // NOTE: The light on the floor, summed over the pixels of the map.
+    f64 Irradiance = 0;
+    for(i32 Y = 0; Y < Height / 2; ++Y)
+    {
+        f64 Theta0 = pi*Y / Height, Theta1 = pi*(Y + 1) / Height;
+        f64 Theta = 0.5*(Theta0 + Theta1);
+        for(i32 X = 0; X < Width; ++X)
+        {
+            const f32 *Pixel = &Pixels[3*((u64)Y*Width + X)];
+            f64 Luminance = 0.2126*Pixel[0] + 0.7152*Pixel[1] + 0.0722*Pixel[2];
+            Irradiance += Luminance*cos(Theta)*(2.0*pi / Width)*(cos(Theta0) - cos(Theta1));
+        }
+    }
+
+    onb Floor(Vec3r(0, 1, 0));
+    const char *Names[] = {"cosine", "environment", "half and half"};
+    for(i32 Strategy = 0; Strategy < 3; ++Strategy)
+    {
+        SeedRandom(10);
+        i32 Count = 65536;
+        f64 Sum = 0, SumSquares = 0;
+        for(i32 Index = 0; Index < Count; ++Index)
+        {
+            f64 Choice = Rand01();
+            vec2d Sample = Vec2d(Rand01(), Rand01());
+            vec3r Direction;
+            if((Strategy == 0) || ((Strategy == 2) && (Choice < 0.5)))
+            {
+                Direction = Floor.Local(SampleCosineHemisphere(Sample));
+            }
+            else
+            {
+                real Unused;
+                Direction = Environment.Sample(Sample, Unused);
+            }
+
+            f64 Cos = Direction.y / Direction.Magnitude();
+            f64 CosinePDF = CosineHemispherePdf(Cos);
+            f64 MapPDF = Environment.PDF(Direction);
+            f64 PDF = (Strategy == 0) ? CosinePDF : ((Strategy == 1) ? MapPDF : 0.5*(CosinePDF + MapPDF));
+            color L = Environment.Value(Direction);
+            f64 Luminance = 0.2126*L.r + 0.7152*L.g + 0.0722*L.b;
+            f64 Estimate = ((Cos > 0) && (PDF > 0)) ? (Luminance*Cos / PDF) : 0.0;
+            Sum += Estimate;
+            SumSquares += Estimate*Estimate;
+        }
+        f64 Mean = Sum / Count;
+        f64 Variance = SumSquares / Count - Mean*Mean;
+        printf("%-14s irradiance %10.2f (exact %10.2f), relative variance %10.3f\n", Names[Strategy],
+               Mean, Irradiance, Variance / (Irradiance*Irradiance));
+    }
+}
+
 #define INTEGRAND_FUNCTION(Func) [](f64 x) { return Func(x); }
 #define INTEGRAND_FUNCTION_2(Func1, Func2) [](f64 x) { return Func1(x)*Func2(x); }
 #define INTEGRAND_FUNCTION_3(Func1, Func2, Func3) [](f64 x) { return Func1(x)*Func2(x)*Func3(x); }
@@ -291,154 +1100,812 @@ PDFFunction(f64 x)
     return Result;
 }
 
-int
-main()
-{
-#if 1
-
-    // MC::StratifiedEstimatePi();
-    // MC::OneDimensionalIntegration(INTEGRAND_FUNCTION_2(sin, cos), 0, 0.5*pi,
-    //                               1'000'000);
-    // MC::ComputePDFHalfwayPoint(&PDFFunction, 0, 2*pi);
-    // MC::ImportanceSampling();
-    MC::SurfaceIntegralOverSphere();
-
-#else
-    hittable_list World;
-
-    // NOTE: Camera Params
-    // NOTE: Depth of Field Parameters
-    // This is how we are handling depth of field.
-    // When objects are far from the focal distance then rays emanating from the
-    // camera after intersecting the focal plane diverge a lot(if the ray
-    // origins are different as we are doing here using the defocus disk), the
-    // divergence will be more for objects away from the focal plane hence
-    // blurring will be more for those objects.
-    // NOTE: Aperture basically. More this angle, more will be defocus blur(More
-    // blurring on the objects which are not in focus).
-    f64 DefocusAngle = 0.0;
-    // NOTE: This is where the camera is focused. Basically this object or
-    // objects close to this distance will be focused on and hence wont be
-    // blurred.
-    f64 FocusDistance = 10.0;
-    // NOTE: Decrease this FOV Vertical to zoom in.
-    f64 VerticalFOV = 40.0;
-    // Positioning and Orienting the Camera.
-    vec3d LookFrom, LookAt;
-    // The Global UP Vector used for calculating the camera's basis vectors.
-    vec3d Up = Vec3d(0, 1, 0);
-    // NOTE: Motion Blur Parameters
-    // This is the time interval when the shutter of the virtual camera is open.
-    f64 ShutterOpenTime = 0.;
-    f64 ShutterCloseTime = 1.;
-
-    f64 AspectRatio = (16.0 / 9.0);
-
-    i32 WorldSelect = 6;
-    color Background = Color(0, 0, 0);
-
-    i32 SamplesPerPixel = 100;
-    i32 ImageWidth = 400;
-
-    switch(WorldSelect)
-    {
-        case 1:
-        {
-            World = RandomScene();
-            Background = Color(0.7, 0.8, 1.0);
-            VerticalFOV = 20;
-            LookFrom = Vec3d(13, 2, 3);
-            LookAt = Vec3d(0, 0, 0);
-            DefocusAngle = 0.6;
-        } break;
-
-        case 2:
-        {
-            World = TwoSpheres();
-            Background = Color(0.7, 0.8, 1.0);
-            VerticalFOV = 20;
-            LookFrom = Vec3d(13, 2, 3);
-            LookAt = Vec3d(0, 0, 0);
-        } break;
-
-        case 3:
-        {
-            World = EarthScene();
-            Background = Color(0.7, 0.8, 1.0);
-            VerticalFOV = 20;
-            LookFrom = Vec3d(0, 0, 12);
-            LookAt = Vec3d(0, 0, 0);
-            DefocusAngle = 0;
-        } break;
-
-        case 4:
-        {
-            World = TwoPerlinSpheres();
-            Background = Color(0.7, 0.8, 1.0);
-            VerticalFOV = 20;
-            LookFrom = Vec3d(13, 2, 3);
-            LookAt = Vec3d(0, 0, 0);
-        } break;
-
-        case 5:
-        {
-            World = SimpleLight();
-            SamplesPerPixel = 400;
-            Background = Color(0, 0, 0);
-            LookFrom = Vec3d(26, 3, 6);
-            LookAt = Vec3d(0, 2, 0);
-            VerticalFOV = 20.0;
-        } break;
-
-        case 6:
-        {
-            World = CornellBox();
-            AspectRatio = 1.0;
-            ImageWidth = 400;
-            SamplesPerPixel = 1225;
-            Background = Color(0, 0, 0);
-            LookFrom = Vec3d(278, 278, -800);
-            LookAt = Vec3d(278, 278, 0);
-            VerticalFOV = 40.0;
-        } break;
-
-        case 7:
-        {
-            World = CornellSmoke();
-            AspectRatio = 1.0;
-            ImageWidth = 600;
-            SamplesPerPixel = 1000;
-            LookFrom = Vec3d(278, 278, -800);
-            LookAt = Vec3d(278, 278, 0);
-            VerticalFOV = 40.0;
-        } break;
-
-        case 8:
-        {
-            World = RT_TheNextWeek_FinalScene();
-            AspectRatio = 1.;
-            ImageWidth = 600;
-            SamplesPerPixel = 1000;
-            Background = Color(0, 0, 0);
-            LookFrom = Vec3d(478, 278, -600);
-            LookAt = Vec3d(278, 278, 0);
-            VerticalFOV = 40.;
-        } break;
-
-        default: {}
-    }
-
-#if 0
-    vec3d FocusAt = Vec3d(0, 0, -1);
-    f64 Dist = (FocusAt - Camera.LookFrom).Magnitude();
-#endif
-
-    camera Cam = camera(LookFrom, LookAt, Up, VerticalFOV, ImageWidth, AspectRatio,
-                        DefocusAngle, FocusDistance, ShutterOpenTime, ShutterCloseTime);
-    Cam.Filename = "10b_CornellSceneAfterStratifiedSampling.ppm";
-    Cam.SamplesPerPixel = SamplesPerPixel;
-    Cam.MaxBounces = 50;
-    Cam.Render(World, Background);
+// NOTE: The scenes that are built in here instead of coming from a scene file.
+// Fills in the settings the scene is meant to be rendered with.
+b32
+BuiltinScene(const char *Name, scene_settings &Settings, hittable_list (**BuildScene)())
+{
+    if(strcmp(Name, "RandomScene") == 0)
+    {
+        *BuildScene = RandomScene;
+        Settings.Background = Color(0.7, 0.8, 1.0);
+        Settings.VerticalFOV = 20;
+        Settings.LookFrom = Vec3r(13, 2, 3);
+        Settings.LookAt = Vec3r(0, 0, 0);
+        Settings.DefocusAngle = 0.6;
+    }
+    else if(strcmp(Name, "TwoSpheres") == 0)
+    {
+        *BuildScene = TwoSpheres;
+        Settings.Background = Color(0.7, 0.8, 1.0);
+        Settings.VerticalFOV = 20;
+        Settings.LookFrom = Vec3r(13, 2, 3);
+        Settings.LookAt = Vec3r(0, 0, 0);
+    }
+    else if(strcmp(Name, "EarthScene") == 0)
+    {
+        *BuildScene = EarthScene;
+        Settings.Background = Color(0.7, 0.8, 1.0);
+        Settings.VerticalFOV = 20;
+        Settings.LookFrom = Vec3r(0, 0, 12);
+        Settings.LookAt = Vec3r(0, 0, 0);
+        Settings.DefocusAngle = 0;
+    }
+    else if(strcmp(Name, "TwoPerlinSpheres") == 0)
+    {
+        *BuildScene = TwoPerlinSpheres;
+        Settings.Background = Color(0.7, 0.8, 1.0);
+        Settings.VerticalFOV = 20;
+        Settings.LookFrom = Vec3r(13, 2, 3);
+        Settings.LookAt = Vec3r(0, 0, 0);
+    }
+    else if(strcmp(Name, "SimpleLight") == 0)
+    {
+        *BuildScene = SimpleLight;
+        Settings.SamplesPerPixel = 400;
+        Settings.Background = Color(0, 0, 0);
+        Settings.LookFrom = Vec3r(26, 3, 6);
+        Settings.LookAt = Vec3r(0, 2, 0);
+        Settings.VerticalFOV = 20.0;
+    }
+    else if(strcmp(Name, "CornellBox") == 0)
+    {
+        *BuildScene = CornellBox;
+        Settings.AspectRatio = 1.0;
+        Settings.ImageWidth = 400;
+        Settings.SamplesPerPixel = 1225;
+        Settings.Background = Color(0, 0, 0);
+        Settings.LookFrom = Vec3r(278, 278, -800);
+        Settings.LookAt = Vec3r(278, 278, 0);
+        Settings.VerticalFOV = 40.0;
+    }
+    else if(strcmp(Name, "CornellSmoke") == 0)
+    {
+        *BuildScene = CornellSmoke;
+        Settings.AspectRatio = 1.0;
+        Settings.ImageWidth = 600;
+        Settings.SamplesPerPixel = 1000;
+        Settings.LookFrom = Vec3r(278, 278, -800);
+        Settings.LookAt = Vec3r(278, 278, 0);
+        Settings.VerticalFOV = 40.0;
+    }
+    else if(strcmp(Name, "CornellCloud") == 0)
+    {
+        *BuildScene = CornellCloud;
+        Settings.AspectRatio = 1.0;
+        Settings.ImageWidth = 600;
+        Settings.SamplesPerPixel = 1000;
+        Settings.LookFrom = Vec3r(278, 278, -800);
+        Settings.LookAt = Vec3r(278, 278, 0);
+        Settings.VerticalFOV = 40.0;
+    }
+    else if(strcmp(Name, "ManyLights") == 0)
+    {
+        *BuildScene = ManyLights;
+        Settings.ImageWidth = 400;
+        Settings.SamplesPerPixel = 64;
+        Settings.Background = Color(0, 0, 0);
+        Settings.LookFrom = Vec3r(0, 14, -32);
+        Settings.LookAt = Vec3r(0, 0, -2);
+        Settings.VerticalFOV = 40.0;
+    }
+    else if(strcmp(Name, "RT_TheNextWeek_FinalScene") == 0)
+    {
+        *BuildScene = RT_TheNextWeek_FinalScene;
+        Settings.Medium = std::make_shared<homogeneous_medium>(
+            .0001, Color(1, 1, 1), aabb(Vec3r(-5000, -5000, -5000), Vec3r(5000, 5000, 5000)));
+        Settings.AspectRatio = 1.;
+        Settings.ImageWidth = 600;
+        Settings.SamplesPerPixel = 1000;
+        Settings.Background = Color(0, 0, 0);
+        Settings.LookFrom = Vec3r(478, 278, -600);
+        Settings.LookAt = Vec3r(278, 278, 0);
+        Settings.VerticalFOV = 40.;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+// NOTE: A built-in scene by name, or else a scene file (text or binary).
+// Built-in scenes are kept in <Name>.rtcache when UseSceneCache is set, keyed
+// on the name and on when this file was compiled. The builders live in here,
+// and so does everything they include, so any change to a scene (or to the
+// objects and materials it is made of) rebuilds it instead of reusing a
+// cache from an older build.
+b32
+LoadScene(const std::string &Name, b32 UseSceneCache, scene &Scene)
+{
+    // NOTE: Image textures keep their tile files next to the images the same
+    // way scenes keep their caches.
+    texture_cache::Get().SetUseTileFiles(UseSceneCache);
+
+    hittable_list (*BuildScene)() = nullptr;
+    if(!BuiltinScene(Name.c_str(), Scene.Settings, &BuildScene))
+    {
+        if(!scene_file::Load(Name.c_str(), Scene, UseSceneCache))
+        {
+            return false;
+        }
+    }
+    else if(UseSceneCache)
+    {
+        std::string CacheFilename = Name + ".rtcache";
+        u64 BuildStamp = scene_cache::HashString(__DATE__ " " __TIME__);
+        // NOTE: The built-in scenes build their BVHs over 0..1, so that's
+        // what the cache is built for too.
+        Scene.World = scene_cache::LoadOrBuild(CacheFilename.c_str(),
+                                               scene_cache::HashString(Name.c_str(), BuildStamp),
+                                               0, 1, BuildScene);
+    }
+    else
+    {
+        Scene.World = BuildScene();
+    }
+
+    // NOTE: Either way, the lights come out of whatever the world ended up
+    // being, cached or not.
+    Scene.Lights = std::make_shared<light_tree>(Scene.World, Scene.Settings.ShutterOpenTime,
+                                                Scene.Settings.ShutterCloseTime);
+
+    if(!Scene.Settings.EnvironmentFile.empty())
+    {
+        Scene.Environment = std::make_shared<environment_map>(Scene.Settings.EnvironmentFile.c_str(),
+                                                              Scene.Settings.EnvironmentScale);
+        if(!Scene.Environment->Loaded())
+        {
+            fprintf(stderr, "Could not load the environment map: %s\n",
+                    Scene.Settings.EnvironmentFile.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+// NOTE: One image to render. Anything left at -1 keeps what the scene asks for.
+struct render_job
+{
+    std::string Scene = "CornellBox";
+    std::string Output;
+    std::string Reference; // .pfm to measure the output against, if any.
+    std::string Environment; // Environment map to light the scene with instead of its own.
+    i32 ImageWidth = -1;
+    i32 SamplesPerPixel = -1;
+    i32 MaxBounces = -1;
+    i32 ThreadCount = 0;
+    u64 Seed = 0;
+    sampler_type Sampler = Sampler_Sobol;
+    b32 UseSceneCache = true;
+    i32 TextureCacheMB = -1; // Memory for image texture tiles.
+    b32 UseRayDifferentials = true;
+    b32 UseLightSampling = true;
+    denoise_filter Denoiser = Denoise_None;
+    u32 AOVs = 0; // aov_types to write next to the image.
+};
+
+// NOTE: What RenderJob measured. Error is only there if the job has a
+// Reference and the images could be compared.
+struct render_stats
+{
+    i32 Width;
+    i32 Height;
+    i32 SamplesPerPixel;
+    f64 Seconds;
+    u64 RaysTraced;
+    b32 Compared;
+    image_error Error;
+};
+
+void
+PrintUsage(const char *Program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s, --scene <name|file>   Built-in scene or scene file (.rts text, or binary).\n"
+            "  -o, --output <file>       Image to write. .pfm writes linear floats, anything\n"
+            "                            else an 8 bit PPM. Defaults to <scene>.ppm.\n"
+            "  -w, --width <pixels>      Image width. The height follows the aspect ratio.\n"
+            "      --spp <count>         Samples per pixel.\n"
+            "      --bounces <count>     Maximum number of bounces.\n"
+            "  -t, --threads <count>     Render threads, 0 for all hardware threads.\n"
+            "      --seed <number>       Random seed.\n"
+            "      --sampler <name>      independent, stratified, halton, sobol (the\n"
+            "                            default), or bluenoise for low sample count\n"
+            "                            previews.\n"
+            "                            pmj02 is the same as sobol.\n"
+            "      --reference <file>    Print the error against this .pfm after the\n"
+            "                            render. The output has to be a .pfm too.\n"
+            "      --no-cache            Do not read or write scene cache or texture tile\n"
+            "                            files.\n"
+            "      --texture-cache <MB>  Memory for image texture tiles, 256 MB by default.\n"
+            "      --no-differentials    Filter textures by path spread alone, without ray\n"
+            "                            differentials.\n"
+            "      --no-light-sampling   Only scatter where the materials do, never\n"
+            "                            towards the lights or the environment.\n"
+            "      --environment <file>  Light the scene with this HDR lat-long image (.pfm\n"
+            "                            or .hdr) instead of its background.\n"
+            "      --denoise <filter>    Denoise the image before writing it: atrous,\n"
+            "                            bilateral or none (the default).\n"
+            "      --aov <list>          Also write these, comma separated, each to\n"
+            "                            <output>.<name>.pfm: albedo, normal, depth,\n"
+            "                            material, object, emission, direct, indirect,\n"
+            "                            samples, or all of them.\n"
+            "      --features            Same as --aov albedo,normal,depth.\n"
+            "  -b, --batch <file>        Render every job in <file>, one per line, written\n"
+            "                            with the options above. Options given on the\n"
+            "                            command line are the defaults for every job.\n"
+            "      --experiment <name>   Run one of the Monte Carlo experiments instead:\n"
+            "                            pi, integrate, halfway, importance, sphere, bvh,\n"
+            "                            vec, noise, medium, phase, lights,\n"
+            "                            environment, or convergence, which benchmarks\n"
+            "                            error against time on a few scenes and prints\n"
+            "                            JSON (see ConvergenceBenchmark).\n"
+            "\n"
+            "Built-in scenes: RandomScene, TwoSpheres, EarthScene, TwoPerlinSpheres,\n"
+            "SimpleLight, CornellBox, CornellSmoke, CornellCloud, ManyLights,\n"
+            "RT_TheNextWeek_FinalScene.\n",
+            Program);
+}
+
+// NOTE: Reads Value as a whole decimal number in [Min, Max]. Empty strings,
+// trailing junk and numbers out of range all fail.
+b32
+NumberFromString(const char *Value, u64 Min, u64 Max, u64 *Number)
+{
+    if(!isdigit((unsigned char)Value[0]))
+    {
+        return false;
+    }
+
+    char *End;
+    errno = 0;
+    u64 Parsed = strtoull(Value, &End, 10);
+    if((*End != 0) || (errno == ERANGE) || (Parsed < Min) || (Parsed > Max))
+    {
+        return false;
+    }
+
+    *Number = Parsed;
+    return true;
+}
+
+// NOTE: Reads the options in Args into Job. BatchFile and Experiment are only
+// looked for when they are passed in, batch files can't nest.
+b32
+ParseJobArgs(i32 ArgCount, char **Args, render_job &Job,
+             std::string *BatchFile = nullptr, std::string *Experiment = nullptr)
+{
+    for(i32 Index = 0; Index < ArgCount; ++Index)
+    {
+        const char *Arg = Args[Index];
+        const char *Value = ((Index + 1) < ArgCount) ? Args[Index + 1] : nullptr;
+        auto Is = [Arg](const char *Short, const char *Long)
+        {
+            return (Short && (strcmp(Arg, Short) == 0)) || (strcmp(Arg, Long) == 0);
+        };
+
+        if(Is(nullptr, "--no-cache"))
+        {
+            Job.UseSceneCache = false;
+            continue;
+        }
+        if(Is(nullptr, "--no-differentials"))
+        {
+            Job.UseRayDifferentials = false;
+            continue;
+        }
+        if(Is(nullptr, "--no-light-sampling"))
+        {
+            Job.UseLightSampling = false;
+            continue;
+        }
+        if(Is(nullptr, "--features"))
+        {
+            Job.AOVs |= AOV_Albedo | AOV_Normal | AOV_Depth;
+            continue;
+        }
+
+        b32 TakesValue = Is("-s", "--scene") || Is("-o", "--output") || Is("-w", "--width") ||
+                         Is(nullptr, "--spp") || Is(nullptr, "--bounces") ||
+                         Is("-t", "--threads") || Is(nullptr, "--seed") ||
+                         Is(nullptr, "--sampler") || Is(nullptr, "--reference") ||
+                         Is(nullptr, "--texture-cache") || Is(nullptr, "--environment") ||
+                         Is(nullptr, "--denoise") || Is(nullptr, "--aov") ||
+                         (BatchFile && Is("-b", "--batch")) ||
+                         (Experiment && Is(nullptr, "--experiment"));
+        if(!TakesValue)
+        {
+            fprintf(stderr, "Unknown option: %s\n", Arg);
+            return false;
+        }
+        if(!Value)
+        {
+            fprintf(stderr, "Missing value for %s\n", Arg);
+            return false;
+        }
+        ++Index;
+
+        if(Is("-s", "--scene"))             { Job.Scene = Value; }
+        else if(Is("-o", "--output"))       { Job.Output = Value; }
+        else if(Is("-w", "--width") || Is(nullptr, "--spp") || Is(nullptr, "--texture-cache"))
+        {
+            u64 Number;
+            if(!NumberFromString(Value, 1, INT32_MAX, &Number))
+            {
+                fprintf(stderr, "%s has to be a positive number, got: %s\n", Arg, Value);
+                return false;
+            }
+            if(Is("-w", "--width"))       { Job.ImageWidth = (i32)Number; }
+            else if(Is(nullptr, "--spp")) { Job.SamplesPerPixel = (i32)Number; }
+            else                          { Job.TextureCacheMB = (i32)Number; }
+        }
+        else if(Is(nullptr, "--bounces") || Is("-t", "--threads"))
+        {
+            u64 Number;
+            if(!NumberFromString(Value, 0, INT32_MAX, &Number))
+            {
+                fprintf(stderr, "%s has to be 0 or a positive number, got: %s\n", Arg, Value);
+                return false;
+            }
+            if(Is(nullptr, "--bounces")) { Job.MaxBounces = (i32)Number; }
+            else                         { Job.ThreadCount = (i32)Number; }
+        }
+        else if(Is(nullptr, "--seed"))
+        {
+            if(!NumberFromString(Value, 0, UINT64_MAX, &Job.Seed))
+            {
+                fprintf(stderr, "%s has to be a number from 0 to %llu, got: %s\n", Arg,
+                        (unsigned long long)UINT64_MAX, Value);
+                return false;
+            }
+        }
+        else if(Is(nullptr, "--reference")) { Job.Reference = Value; }
+        else if(Is(nullptr, "--environment")) { Job.Environment = Value; }
+        else if(Is(nullptr, "--sampler"))
+        {
+            if(!SamplerTypeFromName(Value, &Job.Sampler))
+            {
+                fprintf(stderr, "Unknown sampler: %s\n", Value);
+                return false;
+            }
+        }
+        else if(Is(nullptr, "--denoise"))
+        {
+            if(!DenoiseFilterFromName(Value, &Job.Denoiser))
+            {
+                fprintf(stderr, "Unknown denoiser: %s\n", Value);
+                return false;
+            }
+        }
+        else if(Is(nullptr, "--aov"))
+        {
+            u32 AOVs;
+            if(!AOVsFromNames(Value, &AOVs))
+            {
+                fprintf(stderr, "Unknown AOV in: %s\n", Value);
+                return false;
+            }
+            Job.AOVs |= AOVs;
+        }
+        else if(Is("-b", "--batch"))        { *BatchFile = Value; }
+        else if(Is(nullptr, "--experiment")) { *Experiment = Value; }
+    }
+
+    return true;
+}
+
+// NOTE: Splits a batch file line into arguments. Double quotes keep spaces.
+std::vector<std::string>
+SplitJobLine(const std::string &Line)
+{
+    std::vector<std::string> Result;
+    size_t At = 0;
+    while(At < Line.size())
+    {
+        while((At < Line.size()) && isspace((u8)Line[At])) { ++At; }
+        if((At == Line.size()) || (Line[At] == '#'))
+        {
+            break;
+        }
+
+        std::string Arg;
+        if(Line[At] == '"')
+        {
+            size_t Close = Line.find('"', At + 1);
+            Close = (Close == std::string::npos) ? Line.size() : Close;
+            Arg = Line.substr(At + 1, Close - (At + 1));
+            At = Close + 1;
+        }
+        else
+        {
+            size_t Begin = At;
+            while((At < Line.size()) && !isspace((u8)Line[At])) { ++At; }
+            Arg = Line.substr(Begin, At - Begin);
+        }
+        Result.push_back(Arg);
+    }
+
+    return Result;
+}
+
+b32
+RenderJob(const render_job &Job, const scene &Scene, render_stats *Stats = nullptr)
+{
+    scene_settings Settings = Scene.Settings;
+    if(Job.ImageWidth > 0)      { Settings.ImageWidth = Job.ImageWidth; }
+    if(Job.SamplesPerPixel > 0) { Settings.SamplesPerPixel = Job.SamplesPerPixel; }
+    if(Job.MaxBounces >= 0)     { Settings.MaxBounces = Job.MaxBounces; }
+
+    std::string Output = Job.Output;
+    if(Output.empty())
+    {
+        size_t Slash = Job.Scene.find_last_of("/\\");
+        Output = Job.Scene.substr((Slash == std::string::npos) ? 0 : (Slash + 1));
+        Output = Output.substr(0, Output.find('.')) + ".ppm";
+    }
+
+    camera Cam = MakeCamera(Settings);
+    Cam.Filename = Output.c_str();
+    Cam.ThreadCount = Job.ThreadCount;
+    Cam.Seed = Job.Seed;
+    Cam.SamplerType = Job.Sampler;
+    Cam.UseRayDifferentials = Job.UseRayDifferentials;
+    Cam.Denoiser = Job.Denoiser;
+    Cam.AOVs = Job.AOVs;
+    if(Job.UseLightSampling && Scene.Lights && !Scene.Lights->Empty())
+    {
+        Cam.Lights = Scene.Lights.get();
+    }
+
+    std::shared_ptr<environment_map> Environment = Scene.Environment;
+    if(!Job.Environment.empty())
+    {
+        Environment = std::make_shared<environment_map>(Job.Environment.c_str(), Settings.EnvironmentScale);
+        if(!Environment->Loaded())
+        {
+            fprintf(stderr, "Could not load the environment map: %s\n", Job.Environment.c_str());
+            return false;
+        }
+    }
+    if(Environment)
+    {
+        Cam.Environment = Environment.get();
+        Cam.SampleEnvironment = Job.UseLightSampling && Environment->CanSample();
+    }
+
+    texture_cache &Textures = texture_cache::Get();
+    if(Job.TextureCacheMB > 0)
+    {
+        Textures.SetBudget((u64)Job.TextureCacheMB << 20);
+    }
+    // NOTE: The images have been decoding since the scene opened them.
+    Textures.WaitForTextures();
+    texture_cache_stats TexturesBefore = Textures.Stats();
+
+    auto Begin = std::chrono::steady_clock::now();
+    b32 Written = Cam.Render(Scene.World, Settings.Background);
+    auto End = std::chrono::steady_clock::now();
+    if(!Written)
+    {
+        fprintf(stderr, "Could not write the image: %s\n", Output.c_str());
+        return false;
+    }
+
+    f64 Seconds = std::chrono::duration<f64>(End - Begin).count();
+    fprintf(stderr, "%s: %dx%d, %d spp, %.3f s -> %s\n", Job.Scene.c_str(),
+            Settings.ImageWidth, (i32)(Settings.ImageWidth / Settings.AspectRatio),
+            Settings.SamplesPerPixel, Seconds, Output.c_str());
+    render_stats JobStats = {};
+    JobStats.Width = Settings.ImageWidth;
+    JobStats.Height = (i32)(Settings.ImageWidth / Settings.AspectRatio);
+    JobStats.SamplesPerPixel = Settings.SamplesPerPixel;
+    JobStats.Seconds = Seconds;
+    JobStats.RaysTraced = Cam.RaysTraced;
+
+    if(Textures.TextureCount() > 0)
+    {
+        texture_cache_stats Stats = Textures.Stats();
+        u64 Requests = Stats.Requests - TexturesBefore.Requests;
+        u64 Loads = Stats.Loads - TexturesBefore.Loads;
+        fprintf(stderr, "  textures: %d images (%llu duplicates), %llu tile requests, "
+                "%llu loaded (%.1f%% hits), %llu evicted, %.1f MB resident, %.1f MB peak\n",
+                Textures.TextureCount(), (unsigned long long)Stats.Duplicates,
+                (unsigned long long)Requests, (unsigned long long)Loads,
+                (Requests > 0) ? (100.0*(f64)(Requests - Loads) / (f64)Requests) : 100.0,
+                (unsigned long long)(Stats.Evictions - TexturesBefore.Evictions),
+                (f64)Stats.ResidentBytes / (1 << 20), (f64)Stats.PeakBytes / (1 << 20));
+    }
+
+    b32 Result = true;
+    if(!Job.Reference.empty())
+    {
+        pfm Image = {};
+        pfm Reference = {};
+        if(ReadPFM(Output.c_str(), &Image) && ReadPFM(Job.Reference.c_str(), &Reference) &&
+           (Image.Width == Reference.Width) && (Image.Height == Reference.Height))
+        {
+            image_error Error = CompareImages(Image.ColorData, Reference.ColorData,
+                                              Image.Width, Image.Height);
+            fprintf(stderr, "  against %s: RMSE %.5f, filtered RMSE %.5f, relMSE %.5f\n",
+                    Job.Reference.c_str(), Error.RMSE, Error.FilteredRMSE, Error.RelMSE);
+            JobStats.Compared = true;
+            JobStats.Error = Error;
+        }
+        else
+        {
+            fprintf(stderr, "Can't compare %s with %s, both have to be .pfm files of the same size\n",
+                    Output.c_str(), Job.Reference.c_str());
+            Result = false;
+        }
+        free(Image.ColorData);
+        free(Reference.ColorData);
+    }
+
+    if(Stats)
+    {
+        *Stats = JobStats;
+    }
+    return Result;
+}
+
+// NOTE: Renders the jobs in BatchFile back to back. Jobs naming the same scene
+// share it, so its textures and BVHs are only ever loaded/built once. A job
+// that fails doesn't stop the others, the batch returns 1 if any did.
+i32
+RunBatch(const std::string &BatchFile, const render_job &Defaults)
+{
+    file_read_info File = ReadFile(BatchFile.c_str());
+    if(!File.Data)
+    {
+        return 1;
+    }
+
+    std::vector<render_job> Jobs;
+    std::string Text((const char *)File.Data, File.Size);
+    free(File.Data);
+
+    i32 LineNumber = 0;
+    for(size_t At = 0; At < Text.size(); )
+    {
+        size_t LineEnd = Text.find('\n', At);
+        LineEnd = (LineEnd == std::string::npos) ? Text.size() : LineEnd;
+        std::vector<std::string> Args = SplitJobLine(Text.substr(At, LineEnd - At));
+        At = LineEnd + 1;
+        ++LineNumber;
+
+        if(Args.empty())
+        {
+            continue;
+        }
+
+        std::vector<char *> Argv;
+        for(std::string &Arg : Args)
+        {
+            Argv.push_back(Arg.data());
+        }
+
+        render_job Job = Defaults;
+        if(!ParseJobArgs((i32)Argv.size(), Argv.data(), Job))
+        {
+            fprintf(stderr, "%s(%d): Bad job.\n", BatchFile.c_str(), LineNumber);
+            return 1;
+        }
+        Jobs.push_back(Job);
+    }
+
+    std::unordered_map<std::string, scene> Scenes;
+    i32 Failed = 0;
+    for(size_t Index = 0; Index < Jobs.size(); ++Index)
+    {
+        const render_job &Job = Jobs[Index];
+        fprintf(stderr, "Job %zu/%zu\n", Index + 1, Jobs.size());
+
+        auto Found = Scenes.find(Job.Scene);
+        if(Found == Scenes.end())
+        {
+            scene Scene;
+            if(!LoadScene(Job.Scene, Job.UseSceneCache, Scene))
+            {
+                fprintf(stderr, "Could not load the scene: %s\n", Job.Scene.c_str());
+                ++Failed;
+                continue;
+            }
+            Found = Scenes.emplace(Job.Scene, Scene).first;
+        }
+
+        if(!RenderJob(Job, Found->second))
+        {
+            ++Failed;
+        }
+    }
+
+    i32 Result = (Failed > 0) ? 1 : 0;
+    return Result;
+}
+
+// NOTE: Renders the benchmark scenes at a few fixed sample counts and seeds,
+// measures every image against a reference with far more samples, and prints
+// the lot as JSON on stdout (the progress goes to stderr as usual). The
+// references are rendered to convergence.<scene>.reference.pfm in the working
+// directory the first time and kept from then on; delete them after a change
+// that is meant to change the images.
+//
+// Efficiency is 1 / (relMSE*seconds). Twice the samples take twice the time
+// and halve the relMSE, so it stays put as a render converges and only goes up
+// when the image gets less noisy for the time spent, or faster for the same
+// noise. That makes it the number to compare from one commit to the next. The
+// options on the command line (the sampler, --no-light-sampling, --denoise,
+// --threads and so on) go for the benchmark renders, not the references.
+i32
+ConvergenceBenchmark(const render_job &Defaults)
+{
+    struct benchmark_scene
+    {
+        const char *Name;
+        i32 Width;
+    };
+    static const benchmark_scene Scenes[] =
+    {
+        {"CornellBox", 128},
+        {"CornellSmoke", 128},
+        {"RT_TheNextWeek_FinalScene", 128},
+        {"RandomScene", 128},
+    };
+    static const i32 Budgets[] = {4, 16, 64};
+    const i32 ReferenceSamples = 4096;
+    const u64 ReferenceSeed = 0x5EED;
+    const u64 BenchmarkSeed = 1;
+    const std::string Prefix = "convergence.";
+
+    printf("{\n  \"benchmark\": \"convergence\",\n  \"sampler\": \"%s\",\n"
+           "  \"light_sampling\": %s,\n  \"denoiser\": \"%s\",\n  \"threads\": %d,\n"
+           "  \"reference_spp\": %d,\n  \"runs\": [",
+           SamplerTypeName(Defaults.Sampler), Defaults.UseLightSampling ? "true" : "false",
+           DenoiseFilterName(Defaults.Denoiser),
+           (Defaults.ThreadCount > 0) ? Defaults.ThreadCount
+                                      : (i32)std::thread::hardware_concurrency(),
+           ReferenceSamples);
+
+    i32 Failed = 0;
+    b32 First = true;
+    for(const benchmark_scene &Benchmark : Scenes)
+    {
+        scene Scene;
+        if(!LoadScene(Benchmark.Name, Defaults.UseSceneCache, Scene))
+        {
+            fprintf(stderr, "Could not load the scene: %s\n", Benchmark.Name);
+            ++Failed;
+            continue;
+        }
+
+        std::string Reference = Prefix + Benchmark.Name + ".reference.pfm";
+        FILE *ReferenceFile = fopen(Reference.c_str(), "rb");
+        if(ReferenceFile)
+        {
+            fclose(ReferenceFile);
+        }
+        else
+        {
+            render_job Job;
+            Job.Scene = Benchmark.Name;
+            Job.Output = Reference;
+            Job.ImageWidth = Benchmark.Width;
+            Job.SamplesPerPixel = ReferenceSamples;
+            Job.Seed = ReferenceSeed;
+            Job.ThreadCount = Defaults.ThreadCount;
+            Job.UseSceneCache = Defaults.UseSceneCache;
+            fprintf(stderr, "Rendering the reference for %s\n", Benchmark.Name);
+            if(!RenderJob(Job, Scene))
+            {
+                fprintf(stderr, "Could not render the reference for %s\n", Benchmark.Name);
+                ++Failed;
+                continue;
+            }
+        }
+
+        for(i32 Budget : Budgets)
+        {
+            render_job Job = Defaults;
+            Job.Scene = Benchmark.Name;
+            Job.Output = Prefix + Benchmark.Name + "." + std::to_string(Budget) + "spp.pfm";
+            Job.Reference = Reference;
+            Job.ImageWidth = Benchmark.Width;
+            Job.SamplesPerPixel = Budget;
+            Job.Seed = BenchmarkSeed;
+            Job.AOVs = 0;
+
+            render_stats Stats = {};
+            if(!RenderJob(Job, Scene, &Stats) || !Stats.Compared)
+            {
+                ++Failed;
+                continue;
+            }
+
+            f64 Samples = (f64)Stats.Width*Stats.Height*Stats.SamplesPerPixel;
+            f64 Seconds = (Stats.Seconds > 0.0) ? Stats.Seconds : 1e-9;
+            f64 RelMSE = Stats.Error.RelMSE;
+            printf("%s\n    {\"scene\": \"%s\", \"width\": %d, \"height\": %d, \"spp\": %d, "
+                   "\"seed\": %llu, \"seconds\": %.6f, \"rays\": %llu, "
+                   "\"rays_per_second\": %.1f, \"samples_per_second\": %.1f, "
+                   "\"rmse\": %.8g, \"filtered_rmse\": %.8g, \"relmse\": %.8g, "
+                   "\"efficiency\": %.8g}",
+                   First ? "" : ",", Benchmark.Name, Stats.Width, Stats.Height,
+                   Stats.SamplesPerPixel, (unsigned long long)BenchmarkSeed, Stats.Seconds,
+                   (unsigned long long)Stats.RaysTraced, (f64)Stats.RaysTraced / Seconds,
+                   Samples / Seconds, Stats.Error.RMSE, Stats.Error.FilteredRMSE, RelMSE,
+                   (RelMSE > 0.0) ? (1.0 / (RelMSE*Seconds)) : 0.0);
+            fflush(stdout);
+            First = false;
+        }
+    }
+    printf("\n  ]\n}\n");
+
+    i32 Result = (Failed > 0) ? 1 : 0;
+    return Result;
+}
+
+i32
+RunExperiment(const std::string &Name, const render_job &Defaults)
+{
+    if(Name == "pi")              { MC::StratifiedEstimatePi(); }
+    else if(Name == "integrate")  { MC::OneDimensionalIntegration(INTEGRAND_FUNCTION_2(sin, cos), 0, 0.5*pi, 1'000'000); }
+    else if(Name == "halfway")    { MC::ComputePDFHalfwayPoint(&PDFFunction, 0, 2*pi); }
+    else if(Name == "importance") { MC::ImportanceSampling(); }
+    else if(Name == "sphere")     { MC::SurfaceIntegralOverSphere(); }
+    else if(Name == "bvh")        { BVHBuildThroughput(); }
+    else if(Name == "vec")        { VecMathThroughput(); }
+    else if(Name == "noise")      { NoiseThroughput(); }
+    else if(Name == "medium")     { MediumEstimators(); }
+    else if(Name == "phase")      { PhaseSampling(); }
+    else if(Name == "lights")     { LightSampling(); }
+    else if(Name == "environment") { EnvironmentSampling(); }
+    else if(Name == "convergence") { return ConvergenceBenchmark(Defaults); }
+    else
+    {
+        fprintf(stderr, "Unknown experiment: %s\n", Name.c_str());
+        return 1;
+    }
+
     return 0;
-#endif
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    if(ArgCount < 2)
+    {
+        PrintUsage(Args[0]);
+        return 1;
+    }
+
+    render_job Job;
+    std::string BatchFile, Experiment;
+    if(!ParseJobArgs(ArgCount - 1, Args + 1, Job, &BatchFile, &Experiment))
+    {
+        PrintUsage(Args[0]);
+        return 1;
+    }
+
+    if(!Experiment.empty())
+    {
+        return RunExperiment(Experiment, Job);
+    }
+
+    if(!BatchFile.empty())
+    {
+        return RunBatch(BatchFile, Job);
+    }
+
+    scene Scene;
+    if(!LoadScene(Job.Scene, Job.UseSceneCache, Scene))
+    {
+        fprintf(stderr, "Could not load the scene: %s\n", Job.Scene.c_str());
+        return 1;
+    }
+
+    i32 Result = RenderJob(Job, Scene) ? 0 : 1;
+    return Result;
 }
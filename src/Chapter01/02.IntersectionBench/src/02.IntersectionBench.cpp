@@ -0,0 +1,350 @@
+#include <cstdio>
+#include <defines.h>
+
+#include <AABB.h>
+#include <AARect.h>
+#include <BVH.h>
+#include <ConstantMedium.h>
+#include <HittableList.h>
+#include <Material.h>
+#include <MovingSphere.h>
+#include <Sphere.h>
+#include <Warp.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// NOTE: Nanoseconds per call of the intersection routines the renderer spends
+// its time in, each one on its own, over two batches of rays:
+//
+//   coherent    camera rays, a grid of them through a pinhole in scanline
+//               order, so neighbouring rays go nearly the same way and hit
+//               the same things, the best case for the caches and branches
+//   incoherent  bounce rays, starting anywhere around the object and going
+//               off in any direction, one after the other, the worst case
+//
+// Every batch is gone through Warmup times first, untimed, then Repetitions
+// times timed one by one. The table has the fastest, median and mean time
+// per ray over the repetitions, and the standard deviation, so a regression
+// shows up as a shift in the median well outside of the spread. The fastest
+// repetition is the least disturbed by anything else running.
+//
+// Every kernel gets the same rays from one run to the next (the seed is
+// fixed), so the numbers of two builds can be compared directly. The checksum
+// at the end adds up the hits so the compiler can't drop the calls, and it
+// has to be the same for two builds that are meant to agree.
+
+struct ray_batch
+{
+    const char *Name;
+    std::vector<ray> Rays;
+};
+
+struct kernel_timing
+{
+    f64 MinNs;
+    f64 MedianNs;
+    f64 MeanNs;
+    f64 StdDevNs;
+    f64 HitRate;
+};
+
+// NOTE: A Side x Side grid of rays from LookFrom, through a square view of
+// VerticalFOV degrees around LookAt, one row after the other.
+ray_batch
+CoherentRays(const vec3r &LookFrom, const vec3r &LookAt, real VerticalFOV, i32 Count)
+{
+    ray_batch Result = {"coherent"};
+    i32 Side = (i32)sqrt((f64)Count);
+    Side = (Side < 1) ? 1 : Side;
+
+    vec3r W = Normalize(LookFrom - LookAt);
+    vec3r U = Normalize(Cross(Vec3r(0, 1, 0), W));
+    vec3r V = Cross(W, U);
+    real HalfHeight = (real)tan(Deg2Rad(VerticalFOV) / 2);
+
+    Result.Rays.reserve((size_t)Side*Side);
+    for(i32 Y = 0; Y < Side; ++Y)
+    {
+        for(i32 X = 0; X < Side; ++X)
+        {
+            real S = (real)(2.0*(X + 0.5) / Side - 1.0);
+            real T = (real)(1.0 - 2.0*(Y + 0.5) / Side);
+            vec3r Direction = -W + (S*HalfHeight)*U + (T*HalfHeight)*V;
+            Result.Rays.push_back(ray(LookFrom, Direction, (real)Rand01()));
+        }
+    }
+
+    return Result;
+}
+
+// NOTE: Count rays from anywhere in Region, in directions uniform over the
+// sphere.
+ray_batch
+IncoherentRays(const aabb &Region, i32 Count)
+{
+    ray_batch Result = {"incoherent"};
+    vec3r Min = Region.Min();
+    vec3r Extent = Region.Max() - Region.Min();
+
+    Result.Rays.reserve(Count);
+    for(i32 Index = 0; Index < Count; ++Index)
+    {
+        vec3r Origin = Min + Vec3r(Extent.x*(real)Rand01(), Extent.y*(real)Rand01(),
+                                   Extent.z*(real)Rand01());
+        vec3r Direction = SampleUnitSphere(Vec2d(Rand01(), Rand01()));
+        Result.Rays.push_back(ray(Origin, Direction, (real)Rand01()));
+    }
+
+    return Result;
+}
+
+// NOTE: Hit(Ray, Checksum) runs the kernel on one ray and returns whether it
+// hit, adding something from the hit to Checksum. It is a template so the
+// loop calls it directly, the only indirect call left is the virtual one into
+// the hittable, the same one the renderer makes.
+template <typename hit_function>
+kernel_timing
+TimeKernel(const hit_function &Hit, const ray_batch &Batch, i32 Warmup, i32 Repetitions,
+           f64 &Checksum)
+{
+    u64 Hits = 0;
+    for(i32 Pass = 0; Pass < Warmup; ++Pass)
+    {
+        for(const ray &Ray : Batch.Rays)
+        {
+            Hits += Hit(Ray, Checksum) ? 1 : 0;
+        }
+    }
+
+    Hits = 0;
+    std::vector<f64> Times(Repetitions);
+    for(i32 Pass = 0; Pass < Repetitions; ++Pass)
+    {
+        auto Begin = std::chrono::steady_clock::now();
+        for(const ray &Ray : Batch.Rays)
+        {
+            Hits += Hit(Ray, Checksum) ? 1 : 0;
+        }
+        auto End = std::chrono::steady_clock::now();
+        Times[Pass] = std::chrono::duration<f64, std::nano>(End - Begin).count() /
+                      (f64)Batch.Rays.size();
+    }
+
+    kernel_timing Result = {};
+    std::vector<f64> Sorted = Times;
+    std::sort(Sorted.begin(), Sorted.end());
+    Result.MinNs = Sorted[0];
+    Result.MedianNs = (Repetitions % 2) ? Sorted[Repetitions / 2]
+                                        : 0.5*(Sorted[Repetitions / 2 - 1] + Sorted[Repetitions / 2]);
+    f64 Sum = 0, SquaredSum = 0;
+    for(f64 Time : Times)
+    {
+        Sum += Time;
+        SquaredSum += Time*Time;
+    }
+    Result.MeanNs = Sum / Repetitions;
+    f64 Variance = SquaredSum / Repetitions - Result.MeanNs*Result.MeanNs;
+    Result.StdDevNs = sqrt(MAX(Variance, 0.0));
+    Result.HitRate = (f64)Hits / ((f64)Repetitions*Batch.Rays.size());
+    return Result;
+}
+
+struct benchmark_settings
+{
+    i32 RayCount;
+    i32 Warmup;
+    i32 Repetitions;
+    std::vector<std::string> Only; // Kernels to run, all of them if empty.
+    f64 Checksum;
+};
+
+// NOTE: Times Hit over both batches and prints a line for each. The coherent
+// rays come from a camera at LookFrom, the incoherent ones start in Region.
+template <typename hit_function>
+void
+BenchmarkKernel(benchmark_settings &Settings, const char *Name, const hit_function &Hit,
+                const vec3r &LookFrom, const vec3r &LookAt, real VerticalFOV,
+                const aabb &Region)
+{
+    if(!Settings.Only.empty() &&
+       (std::find(Settings.Only.begin(), Settings.Only.end(), Name) == Settings.Only.end()))
+    {
+        return;
+    }
+
+    // NOTE: The same rays every run, whichever kernels are picked.
+    SeedRandom(2);
+    ray_batch Batches[2] =
+    {
+        CoherentRays(LookFrom, LookAt, VerticalFOV, Settings.RayCount),
+        IncoherentRays(Region, Settings.RayCount),
+    };
+    for(const ray_batch &Batch : Batches)
+    {
+        kernel_timing Timing = TimeKernel(Hit, Batch, Settings.Warmup, Settings.Repetitions,
+                                          Settings.Checksum);
+        printf("%-24s %-11s %10.2f %10.2f %10.2f %9.2f %6.1f%%\n", Name, Batch.Name,
+               Timing.MinNs, Timing.MedianNs, Timing.MeanNs, Timing.StdDevNs,
+               100.0*Timing.HitRate);
+        fflush(stdout);
+    }
+}
+
+// NOTE: Runs a hittable's Hit over the whole ray.
+void
+BenchmarkHittable(benchmark_settings &Settings, const char *Name, const hittable &Object,
+                  const vec3r &LookFrom, const vec3r &LookAt, real VerticalFOV,
+                  const aabb &Region)
+{
+    auto Hit = [&Object](const ray &Ray, f64 &Checksum)
+    {
+        hit_record Record;
+        b32 Result = Object.Hit(Ray, interval(0, Infinity), Record);
+        Checksum += Result ? (f64)Record.t : 0.0;
+        return Result;
+    };
+    BenchmarkKernel(Settings, Name, Hit, LookFrom, LookAt, VerticalFOV, Region);
+}
+
+void
+PrintUsage(const char *Program)
+{
+    fprintf(stderr,
+            "Usage: %s [options] [kernel...]\n"
+            "      --rays <count>         Rays per batch, 65536 by default.\n"
+            "      --warmup <count>       Untimed passes over every batch first, 2 by\n"
+            "                             default.\n"
+            "      --repetitions <count>  Timed passes over every batch, 15 by default.\n"
+            "      --primitives <count>   Spheres in the BVH scene, 4096 by default.\n"
+            "\n"
+            "Kernels: sphere, moving_sphere, xy_rect, aabb, bvh_node, flat_bvh (the\n"
+            "same tree the way the renderer walks it), constant_density_medium. All\n"
+            "of them if none are given.\n",
+            Program);
+}
+
+int
+main(int ArgCount, char **Args)
+{
+    // NOTE: Has to list every kernel run below, the ones asked for on the
+    // command line are checked against it.
+    const char *KernelNames[] = {"sphere", "moving_sphere", "xy_rect", "aabb", "bvh_node",
+                                 "flat_bvh", "constant_density_medium"};
+    benchmark_settings Settings = {65536, 2, 15};
+    i32 PrimitiveCount = 4096;
+    for(i32 Index = 1; Index < ArgCount; ++Index)
+    {
+        const char *Arg = Args[Index];
+        const char *Value = ((Index + 1) < ArgCount) ? Args[Index + 1] : nullptr;
+        i32 *Count = (strcmp(Arg, "--rays") == 0) ? &Settings.RayCount :
+                     (strcmp(Arg, "--warmup") == 0) ? &Settings.Warmup :
+                     (strcmp(Arg, "--repetitions") == 0) ? &Settings.Repetitions :
+                     (strcmp(Arg, "--primitives") == 0) ? &PrimitiveCount : nullptr;
+        if(Count)
+        {
+            if(!Value)
+            {
+                fprintf(stderr, "Missing value for %s\n", Arg);
+                PrintUsage(Args[0]);
+                return 1;
+            }
+            // NOTE: Only warmup may be 0, a run needs rays, passes and
+            // something to hit.
+            i32 Min = (Count == &Settings.Warmup) ? 0 : 1;
+            char *End;
+            errno = 0;
+            long Number = strtol(Value, &End, 10);
+            if((End == Value) || (*End != 0) || (errno == ERANGE) || (Number < Min) ||
+               (Number > INT32_MAX))
+            {
+                fprintf(stderr, "%s has to be a number from %d up, got: %s\n", Arg, Min, Value);
+                PrintUsage(Args[0]);
+                return 1;
+            }
+            *Count = (i32)Number;
+            ++Index;
+        }
+        else if(Arg[0] == '-')
+        {
+            PrintUsage(Args[0]);
+            return 1;
+        }
+        else if(std::find(std::begin(KernelNames), std::end(KernelNames), std::string(Arg)) ==
+                std::end(KernelNames))
+        {
+            fprintf(stderr, "Unknown kernel: %s\n", Arg);
+            PrintUsage(Args[0]);
+            return 1;
+        }
+        else
+        {
+            Settings.Only.push_back(Arg);
+        }
+    }
+
+    SeedRandom(1);
+    lambertian White = lambertian(Color(.73, .73, .73));
+
+    // NOTE: Every single object is about a unit in size at the origin, and
+    // its incoherent rays start from a box twice as big, so a fair share of
+    // them miss.
+    aabb Region = aabb(Vec3r(-2, -2, -2), Vec3r(2, 2, 2));
+    vec3r LookFrom = Vec3r(0.5, 0.5, 4);
+    vec3r LookAt = Vec3r(0, 0, 0);
+    real FOV = 40;
+
+    // NOTE: Small spheres scattered over a floor, the way the random
+    // spheres scene has them, seen from where its camera is.
+    hittable_list Spheres;
+    Spheres.Arena = std::make_shared<scene_arena>();
+    Spheres.Add(Spheres.Arena->New<sphere>(Vec3r(0, -1000, 0), 1000, &White));
+    real Spread = (real)(0.5*sqrt((f64)PrimitiveCount));
+    for(i32 Index = 1; Index < PrimitiveCount; ++Index)
+    {
+        vec3r Center = Vec3r((real)RandRange(-Spread, Spread), 0.2,
+                             (real)RandRange(-Spread, Spread));
+        Spheres.Add(Spheres.Arena->New<sphere>(Center, 0.2, &White));
+    }
+    bvh_node BVH = bvh_node(Spheres, 0, 1);
+    std::shared_ptr<flat_bvh> FlatBVH = flat_bvh::Build(Spheres.Objects, 0, 1);
+    aabb SpheresRegion = aabb(Vec3r(-Spread, 0, -Spread), Vec3r(Spread, 2, Spread));
+
+    sphere Sphere = sphere(Vec3r(0, 0, 0), 1, &White);
+    moving_sphere MovingSphere = moving_sphere(Vec3r(0, -0.25, 0), Vec3r(0, 0.25, 0), 0, 1, 1, &White);
+    xy_rect Rect = xy_rect(-1, 1, -1, 1, 0, &White);
+    aabb Box = aabb(Vec3r(-1, -1, -1), Vec3r(1, 1, 1));
+    constant_density_medium Medium = constant_density_medium(&Sphere, 0.5, Color(1, 1, 1));
+
+    printf("%d rays a batch, %d warmup and %d timed passes, %d primitives in the BVHs\n",
+           Settings.RayCount, Settings.Warmup, Settings.Repetitions, PrimitiveCount);
+    printf("%-24s %-11s %10s %10s %10s %9s %7s\n", "kernel", "rays", "min ns", "median ns",
+           "mean ns", "stddev", "hits");
+
+    BenchmarkHittable(Settings, "sphere", Sphere, LookFrom, LookAt, FOV, Region);
+    BenchmarkHittable(Settings, "moving_sphere", MovingSphere, LookFrom, LookAt, FOV, Region);
+    BenchmarkHittable(Settings, "xy_rect", Rect, LookFrom, LookAt, FOV, Region);
+    auto BoxHit = [&Box](const ray &Ray, f64 &Checksum)
+    {
+        b32 Result = Box.Hit(Ray, 0, Infinity);
+        Checksum += Result ? 1.0 : 0.0;
+        return Result;
+    };
+    BenchmarkKernel(Settings, "aabb", BoxHit, LookFrom, LookAt, FOV, Region);
+    BenchmarkHittable(Settings, "bvh_node", BVH, Vec3r(13, 2, 3), Vec3r(0, 0, 0), 20,
+                      SpheresRegion);
+    BenchmarkHittable(Settings, "flat_bvh", *FlatBVH, Vec3r(13, 2, 3), Vec3r(0, 0, 0), 20,
+                      SpheresRegion);
+    BenchmarkHittable(Settings, "constant_density_medium", Medium, LookFrom, LookAt, FOV,
+                      Region);
+
+    printf("checksum %.6g\n", Settings.Checksum);
+    return 0;
+}